@@ -21,6 +21,7 @@ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "app.h"
+#include "bench.h"
 #include "bookmarks.h"
 #include "defs.h"
 #include "export.h"
@@ -30,10 +31,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "gmutil.h"
 #include "history.h"
 #include "ipc.h"
+#include "media.h"
 #include "mimehooks.h"
 #include "misfin.h"
 #include "periodic.h"
+#include "profiler.h"
 #include "resources.h"
+#include "responsecache.h"
 #include "sitespec.h"
 #include "snippets.h"
 #include "ui/certimportwidget.h"
@@ -51,6 +55,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "ui/touch.h"
 #include "ui/uploadwidget.h"
 #include "ui/util.h"
+#include "ui/visbuf.h"
 #include "ui/window.h"
 #include "updater.h"
 #include "visited.h"
@@ -168,6 +173,7 @@ struct Impl_App {
     uint32_t     lastTickerTime;
     uint32_t     elapsedSinceLastTicker;
     iBool        isRunning;
+    SDL_threadID mainThread; /* for asserting */
     iBool        isRunningUnderWindowSystem;
     iBool        isRunningUnderWayland;
     iBool        isTextInputActive;
@@ -178,8 +184,8 @@ struct Impl_App {
     iStringList *launchCommands;
     iBool        isFinishedLaunching;
     iTime        lastDropTime; /* for detecting drops of multiple items */
-    uint32_t     lastVisitedSaveTime;
     int          autoReloadTimer; /* TODO: only start this when tabs are autoreloading */
+    int          saveChangesTimer; /* pending write of journaled visited/feed changes */
     iPeriodic    periodic;
     int          warmupFrames; /* forced refresh just after resuming from background; FIXME: shouldn't be needed */
 #if defined (LAGRANGE_ENABLE_IDLE_SLEEP)
@@ -323,6 +329,8 @@ static iString *serializePrefs_App_(const iApp *d) {
     appendFormat_String(str, "uploadzoom.set arg:%d\n", d->prefs.editorZoomLevel);
     appendFormat_String(str, "pinsplit.set arg:%d\n", d->prefs.pinSplit);
     appendFormat_String(str, "feedinterval.set arg:%d\n", d->prefs.feedInterval);
+    appendFormat_String(str, "feedrequests.set arg:%d perhost:%d\n",
+                        d->prefs.maxFeedRequests, d->prefs.maxFeedRequestsPerHost);
     appendFormat_String(str, "smoothscroll arg:%d\n", d->prefs.smoothScrolling);
     appendFormat_String(str, "scrollspeed arg:%d type:%d\n", d->prefs.smoothScrollSpeed[keyboard_ScrollType], keyboard_ScrollType);
     appendFormat_String(str, "scrollspeed arg:%d type:%d\n", d->prefs.smoothScrollSpeed[mouse_ScrollType], mouse_ScrollType);
@@ -330,6 +338,8 @@ static iString *serializePrefs_App_(const iApp *d) {
     appendFormat_String(str, "cachesize.set arg:%d\n", d->prefs.maxCacheSize);
     appendFormat_String(str, "memorysize.set arg:%d\n", d->prefs.maxMemorySize);
     appendFormat_String(str, "urlsize.set arg:%d\n", d->prefs.maxUrlSize);
+    appendFormat_String(str, "glyphcache.set arg:%d\n", d->prefs.maxGlyphCacheSize);
+    appendFormat_String(str, "audiobuffer.set arg:%d\n", d->prefs.audioBufferSize);
     appendFormat_String(str, "decodeurls arg:%d\n", d->prefs.decodeUserVisibleURLs);
     appendFormat_String(str, "linewidth.set arg:%d\n", d->prefs.lineWidth);
     appendFormat_String(str, "linespacing.set arg:%f\n", d->prefs.lineSpacing);
@@ -493,6 +503,7 @@ static void migrateInternalUserDirToExternalStorage_App_(iApp *d) {
         "idents.lgr",
         "trusted.2.txt",
         "visited.2.txt",
+        "visited.lgr",
     };
     makeDirs_Path(collectNewCStr_String(extDataDir));
     iForIndices(i, names) {
@@ -922,6 +933,7 @@ static void saveState_App_(const iApp *d, iBool withContent) {
     }
     if (withContent) {
         trimCache_App();
+        save_ResponseCache();
     }
     /* UI state is saved in binary because it is quite complex (e.g.,
        navigation history, cached content) and depends closely on the widget
@@ -1015,6 +1027,29 @@ static uint32_t postAutoReloadCommand_App_(uint32_t interval, void *param) {
     return interval;
 }
 
+static uint32_t postSaveChangesCommand_App_(uint32_t interval, void *param) {
+    iUnused(interval, param);
+    postCommand_App("changes.save");
+    return 0; /* does not repeat */
+}
+
+static void saveChangesLater_App_(iApp *d) {
+    /* Changes are batched so the files aren't written on every event. */
+    if (!d->saveChangesTimer) {
+        d->saveChangesTimer = SDL_AddTimer(10 * 1000, postSaveChangesCommand_App_, NULL);
+    }
+}
+
+static void saveChanges_App_(iApp *d) {
+    if (d->saveChangesTimer) {
+        SDL_RemoveTimer(d->saveChangesTimer);
+        d->saveChangesTimer = 0;
+    }
+    /* The changes are appended to the files; they are only rewritten occasionally. */
+    saveChanges_Visited(d->visited, dataDir_App_());
+    saveChanges_Feeds();
+}
+
 static void terminate_App_(int rc) {
     SDL_Quit();
     deinit_Foundation();
@@ -1161,6 +1196,7 @@ static void init_App_(iApp *d, int argc, char **argv) {
     d->isRunningUnderWayland      = iFalse;
     d->isRunningUnderWindowSystem = iTrue;
 #endif
+    d->mainThread = SDL_ThreadID();
     d->isTextInputActive = iFalse;
     d->isDarkSystemTheme = iTrue; /* will be updated by system later on, if supported */
     d->isSuspended = iFalse;
@@ -1335,7 +1371,6 @@ static void init_App_(iApp *d, int argc, char **argv) {
     d->certs     = new_GmCerts(dataDir_App_());
     d->visited   = new_Visited();
     d->bookmarks = new_Bookmarks();
-    d->lastVisitedSaveTime = 0;
     /* Dumping requested pages. */
     if (doDump) {
         const iGmIdentity *ident = NULL;
@@ -1372,6 +1407,7 @@ static void init_App_(iApp *d, int argc, char **argv) {
         exit(0);
     }
     init_Periodic(&d->periodic);
+    init_Profiler();
 #if defined (iPlatformAppleDesktop)
     setupApplication_MacOS();
 # if defined (LAGRANGE_NATIVE_MENU)
@@ -1431,6 +1467,7 @@ static void init_App_(iApp *d, int argc, char **argv) {
         postCommand_App("~bookmarks.changed");
     }
     init_Feeds(dataDir_App_());
+    init_ResponseCache(dataDir_App_());
     /* Widget state init. */
     processEvents_App(postedEventsOnly_AppEventMode);
     if (!loadState_App_(d)) {
@@ -1521,6 +1558,7 @@ static void deinit_App(iApp *d) {
     SDL_RemoveTimer(d->sleepTimer);
 #endif
     SDL_RemoveTimer(d->autoReloadTimer);
+    SDL_RemoveTimer(d->saveChangesTimer);
     saveState_App_(d, iTrue);
     savePrefs_App_(d);
     iReverseForEach(PtrArray, j, &d->mainWindows) {
@@ -1529,6 +1567,8 @@ static void deinit_App(iApp *d) {
     iAssert(isEmpty_PtrArray(&d->mainWindows));
     deinit_PtrArray(&d->mainWindows);
     d->window = NULL;
+    waitForImageDecodes_Media(); /* all images have been deleted */
+    deinit_ResponseCache();
     deinit_Feeds();
     save_Keys(dataDir_App_());
     deinit_Keys();
@@ -1540,7 +1580,7 @@ static void deinit_App(iApp *d) {
     deinit_Prefs(&d->prefs);
     save_Bookmarks(d->bookmarks, dataDir_App_());
     delete_Bookmarks(d->bookmarks);
-    save_Visited(d->visited, dataDir_App_());
+    saveChanges_Visited(d->visited, dataDir_App_());
     delete_Visited(d->visited);
     delete_GmCerts(d->certs);
     save_MimeHooks(d->mimehooks);
@@ -1553,6 +1593,7 @@ static void deinit_App(iApp *d) {
 #endif
     deinit_SortedArray(&d->tickers);
     deinit_Periodic(&d->periodic);
+    deinit_Profiler();
     deinit_Lang();
     iRecycle();
     /* Delete all temporary files created while running. */
@@ -1694,6 +1735,16 @@ const iString *debugInfo_App(void) {
         appendFormat_String(msg, "Total cache: %.3f MB\n", total.cacheSize / 1.0e6f);
         appendFormat_String(msg, "Total memory: %.3f MB\n", total.memorySize / 1.0e6f);
     }
+    appendFormat_String(msg, "## Glyph cache\n");
+    append_String(msg, debugInfo_Text(get_Window()->text));
+    appendFormat_String(msg, "## Document buffers\n");
+    append_String(msg, debugInfoPool_VisBuf());
+    appendFormat_String(msg, "## Profiler\n");
+    append_String(msg, debugInfo_Profiler());
+    appendFormat_String(msg,
+                        "=> about:command?profiler.toggle %s recording\n"
+                        "=> about:command?profiler.save Save the recording as a Chrome trace\n",
+                        isEnabled_Profiler() ? "Stop" : "Start");
     appendFormat_String(msg, "## Documents\n");
     iForEach(ObjectList, k, docs) {
         iDocumentWidget *doc = k.object;
@@ -1725,6 +1776,7 @@ static void clearCache_App_(void) {
     iForEach(ObjectList, i, iClob(listDocuments_App(NULL))) {
         clearCache_History(history_DocumentWidget(i.object));
     }
+    clear_ResponseCache();
 }
 
 iObjectList *listAllDocuments_App(void) {
@@ -1748,6 +1800,7 @@ void trimCache_App(void) {
     iApp *d = &app_;
     size_t cacheSize = 0;
     const size_t limit = d->prefs.maxCacheSize * 1000000;
+    trim_ResponseCache(limit);
     iObjectList *docs = listAllDocuments_App();
     iForEach(ObjectList, i, docs) {
         cacheSize += cacheSize_History(history_DocumentWidget(i.object));
@@ -1949,6 +2002,7 @@ void processEvents_App(enum iAppEventMode eventMode) {
        motion events that get us stuck here in the event processing loop for too long. */
     eventProcessingStartTime_ = 0;
     numPendingMotionEvents_ = 0;
+    beginZone_Profiler("processEvents_App");
     pendingMotionPosted_ = iFalse;
     iZap(pendingMotion_);
     while (nextEvent_App_(d, gotRefresh ? postedEventsOnly_AppEventMode : eventMode, &ev)) {
@@ -1978,6 +2032,7 @@ void processEvents_App(enum iAppEventMode eventMode) {
 #else
                 savePrefs_App_(d);
                 saveState_App_(d, iTrue);
+                saveChanges_App_(d);
 #endif
                 break;
             }
@@ -2014,6 +2069,7 @@ void processEvents_App(enum iAppEventMode eventMode) {
                 }
                 savePrefs_App_(d);
                 saveState_App_(d, iTrue);
+                saveChanges_App_(d);
                 d->isSuspended = iTrue;
                 if (d->isTextInputActive) {
                     SDL_StopTextInput();
@@ -2355,6 +2411,7 @@ void processEvents_App(enum iAppEventMode eventMode) {
     }
 #endif
 backToMainLoop:;
+    endZone_Profiler();
     deinit_PtrArray(&windows);
     setCurrent_Root(oldCurrentRoot);
 }
@@ -2367,6 +2424,7 @@ static void runTickers_App_(iApp *d) {
         d->lastTickerTime = 0;
         return;
     }
+    beginZone_Profiler("runTickers_App_");
     /* Update window state. */ {
         iPtrArray *winList = listWindows_App();
         iForEach(PtrArray, i, winList) {
@@ -2398,6 +2456,7 @@ static void runTickers_App_(iApp *d) {
     if (isEmpty_SortedArray(&d->tickers)) {
         d->lastTickerTime = 0;
     }
+    endZone_Profiler();
 }
 
 static int resizeWatcher_(void *user, SDL_Event *event) {
@@ -2500,16 +2559,16 @@ void refresh_App(void) {
             if (!d->warmupFrames && !exchange_Atomic(&win->isRefreshPending, iFalse)) {
                 continue; /* No need to draw this window. */
             }
+            if (d->warmupFrames) {
+                set_Atomic(&win->isFullyDamaged, iTrue);
+            }
             setCurrent_Window(win);
             switch (win->type) {
-                case main_WindowType: {
-//                    iTime draw;
-//                    initCurrent_Time(&draw);
+                case main_WindowType:
+                    beginFrame_Profiler();
                     draw_MainWindow(as_MainWindow(win));
-//                    printf("draw: %lld \u03bcs\n", (long long) (elapsedSeconds_Time(&draw) * 1000000));
-//                    fflush(stdout);
+                    endFrame_Profiler();
                     break;
-                }
                 default:
                     draw_Window(win);
                     break;
@@ -2635,17 +2694,20 @@ iBool schemeProxyHostAndPort_App(iRangecc scheme, const iString **host, uint16_t
 
 int run_App(int argc, char **argv) {
     init_App_(&app_, argc, argv);
+#if defined (LAGRANGE_ENABLE_BENCH)
+    const int rc = run_Bench(); /* instead of the event loop */
+#else
     const int rc = run_App_(&app_);
+#endif
     deinit_App(&app_);
     return rc;
 }
 
-void postRefresh_Window(iAnyWindow *windowPtr) {
+static void postRefreshEvent_Window_(iWindow *window) {
     iApp *d = &app_;
 #if defined (LAGRANGE_ENABLE_IDLE_SLEEP)
     d->isIdling = iFalse;
 #endif
-    iWindow *window = windowPtr;
     iAtomicInt *pendingWindow = (window ? &window->isRefreshPending : NULL);
     iBool wasPending = exchange_Atomic(&d->pendingRefresh, iTrue);
     if (pendingWindow) {
@@ -2658,6 +2720,30 @@ void postRefresh_Window(iAnyWindow *windowPtr) {
     }
 }
 
+void postRefresh_Window(iAnyWindow *windowPtr) {
+    iWindow *window = windowPtr;
+    if (window) {
+        set_Atomic(&window->isFullyDamaged, iTrue);
+    }
+    postRefreshEvent_Window_(window);
+}
+
+void postDamage_Window(iAnyWindow *windowPtr, iRect rect) {
+    iAssert(SDL_ThreadID() == app_.mainThread); /* `damage` is not atomic */
+    iWindow *window = windowPtr;
+    if (!window) {
+        postRefreshEvent_Window_(NULL);
+        return;
+    }
+    if (isEmpty_Rect(window->damage)) {
+        window->damage = rect;
+    }
+    else if (!isEmpty_Rect(rect)) {
+        window->damage = union_Rect(window->damage, rect);
+    }
+    postRefreshEvent_Window_(window);
+}
+
 void postRefreshAllWindows_App(void) {
     iApp *d = &app_;
     iConstForEach(PtrArray, m, &d->mainWindows) {
@@ -3969,6 +4055,12 @@ static iBool handleNonWindowRelatedCommand_App_(iApp *d, const char *cmd) {
         setRefreshInterval_Feeds(d->prefs.feedInterval);
         return iTrue;
     }
+    else if (equal_Command(cmd, "feedrequests.set")) {
+        d->prefs.maxFeedRequests        = iMax(1, arg_Command(cmd));
+        d->prefs.maxFeedRequestsPerHost = iMax(1, argLabel_Command(cmd, "perhost"));
+        setMaxRequests_Feeds(d->prefs.maxFeedRequests, d->prefs.maxFeedRequestsPerHost);
+        return iTrue;
+    }
     else if (equal_Command(cmd, "theme.set")) {
         const int isAuto = argLabel_Command(cmd, "auto");
         d->prefs.theme = arg_Command(cmd);
@@ -4080,6 +4172,21 @@ static iBool handleNonWindowRelatedCommand_App_(iApp *d, const char *cmd) {
         }
         return iTrue;
     }
+    else if (equal_Command(cmd, "glyphcache.set")) {
+        const int size = iMax(0, arg_Command(cmd));
+        if (d->prefs.maxGlyphCacheSize != size) {
+            d->prefs.maxGlyphCacheSize = size;
+            if (!isFrozen) {
+                resetFontCache_Text(text_Window(get_MainWindow())); /* apply the new limit */
+                postCommand_App("font.changed");
+            }
+        }
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "audiobuffer.set")) {
+        d->prefs.audioBufferSize = iMax(1, arg_Command(cmd)); /* applies to new players */
+        return iTrue;
+    }
     else if (equal_Command(cmd, "urlsize.set")) {
         d->prefs.maxUrlSize = arg_Command(cmd);
         if (d->prefs.maxUrlSize < 1024) {
@@ -4210,19 +4317,25 @@ static iBool handleNonWindowRelatedCommand_App_(iApp *d, const char *cmd) {
         return iTrue;
     }
     else if (equal_Command(cmd, "visited.changed")) {
-        /* The visited file can grow large, so don't keep rewriting it after every navigation. */
-        const uint32_t now = SDL_GetTicks();
-        unsigned seconds = (now - d->lastVisitedSaveTime) / 1000;
-        if (seconds > 60) {
-            d->lastVisitedSaveTime = now;
-            save_Visited(d->visited, dataDir_App_());
-        }
+        saveChangesLater_App_(d);
         return iFalse;
     }
+    else if (equal_Command(cmd, "feeds.changed")) {
+        saveChangesLater_App_(d);
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "changes.save")) {
+        saveChanges_App_(d);
+        return iTrue;
+    }
     else if (equal_Command(cmd, "idents.changed")) {
         saveIdentities_GmCerts(d->certs);
         return iFalse;
     }
+    else if (equal_Command(cmd, "certs.trust.changed")) {
+        saveTrusted_GmCerts(d->certs);
+        return iTrue;
+    }
     else if (equal_Command(cmd, "ident.signin")) {
         const iString *url = collect_String(suffix_Command(cmd, "url"));
         signIn_GmCerts(
@@ -4599,6 +4712,19 @@ iBool handleCommand_App(const char *cmd) {
         resetFonts_App();
         return iTrue;
     }
+    else if (equal_Command(cmd, "profiler.toggle")) {
+        setEnabled_Profiler(!isEnabled_Profiler());
+        postCommand_App("document.reload"); /* about:debug shows the state */
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "profiler.save")) {
+        const char *path = concatPath_CStr(cstr_String(downloadDir_App()), "lagrange-trace.json");
+        makeSimpleMessage_Widget("Profiler",
+                                 save_Profiler(path)
+                                     ? format_CStr("Trace saved to %s", path)
+                                     : format_CStr("Failed to write %s", path));
+        return iTrue;
+    }
     else if (equal_Command(cmd, "font.reload")) {
         reload_Fonts(); /* also does font cache reset, window invalidation */
         return iTrue;
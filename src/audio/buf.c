@@ -22,23 +22,150 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "buf.h"
 
+static const size_t chunkSize_InputBuf_     = 256 * 1024; /* small appends are combined */
+static const size_t defaultWindow_InputBuf_ = 4 * 1024 * 1024;
+static const size_t maxSpillSize_InputBuf_  = 512 * 1024 * 1024;
+
 iDefineTypeConstruction(InputBuf)
 
 void init_InputBuf(iInputBuf *d) {
     init_Mutex(&d->mtx);
     init_Condition(&d->changed);
-    init_Block(&d->data, 0);
-    d->isComplete = iTrue;
+    init_PtrArray(&d->chunks);
+    d->memStart       = 0;
+    d->size           = 0;
+    d->window         = defaultWindow_InputBuf_;
+    d->isSpillEnabled = iTrue;
+    d->spill          = NULL;
+    d->isComplete     = iTrue;
 }
 
 void deinit_InputBuf(iInputBuf *d) {
-    deinit_Block(&d->data);
+    clear_InputBuf(d);
+    deinit_PtrArray(&d->chunks);
     deinit_Condition(&d->changed);
     deinit_Mutex(&d->mtx);
 }
 
 size_t size_InputBuf(const iInputBuf *d) {
-    return size_Block(&d->data);
+    return d->size;
+}
+
+size_t memorySize_InputBuf(const iInputBuf *d) {
+    return d->size - d->memStart;
+}
+
+void setWindow_InputBuf(iInputBuf *d, size_t window, iBool spillToFile) {
+    d->window         = window;
+    d->isSpillEnabled = spillToFile;
+}
+
+void clear_InputBuf(iInputBuf *d) {
+    iForEach(PtrArray, i, &d->chunks) {
+        delete_Block(i.ptr);
+    }
+    clear_PtrArray(&d->chunks);
+    if (d->spill) {
+        fclose(d->spill);
+        d->spill = NULL;
+    }
+    d->memStart = 0;
+    d->size     = 0;
+}
+
+void append_InputBuf(iInputBuf *d, const void *data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    iBlock *last = isEmpty_PtrArray(&d->chunks) ? NULL : back_PtrArray(&d->chunks);
+    if (last && size_Block(last) < chunkSize_InputBuf_) {
+        appendData_Block(last, data, size);
+    }
+    else {
+        pushBack_PtrArray(&d->chunks, newData_Block(data, size));
+    }
+    d->size += size;
+}
+
+iRangecc peek_InputBuf(const iInputBuf *d, size_t pos) {
+    /* Returns the contiguous data at `pos` without copying it, up to the end of a chunk. */
+    size_t chunkPos = d->memStart;
+    if (pos >= chunkPos) {
+        iConstForEach(PtrArray, i, &d->chunks) {
+            const iBlock *chunk    = i.ptr;
+            const size_t  chunkEnd = chunkPos + size_Block(chunk);
+            if (pos < chunkEnd) {
+                return (iRangecc){ constBegin_Block(chunk) + (pos - chunkPos),
+                                   constEnd_Block(chunk) };
+            }
+            chunkPos = chunkEnd;
+        }
+    }
+    return iNullRange;
+}
+
+size_t read_InputBuf(iInputBuf *d, size_t pos, size_t size, void *data_out) {
+    if (pos >= d->size) {
+        return 0;
+    }
+    char  *out   = data_out;
+    size_t total = 0;
+    size         = iMin(size, d->size - pos);
+    if (pos < d->memStart) {
+        /* Dropped from memory. */
+        const size_t n = iMin(size, d->memStart - pos);
+        if (!d->spill || fseek(d->spill, (long) pos, SEEK_SET) ||
+            fread(out, 1, n, d->spill) != n) {
+            return 0;
+        }
+        out   += n;
+        pos   += n;
+        size  -= n;
+        total += n;
+    }
+    while (size > 0) {
+        const iRangecc avail = peek_InputBuf(d, pos);
+        const size_t   n     = iMin(size, size_Range(&avail));
+        if (n == 0) {
+            break;
+        }
+        memcpy(out, avail.start, n);
+        out   += n;
+        pos   += n;
+        size  -= n;
+        total += n;
+    }
+    return total;
+}
+
+static void spill_InputBuf_(iInputBuf *d, const iBlock *chunk) {
+    if (d->memStart == 0 && d->isSpillEnabled) {
+        d->spill = tmpfile();
+    }
+    if (d->spill) {
+        if (d->memStart + size_Block(chunk) > maxSpillSize_InputBuf_ ||
+            fseek(d->spill, 0, SEEK_END) ||
+            fwrite(constData_Block(chunk), 1, size_Block(chunk), d->spill) != size_Block(chunk)) {
+            /* The beginning of the stream is no longer available. */
+            fclose(d->spill);
+            d->spill = NULL;
+        }
+    }
+}
+
+void consume_InputBuf(iInputBuf *d, size_t pos) {
+    /* Data before `pos` has been decoded. Only a window of it is kept in memory. */
+    while (!isEmpty_PtrArray(&d->chunks)) {
+        iBlock      *chunk    = front_PtrArray(&d->chunks);
+        const size_t chunkEnd = d->memStart + size_Block(chunk);
+        if (chunkEnd + d->window > pos) {
+            break;
+        }
+        spill_InputBuf_(d, chunk);
+        take_PtrArray(&d->chunks, 0, (void **) &chunk);
+        delete_Block(chunk);
+        d->memStart = chunkEnd;
+    }
 }
 
 /*----------------------------------------------------------------------------------------------*/
@@ -52,18 +179,20 @@ void init_SampleBuf(iSampleBuf *d, SDL_AudioFormat format, size_t numChannels, s
     d->sampleSize  = SDL_AUDIO_BITSIZE(format) / 8 * numChannels;
     d->count       = count + 1; /* considered empty if head==tail */
     d->data        = malloc(d->sampleSize * d->count);
-    d->head        = 0;
-    d->tail        = 0;
-    init_Condition(&d->moreNeeded);
+    d->moreNeeded  = SDL_CreateSemaphore(0);
+    set_Atomic(&d->head, 0);
+    set_Atomic(&d->tail, 0);
 }
 
 void deinit_SampleBuf(iSampleBuf *d) {
-    deinit_Condition(&d->moreNeeded);
+    SDL_DestroySemaphore(d->moreNeeded);
     free(d->data);
 }
 
 size_t size_SampleBuf(const iSampleBuf *d) {
-    return d->head - d->tail;
+    const size_t head = value_Atomic(&d->head);
+    const size_t tail = value_Atomic(&d->tail);
+    return (head + d->count - tail) % d->count;
 }
 
 size_t vacancy_SampleBuf(const iSampleBuf *d) {
@@ -76,7 +205,7 @@ iBool isFull_SampleBuf(const iSampleBuf *d) {
 
 void write_SampleBuf(iSampleBuf *d, const void *samples, const size_t n) {
     iAssert(n <= vacancy_SampleBuf(d));
-    const size_t headPos = d->head % d->count;
+    const size_t headPos = value_Atomic(&d->head);
     const size_t avail   = d->count - headPos;
     if (n > avail) {
         const char *in = samples;
@@ -87,12 +216,13 @@ void write_SampleBuf(iSampleBuf *d, const void *samples, const size_t n) {
     else {
         memcpy(ptr_SampleBuf_(d, headPos), samples, d->sampleSize * n);
     }
-    d->head += n;
+    /* The samples are in place before the reader can see them. */
+    set_Atomic(&d->head, (int) ((headPos + n) % d->count));
 }
 
 void read_SampleBuf(iSampleBuf *d, const size_t n, void *samples_out) {
     iAssert(n <= size_SampleBuf(d));
-    const size_t tailPos = d->tail % d->count;
+    const size_t tailPos = value_Atomic(&d->tail);
     const size_t avail   = d->count - tailPos;
     if (n > avail) {
         char *out = samples_out;
@@ -103,5 +233,16 @@ void read_SampleBuf(iSampleBuf *d, const size_t n, void *samples_out) {
     else {
         memcpy(samples_out, ptr_SampleBuf_(d, tailPos), d->sampleSize * n);
     }
-    d->tail += n;
+    set_Atomic(&d->tail, (int) ((tailPos + n) % d->count));
+}
+
+void signalMoreNeeded_SampleBuf(iSampleBuf *d) {
+    /* Called by the reader. A single pending post is enough to wake up the writer. */
+    if (SDL_SemValue(d->moreNeeded) == 0) {
+        SDL_SemPost(d->moreNeeded);
+    }
+}
+
+void waitMoreNeeded_SampleBuf(iSampleBuf *d) {
+    SDL_SemWait(d->moreNeeded);
 }
@@ -24,10 +24,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #if defined (LAGRANGE_ENABLE_AUDIO)
 
+#include "the_Foundation/atomic.h"
 #include "the_Foundation/block.h"
 #include "the_Foundation/mutex.h"
+#include "the_Foundation/ptrarray.h"
 
 #include <SDL_audio.h>
+#include <SDL_mutex.h>
+#include <stdio.h>
 
 iDeclareType(InputBuf)
 iDeclareType(SampleBuf)
@@ -39,27 +43,45 @@ iDeclareType(SampleBuf)
 #   define AUDIO_F64LSB     0x8140  /* 64-bit floating point samples */
 #endif
 
+/* Received stream data. Only a window of data behind the consumed position is kept in
+   memory; older data is moved to a temporary file (if enabled) so it can still be read when
+   seeking back or restarting playback. All functions must be called with `mtx` locked. */
 struct Impl_InputBuf {
     iMutex     mtx;
     iCondition changed;
-    iBlock     data;
+    iPtrArray  chunks;     /* iBlock; the part of the stream that is in memory */
+    size_t     memStart;   /* stream position of the first byte in `chunks` */
+    size_t     size;       /* total number of bytes received */
+    size_t     window;     /* bytes kept in memory behind the consumed position */
+    iBool      isSpillEnabled;
+    FILE *     spill;      /* data before `memStart`; NULL if not available */
     iBool      isComplete;
 };
 
 iDeclareTypeConstruction(InputBuf)
 
-size_t  size_InputBuf   (const iInputBuf *);
+size_t  size_InputBuf       (const iInputBuf *);
+size_t  memorySize_InputBuf (const iInputBuf *);
+iRangecc peek_InputBuf      (const iInputBuf *, size_t pos);
+
+void    setWindow_InputBuf  (iInputBuf *, size_t window, iBool spillToFile);
+void    clear_InputBuf      (iInputBuf *);
+void    append_InputBuf     (iInputBuf *, const void *data, size_t size);
+size_t  read_InputBuf       (iInputBuf *, size_t pos, size_t size, void *data_out);
+void    consume_InputBuf    (iInputBuf *, size_t pos);
 
 /*----------------------------------------------------------------------------------------------*/
 
+/* Ring buffer with one writer and one reader thread. Only the writer moves `head` and only
+   the reader moves `tail`, so neither side ever needs to wait for the other. */
 struct Impl_SampleBuf {
     SDL_AudioFormat format;
     uint8_t         numChannels;
     uint8_t         sampleSize; /* as bytes; one sample includes values for all channels */
     void *          data;
     size_t          count;
-    size_t          head, tail;
-    iCondition      moreNeeded;
+    iAtomicInt      head, tail; /* positions in the ring */
+    SDL_sem *       moreNeeded; /* posted by the reader */
 };
 
 iDeclareTypeConstructionArgs(SampleBuf, SDL_AudioFormat format, size_t numChannels, size_t count)
@@ -74,5 +96,7 @@ iLocalDef void *ptr_SampleBuf_(iSampleBuf *d, size_t pos) {
 
 void    write_SampleBuf     (iSampleBuf *, const void *samples, const size_t n);
 void    read_SampleBuf      (iSampleBuf *, const size_t n, void *samples_out);
+void    signalMoreNeeded_SampleBuf  (iSampleBuf *);
+void    waitMoreNeeded_SampleBuf    (iSampleBuf *);
 
 #endif /* LAGRANGE_ENABLE_AUDIO */
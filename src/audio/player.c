@@ -78,10 +78,10 @@ struct Impl_Decoder {
     SDL_AudioFormat   inputFormat;
     iInputBuf *       input;
     size_t            inputPos;
+    iBlock            inputScratch; /* input that isn't contiguous in memory */
     size_t            totalInputSize;
     unsigned int      outputFreq;
     iSampleBuf        output;
-    iMutex            outputMutex;
     iArray            pendingOutput;
     uint64_t          currentSample;
     uint64_t          totalSamples; /* zero if unknown */
@@ -105,6 +105,24 @@ enum iDecoderStatus {
     needMoreInput_DecoderStatus,
 };
 
+static iRangecc input_Decoder_(iDecoder *d, size_t minSize) {
+    /* Returns input data at the current position, without copying if it is contiguous in
+       memory. Otherwise, at least `minSize` bytes (if available) are copied to a scratch
+       buffer. The input mutex must be locked. */
+    const size_t avail = size_InputBuf(d->input) - iMin(d->inputPos, size_InputBuf(d->input));
+    const iRangecc data = peek_InputBuf(d->input, d->inputPos);
+    if (size_Range(&data) >= iMin(minSize, avail)) {
+        return data;
+    }
+    resize_Block(&d->inputScratch, iMin(avail, iMax(minSize, 64 * 1024)));
+    truncate_Block(&d->inputScratch,
+                   read_InputBuf(d->input,
+                                 d->inputPos,
+                                 size_Block(&d->inputScratch),
+                                 data_Block(&d->inputScratch)));
+    return range_Block(&d->inputScratch);
+}
+
 static enum iDecoderStatus decodeWav_Decoder_(iDecoder *d, iRanges inputRange) {
     const uint8_t numChannels     = d->output.numChannels;
     const size_t  inputSampleSize = numChannels * SDL_AUDIO_BITSIZE(d->inputFormat) / 8;
@@ -121,11 +139,10 @@ static enum iDecoderStatus decodeWav_Decoder_(iDecoder *d, iRanges inputRange) {
     void *samples = malloc(inputSampleSize * n);
     /* Get a copy of the input for further processing. */ {
         lock_Mutex(&d->input->mtx);
-        iAssert(inputSampleSize * d->inputPos < size_Block(&d->input->data));
-        memcpy(samples,
-               constData_Block(&d->input->data) + inputSampleSize * d->inputPos,
-               inputSampleSize * n);
+        iAssert(inputSampleSize * d->inputPos < size_InputBuf(d->input));
+        read_InputBuf(d->input, inputSampleSize * d->inputPos, inputSampleSize * n, samples);
         d->inputPos += n;
+        consume_InputBuf(d->input, inputSampleSize * d->inputPos);
         unlock_Mutex(&d->input->mtx);
     }
     /* Gain. */ {
@@ -179,7 +196,7 @@ static enum iDecoderStatus decodeWav_Decoder_(iDecoder *d, iRanges inputRange) {
             }
         }
     }
-    iGuardMutex(&d->outputMutex, write_SampleBuf(&d->output, samples, n));
+    write_SampleBuf(&d->output, samples, n);
     d->currentSample += n;
     free(samples);
     return ok_DecoderStatus;
@@ -187,24 +204,55 @@ static enum iDecoderStatus decodeWav_Decoder_(iDecoder *d, iRanges inputRange) {
 
 static void writePending_Decoder_(iDecoder *d) {
     /* Write as much as we can. */
-    lock_Mutex(&d->outputMutex);
     size_t avail = vacancy_SampleBuf(&d->output);
     size_t n = iMin(avail, size_Array(&d->pendingOutput));
     write_SampleBuf(&d->output, constData_Array(&d->pendingOutput), n);
     removeN_Array(&d->pendingOutput, 0, n);
-    unlock_Mutex(&d->outputMutex);
     d->currentSample += n;
 }
 
+static uint64_t lastOggGranulePos_(iInputBuf *input) {
+    /* The granule position of the last Ogg page is the total number of samples. */
+    const size_t maxPageSize = 27 + 255 + 255 * 255;
+    const size_t size        = size_InputBuf(input);
+    const size_t n           = iMin(size, maxPageSize);
+    uint8_t *    tail        = malloc(n);
+    uint64_t     granulePos  = 0;
+    if (n >= 27 && read_InputBuf(input, size - n, n, tail) == n) {
+        for (size_t i = n - 27 + 1; i-- > 0; ) {
+            if (!memcmp(tail + i, "OggS", 4)) {
+                uint64_t pos = 0;
+                for (int b = 7; b >= 0; b--) {
+                    pos = (pos << 8) | tail[i + 6 + b];
+                }
+                if (pos != UINT64_MAX) { /* -1 if no packet ends on the page */
+                    granulePos = pos;
+                    break;
+                }
+            }
+        }
+    }
+    free(tail);
+    return granulePos;
+}
+
 static enum iDecoderStatus decodeVorbis_Decoder_(iDecoder *d) {
-    const iBlock *input = &d->input->data;
     if (!d->vorbis) {
         lock_Mutex(&d->input->mtx);
-        int error;
-        int consumed;
-        d->vorbis = stb_vorbis_open_pushdata(
-            constData_Block(input), (int) size_Block(input), &consumed, &error, NULL);
+        const size_t remaining = size_InputBuf(d->input) - d->inputPos;
+        int error    = 0;
+        int consumed = 0;
+        for (size_t minSize = 1; ; ) {
+            const iRangecc data = input_Decoder_(d, minSize);
+            d->vorbis = stb_vorbis_open_pushdata(
+                (const uint8_t *) data.start, (int) size_Range(&data), &consumed, &error, NULL);
+            if (d->vorbis || error != VORBIS_need_more_data || size_Range(&data) >= remaining) {
+                break;
+            }
+            minSize = 2 * size_Range(&data) + 1; /* headers continue in the next chunk */
+        }
         if (!d->vorbis) {
+            unlock_Mutex(&d->input->mtx);
             return needMoreInput_DecoderStatus;
         }
         d->inputPos += consumed;
@@ -234,14 +282,8 @@ static enum iDecoderStatus decodeVorbis_Decoder_(iDecoder *d) {
     if (d->totalSamples == 0 && d->input->isComplete) {
         /* Time to check the stream size. */
         lock_Mutex(&d->input->mtx);
-        d->totalInputSize = size_Block(input);
-        int error = 0;
-        stb_vorbis *vrb = stb_vorbis_open_memory(constData_Block(input), (int) size_Block(input),
-                                                 &error, NULL);
-        if (vrb) {
-            d->totalSamples = stb_vorbis_stream_length_in_samples(vrb);
-            stb_vorbis_close(vrb);
-        }
+        d->totalInputSize = size_InputBuf(d->input);
+        d->totalSamples   = lastOggGranulePos_(d->input);
         unlock_Mutex(&d->input->mtx);
     }
     enum iDecoderStatus status = ok_DecoderStatus;
@@ -250,11 +292,29 @@ static enum iDecoderStatus decodeVorbis_Decoder_(iDecoder *d) {
         lock_Mutex(&d->input->mtx);
         int     count     = 0;
         float **samples   = NULL;
-        int     remaining = d->inputPos < size_Block(input) ? size_Block(input) - d->inputPos : 0;
-        int     consumed  = stb_vorbis_decode_frame_pushdata(
-            d->vorbis, constData_Block(input) + d->inputPos, remaining, NULL, &samples, &count);
+        int     consumed  = 0;
+        size_t  remaining = size_InputBuf(d->input) - iMin(d->inputPos, size_InputBuf(d->input));
+        if (remaining == 0) {
+            unlock_Mutex(&d->input->mtx);
+            status = needMoreInput_DecoderStatus;
+            break;
+        }
+        for (size_t minSize = 1; ; ) {
+            const iRangecc data = input_Decoder_(d, minSize);
+            consumed = stb_vorbis_decode_frame_pushdata(d->vorbis,
+                                                        (const uint8_t *) data.start,
+                                                        (int) size_Range(&data),
+                                                        NULL,
+                                                        &samples,
+                                                        &count);
+            if (consumed || count || size_Range(&data) >= remaining) {
+                break;
+            }
+            minSize = 2 * size_Range(&data) + 1; /* the frame continues in the next chunk */
+        }
         d->inputPos += consumed;
-        iAssert(d->inputPos <= size_Block(input));
+        iAssert(d->inputPos <= size_InputBuf(d->input));
+        consume_InputBuf(d->input, d->inputPos);
         unlock_Mutex(&d->input->mtx);
         if (count == 0) {
             if (consumed == 0) {
@@ -287,7 +347,6 @@ static const char *mpegStr_(const mpg123_string *str) {
 enum iDecoderStatus decodeMpeg_Decoder_(iDecoder *d) {
     enum iDecoderStatus status = ok_DecoderStatus;
 #if defined (LAGRANGE_ENABLE_MPG123)
-    const iBlock *input = &d->input->data;
     if (!d->mpeg) {
         d->inputPos = 0;
         d->mpeg = mpg123_new(NULL, NULL);
@@ -298,18 +357,27 @@ enum iDecoderStatus decodeMpeg_Decoder_(iDecoder *d) {
     /* Feed more input. */ {
         lock_Mutex(&d->input->mtx);
         if (d->input->isComplete) {
-            d->totalInputSize = size_Block(input);
+            d->totalInputSize = size_InputBuf(d->input);
         }
-        if (d->inputPos < size_Block(input)) {
-            mpg123_feed(d->mpeg, constData_Block(input) + d->inputPos, size_Block(input) - d->inputPos);
-            if (d->inputPos == 0) {
+        if (d->inputPos < size_InputBuf(d->input)) {
+            const iBool isStart = (d->inputPos == 0);
+            /* mpg123 keeps its own copy of the fed data. */
+            while (d->inputPos < size_InputBuf(d->input)) {
+                const iRangecc data = input_Decoder_(d, 1);
+                if (isEmpty_Range(&data)) {
+                    break;
+                }
+                mpg123_feed(d->mpeg, (const unsigned char *) data.start, size_Range(&data));
+                d->inputPos += size_Range(&data);
+            }
+            if (isStart) {
                 long r; int ch, enc;
                 mpg123_getformat(d->mpeg, &r, &ch, &enc);
                 iAssert(r == d->outputFreq);
                 iAssert(ch == d->output.numChannels);
                 iAssert(enc == MPG123_ENC_SIGNED_16);
             }
-            d->inputPos = size_Block(input);
+            consume_InputBuf(d->input, d->inputPos);
         }
         unlock_Mutex(&d->input->mtx);
     }
@@ -355,20 +423,16 @@ enum iDecoderStatus decodeMpeg_Decoder_(iDecoder *d) {
 
 #if defined (LAGRANGE_ENABLE_OPUS)
 static int readOpus_(void *stream, unsigned char *ptr, int nbytes) {
-    iDecoder     *d     = stream;
-    const iBlock *input = &d->input->data;
-    const size_t  avail = size_Block(input) - d->inputPos;
-    const size_t  n     = iMin(avail, nbytes);
-    memcpy(ptr, constData_Block(input) + d->inputPos, n);
+    iDecoder    *d = stream;
+    const size_t n = read_InputBuf(d->input, d->inputPos, nbytes, ptr);
     d->inputPos += n;
     return n;
 }
 
 static int seekOpus_(void *stream, opus_int64 offset, int whence) {
-    iDecoder     *d     = stream;
-    const iBlock *input = &d->input->data;
-    const size_t  avail = size_Block(input);
-    const size_t  pos   = d->inputPos;
+    iDecoder    *d     = stream;
+    const size_t avail = size_InputBuf(d->input);
+    const size_t pos   = d->inputPos;
     switch (whence) {
         case SEEK_SET:
             d->inputPos = offset;
@@ -383,7 +447,7 @@ static int seekOpus_(void *stream, opus_int64 offset, int whence) {
             if (avail <= pos + offset || PTRDIFF_MAX - pos < offset || -offset > pos) {
                 return -1;
             }
-            d->inputPos = size_Block(input) + offset;
+            d->inputPos = avail + offset;
             break;
     }
     return 0;
@@ -405,9 +469,8 @@ static const OpusFileCallbacks opusCallbacks_ = {
 static enum iDecoderStatus decodeOpus_Decoder_(iDecoder *d) {
     enum iDecoderStatus status = ok_DecoderStatus;
 #if defined (LAGRANGE_ENABLE_OPUS)
-    const iBlock *input = &d->input->data;
     lock_Mutex(&d->input->mtx);
-    if (!d->opus || d->opusLastInputSize != size_Block(input)) {
+    if (!d->opus || d->opusLastInputSize != size_InputBuf(d->input)) {
         ogg_int64_t lastRead = 0;
         if (d->opus) {
             lastRead = op_pcm_tell(d->opus);
@@ -434,7 +497,7 @@ static enum iDecoderStatus decodeOpus_Decoder_(iDecoder *d) {
             }
         }
     }
-    d->opusLastInputSize = size_Block(input);
+    d->opusLastInputSize = size_InputBuf(d->input);
     while (size_Array(&d->pendingOutput) < d->output.count) {
         float       buffer[512];
         const int   samplePerCh  = op_read_float(d->opus, buffer, sizeof(buffer) / sizeof(float), NULL);
@@ -449,6 +512,9 @@ static enum iDecoderStatus decodeOpus_Decoder_(iDecoder *d) {
             break;
         }
     }
+    /* The stream is reopened from the beginning when more input arrives, so this relies on
+       the dropped data being available in the spill file. */
+    consume_InputBuf(d->input, d->inputPos);
     unlock_Mutex(&d->input->mtx);
 
     // Only check the length if we have the whole input
@@ -497,11 +563,8 @@ static iThreadResult run_Decoder_(iThread *thread) {
             }
             unlock_Mutex(&d->input->mtx);
         }
-        else {
-            iGuardMutex(
-                &d->outputMutex, if (isFull_SampleBuf(&d->output)) {
-                    wait_Condition(&d->output.moreNeeded, &d->outputMutex);
-                });
+        else if (isFull_SampleBuf(&d->output)) {
+            waitMoreNeeded_SampleBuf(&d->output);
         }
     }
     return 0;
@@ -512,6 +575,7 @@ void init_Decoder(iDecoder *d, iInputBuf *input, const iContentSpec *spec) {
     d->gain           = 1.0f;
     d->input          = input;
     d->inputPos       = spec->inputStartPos;
+    init_Block(&d->inputScratch, 0);
     d->inputFormat    = spec->inputFormat;
     d->totalInputSize = spec->totalInputSize;
     d->outputFreq     = spec->output.freq;
@@ -536,7 +600,6 @@ void init_Decoder(iDecoder *d, iInputBuf *input, const iContentSpec *spec) {
     d->opus = NULL;
     d->opusLastInputSize = 0;
 #endif
-    init_Mutex(&d->outputMutex);
     d->thread = new_Thread(run_Decoder_);
     setUserData_Thread(d->thread, d);
     start_Thread(d->thread);
@@ -544,13 +607,13 @@ void init_Decoder(iDecoder *d, iInputBuf *input, const iContentSpec *spec) {
 
 void deinit_Decoder(iDecoder *d) {
     d->type = none_DecoderType;
-    signal_Condition(&d->output.moreNeeded);
+    signalMoreNeeded_SampleBuf(&d->output);
     signal_Condition(&d->input->changed);
     join_Thread(d->thread);
     iRelease(d->thread);
-    deinit_Mutex(&d->outputMutex);
     deinit_SampleBuf(&d->output);
     deinit_Array(&d->pendingOutput);
+    deinit_Block(&d->inputScratch);
     iForIndices(i, d->tags) {
         deinit_String(&d->tags[i]);
     }
@@ -606,10 +669,21 @@ static iRangecc mediaType_(const iString *str) {
     return part;
 }
 
-static iContentSpec detectContentSpec_Player_(const iPlayer *d) {
+static const iBlock *header_Player_(iPlayer *d) {
+    /* A copy of the beginning of the stream, which is enough for detecting the format. */
+    const size_t maxSize = 4 * 1024 * 1024;
+    lock_Mutex(&d->data->mtx);
+    iBlock *head = collect_Block(new_Block(iMin(size_InputBuf(d->data), maxSize)));
+    truncate_Block(head, read_InputBuf(d->data, 0, size_Block(head), data_Block(head)));
+    unlock_Mutex(&d->data->mtx);
+    return head;
+}
+
+static iContentSpec detectContentSpec_Player_(iPlayer *d) {
     iContentSpec content;
     iZap(content);
-    const size_t dataSize = size_InputBuf(d->data);
+    const iBlock *head = header_Player_(d);
+    const size_t dataSize = size_Block(head);
     iBuffer *buf = NULL;
     const iRangecc mediaType = mediaType_(&d->mime);
     if (equal_Rangecc(mediaType, "audio/wave") || equal_Rangecc(mediaType, "audio/wav") ||
@@ -629,8 +703,8 @@ static iContentSpec detectContentSpec_Player_(const iPlayer *d) {
         content.type = vorbis_DecoderType;
 #if defined (LAGRANGE_ENABLE_OPUS)
         // Some servers will reply with audio/ogg for Opus, so we need to check the content.
-        OpusHead head;
-        int result = op_test(&head, constData_Block(&d->data->data), size_Block(&d->data->data));
+        OpusHead opusHead;
+        int result = op_test(&opusHead, constData_Block(head), size_Block(head));
         if (result == 0) {
             content.type = opus_DecoderType;
         }
@@ -647,9 +721,7 @@ static iContentSpec detectContentSpec_Player_(const iPlayer *d) {
     }
     if (content.type != none_DecoderType) {
         buf = iClob(new_Buffer());
-        /* This holds a reference to the data block. The decoder runs in a background
-           thread so it needs its own copy of the data. */
-        open_Buffer(buf, &d->data->data);
+        open_Buffer(buf, head);
     }
     if (content.type == wav_DecoderType && dataSize >= 44) {
         /* Read the RIFF/WAVE header. */
@@ -734,7 +806,7 @@ static iContentSpec detectContentSpec_Player_(const iPlayer *d) {
         int consumed = 0;
         int error = 0;
         stb_vorbis *vrb = stb_vorbis_open_pushdata(
-            constData_Block(&d->data->data), size_Block(&d->data->data), &consumed, &error, NULL);
+            constData_Block(head), size_Block(head), &consumed, &error, NULL);
         if (!vrb) {
             if (error != VORBIS_need_more_data) {
                 content.type = none_DecoderType;
@@ -756,7 +828,7 @@ static iContentSpec detectContentSpec_Player_(const iPlayer *d) {
 #if defined (LAGRANGE_ENABLE_MPG123)
         mpg123_handle *mh = mpg123_new(NULL, NULL);
         mpg123_open_feed(mh);
-        mpg123_feed(mh, constData_Block(&d->data->data), size_Block(&d->data->data));
+        mpg123_feed(mh, constData_Block(head), size_Block(head));
         long rate     = 0;
         int  channels = 0;
         int  encoding = 0;
@@ -772,13 +844,13 @@ static iContentSpec detectContentSpec_Player_(const iPlayer *d) {
     }
     else if (content.type == opus_DecoderType) {
 #if defined (LAGRANGE_ENABLE_OPUS)
-        OpusHead head;
-        int result = op_test(&head, constData_Block(&d->data->data), size_Block(&d->data->data));
+        OpusHead opusHead;
+        int result = op_test(&opusHead, constData_Block(head), size_Block(head));
         if (result != 0) {
             return content;
         }
         content.output.freq     = 48000;
-        content.output.channels = head.channel_count;
+        content.output.channels = opusHead.channel_count;
         content.inputFormat     = AUDIO_F32;
         content.output.format   = AUDIO_F32;
 #endif
@@ -795,15 +867,14 @@ static void writeOutputSamples_Player_(void *plr, Uint8 *stream, int len) {
     iAssert(d->decoder);
     const size_t sampleSize = sampleSize_Player_(d);
     const size_t count      = len / sampleSize;
-    lock_Mutex(&d->decoder->outputMutex);
+    /* This is the audio thread, so never block here: the decoder is the only writer. */
     if (size_SampleBuf(&d->decoder->output) >= count) {
         read_SampleBuf(&d->decoder->output, count, stream);
     }
     else {
         memset(stream, d->spec.silence, len);
     }
-    signal_Condition(&d->decoder->output.moreNeeded);
-    unlock_Mutex(&d->decoder->outputMutex);
+    signalMoreNeeded_SampleBuf(&d->decoder->output);
 }
 
 void init_Player(iPlayer *d) {
@@ -867,32 +938,39 @@ void updateSourceData_Player(iPlayer *d, const iString *mimeType, const iBlock *
     }
     switch (update) {
         case replace_PlayerUpdate:
-            set_Block(&input->data, data);
+            clear_InputBuf(input);
+            append_InputBuf(input, constData_Block(data), size_Block(data));
             input->isComplete = iFalse;
             break;
         case append_PlayerUpdate: {
-            const size_t oldSize = size_Block(&input->data);
+            const size_t oldSize = size_InputBuf(input);
             const size_t newSize = size_Block(data);
             if (input->isComplete) {
                 iAssert(newSize == oldSize);
                 break;
             }
             /* The old parts cannot have changed. */
-            /* NOTE: The decoder will hold a reference to the data block, which means
-               appending here will cause a copy-on-write detach to occur. */
-            appendData_Block(&input->data, constBegin_Block(data) + oldSize, newSize - oldSize);
+            append_InputBuf(input, constBegin_Block(data) + oldSize, newSize - oldSize);
             break;
         }
+        case appendNew_PlayerUpdate:
+            if (!input->isComplete) {
+                append_InputBuf(input, constData_Block(data), size_Block(data));
+            }
+            break;
         case complete_PlayerUpdate:
             if (!input->isComplete) {
                 input->isComplete = iTrue;
 #if defined (iPlatformAppleMobile)
                 iAssert(d->avfPlayer == NULL);
                 d->avfPlayer = new_AVFAudioPlayer();
-                if (!setInput_AVFAudioPlayer(d->avfPlayer, &d->mime, &input->data)) {
+                iBlock *all = new_Block(size_InputBuf(input));
+                truncate_Block(all, read_InputBuf(input, 0, size_Block(all), data_Block(all)));
+                if (!setInput_AVFAudioPlayer(d->avfPlayer, &d->mime, all)) {
                     delete_AVFAudioPlayer(d->avfPlayer);
                     d->avfPlayer = NULL;
                 }
+                delete_Block(all);
 #endif
             }
             break;
@@ -902,8 +980,9 @@ void updateSourceData_Player(iPlayer *d, const iString *mimeType, const iBlock *
 }
 
 size_t sourceDataSize_Player(const iPlayer *d) {
+    /* Only the data kept in memory is counted. */
     lock_Mutex(&d->data->mtx);
-    const size_t size = size_Block(&d->data->data);
+    const size_t size = memorySize_InputBuf(d->data);
     unlock_Mutex(&d->data->mtx);
     return size;
 }
@@ -988,6 +1067,10 @@ void stop_Player(iPlayer *d) {
     }
 }
 
+void setInputWindow_Player(iPlayer *d, size_t window) {
+    iGuardMutex(&d->data->mtx, setWindow_InputBuf(d->data, window, iTrue));
+}
+
 void setVolume_Player(iPlayer *d, float volume) {
     d->volume = iClamp(volume, 0, 1);
     if (d->decoder) {
@@ -29,7 +29,8 @@ iDeclareTypeConstruction(Player)
 
 enum iPlayerUpdate {
     replace_PlayerUpdate,
-    append_PlayerUpdate,
+    append_PlayerUpdate,    /* data is the entire stream received so far */
+    appendNew_PlayerUpdate, /* data is only what was received after the previous update */
     complete_PlayerUpdate,
 };
 
@@ -56,6 +57,7 @@ void    	setPaused_Player        (iPlayer *, iBool isPaused);
 void    	setVolume_Player        (iPlayer *, float volume);
 void    	setFlags_Player         (iPlayer *, int flags, iBool set);
 void    	setNotIdle_Player       (iPlayer *);
+void        setInputWindow_Player   (iPlayer *, size_t window); /* bytes kept in memory for seeking back */
 	
 int     	flags_Player            (const iPlayer *);
 const iString *tag_Player           (const iPlayer *, enum iPlayerTag tag);
@@ -0,0 +1,805 @@
+/* Copyright 2023 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "bench.h"
+#include "app.h"
+#include "gmcerts.h"
+#include "gmdocument.h"
+#include "gmutil.h"
+#include "gopher.h"
+#include "markdown.h"
+#include "visited.h"
+#include "ui/paint.h"
+#include "ui/text.h"
+#include "ui/visbuf.h"
+#include "ui/window.h"
+
+#include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
+#include <the_Foundation/path.h>
+#include <the_Foundation/regexp.h>
+#include <the_Foundation/stringarray.h>
+#include <the_Foundation/stringset.h>
+#include <the_Foundation/thread.h>
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#if defined (LAGRANGE_ENABLE_MPG123)
+#  include <mpg123.h>
+#endif
+
+/* Command line of the benchmark. The app itself only sees `--user`, so a separate data
+   directory is used and the user's own settings and history are never touched. */
+static struct {
+    iStringArray *corpus;       /* files to benchmark */
+    int           widths[8];
+    size_t        numWidths;
+    float         fontSizes[8];
+    size_t        numFontSizes;
+    int           repeat;       /* best of N */
+    int           numHitTests;
+    int           numVisited;   /* size of the visited URLs benchmark; zero to skip */
+    int           numTrusted;   /* servers in the TOFU trust benchmark; zero to skip */
+} args_Bench_;
+
+static const int viewHeight_Bench_ = 1000; /* pixels */
+
+static uint64_t now_Bench_(void) {
+    return SDL_GetPerformanceCounter();
+}
+
+static double msSince_Bench_(uint64_t start) {
+    return (double) (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static void keepBest_Bench_(double *best, double ms) {
+    if (*best < 0 || ms < *best) {
+        *best = ms;
+    }
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(BenchInput)
+
+struct Impl_BenchInput {
+    iString           url;
+    iString           source;
+    enum iSourceFormat format;
+};
+
+static iBool load_BenchInput_(iBenchInput *d, const iString *path) {
+    iFile *f = new_File(path);
+    if (!open_File(f, readOnly_FileMode)) {
+        iRelease(f);
+        return iFalse;
+    }
+    iBlock *data = readAll_File(f);
+    iRelease(f);
+    init_String(&d->url);
+    init_String(&d->source);
+    d->format = gemini_SourceFormat;
+    const iRangecc name = baseName_Path(path);
+    if (endsWithCase_Rangecc(name, ".md")) {
+        d->format = markdown_SourceFormat;
+    }
+    else if (endsWithCase_Rangecc(name, ".txt")) {
+        d->format = plainText_SourceFormat;
+    }
+    if (endsWithCase_Rangecc(name, ".gph") || endsWithCase_Rangecc(name, ".gophermap") ||
+        equalCase_Rangecc(name, "gophermap")) {
+        /* Convert the menu to Gemtext like a Gopher request would. */
+        iGopher gopher;
+        iString meta;
+        iBlock  output;
+        init_Gopher(&gopher);
+        init_String(&meta);
+        init_Block(&output, 0);
+        gopher.type   = '1';
+        gopher.meta   = &meta;
+        gopher.output = &output;
+        appendData_Block(data, "\n", 1); /* the last line must be terminated */
+        processResponse_Gopher(&gopher, data);
+        setBlock_String(&d->source, &output);
+        format_String(&d->url, "gopher://bench.localhost/1/%s", cstr_Rangecc(name));
+        deinit_Block(&output);
+        deinit_String(&meta);
+        deinit_Gopher(&gopher);
+    }
+    else {
+        setBlock_String(&d->source, data);
+        set_String(&d->url, collect_String(makeFileUrl_String(path)));
+    }
+    delete_Block(data);
+    return iTrue;
+}
+
+static void deinit_BenchInput_(iBenchInput *d) {
+    deinit_String(&d->source);
+    deinit_String(&d->url);
+}
+
+static iGmDocument *newDocument_BenchInput_(const iBenchInput *d) {
+    iGmDocument *doc = new_GmDocument();
+    setUrl_GmDocument(doc, &d->url);
+    setFormat_GmDocument(doc, d->format);
+    return doc;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(BenchResult)
+
+struct Impl_BenchResult {
+    double import;
+    double layout;
+    double bgLayout;
+    double glyphs;
+    double render;
+    double hitTest;
+};
+
+static void cacheRunGlyphs_Bench_(void *context, const iGmRun *run) {
+    iUnused(context);
+    if (!isMedia_GmRun(run) && !isEmpty_Range(&run->text)) {
+        cache_Text(run->font, run->text);
+    }
+}
+
+iDeclareType(BenchRender)
+
+struct Impl_BenchRender {
+    int origin; /* top of the buffer in document coordinates */
+};
+
+static void drawRun_Bench_(void *context, const iGmRun *run) {
+    const iBenchRender *d = context;
+    if (!isMedia_GmRun(run) && !isEmpty_Range(&run->text)) {
+        drawRange_Text(run->font,
+                       init_I2(left_Rect(run->visBounds), top_Rect(run->visBounds) - d->origin),
+                       run->color,
+                       run->text);
+    }
+}
+
+static void render_Bench_(const iGmDocument *doc, iVisBuf *visBuf) {
+    const int docHeight = size_GmDocument(doc).y;
+    iPaint p;
+    init_Paint(&p);
+    invalidate_VisBuf(visBuf);
+    /* Scroll through the entire document, half a view at a time. */
+    for (int top = 0; top < iMax(1, docHeight); top += viewHeight_Bench_ / 2) {
+        reposition_VisBuf(visBuf, (iRangei){ top, top + viewHeight_Bench_ });
+        iRangei invalidRange[iElemCount(visBuf->buffers)];
+        invalidRanges_VisBuf(visBuf, (iRangei){ 0, docHeight }, invalidRange);
+        iForIndices(i, visBuf->buffers) {
+            iVisBufTexture *buf = &visBuf->buffers[i];
+            if (isEmpty_Rangei(invalidRange[i])) {
+                continue;
+            }
+            iBenchRender ctx = { .origin = buf->origin };
+            beginTarget_Paint(&p, buf->texture);
+            fillRect_Paint(&p,
+                           (iRect){ init_I2(0, invalidRange[i].start - buf->origin),
+                                    init_I2(visBuf->texSize.x, size_Range(&invalidRange[i])) },
+                           tmBackground_ColorId);
+            render_GmDocument(doc, invalidRange[i], drawRun_Bench_, &ctx);
+            endTarget_Paint(&p);
+        }
+        validate_VisBuf(visBuf);
+    }
+#if SDL_VERSION_ATLEAST(2, 0, 10)
+    SDL_RenderFlush(renderer_Window(get_Window()));
+#endif
+}
+
+static void hitTest_Bench_(const iGmDocument *doc, int width) {
+    const iInt2 size = size_GmDocument(doc);
+    uint32_t    seed = 1;
+    size_t      numFound = 0;
+    for (int i = 0; i < args_Bench_.numHitTests; i++) {
+        /* Same pseudo-random points for every run. */
+        seed = seed * 1103515245 + 12345;
+        const int x = (int) ((seed >> 8) % (uint32_t) iMax(1, width));
+        seed = seed * 1103515245 + 12345;
+        const int y = (int) ((seed >> 8) % (uint32_t) iMax(1, size.y));
+        if (findRun_GmDocument(doc, init_I2(x, y))) {
+            numFound++;
+        }
+        if (findLoc_GmDocument(doc, init_I2(x, y)).start) {
+            numFound++;
+        }
+    }
+    iUnused(numFound);
+}
+
+static iBenchResult run_BenchInput_(const iBenchInput *d, int width, iVisBuf *visBuf) {
+    iText *text = text_Window(get_Window());
+    iBenchResult res = { -1, -1, -1, -1, -1, -1 };
+    for (int rep = 0; rep < args_Bench_.repeat; rep++) {
+        iGmDocument *doc = newDocument_BenchInput_(d);
+        /* Import includes normalization and format conversion. setSource_GmDocument() also
+           lays out the document, so an equal relayout is subtracted afterwards. */
+        uint64_t t = now_Bench_();
+        setSource_GmDocument(doc, &d->source, width, width, final_GmDocumentUpdate);
+        const double setSourceTime = msSince_Bench_(t);
+        t = now_Bench_();
+        setWidth_GmDocument(doc, width, width);
+        const double layoutTime = msSince_Bench_(t);
+        keepBest_Bench_(&res.layout, layoutTime);
+        keepBest_Bench_(&res.import, iMax(0.0, setSourceTime - layoutTime));
+        /* Relayout at another width on a background thread. */
+        t = now_Bench_();
+        if (layoutInBackground_GmDocument(doc, width * 3 / 4, width)) {
+            while (!takeBackgroundLayout_GmDocument(doc)) {
+                sleep_Thread(0.0005);
+            }
+            keepBest_Bench_(&res.bgLayout, msSince_Bench_(t));
+            setWidth_GmDocument(doc, width, width);
+        }
+        /* Rasterize the glyphs of the whole document into an empty cache. */
+        resetFontCache_Text(text);
+        t = now_Bench_();
+        beginCacheBatch_Text();
+        render_GmDocument(doc, (iRangei){ 0, size_GmDocument(doc).y }, cacheRunGlyphs_Bench_, NULL);
+        endCacheBatch_Text();
+        keepBest_Bench_(&res.glyphs, msSince_Bench_(t));
+        /* Draw into the visible area buffers. */
+        alloc_VisBuf(visBuf, init_I2(width, viewHeight_Bench_), 1);
+        t = now_Bench_();
+        render_Bench_(doc, visBuf);
+        keepBest_Bench_(&res.render, msSince_Bench_(t));
+        t = now_Bench_();
+        hitTest_Bench_(doc, width);
+        keepBest_Bench_(&res.hitTest, msSince_Bench_(t));
+        iRelease(doc);
+    }
+    return res;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+/* The regular expression based Markdown converter that was used before the current one.
+   It is kept here for comparing throughput and verifying that the output is identical. */
+
+iDeclareType(PendingLink)
+struct Impl_PendingLink {
+    iString *url;
+    iString *title;
+};
+
+static void addPendingLink_Bench_(void *context, const iRegExpMatch *m) {
+    pushBack_Array(context, &(iPendingLink){
+        .url   = captured_RegExpMatch(m, 2),
+        .title = captured_RegExpMatch(m, 1)
+    });
+}
+
+static void addPendingNamedLink_Bench_(void *context, const iRegExpMatch *m) {
+    pushBack_Array(context, &(iPendingLink){
+        .url   = newFormat_String("[]%s", cstr_Rangecc(capturedRange_RegExpMatch(m, 2))),
+        .title = captured_RegExpMatch(m, 1)
+    });
+}
+
+static void flushPendingLinks_Bench_(iArray *links, const iString *source, iString *out) {
+    iRegExp *namePattern = new_RegExp("\n\\s*\\[(.+?)\\]\\s*:\\s*([^\n]+)", 0);
+    if (!endsWith_String(out, "\n")) {
+        appendCStr_String(out, "\n");
+    }
+    iForEach(Array, i, links) {
+        iPendingLink *pending = i.value;
+        const char *url = cstr_String(pending->url);
+        if (startsWith_CStr(url, "[]")) {
+            /* Find the matching named link. */
+            iRegExpMatch m;
+            init_RegExpMatch(&m);
+            while (matchString_RegExp(namePattern, source, &m)) {
+                if (equal_Rangecc(capturedRange_RegExpMatch(&m, 1), url + 2)) {
+                    url = cstrCollect_String(captured_RegExpMatch(&m, 2));
+                    break;
+                }
+            }
+        }
+        appendFormat_String(out, "\n=> %s %s", url, cstr_String(pending->title));
+        delete_String(pending->url);
+        delete_String(pending->title);
+    }
+    clear_Array(links);
+    iRelease(namePattern);
+}
+
+static void convertMarkdownRegExp_Bench_(iString *source) {
+    /* Get rid of indented preformats. */ {
+        iArray        *pendingLinks     = collectNew_Array(sizeof(iPendingLink));
+        const iRegExp *imageLinkPattern = iClob(new_RegExp("\n?!\\[(.+)\\]\\(([^)]+)\\)\n?", 0));
+        const iRegExp *linkPattern      = iClob(new_RegExp("\\[(.+?)\\]\\(([^)]+)\\)", 0));
+        const iRegExp *standaloneLinkPattern = iClob(new_RegExp("^[\\s*_]*\\[(.+?)\\]\\(([^)]+)\\)[\\s*_]*$", 0));
+        const iRegExp *namedLinkPattern = iClob(new_RegExp("\\[(.+?)\\]\\[(.+?)\\]", 0));
+        const iRegExp *namePattern      = iClob(new_RegExp("\\s*\\[(.+?)\\]\\s*:\\s*([^\n]+)", 0));
+        iString result;
+        init_String(&result);
+        replace_String(source, "&nbsp;", "\u00a0");
+        replaceRegExp_String(source, iClob(new_RegExp("```", 0)), "\n```\n", NULL, NULL);
+        iRangecc line = iNullRange;
+        iBool isPre = iFalse;
+        iBool isBlock = iFalse;
+        iBool isLastEmpty = iFalse;
+        while (nextSplit_Rangecc(range_String(source), "\n", &line)) {
+            if (!isPre && !isBlock) {
+                if (equal_Rangecc(line, "```")) {
+                    isBlock = iTrue;
+                    appendCStr_String(&result, "\n```");
+                    continue;
+                }
+                if (*line.start == '#') {
+                    flushPendingLinks_Bench_(pendingLinks, source, &result);
+                }
+                if (isEmpty_Range(&line)) {
+                    isLastEmpty = iTrue;
+                    continue;
+                }
+                if (isLastEmpty) {
+                    appendCStr_String(&result, "\n\n");
+                }
+                else if (size_Range(&line) >= 2 && isdigit(line.start[0]) &&
+                         (line.start[1] == '.' ||
+                          (isdigit(line.start[1]) && line.start[2] == '.'))) {
+                    appendCStr_String(&result, "\n\n");
+                }
+                else if (endsWith_String(&result, "  ") ||
+                         *line.start == '*' || *line.start == '>' || *line.start == '#' ||
+                         (*line.start == '|' && endsWith_String(&result, "|"))) {
+                    appendCStr_String(&result, "\n");
+                }
+                else {
+                    appendCStr_String(&result, " ");
+                }
+                isLastEmpty = iFalse;
+            }
+            else if (isBlock) {
+                if (equal_Rangecc(line, "```")) {
+                    isBlock = iFalse;
+                    appendCStr_String(&result, "\n```\n");
+                }
+                else {
+                    appendCStr_String(&result, "\n");
+                    appendRange_String(&result, line);
+                }
+                continue;
+            }
+            if (startsWith_Rangecc(line, "    ")) {
+                line.start += 4;
+                if (!isPre) {
+                    appendCStr_String(&result, "```\n");
+                    isPre = iTrue;
+                }
+            }
+            else if (isPre) {
+                if (!endsWith_String(&result, "\n")) {
+                    appendCStr_String(&result, "\n");
+                }
+                appendCStr_String(&result, "```\n");
+                if (equal_Rangecc(line, "```")) {
+                    line.start = line.end; /* don't repeat it */
+                }
+                isPre = iFalse;
+            }
+            if (isPre) {
+                appendRange_String(&result, line);
+                appendCStr_String(&result, "\n");
+            }
+            else {
+                iString ln;
+                initRange_String(&ln, line);
+                replaceRegExp_String(&ln, namePattern, "", NULL, 0);
+                replaceRegExp_String(&ln, standaloneLinkPattern, "\n=> \\2 \\1", NULL, NULL);
+                replaceRegExp_String(&ln, imageLinkPattern, "\n=> \\2 \\1\n", NULL, NULL);
+                replaceRegExp_String(&ln, namedLinkPattern, "\\1", addPendingNamedLink_Bench_, pendingLinks);
+                replaceRegExp_String(&ln, linkPattern, "\\1", addPendingLink_Bench_, pendingLinks);
+                replaceRegExp_String(&ln, iClob(new_RegExp("\\*\\*(.+?)\\*\\*", 0)), "\x1b[1m\\1\x1b[0m", NULL, NULL);
+                replaceRegExp_String(&ln, iClob(new_RegExp("__(.+?)__", 0)), "\x1b[1m\\1\x1b[0m", NULL, NULL);
+                replaceRegExp_String(&ln, iClob(new_RegExp("\\*(.+?)\\*", 0)), "\x1b[3m\\1\x1b[0m", NULL, NULL);
+                replaceRegExp_String(&ln, iClob(new_RegExp("\\b_([^_]+?)_\\b", 0)), "\x1b[3m\\1\x1b[0m", NULL, NULL);
+                replaceRegExp_String(&ln, iClob(new_RegExp("(?<!`)`([^`]+?)`(?!`)", 0)), "\x1b[11m\\1\x1b[0m", NULL, NULL);
+                replace_String(&ln, "\\_", "_");
+                append_String(&result, &ln);
+                deinit_String(&ln);
+            }
+        }
+        flushPendingLinks_Bench_(pendingLinks, source, &result);
+        set_String(source, &result);
+        deinit_String(&result);
+    }
+    /* Replace Markdown syntax with equivalent Gemtext, where possible. */
+    replaceRegExp_String(source, iClob(new_RegExp("(\\s*\n){2,}", 0)), "\n\n", NULL, NULL); /* normalize paragraph breaks */
+}
+
+static void runMarkdown_Bench_(const iBenchInput *d, const char *name) {
+    double   refTime = -1, convTime = -1;
+    iString *ref     = collectNew_String();
+    iString *conv    = collectNew_String();
+    for (int rep = 0; rep < args_Bench_.repeat; rep++) {
+        set_String(ref, &d->source);
+        uint64_t t = now_Bench_();
+        convertMarkdownRegExp_Bench_(ref);
+        keepBest_Bench_(&refTime, msSince_Bench_(t));
+        t = now_Bench_();
+        convertToGemtext_Markdown(range_String(&d->source), conv);
+        keepBest_Bench_(&convTime, msSince_Bench_(t));
+    }
+    const double mb = size_String(&d->source) / 1.0e6;
+    printf("%-32s markdown: regexp %9.3f ms (%7.1f MB/s), converter %9.3f ms (%7.1f MB/s), %s\n",
+           name,
+           refTime, refTime > 0 ? mb / refTime * 1000.0 : 0.0,
+           convTime, convTime > 0 ? mb / convTime * 1000.0 : 0.0,
+           equal_String(ref, conv) ? "identical output" : "OUTPUT DIFFERS");
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static void runVisited_Bench_(void) {
+    const int num = args_Bench_.numVisited;
+    const char *dir = concatPath_CStr(cstr_String(dataDir_App()), "bench");
+    makeDirs_Path(collectNewCStr_String(dir));
+    iStringArray *urls = new_StringArray();
+    for (int i = 0; i < num; i++) {
+        pushBack_StringArray(urls,
+                             collect_String(newFormat_String(
+                                 "gemini://host%d.example/gemlog/%d/entry-%d.gmi", i % 997, i / 997, i)));
+    }
+    iVisited *visited = new_Visited();
+    uint64_t t = now_Bench_();
+    iConstForEach(StringArray, i, urls) {
+        visitUrl_Visited(visited, i.value, 0);
+    }
+    const double insertTime = msSince_Bench_(t);
+    t = now_Bench_();
+    save_Visited(visited, dir);
+    const double saveTime = msSince_Bench_(t);
+    delete_Visited(visited);
+    visited = new_Visited();
+    t = now_Bench_();
+    load_Visited(visited, dir);
+    const double loadTime = msSince_Bench_(t);
+    size_t numFound = 0;
+    t = now_Bench_();
+    iConstForEach(StringArray, j, urls) {
+        numFound += containsUrl_Visited(visited, j.value);
+    }
+    const double lookupTime = msSince_Bench_(t);
+    delete_Visited(visited);
+    iRelease(urls);
+    printf("\nvisited URLs: %d (%zu found after reload)\n", num, numFound);
+    printf("  insert %8.2f ms   save %8.2f ms   load %8.2f ms   lookup %8.2f ms\n",
+           insertTime, saveTime, loadTime, lookupTime);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(TrustBurst)
+
+/* One feed refresh worker: checks the certificates of a range of servers. */
+struct Impl_TrustBurst {
+    const iTlsCertificate *cert;
+    int                    first;
+    int                    count;
+    int                    numTrusted;
+};
+
+static iThreadResult checkTrust_TrustBurst_(iThread *thread) {
+    iTrustBurst *d = userData_Thread(thread);
+    iString host;
+    init_String(&host);
+    for (int i = d->first; i < d->first + d->count; i++) {
+        format_String(&host, "feed%d.bench.example", i);
+        d->numTrusted += checkTrust_GmCerts(certs_App(), range_String(&host), 0, d->cert);
+    }
+    deinit_String(&host);
+    return 0;
+}
+
+static double runTrustBurst_Bench_(const iTlsCertificate *cert, int *numTrusted_out) {
+    /* Feeds are refreshed with up to ten concurrent requests. */
+    enum { numWorkers_Bench = 10 };
+    const int   num = args_Bench_.numTrusted;
+    iTrustBurst bursts[numWorkers_Bench];
+    iThread *   workers[numWorkers_Bench];
+    uint64_t    t = now_Bench_();
+    for (int i = 0; i < numWorkers_Bench; i++) {
+        bursts[i] = (iTrustBurst){ .cert  = cert,
+                                   .first = num * i / numWorkers_Bench,
+                                   .count = num * (i + 1) / numWorkers_Bench -
+                                            num * i / numWorkers_Bench };
+        workers[i] = new_Thread(checkTrust_TrustBurst_);
+        setUserData_Thread(workers[i], &bursts[i]);
+        start_Thread(workers[i]);
+    }
+    *numTrusted_out = 0;
+    for (int i = 0; i < numWorkers_Bench; i++) {
+        join_Thread(workers[i]);
+        iRelease(workers[i]);
+        *numTrusted_out += bursts[i].numTrusted;
+    }
+    return msSince_Bench_(t);
+}
+
+static void runTrust_Bench_(void) {
+    iDate until;
+    initCurrent_Date(&until);
+    until.year++;
+    const iString *name = collectNewCStr_String("bench.example");
+    const iTlsCertificateName names[] = {
+        { issuerCommonName_TlsCertificateNameType,  name },
+        { subjectCommonName_TlsCertificateNameType, name },
+        { 0, NULL }
+    };
+    iTlsCertificate *cert = newSelfSignedRSA_TlsCertificate(2048, until, names);
+    const iString *path = collect_String(concatCStr_Path(dataDir_App(), "trusted.2.txt"));
+    /* First burst: every server is new and gets a trust entry. */
+    int numNew = 0;
+    const double newTime = runTrustBurst_Bench_(cert, &numNew);
+    if (numNew < args_Bench_.numTrusted) {
+        fprintf(stderr, "lagrange-bench: servers were trusted by an earlier run; "
+                        "use an empty --user directory\n");
+    }
+    uint64_t t = now_Bench_();
+    saveTrusted_GmCerts(certs_App());
+    const double newSaveTime = msSince_Bench_(t);
+    const size_t fileSize = fileSize_FileInfo(path);
+    /* Second burst: nothing changes, so there should be nothing to save. */
+    int numKnown = 0;
+    const double knownTime = runTrustBurst_Bench_(cert, &numKnown);
+    t = now_Bench_();
+    saveTrusted_GmCerts(certs_App());
+    const double knownSaveTime = msSince_Bench_(t);
+    delete_TlsCertificate(cert);
+    printf("\nTOFU trust: %d servers checked by 10 threads (%d + %d trusted), file %zu bytes\n",
+           args_Bench_.numTrusted, numNew, numKnown, fileSize);
+    printf("  new: check %8.2f ms  save %8.2f ms   known: check %8.2f ms  save %8.2f ms\n",
+           newTime, newSaveTime, knownTime, knownSaveTime);
+}
+
+static void addCorpus_Bench_(const char *path) {
+    iFileInfo *info = iClob(new_FileInfo(collectNewCStr_String(path)));
+    if (isDirectory_FileInfo(info)) {
+        iStringSet *sorted = iClob(new_StringSet());
+        iForEach(DirFileInfo, i, iClob(directoryContents_FileInfo(info))) {
+            if (!isDirectory_FileInfo(i.value)) {
+                insert_StringSet(sorted, path_FileInfo(i.value));
+            }
+        }
+        iConstForEach(StringSet, s, sorted) {
+            pushBack_StringArray(args_Bench_.corpus, s.value);
+        }
+    }
+    else {
+        pushBackCStr_StringArray(args_Bench_.corpus, path);
+    }
+}
+
+int run_Bench(void) {
+    iWindow *win = get_Window();
+    if (!win) {
+        fprintf(stderr, "lagrange-bench: no window\n");
+        return 1;
+    }
+    win->isExposed = iTrue; /* glyphs are cached only for exposed windows */
+    iText   *text   = text_Window(win);
+    iVisBuf *visBuf = new_VisBuf();
+    printf("%-32s %5s %5s %9s %9s %9s %9s %9s %9s\n",
+           "file", "font", "width", "import", "layout", "bglayout", "glyphs", "render", "hittest");
+    iConstForEach(StringArray, i, args_Bench_.corpus) {
+        iBenchInput input;
+        if (!load_BenchInput_(&input, i.value)) {
+            fprintf(stderr, "lagrange-bench: failed to read %s\n", cstr_String(i.value));
+            continue;
+        }
+        for (size_t f = 0; f < args_Bench_.numFontSizes; f++) {
+            setDocumentFontSize_Text(text, args_Bench_.fontSizes[f]);
+            for (size_t w = 0; w < args_Bench_.numWidths; w++) {
+                const iBenchResult res = run_BenchInput_(&input, args_Bench_.widths[w], visBuf);
+                printf("%-32s %5.2f %5d %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+                       cstr_Rangecc(baseName_Path(i.value)),
+                       args_Bench_.fontSizes[f],
+                       args_Bench_.widths[w],
+                       res.import,
+                       res.layout,
+                       res.bgLayout,
+                       res.glyphs,
+                       res.render,
+                       res.hitTest);
+            }
+        }
+        if (input.format == markdown_SourceFormat) {
+            runMarkdown_Bench_(&input, cstr_Rangecc(baseName_Path(i.value)));
+        }
+        deinit_BenchInput_(&input);
+    }
+    printf("(milliseconds, best of %d; bglayout -1 if not done in background; "
+           "hittest is %d findRun + findLoc queries)\n",
+           args_Bench_.repeat, args_Bench_.numHitTests);
+    delete_VisBuf(visBuf);
+    setDocumentFontSize_Text(text, (float) prefs_App()->zoomPercent / 100.0f);
+    if (args_Bench_.numVisited > 0) {
+        runVisited_Bench_();
+    }
+    if (args_Bench_.numTrusted > 0) {
+        runTrust_Bench_();
+    }
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static size_t parseList_Bench_(const char *list, void *values, size_t max, iBool isFloat) {
+    size_t   count = 0;
+    iRangecc seg   = iNullRange;
+    while (count < max && nextSplit_Rangecc(range_CStr(list), ",", &seg)) {
+        const char *num = cstr_Rangecc(seg);
+        if (isFloat) {
+            ((float *) values)[count++] = strtof(num, NULL);
+        }
+        else {
+            ((int *) values)[count++] = atoi(num);
+        }
+    }
+    return count;
+}
+
+static void printUsage_Bench_(const char *argv0) {
+    printf("Usage: %s [options] FILE|DIR...\n"
+           "Lays out and renders .gmi, .txt, .md, and Gopher menu (.gph) files headlessly.\n"
+           "  --width W1,W2,...     document widths in pixels (default: 500,800,1200)\n"
+           "  --font F1,F2,...      document font size factors (default: 1,1.5)\n"
+           "  --repeat N            report the best of N runs (default: 3)\n"
+           "  --hits N              number of hit test queries (default: 10000)\n"
+           "  --visited N           also benchmark N visited URLs (default: 0)\n"
+           "  --trust N             also benchmark a burst of N feed servers' TOFU checks\n"
+           "                        (e.g. 200; default: 0)\n"
+           "  --user DIR            app data directory (default: a new temporary directory)\n",
+           argv0);
+}
+
+static void removeDirectory_Bench_(const iString *path) {
+    iForEach(DirFileInfo, i, iClob(new_DirFileInfo(path))) {
+        if (isDirectory_FileInfo(i.value)) {
+            removeDirectory_Bench_(path_FileInfo(i.value));
+        }
+        else {
+            remove(cstr_String(path_FileInfo(i.value)));
+        }
+    }
+    rmdir_Path(path);
+}
+
+int main(int argc, char **argv) {
+#if !defined (iPlatformMsys)
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    static const int   defaultWidths[]    = { 500, 800, 1200 };
+    static const float defaultFontSizes[] = { 1.0f, 1.5f };
+    const char *userDir     = NULL;
+    iString    *tempUserDir = NULL; /* removed afterwards */
+    init_Foundation();
+    args_Bench_.corpus       = new_StringArray();
+    args_Bench_.numWidths    = iElemCount(defaultWidths);
+    args_Bench_.numFontSizes = iElemCount(defaultFontSizes);
+    memcpy(args_Bench_.widths, defaultWidths, sizeof(defaultWidths));
+    memcpy(args_Bench_.fontSizes, defaultFontSizes, sizeof(defaultFontSizes));
+    args_Bench_.repeat      = 3;
+    args_Bench_.numHitTests = 10000;
+    for (int i = 1; i < argc; i++) {
+        const char *arg   = argv[i];
+        const char *value = (i + 1 < argc ? argv[i + 1] : NULL);
+        if (!iCmpStr(arg, "--help") || !iCmpStr(arg, "-h")) {
+            printUsage_Bench_(argv[0]);
+            return 0;
+        }
+        if (*arg == '-' && !value) {
+            fprintf(stderr, "lagrange-bench: %s needs a value\n", arg);
+            return 1;
+        }
+        if (!iCmpStr(arg, "--width")) {
+            args_Bench_.numWidths = parseList_Bench_(value, args_Bench_.widths,
+                                                     iElemCount(args_Bench_.widths), iFalse);
+            i++;
+        }
+        else if (!iCmpStr(arg, "--font")) {
+            args_Bench_.numFontSizes = parseList_Bench_(value, args_Bench_.fontSizes,
+                                                        iElemCount(args_Bench_.fontSizes), iTrue);
+            i++;
+        }
+        else if (!iCmpStr(arg, "--repeat")) {
+            args_Bench_.repeat = iMax(1, atoi(value));
+            i++;
+        }
+        else if (!iCmpStr(arg, "--hits")) {
+            args_Bench_.numHitTests = iMax(0, atoi(value));
+            i++;
+        }
+        else if (!iCmpStr(arg, "--visited")) {
+            args_Bench_.numVisited = iMax(0, atoi(value));
+            i++;
+        }
+        else if (!iCmpStr(arg, "--trust")) {
+            args_Bench_.numTrusted = iMax(0, atoi(value));
+            i++;
+        }
+        else if (!iCmpStr(arg, "--user")) {
+            userDir = value;
+            i++;
+        }
+        else if (*arg == '-') {
+            fprintf(stderr, "lagrange-bench: unknown option %s\n", arg);
+            return 1;
+        }
+        else {
+            addCorpus_Bench_(arg);
+        }
+    }
+    if (isEmpty_StringArray(args_Bench_.corpus) && args_Bench_.numVisited == 0 &&
+        args_Bench_.numTrusted == 0) {
+        printUsage_Bench_(argv[0]);
+        return 1;
+    }
+    if (!userDir) {
+        /* Each run gets a fresh directory so data saved by earlier runs (e.g., trusted
+           certificates) doesn't change what is being measured. */
+        char dirName[64];
+        snprintf(dirName, sizeof(dirName), "lagrange-bench-%lld-%llu", (long long) time(NULL),
+                 (unsigned long long) (now_Bench_() % 1000000));
+#if defined (P_tmpdir)
+        tempUserDir = concatCStr_Path(collectNewCStr_String(P_tmpdir), dirName);
+#else
+        tempUserDir = newCStr_String(dirName);
+#endif
+        userDir = cstr_String(tempUserDir);
+    }
+    /* No display or GPU is needed. */
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+    SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+#if defined (LAGRANGE_ENABLE_MPG123)
+    mpg123_init();
+#endif
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER)) {
+        fprintf(stderr, "[SDL] init failed: %s\n", SDL_GetError());
+        return -1;
+    }
+    char *appArgv[] = { argv[0], "--user", (char *) userDir, NULL };
+    const int rc = run_App(3, appArgv);
+    SDL_Quit();
+    if (tempUserDir) {
+        removeDirectory_Bench_(tempUserDir);
+        delete_String(tempUserDir);
+    }
+#if defined (LAGRANGE_ENABLE_MPG123)
+    mpg123_exit();
+#endif
+    iRelease(args_Bench_.corpus);
+    deinit_Foundation();
+    return rc;
+}
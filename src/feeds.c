@@ -26,8 +26,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "visited.h"
 #include "lang.h"
 #include "app.h"
+#include "profiler.h"
 
+#include <the_Foundation/buffer.h>
 #include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
 #include <the_Foundation/hash.h>
 #include <the_Foundation/intset.h>
 #include <the_Foundation/mutex.h>
@@ -122,32 +125,110 @@ iDefineTypeConstructionArgs(FeedJob, (const iBookmark *bm), bm)
 
 /*----------------------------------------------------------------------------------------------*/
 
-static const char *feedsFilename_Feeds_ = "feeds.txt";
+static const char *fileName_Feeds_     = "feeds.lgr";
+static const char *tempFileName_Feeds_ = "feeds.lgr.tmp";
+static const char *textFileName_Feeds_ = "feeds.txt"; /* older format, only loaded */
+static const char *magic_Feeds_        = "lgFd";
+
+enum iFeedsFileVersion {
+    initial_FeedsFileVersion = 1,
+    /* meta */
+    latest_FeedsFileVersion = initial_FeedsFileVersion,
+};
+
+/* feeds.lgr is a log of records. It begins with a snapshot of all the entries and is then
+   appended to as entries are found, changed, or removed. Once there are more than twice as many
+   records as entries, or the snapshot is a month old, the file is rewritten with a new snapshot.
+
+   header: "lgFd"  u32 version  u64 snapshot time
+   record: u32 type  u32 size  <size bytes of data>
+
+   Feed IDs in the records are bookmark IDs of the session that wrote them. A feed record
+   defines the URL of an ID before any other record refers to the ID. */
+
+enum iFeedsRecordType {
+    refreshed_FeedsRecordType   = 1, /* u64 seconds */
+    feed_FeedsRecordType        = 2, /* u32 feed ID, URL */
+    entry_FeedsRecordType       = 3, /* u32 feed ID, u64 posted, u64 discovered, URL, title */
+    removeEntry_FeedsRecordType = 4, /* u32 feed ID, URL */
+    removeFeed_FeedsRecordType  = 5, /* u32 feed ID */
+};
+
+#define maxSnapshotAgeSeconds_Feeds (30 * 24 * 3600)
+
+iDeclareType(FeedSourceHashNode)
+
+/* Checksum of the most recently parsed source of a feed. If the source hasn't changed, there is
+   no need to parse it again. */
+struct Impl_FeedSourceHashNode {
+    iHashNode node; /* key is the bookmark ID */
+    uint32_t  sourceCrc;
+    size_t    sourceSize;
+    uint32_t  urlCrc;
+    iBool     checkHeadings;
+    iBool     ignoreWeb;
+    iTime     parsedAt;
+};
 
 struct Impl_Feeds {
     iMutex *  mtx;
+    iMutex *  fileMtx; /* serializes writing of the file */
     iString   saveDir;
     iIntSet   previouslyCheckedFeeds; /* bookmark IDs */
     iTime     lastRefreshedAt;
     int       refreshTimer;
     uint32_t  refreshInterval; /* milliseconds, for refreshTimer */
+    int       maxRequests;        /* concurrent requests during a refresh */
+    int       maxRequestsPerHost;
     iThread * worker;
     iBool     stopWorker;
+    iCondition wakeWorker; /* a request has finished or the worker should stop */
+    iBool     isWorkerWoken;
+    iThread * loader;
+    iCondition loaded;
+    iBool     isLoaded;
+    iBuffer * journal;        /* records not yet appended to the file */
+    iIntSet   journaledFeeds; /* feed records that have been written during this session */
+    size_t    numFileRecords; /* snapshot and appended */
+    iTime     snapshotTime;
+    iBool     needSnapshot;
     iPtrArray jobs; /* pending */
+    iHash     sourceHashes;
     iSortedArray entries; /* pointers to all discovered feed entries, sorted by entry ID (URL) */
 };
 
 static iFeeds feeds_;
 
-#define maxConcurrentRequests_Feeds 10
+#define maxSkipParseSeconds_Feeds           (24 * 3600) /* unchanged sources are still parsed daily */
 
 static iBool isInitialized_Feeds_(const iFeeds *d) {
     return d->mtx != NULL;
 }
 
+static void waitForLoad_Feeds_(iFeeds *d) {
+    /* The entries are loaded in a background thread after launch. */
+    lock_Mutex(d->mtx);
+    while (!d->isLoaded) {
+        wait_Condition(&d->loaded, d->mtx);
+    }
+    signal_Condition(&d->loaded); /* there may be other waiters */
+    unlock_Mutex(d->mtx);
+}
+
+static void requestFinished_FeedJob_(iAnyObject *obj, iGmRequest *req) {
+    /* Called in the request's thread. */
+    iUnused(obj, req);
+    iFeeds *d = &feeds_;
+    lock_Mutex(d->mtx);
+    d->isWorkerWoken = iTrue;
+    signal_Condition(&d->wakeWorker);
+    unlock_Mutex(d->mtx);
+}
+
 static void submit_FeedJob_(iFeedJob *d) {
     d->request = new_GmRequest(certs_App());
     setUrl_GmRequest(d->request, &d->url);
+    iConnect(GmRequest, d->request, finished, d->request, requestFinished_FeedJob_);
     initCurrent_Time(&d->startTime);
     submit_GmRequest(d->request);
 }
@@ -161,14 +242,35 @@ static const iPtrArray *listSubscriptions_(void) {
     return list_Bookmarks(bookmarks_App(), NULL, isSubscribed_, NULL);
 }
 
-static iFeedJob *startNextJob_Feeds_(iFeeds *d) {
-    if (isEmpty_PtrArray(&d->jobs)) {
-        return NULL;
+static size_t numJobsForHost_(const iPtrArray *jobs, iRangecc host) {
+    size_t count = 0;
+    iConstForEach(PtrArray, i, jobs) {
+        const iFeedJob *job = i.ptr;
+        if (equalCase_Rangecc(urlHost_String(&job->url), host)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void startJobs_Feeds_(iFeeds *d, iPtrArray *active) {
+    /* Pending jobs are started in order, but a server is only sent a limited number of
+       requests at a time. */
+    size_t maxRequests, maxPerHost;
+    iGuardMutex(d->mtx, {
+        maxRequests = d->maxRequests;
+        maxPerHost  = d->maxRequestsPerHost;
+    });
+    for (size_t pos = 0; pos < size_PtrArray(&d->jobs) && size_PtrArray(active) < maxRequests; ) {
+        iFeedJob *job = at_PtrArray(&d->jobs, pos);
+        if (numJobsForHost_(active, urlHost_String(&job->url)) >= maxPerHost) {
+            pos++;
+            continue;
+        }
+        removeOne_PtrArray(&d->jobs, job);
+        pushBack_PtrArray(active, job);
+        submit_FeedJob_(job);
     }
-    iFeedJob *job;
-    take_PtrArray(&d->jobs, 0, (void **) &job);
-    submit_FeedJob_(job);
-    return job;
 }
 
 static iBool isTrimmablePunctuation_(iChar c) {
@@ -208,13 +310,15 @@ static iBool parseResult_FeedJob_(iFeedJob *d) {
         if (statusCode == redirectPermanent_GmStatusCode) {
             if (updateUrls_Bookmark(bookmarks_App(), &d->url, dstUrl)) {
                 postCommand_App("bookmarks.changed");
+                /* Journaled feed records refer to the old URL. */
+                iGuardMutex(feeds_.mtx, feeds_.needSnapshot = iTrue);
             }
         }
-        /* Set up a new request. */
+        /* The job goes back to the pending jobs so the new request is scheduled like
+           any other. */
         if (++d->numRedirect < 5) {
             set_String(&d->url, dstUrl);
-            iRelease(d->request);
-            submit_FeedJob_(d);
+            iReleasePtr(&d->request);
             return iFalse;
         }
         return iTrue;
@@ -296,44 +400,214 @@ static iBool parseResult_FeedJob_(iFeedJob *d) {
     return iTrue;
 }
 
+static iBool isSourceUnchanged_Feeds_(iFeeds *d, const iFeedJob *job) {
+    /* Checks the source of a successfully finished job against the previous one. The stored
+       checksum is updated if the source will be parsed. */
+    if (!isSuccess_GmStatusCode(status_GmRequest(job->request))) {
+        return iFalse;
+    }
+    const iBlock  *src    = &lockResponse_GmRequest(job->request)->body;
+    const uint32_t crc    = iCrc32(constData_Block(src), size_Block(src));
+    const size_t   size   = size_Block(src);
+    unlockResponse_GmRequest(job->request);
+    const iString *url    = url_GmRequest(job->request);
+    const uint32_t urlCrc = iCrc32(cstr_String(url), size_String(url));
+    iBool          isSame = iFalse;
+    lock_Mutex(d->mtx);
+    iFeedSourceHashNode *node = (iFeedSourceHashNode *) value_Hash(&d->sourceHashes,
+                                                                   job->bookmarkId);
+    if (!node) {
+        node = iMalloc(FeedSourceHashNode);
+        node->node.key = job->bookmarkId;
+        iZap(node->parsedAt);
+        insert_Hash(&d->sourceHashes, &node->node);
+    }
+    else {
+        isSame = (node->sourceCrc == crc && node->sourceSize == size && node->urlCrc == urlCrc &&
+                  node->checkHeadings == job->checkHeadings && node->ignoreWeb == job->ignoreWeb &&
+                  elapsedSeconds_Time(&node->parsedAt) < maxSkipParseSeconds_Feeds);
+    }
+    if (!isSame) {
+        node->sourceCrc     = crc;
+        node->sourceSize    = size;
+        node->urlCrc        = urlCrc;
+        node->checkHeadings = job->checkHeadings;
+        node->ignoreWeb     = job->ignoreWeb;
+        initCurrent_Time(&node->parsedAt);
+    }
+    unlock_Mutex(d->mtx);
+    return isSame;
+}
+
+static void forgetSourceHash_Feeds_(iFeeds *d, uint32_t bookmarkId) {
+    lock_Mutex(d->mtx);
+    iHashNode *node = remove_Hash(&d->sourceHashes, bookmarkId);
+    unlock_Mutex(d->mtx);
+    free(node);
+}
+
+static void writeRecord_Feeds_(iStream *outs, enum iFeedsRecordType type, const iBuffer *data) {
+    writeU32_Stream(outs, type);
+    writeU32_Stream(outs, (uint32_t) size_Block(data_Buffer(data)));
+    writeData_Stream(outs, constData_Block(data_Buffer(data)), size_Block(data_Buffer(data)));
+}
+
+static void writeFeed_Feeds_(iStream *outs, uint32_t feedId, const iString *url) {
+    iBuffer *buf = new_Buffer();
+    openEmpty_Buffer(buf);
+    writeU32_Stream(stream_Buffer(buf), feedId);
+    serialize_String(url, stream_Buffer(buf));
+    writeRecord_Feeds_(outs, feed_FeedsRecordType, buf);
+    iRelease(buf);
+}
+
+static void writeEntry_Feeds_(iStream *outs, const iFeedEntry *entry, iBool isRemoved) {
+    iBuffer *buf = new_Buffer();
+    openEmpty_Buffer(buf);
+    iStream *data = stream_Buffer(buf);
+    writeU32_Stream(data, entry->bookmarkId);
+    if (!isRemoved) {
+        writeU64_Stream(data, integralSeconds_Time(&entry->posted));
+        writeU64_Stream(data, integralSeconds_Time(&entry->discovered));
+    }
+    serialize_String(&entry->url, data);
+    if (!isRemoved) {
+        serialize_String(&entry->title, data);
+    }
+    writeRecord_Feeds_(
+        outs, isRemoved ? removeEntry_FeedsRecordType : entry_FeedsRecordType, buf);
+    iRelease(buf);
+}
+
+static void writeTime_Feeds_(iStream *outs, enum iFeedsRecordType type, const iTime *time) {
+    iBuffer *buf = new_Buffer();
+    openEmpty_Buffer(buf);
+    writeU64_Stream(stream_Buffer(buf), integralSeconds_Time(time));
+    writeRecord_Feeds_(outs, type, buf);
+    iRelease(buf);
+}
+
+static iBool journalFeed_Feeds_(iFeeds *d, uint32_t feedId) {
+    /* Records referring to a feed must be preceded by a definition of the feed's URL.
+       Mutex must be locked. */
+    if (contains_IntSet(&d->journaledFeeds, feedId)) {
+        return iTrue;
+    }
+    const iBookmark *bm = get_Bookmarks(bookmarks_App(), feedId);
+    if (!bm) {
+        d->needSnapshot = iTrue;
+        return iFalse;
+    }
+    writeFeed_Feeds_(stream_Buffer(d->journal), feedId, &bm->url);
+    insert_IntSet(&d->journaledFeeds, feedId);
+    d->numFileRecords++;
+    return iTrue;
+}
+
+static void journalEntry_Feeds_(iFeeds *d, const iFeedEntry *entry, iBool isRemoved) {
+    /* Mutex must be locked. */
+    if (journalFeed_Feeds_(d, entry->bookmarkId)) {
+        writeEntry_Feeds_(stream_Buffer(d->journal), entry, isRemoved);
+        d->numFileRecords++;
+    }
+}
+
+static iBool isTooOld_FeedEntry_(const iFeedEntry *d, const iTime *now) {
+    /* Heading entries are kept as long as they are present in the source. */
+    return !d->isHeading && isValid_Time(&d->discovered) &&
+           secondsSince_Time(now, &d->discovered) > maxAge_Visited;
+}
+
+static iBuffer *saveSnapshot_Feeds_(iFeeds *d) {
+    /* Mutex must be locked. Returns the snapshot to be written to the file. */
+    iBuffer *buf = new_Buffer();
+    openEmpty_Buffer(buf);
+    iStream *outs = stream_Buffer(buf);
+    iTime now;
+    initCurrent_Time(&now);
+    writeData_Stream(outs, magic_Feeds_, 4);
+    writeU32_Stream(outs, latest_FeedsFileVersion);
+    writeU64_Stream(outs, integralSeconds_Time(&now));
+    writeTime_Feeds_(outs, refreshed_FeedsRecordType, &d->lastRefreshedAt);
+    size_t numRecords = 1;
+    clear_IntSet(&d->journaledFeeds);
+    /* Index of feeds for IDs. */ {
+        iConstForEach(PtrArray, i, listSubscriptions_()) {
+            const iBookmark *bm = i.ptr;
+            writeFeed_Feeds_(outs, id_Bookmark(bm), &bm->url);
+            insert_IntSet(&d->journaledFeeds, id_Bookmark(bm));
+            numRecords++;
+        }
+    }
+    iConstForEach(Array, i, &d->entries.values) {
+        const iFeedEntry *entry = *(const iFeedEntry **) i.value;
+        if (isTooOld_FeedEntry_(entry, &now)) {
+            continue; /* Forget entries discovered long ago. */
+        }
+        if (contains_IntSet(&d->journaledFeeds, entry->bookmarkId)) {
+            writeEntry_Feeds_(outs, entry, iFalse);
+            numRecords++;
+        }
+    }
+    /* Pending records are included in the snapshot. */
+    d->snapshotTime   = now;
+    d->numFileRecords = numRecords;
+    d->needSnapshot   = iFalse;
+    close_Buffer(d->journal);
+    openEmpty_Buffer(d->journal);
+    return buf;
+}
+
 static void save_Feeds_(iFeeds *d) {
-    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, feedsFilename_Feeds_)));
-    if (open_File(f, write_FileMode | text_FileMode)) {
-        lock_Mutex(d->mtx);
-        iString *str = new_String();
-        format_String(str, "%llu\n# Feeds\n", (unsigned long long)
-                      integralSeconds_Time(&d->lastRefreshedAt));
-        write_File(f, utf8_String(str));
-        /* Index of feeds for IDs. */ {
-            iConstForEach(PtrArray, i, listSubscriptions_()) {
-                const iBookmark *bm = i.ptr;
-                format_String(str, "%08x %s\n", id_Bookmark(bm), cstr_String(&bm->url));
-                write_File(f, utf8_String(str));
-            }
+    /* Pending records are appended to the file, unless it is time for a new snapshot.
+       The file is written after unlocking `mtx` so the entries remain accessible meanwhile. */
+    const char *path = cstrCollect_String(concatCStr_Path(&d->saveDir, fileName_Feeds_));
+    iBuffer    *snapshot = NULL;
+    iBuffer    *journal  = NULL;
+    lock_Mutex(d->fileMtx);
+    lock_Mutex(d->mtx);
+    if (d->needSnapshot || d->numFileRecords > 2 * size_SortedArray(&d->entries) + 100 ||
+        !isValid_Time(&d->snapshotTime) ||
+        elapsedSeconds_Time(&d->snapshotTime) > maxSnapshotAgeSeconds_Feeds ||
+        !fileExistsCStr_FileInfo(path)) {
+        snapshot = saveSnapshot_Feeds_(d);
+    }
+    else if (!isEmpty_Block(data_Buffer(d->journal))) {
+        journal = d->journal;
+        d->journal = new_Buffer();
+        openEmpty_Buffer(d->journal);
+    }
+    unlock_Mutex(d->mtx);
+    iBool ok = iTrue;
+    if (snapshot) {
+        const char *tempPath =
+            cstrCollect_String(concatCStr_Path(&d->saveDir, tempFileName_Feeds_));
+        iFile *f = newCStr_File(tempPath);
+        ok = open_File(f, writeOnly_FileMode);
+        if (ok) {
+            write_File(f, data_Buffer(snapshot));
+            close_File(f);
         }
-        writeData_File(f, "# Entries\n", 10);
-        iTime now;
-        initCurrent_Time(&now);
-        iConstForEach(Array, i, &d->entries.values) {
-            const iFeedEntry *entry = *(const iFeedEntry **) i.value;
-            /* Heading entries are kept as long as they are present in the source. */
-            if (!entry->isHeading && isValid_Time(&entry->discovered) &&
-                secondsSince_Time(&now, &entry->discovered) > maxAge_Visited) {
-                continue; /* Forget entries discovered long ago. */
-            }
-            format_String(str, "%x\n%llu\n%llu\n%s\n%s\n",
-                          entry->bookmarkId,
-                          (unsigned long long) integralSeconds_Time(&entry->posted),
-                          (unsigned long long) integralSeconds_Time(&entry->discovered),
-                          cstr_String(&entry->url),
-                          cstr_String(&entry->title));
-            write_File(f, utf8_String(str));
-        }
-        delete_String(str);
-        close_File(f);
-        unlock_Mutex(d->mtx);
+        iRelease(f);
+        if (ok) {
+            commitFile_App(path, tempPath);
+        }
+        iRelease(snapshot);
     }
-    iRelease(f);
+    else if (journal) {
+        iFile *f = newCStr_File(path);
+        ok = open_File(f, append_FileMode);
+        if (ok) {
+            write_File(f, data_Buffer(journal));
+        }
+        iRelease(f);
+        iRelease(journal);
+    }
+    if (!ok) {
+        /* The records are still in memory; try again with a full snapshot. */
+        iGuardMutex(d->mtx, d->needSnapshot = iTrue);
+    }
+    unlock_Mutex(d->fileMtx);
 }
 
 static iBool isHeadingEntry_FeedEntry_(const iFeedEntry *d) {
@@ -374,6 +648,7 @@ static iBool updateEntries_Feeds_(iFeeds *d, iBool isHeadings, uint32_t sourceId
             if (!contains_StringSet(known, &entry->url)) {
 //                printf("  {%s} is new\n", cstr_String(&entry->url));
                 insert_SortedArray(&d->entries, &entry);
+                journalEntry_Feeds_(d, entry, iFalse);
                 gotNew = iTrue;
                 remove_PtrArrayIterator(&i);
             }
@@ -389,6 +664,7 @@ static iBool updateEntries_Feeds_(iFeeds *d, iBool isHeadings, uint32_t sourceId
             if (entry->bookmarkId == sourceId &&
                 !contains_StringSet(presentInSource, &entry->url)) {
 //                printf("    {%s}\n", cstr_String(&entry->url));
+                journalEntry_Feeds_(d, entry, iTrue);
                 delete_FeedEntry(entry);
                 remove_ArrayIterator(&e);
             }
@@ -443,11 +719,15 @@ static iBool updateEntries_Feeds_(iFeeds *d, iBool isHeadings, uint32_t sourceId
                 if (changed) {
                     /* TODO: better to use a new flag for read feed entries? */
                     removeUrl_Visited(visited_App(), &existing->url);
+                    journalEntry_Feeds_(d, existing, iFalse);
                     gotNew = iTrue;
                 }
+                /* Updated discovery times are not journaled. The next snapshot will have
+                   them well before the entry would be considered too old. */
             }
             else {
                 insert_SortedArray(&d->entries, &entry);
+                journalEntry_Feeds_(d, entry, iFalse);
                 gotNew = iTrue;
             }
             remove_PtrArrayIterator(&i);
@@ -459,71 +739,100 @@ static iBool updateEntries_Feeds_(iFeeds *d, iBool isHeadings, uint32_t sourceId
     return gotNew;
 }
 
+static void waitForRequests_Feeds_(iFeeds *d, const iPtrArray *active) {
+    /* Sleep until a request finishes, the worker is stopped, or the oldest ongoing request
+       times out. */
+    double timeout = requestTimeoutSeconds_FeedJob_;
+    iConstForEach(PtrArray, i, active) {
+        const iFeedJob *job = i.ptr;
+        timeout = iMin(timeout, requestTimeoutSeconds_FeedJob_ - elapsedSeconds_Time(&job->startTime));
+    }
+    lock_Mutex(d->mtx);
+    if (!d->isWorkerWoken && !d->stopWorker && timeout > 0.0) {
+        iTime until;
+        initTimeout_Time(&until, timeout + 0.01);
+        waitTimeout_Condition(&d->wakeWorker, d->mtx, &until);
+    }
+    d->isWorkerWoken = iFalse;
+    unlock_Mutex(d->mtx);
+}
+
 static iThreadResult fetch_Feeds_(iThread *thread) {
     iFeeds *d = &feeds_;
     iUnused(thread);
-    iFeedJob *work[maxConcurrentRequests_Feeds]; /* We'll do a couple of concurrent requests. */
-    iZap(work);
+    iPtrArray active; /* We'll do a couple of concurrent requests. */
+    init_PtrArray(&active);
     iBool gotNew = iFalse;
+    setThreadName_Profiler("Feeds");
     postCommand_App("feeds.update.started");
     const size_t totalJobs = size_PtrArray(&d->jobs);
     int numFinishedJobs = 0;
     while (!d->stopWorker) {
-        /* Start new jobs. */
-        iForIndices(i, work) {
-            if (!work[i]) {
-                work[i] = startNextJob_Feeds_(d);
-            }
-        }
-        sleep_Thread(0.5); /* TODO: wait on a Condition so we can exit quickly */
-        if (d->stopWorker) break;
-        size_t ongoing = 0;
-        iBool doNotify = iFalse;
-        iForIndices(i, work) {
-            if (work[i]) {
-                if (isFinished_GmRequest(work[i]->request)) {
-                    if (parseResult_FeedJob_(work[i])) {
+        startJobs_Feeds_(d, &active);
+        iBool doNotify   = iFalse;
+        iBool isRequeued = iFalse;
+        iForEach(PtrArray, i, &active) {
+            iFeedJob *job = i.ptr;
+            if (isFinished_GmRequest(job->request)) {
+                iBool isDone = iTrue;
+                if (!isSourceUnchanged_Feeds_(d, job)) {
+                    beginZone_Profiler("parseResult_FeedJob_");
+                    isDone = parseResult_FeedJob_(job);
+                    endZone_Profiler();
+                    if (isDone) {
+                        beginZone_Profiler("updateEntries_Feeds_");
                         gotNew |= updateEntries_Feeds_(
-                            d, work[i]->checkHeadings, work[i]->bookmarkId, &work[i]->results);
-                        delete_FeedJob(work[i]);
-                        work[i] = NULL;
-                        numFinishedJobs++;
-                        doNotify = iTrue;
-                    }
-                    else {
-                        ongoing++;
+                            d, job->checkHeadings, job->bookmarkId, &job->results);
+                        endZone_Profiler();
                     }
                 }
-                else if (isTimedOut_FeedJob_(work[i])) {
-                    /* Maybe we'll get it next time! */
-                    delete_FeedJob(work[i]);
-                    work[i] = NULL;
+                if (isDone) {
+                    delete_FeedJob(job);
+                    remove_PtrArrayIterator(&i);
                     numFinishedJobs++;
                     doNotify = iTrue;
                 }
-                else {
-                    ongoing++;
+                else if (!job->request) {
+                    /* Redirected; will be started when the host has capacity. */
+                    remove_PtrArrayIterator(&i);
+                    pushFront_PtrArray(&d->jobs, job);
+                    isRequeued = iTrue;
                 }
-                /* TODO: abort job if it takes too long (> 15 seconds?) */
+            }
+            else if (isTimedOut_FeedJob_(job)) {
+                /* Maybe we'll get it next time! */
+                delete_FeedJob(job);
+                remove_PtrArrayIterator(&i);
+                numFinishedJobs++;
+                doNotify = iTrue;
             }
         }
         if (doNotify) {
             postCommandf_App("feeds.update.progress arg:%d total:%zu", numFinishedJobs, totalJobs);
         }
         /* Stop if everything has finished. */
-        if (ongoing == 0 && isEmpty_PtrArray(&d->jobs)) {
+        if (isEmpty_PtrArray(&active) && isEmpty_PtrArray(&d->jobs)) {
             break;
         }
-    }
-    if (d->stopWorker) {
-        iForIndices(i, work) {
-            if (work[i]) {
-                cancel_GmRequest(work[i]->request);
-            }
+        if (doNotify || isRequeued) {
+            continue; /* there may be room for more jobs */
         }
+        waitForRequests_Feeds_(d, &active);
     }
-    initCurrent_Time(&d->lastRefreshedAt);
+    iForEach(PtrArray, i, &active) {
+        iFeedJob *job = i.ptr;
+        cancel_GmRequest(job->request);
+        delete_FeedJob(job);
+    }
+    deinit_PtrArray(&active);
+    iGuardMutex(d->mtx, {
+        initCurrent_Time(&d->lastRefreshedAt);
+        writeTime_Feeds_(stream_Buffer(d->journal), refreshed_FeedsRecordType, &d->lastRefreshedAt);
+        d->numFileRecords++;
+    });
+    beginZone_Profiler("save_Feeds_");
     save_Feeds_(d);
+    endZone_Profiler();
     /* Check if there are visited URLs marked as Kept that can be cleared because they are no
        longer present in the database. */ {
         iStringSet *knownEntryUrls = new_StringSet();
@@ -548,6 +857,7 @@ static iThreadResult fetch_Feeds_(iThread *thread) {
 }
 
 static iBool startWorker_Feeds_(iFeeds *d) {
+    waitForLoad_Feeds_(d);
     if (d->worker) {
         return iFalse; /* Refresh is already ongoing. */
     }
@@ -566,6 +876,7 @@ static iBool startWorker_Feeds_(iFeeds *d) {
     if (!isEmpty_Array(&d->jobs)) {
         d->worker = new_Thread(fetch_Feeds_);
         d->stopWorker = iFalse;
+        d->isWorkerWoken = iFalse;
         start_Thread(d->worker);
         return iTrue;
     }
@@ -587,7 +898,10 @@ static void removeRefreshTimer_Feeds_(iFeeds *d) {
 
 static void stopWorker_Feeds_(iFeeds *d) {
     if (d->worker) {
+        lock_Mutex(d->mtx);
         d->stopWorker = iTrue;
+        signal_Condition(&d->wakeWorker);
+        unlock_Mutex(d->mtx);
         join_Thread(d->worker);
         iReleasePtr(&d->worker);
     }
@@ -615,9 +929,8 @@ struct Impl_FeedHashNode {
     uint32_t  bookmarkId;
 };
 
-static void load_Feeds_(iFeeds *d) {
-    /* TODO: If there are lots of entries, it would make sense to load async. */
-    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, feedsFilename_Feeds_)));
+static void loadText_Feeds_(iFeeds *d) {
+    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, textFileName_Feeds_)));
     if (open_File(f, read_FileMode | text_FileMode)) {
         iBlock * src     = readAll_File(f);
         iRangecc line    = iNullRange;
@@ -721,29 +1034,207 @@ static void load_Feeds_(iFeeds *d) {
     iRelease(f);
 }
 
+static uint32_t feedBookmarkId_(iHash *feeds, uint32_t feedId) {
+    const iFeedHashNode *node = (const iFeedHashNode *) value_Hash(feeds, feedId);
+    return node ? node->bookmarkId : 0;
+}
+
+static iBool loadBinary_Feeds_(iFeeds *d, const iBlock *data) {
+    iBuffer *buf = new_Buffer();
+    open_Buffer(buf, data);
+    iStream *ins = stream_Buffer(buf);
+    char magic[4] = { 0 };
+    readData_Stream(ins, 4, magic);
+    if (memcmp(magic, magic_Feeds_, 4) || readU32_Stream(ins) > latest_FeedsFileVersion) {
+        iRelease(buf);
+        return iFalse;
+    }
+    d->snapshotTime.ts.tv_sec = readU64_Stream(ins);
+    iHash   *feeds  = new_Hash(); /* mapping from IDs to feed bookmarks */
+    iString *url    = new_String();
+    size_t   numRecords = 0;
+    while (size_Stream(ins) - pos_Stream(ins) >= 8) {
+        const uint32_t type = readU32_Stream(ins);
+        const size_t   size = readU32_Stream(ins);
+        const size_t   next = pos_Stream(ins) + size;
+        if (next > size_Stream(ins)) {
+            break; /* truncated */
+        }
+        numRecords++;
+        switch (type) {
+            case refreshed_FeedsRecordType:
+                d->lastRefreshedAt.ts.tv_sec = readU64_Stream(ins);
+                break;
+            case feed_FeedsRecordType: {
+                const uint32_t feedId = readU32_Stream(ins);
+                deserialize_String(url, ins);
+                iFeedHashNode *node = (iFeedHashNode *) value_Hash(feeds, feedId);
+                if (!node) {
+                    node = iMalloc(FeedHashNode);
+                    node->node.key = feedId;
+                    insert_Hash(feeds, &node->node);
+                }
+                node->bookmarkId = findUrl_Bookmarks(bookmarks_App(), url);
+                if (node->bookmarkId) {
+                    insert_IntSet(&d->previouslyCheckedFeeds, node->bookmarkId);
+                }
+                break;
+            }
+            case entry_FeedsRecordType: {
+                const uint32_t bookmarkId = feedBookmarkId_(feeds, readU32_Stream(ins));
+                iFeedEntry *entry = new_FeedEntry();
+                entry->bookmarkId           = bookmarkId;
+                entry->posted.ts.tv_sec     = readU64_Stream(ins);
+                entry->discovered.ts.tv_sec = readU64_Stream(ins);
+                deserialize_String(&entry->url, ins);
+                deserialize_String(&entry->title, ins);
+                entry->isHeading = isHeadingEntry_FeedEntry_(entry);
+                size_t pos;
+                if (!bookmarkId) {
+                    delete_FeedEntry(entry);
+                }
+                else if (locate_SortedArray(&d->entries, &entry, &pos)) {
+                    iFeedEntry **existing = (iFeedEntry **) at_SortedArray(&d->entries, pos);
+                    delete_FeedEntry(*existing);
+                    *existing = entry;
+                }
+                else {
+                    insert_SortedArray(&d->entries, &entry);
+                }
+                break;
+            }
+            case removeEntry_FeedsRecordType: {
+                iFeedEntry key = { .bookmarkId = feedBookmarkId_(feeds, readU32_Stream(ins)) };
+                deserialize_String(url, ins);
+                key.url = *url;
+                const iFeedEntry *keyPtr = &key;
+                size_t pos;
+                if (key.bookmarkId && locate_SortedArray(&d->entries, &keyPtr, &pos)) {
+                    delete_FeedEntry(*(iFeedEntry **) at_SortedArray(&d->entries, pos));
+                    remove_SortedArray(&d->entries, pos);
+                }
+                break;
+            }
+            case removeFeed_FeedsRecordType: {
+                const uint32_t bookmarkId = feedBookmarkId_(feeds, readU32_Stream(ins));
+                iForEach(Array, i, &d->entries.values) {
+                    iFeedEntry **entry = i.value;
+                    if (bookmarkId && (*entry)->bookmarkId == bookmarkId) {
+                        delete_FeedEntry(*entry);
+                        remove_ArrayIterator(&i);
+                    }
+                }
+                break;
+            }
+            default:
+                break; /* unknown records are skipped */
+        }
+        seek_Stream(ins, next);
+    }
+    d->numFileRecords = numRecords;
+    iForEach(Hash, i, feeds) {
+        free(i.value);
+    }
+    delete_Hash(feeds);
+    delete_String(url);
+    iRelease(buf);
+    return iTrue;
+}
+
+static void startRefreshTimer_Feeds_(iFeeds *d) {
+    if (d->refreshInterval && isValid_Time(&d->lastRefreshedAt)) {
+        const int elapsedMs  = (int) (elapsedSeconds_Time(&d->lastRefreshedAt) * 1000);
+        const int intervalMs = iMax(1000, d->refreshInterval - elapsedMs);
+        d->refreshTimer = SDL_AddTimer(intervalMs, refresh_Feeds_, NULL);
+    }
+}
+
+static iThreadResult load_Feeds_(iThread *thread) {
+    /* Nothing else accesses the entries until loading has finished. */
+    iFeeds *d = &feeds_;
+    iUnused(thread);
+    setThreadName_Profiler("FeedsLoader");
+    beginZone_Profiler("load_Feeds_");
+    iBeginCollect();
+    const iString *path = collect_String(concatCStr_Path(&d->saveDir, fileName_Feeds_));
+    if (fileExistsCStr_FileInfo(cstr_String(path))) {
+        iFile *f = new_File(path);
+        if (open_File(f, readOnly_FileMode)) {
+            iBlock *data = readAll_File(f);
+            if (!loadBinary_Feeds_(d, data)) {
+                fprintf(stderr, "[Feeds] %s has an unknown format\n", cstr_String(path));
+                d->needSnapshot = iTrue;
+            }
+            delete_Block(data);
+        }
+        iRelease(f);
+    }
+    else {
+        /* Fall back to the older text format. It will be replaced with a snapshot. */
+        loadText_Feeds_(d);
+        d->needSnapshot = iTrue;
+    }
+    iEndCollect();
+    endZone_Profiler();
+    lock_Mutex(d->mtx);
+    startRefreshTimer_Feeds_(d);
+    d->isLoaded = iTrue;
+    signal_Condition(&d->loaded);
+    unlock_Mutex(d->mtx);
+    return 0;
+}
+
 /*----------------------------------------------------------------------------------------------*/
 
 void init_Feeds(const char *saveDir) {
     iFeeds *d = &feeds_;
     d->refreshTimer = 0;
     d->mtx = new_Mutex();
+    d->fileMtx = new_Mutex();
     initCStr_String(&d->saveDir, saveDir);
     init_IntSet(&d->previouslyCheckedFeeds);
     iZap(d->lastRefreshedAt);
     d->worker = NULL;
+    d->stopWorker = iFalse;
+    init_Condition(&d->wakeWorker);
+    d->isWorkerWoken = iFalse;
     init_PtrArray(&d->jobs);
+    init_Hash(&d->sourceHashes);
     init_SortedArray(&d->entries, sizeof(iFeedEntry *), cmp_FeedEntryPtr_);
-    load_Feeds_(d);
-    setRefreshInterval_Feeds(prefs_App()->feedInterval);
+    d->journal = new_Buffer();
+    openEmpty_Buffer(d->journal);
+    init_IntSet(&d->journaledFeeds);
+    d->numFileRecords = 0;
+    iZap(d->snapshotTime);
+    d->needSnapshot = iFalse;
+    d->refreshInterval = prefs_App()->feedInterval * 1000;
+    d->maxRequests        = prefs_App()->maxFeedRequests;
+    d->maxRequestsPerHost = prefs_App()->maxFeedRequestsPerHost;
+    init_Condition(&d->loaded);
+    d->isLoaded = iFalse;
+    d->loader = new_Thread(load_Feeds_);
+    start_Thread(d->loader);
 }
 
 void deinit_Feeds(void) {
     iFeeds *d = &feeds_;
+    join_Thread(d->loader);
+    iReleasePtr(&d->loader);
     removeRefreshTimer_Feeds_(d);
     stopWorker_Feeds_(d);
+    save_Feeds_(d);
     iAssert(isEmpty_PtrArray(&d->jobs));
     deinit_PtrArray(&d->jobs);
+    iForEach(Hash, h, &d->sourceHashes) {
+        free(h.value);
+    }
+    deinit_Hash(&d->sourceHashes);
+    deinit_Condition(&d->wakeWorker);
+    deinit_Condition(&d->loaded);
+    iRelease(d->journal);
+    deinit_IntSet(&d->journaledFeeds);
     deinit_String(&d->saveDir);
+    delete_Mutex(d->fileMtx);
     delete_Mutex(d->mtx);
     iForEach(Array, i, &d->entries.values) {
         iFeedEntry **entry = i.value;
@@ -760,13 +1251,28 @@ void refresh_Feeds(void) {
 void setRefreshInterval_Feeds(enum iFeedInterval feedInterval) {
     iFeeds *d = &feeds_;
     if (isInitialized_Feeds_(d)) {
+        waitForLoad_Feeds_(d);
         removeRefreshTimer_Feeds_(d);
         d->refreshInterval = feedInterval * 1000;
-        if (d->refreshInterval && isValid_Time(&d->lastRefreshedAt)) {
-            const int elapsedMs  = (int) (elapsedSeconds_Time(&d->lastRefreshedAt) * 1000);
-            const int intervalMs = iMax(1000, d->refreshInterval - elapsedMs);
-            d->refreshTimer = SDL_AddTimer(intervalMs, refresh_Feeds_, NULL);
-        }
+        startRefreshTimer_Feeds_(d);
+    }
+}
+
+void setMaxRequests_Feeds(int maxRequests, int maxRequestsPerHost) {
+    iFeeds *d = &feeds_;
+    if (isInitialized_Feeds_(d)) {
+        iGuardMutex(d->mtx, {
+            d->maxRequests        = maxRequests;
+            d->maxRequestsPerHost = maxRequestsPerHost;
+        });
+    }
+}
+
+void saveChanges_Feeds(void) {
+    iFeeds *d = &feeds_;
+    if (isInitialized_Feeds_(d)) {
+        waitForLoad_Feeds_(d);
+        save_Feeds_(d);
     }
 }
 
@@ -776,6 +1282,9 @@ void refreshFinished_Feeds(void) {
 
 void removeEntries_Feeds(uint32_t feedBookmarkId) {
     iFeeds *d = &feeds_;
+    waitForLoad_Feeds_(d);
+    forgetSourceHash_Feeds_(d, feedBookmarkId);
+    lock_Mutex(d->mtx);
     iForEach(Array, i, &d->entries.values) {
         iFeedEntry **entry = i.value;
         if ((*entry)->bookmarkId == feedBookmarkId) {
@@ -783,6 +1292,16 @@ void removeEntries_Feeds(uint32_t feedBookmarkId) {
             remove_ArrayIterator(&i);
         }
     }
+    if (journalFeed_Feeds_(d, feedBookmarkId)) {
+        iBuffer *buf = new_Buffer();
+        openEmpty_Buffer(buf);
+        writeU32_Stream(stream_Buffer(buf), feedBookmarkId);
+        writeRecord_Feeds_(stream_Buffer(d->journal), removeFeed_FeedsRecordType, buf);
+        d->numFileRecords++;
+        iRelease(buf);
+    }
+    unlock_Mutex(d->mtx);
+    postCommand_App("feeds.changed"); /* the journal is saved later, with other changes */
 }
 
 void markEntryAsRead_Feeds(uint32_t feedBookmarkId, const iString *entryUrl, iBool isRead) {
@@ -790,6 +1309,7 @@ void markEntryAsRead_Feeds(uint32_t feedBookmarkId, const iString *entryUrl, iBo
     if (bm) {
         iFeeds *d = &feeds_;
         iVisited *vis = visited_App();
+        waitForLoad_Feeds_(d);
         if (bm->flags & headings_BookmarkFlag) {
             iTime oneSecond;
             initSeconds_Time(&oneSecond, 1.0);
@@ -832,6 +1352,7 @@ void markEntryAsRead_Feeds(uint32_t feedBookmarkId, const iString *entryUrl, iBo
 iBool isUnreadEntry_Feeds(uint32_t feedBookmarkId, const iString *entryUrl) {
     iBool isUnread = iFalse;
     iFeeds *d = &feeds_;
+    waitForLoad_Feeds_(d);
     lock_Mutex(d->mtx);
     iFeedEntry entry = { .url = *entryUrl, .bookmarkId = feedBookmarkId };
     iFeedEntry *entryPtr = &entry;
@@ -853,6 +1374,7 @@ static int cmpTimeDescending_FeedEntryPtr_(const void *a, const void *b) {
 
 const iPtrArray *listEntries_Feeds(void) {
     iFeeds *d = &feeds_;
+    waitForLoad_Feeds_(d);
     lock_Mutex(d->mtx);
     /* The worker will never delete feed entries so we can use the same ones. Just make a copy
        of the array in case the worker modifies it. */
@@ -883,6 +1405,7 @@ const iString *entryListPage_Feeds(void) {
     iFeeds *d = &feeds_;
     iString *src = collectNew_String();
     setCStr_String(src, translateCStr_Lang("# ${feeds.list.title}\n\n"));
+    waitForLoad_Feeds_(d);
     lock_Mutex(d->mtx);
     const iPtrArray *subs = listSubscriptions_();
     const int elapsed = elapsedSeconds_Time(&d->lastRefreshedAt) / 60;
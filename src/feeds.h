@@ -52,7 +52,9 @@ void    init_Feeds              (const char *saveDir);
 void    deinit_Feeds            (void);
 void    refresh_Feeds           (void);
 void    setRefreshInterval_Feeds(enum iFeedInterval feedInterval);
+void    setMaxRequests_Feeds    (int maxRequests, int maxRequestsPerHost); /* concurrent, during a refresh */
 void    refreshFinished_Feeds   (void); /* called on "feeds.refresh.finished" */
+void    saveChanges_Feeds       (void); /* writes journaled changes to the file */
 void    removeEntries_Feeds     (uint32_t feedBookmarkId);
 void    markEntryAsRead_Feeds   (uint32_t feedBookmarkId, const iString *entryUrl, iBool isRead);
 iBool   isUnreadEntry_Feeds     (uint32_t feedBookmarkId, const iString *entryUrl);
@@ -23,6 +23,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "fontpack.h"
 #include "resources.h"
 #include "ui/window.h"
+#include "gmdocument.h"
 #include "gmrequest.h"
 #include "app.h"
 
@@ -556,6 +557,7 @@ iBool isReadOnly_FontPack(const iFontPack *d) {
 /*----------------------------------------------------------------------------------------------*/
 
 static void unloadFonts_Fonts_(iFonts *d) {
+    waitForBackgroundLayouts_GmDocument(); /* they may be using the fonts */
     iForEach(PtrArray, i, &d->packs) {
         iFontPack *pack = i.ptr;
         delete_FontPack(pack);
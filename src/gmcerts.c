@@ -25,6 +25,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "defs.h"
 #include "app.h"
 
+#include <the_Foundation/atomic.h>
+#include <the_Foundation/buffer.h>
 #include <the_Foundation/file.h>
 #include <the_Foundation/fileinfo.h>
 #include <the_Foundation/mutex.h>
@@ -37,6 +39,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <ctype.h>
 
 static const char *trustedFilename_GmCerts_   = "trusted.2.txt";
+static const char *tempTrustedFilename_GmCerts_ = "trusted.2.txt.tmp";
 static const char *identsDir_GmCerts_         = "idents";
 static const char *oldIdentsFilename_GmCerts_ = "idents.binary";
 static const char *identsFilename_GmCerts_    = "idents.lgr";
@@ -66,6 +69,10 @@ iDefineClass(TrustEntry)
 
 /*----------------------------------------------------------------------------------------------*/
 
+/* Incremented whenever the use-URLs of any identity change or an identity is destroyed,
+   so GmCerts knows when its URL index is out of date. */
+static iAtomicInt useUrlsGeneration_GmIdentity_;
+
 static int cmpUrl_GmIdentity_(const iString *a, const iString *b) {
     return cmpStringCase_String(a, b);
 }
@@ -80,6 +87,7 @@ void init_GmIdentity(iGmIdentity *d) {
 }
 
 void deinit_GmIdentity(iGmIdentity *d) {
+    add_Atomic(&useUrlsGeneration_GmIdentity_, 1);
     iRelease(d->useUrls);
     deinit_String(&d->notes);
     delete_TlsCertificate(d->cert);
@@ -233,6 +241,7 @@ void setUse_GmIdentity(iGmIdentity *d, const iString *url, iBool use) {
     if (use && isUsedOn_GmIdentity(d, url)) {
         return; /* Redudant. */
     }
+    add_Atomic(&useUrlsGeneration_GmIdentity_, 1);
     if (use) {
         /* Remove all use-URLs that become redundant by this newly added URL. */
         /* TODO: StringSet could have a non-const iterator. */
@@ -261,6 +270,7 @@ void setUse_GmIdentity(iGmIdentity *d, const iString *url, iBool use) {
 }
 
 void clearUse_GmIdentity(iGmIdentity *d) {
+    add_Atomic(&useUrlsGeneration_GmIdentity_, 1);
     clear_StringSet(d->useUrls);
 }
 
@@ -302,11 +312,76 @@ iDefineTypeConstruction(GmIdentity)
 
 /*-----------------------------------------------------------------------------------------------*/
 
+/* Case-insensitive prefix tree of all the identities' use-URLs. Nodes are kept in an array;
+   the root is at index zero, so a zero child/sibling index means there is none. */
+iDeclareType(UrlTrieNode)
+
+struct Impl_UrlTrieNode {
+    uint32_t firstChild;
+    uint32_t nextSibling;
+    const iGmIdentity *ident; /* a use-URL ends here */
+    char ch;
+};
+
+static uint32_t findChild_UrlTrie_(const iArray *d, uint32_t parent, char ch) {
+    ch = tolower((unsigned char) ch);
+    for (uint32_t i = ((const iUrlTrieNode *) constAt_Array(d, parent))->firstChild; i; ) {
+        const iUrlTrieNode *node = constAt_Array(d, i);
+        if (node->ch == ch) {
+            return i;
+        }
+        i = node->nextSibling;
+    }
+    return 0;
+}
+
+static void insert_UrlTrie_(iArray *d, const iString *url, const iGmIdentity *ident) {
+    uint32_t node = 0;
+    for (const char *ch = constBegin_String(url); ch != constEnd_String(url); ch++) {
+        uint32_t child = findChild_UrlTrie_(d, node, *ch);
+        if (!child) {
+            iUrlTrieNode *parent = at_Array(d, node);
+            const iUrlTrieNode newNode = { .nextSibling = parent->firstChild,
+                                           .ch          = tolower((unsigned char) *ch) };
+            child = parent->firstChild = (uint32_t) size_Array(d);
+            pushBack_Array(d, &newNode);
+        }
+        node = child;
+    }
+    iUrlTrieNode *end = at_Array(d, node);
+    if (!end->ident) {
+        end->ident = ident; /* the first identity wins if the same URL is used by many */
+    }
+}
+
+/* Returns the identity of the longest use-URL that is a prefix of the concatenated ranges. */
+static const iGmIdentity *findLongest_UrlTrie_(const iArray *d, const iRangecc *url, size_t count) {
+    const iGmIdentity *found = ((const iUrlTrieNode *) constAt_Array(d, 0))->ident;
+    uint32_t node = 0;
+    for (size_t i = 0; i < count; i++) {
+        for (const char *ch = url[i].start; ch != url[i].end; ch++) {
+            if ((node = findChild_UrlTrie_(d, node, *ch)) == 0) {
+                return found;
+            }
+            const iGmIdentity *ident = ((const iUrlTrieNode *) constAt_Array(d, node))->ident;
+            if (ident) {
+                found = ident;
+            }
+        }
+    }
+    return found;
+}
+
 struct Impl_GmCerts {
     iMutex *mtx;
     iString saveDir;
     iStringHash *trusted;
+    iString trustJournal;     /* changed entries not yet appended to the file */
+    size_t numTrustLines;     /* lines in the trust file, including superseded ones */
+    iBool needTrustSnapshot;  /* file must be fully rewritten at next save */
     iPtrArray idents;
+    iArray urlTrie; /* UrlTrieNode */
+    int urlTrieGeneration;
 };
 
 static const char *magicIdMeta_GmCerts_   = "lgL2";
@@ -314,17 +389,23 @@ static const char *magicIdentity_GmCerts_ = "iden";
 
 iDefineTypeConstructionArgs(GmCerts, (const char *saveDir), saveDir)
 
+static void formatTrustLine_(iString *line, const iString *key, const iTrustEntry *trust) {
+    iString *fp = hexEncode_Block(&trust->fingerprint);
+    appendFormat_String(line,
+                        "%s %llu %s\n",
+                        cstr_String(key),
+                        (unsigned long long) integralSeconds_Time(&trust->validUntil),
+                        cstr_String(fp));
+    delete_String(fp);
+}
+
 void serialize_GmCerts(const iGmCerts *d, iStream *trusted, iStream *identsMeta) {
     if (trusted) {
         iString line;
         init_String(&line);
         iConstForEach(StringHash, i, d->trusted) {
-            const iTrustEntry *trust = value_StringHashNode(i.value);
-            format_String(&line,
-                          "%s %llu %s\n",
-                          cstr_String(key_StringHashConstIterator(&i)),
-                          (unsigned long long) integralSeconds_Time(&trust->validUntil),
-                          cstrCollect_String(hexEncode_Block(&trust->fingerprint)));
+            clear_String(&line);
+            formatTrustLine_(&line, key_StringHashConstIterator(&i), value_StringHashNode(i.value));
             write_Stream(trusted, &line.chars);
         }
         deinit_String(&line);
@@ -354,14 +435,71 @@ void saveIdentities_GmCerts(const iGmCerts *d) {
                    cstr_String(tempPath));
 }
 
-static void save_GmCerts_(const iGmCerts *d) {
+static void journalTrust_GmCerts_(iGmCerts *d, const iString *key, const iTrustEntry *trust) {
+    /* Called with the mutex locked. The file is written later in the main thread. */
+    const iBool wasEmpty = isEmpty_String(&d->trustJournal);
+    formatTrustLine_(&d->trustJournal, key, trust);
+    if (wasEmpty) {
+        postCommand_App("certs.trust.changed");
+    }
+}
+
+static iBool isTrustCompactionNeeded_GmCerts_(const iGmCerts *d, size_t numNewLines) {
+    /* Each change to an entry leaves an obsolete line behind. */
+    return d->needTrustSnapshot ||
+           d->numTrustLines + numNewLines > 2 * size_StringHash(d->trusted) + 100;
+}
+
+void saveTrusted_GmCerts(iGmCerts *d) {
+    /* Only the in-memory state is accessed while locked; file I/O happens afterwards so that
+       certificate checks in other threads are not blocked by it. */
+    iBool    isSnapshot = iFalse;
+    iString *data       = new_String();
+    lock_Mutex(d->mtx);
+    if (!isEmpty_String(&d->trustJournal) || d->needTrustSnapshot) {
+        size_t numLines = 0;
+        for (const char *ch = cstr_String(&d->trustJournal); *ch; ch++) {
+            numLines += (*ch == '\n');
+        }
+        if (isTrustCompactionNeeded_GmCerts_(d, numLines)) {
+            iBuffer *buf = new_Buffer();
+            openEmpty_Buffer(buf);
+            serialize_GmCerts(d, stream_Buffer(buf), NULL);
+            setBlock_String(data, data_Buffer(buf));
+            iRelease(buf);
+            d->numTrustLines     = size_StringHash(d->trusted);
+            d->needTrustSnapshot = iFalse;
+            isSnapshot           = iTrue;
+        }
+        else {
+            set_String(data, &d->trustJournal);
+            d->numTrustLines += numLines;
+        }
+        clear_String(&d->trustJournal);
+    }
+    unlock_Mutex(d->mtx);
     iBeginCollect();
-    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, trustedFilename_GmCerts_)));
-    if (open_File(f, writeOnly_FileMode | text_FileMode)) {
-        serialize_GmCerts(d, stream_File(f), NULL);
+    const iString *path = collect_String(concatCStr_Path(&d->saveDir, trustedFilename_GmCerts_));
+    if (isSnapshot) {
+        const iString *tempPath =
+            collect_String(concatCStr_Path(&d->saveDir, tempTrustedFilename_GmCerts_));
+        iFile *f = new_File(tempPath);
+        if (open_File(f, writeOnly_FileMode | text_FileMode)) {
+            write_File(f, &data->chars);
+            close_File(f);
+            commitFile_App(cstr_String(path), cstr_String(tempPath));
+        }
+        iRelease(f);
+    }
+    else if (!isEmpty_String(data)) {
+        iFile *f = new_File(path);
+        if (open_File(f, append_FileMode | text_FileMode)) {
+            write_File(f, &data->chars);
+        }
+        iRelease(f);
     }
-    iRelease(f);
     iEndCollect();
+    delete_String(data);
 }
 
 static void loadIdentityFromCertificate_GmCerts_(iGmCerts *d, const iString *crtPath) {
@@ -496,15 +634,18 @@ iGmIdentity *findIdentityFuzzy_GmCerts(iGmCerts *d, const iString *fuzzy) {
     return found;
 }
 
-void deserializeTrusted_GmCerts(iGmCerts *d, iStream *ins, enum iImportMethod method) {
-    iRegExp *      pattern = new_RegExp("([^\\s]+) ([0-9]+) ([a-z0-9]+)", 0);
-    const iRangecc src     = range_Block(collect_Block(readAll_Stream(ins)));
-    iRangecc       line    = iNullRange;
+static size_t deserializeTrusted_GmCerts_(iGmCerts *d, iStream *ins, enum iImportMethod method) {
+    iRegExp *      pattern  = new_RegExp("([^\\s]+) ([0-9]+) ([a-z0-9]+)", 0);
+    const iRangecc src      = range_Block(collect_Block(readAll_Stream(ins)));
+    iRangecc       line     = iNullRange;
+    size_t         numLines = 0;
     lock_Mutex(d->mtx);
     while (nextSplit_Rangecc(src, "\n", &line)) {
         iRegExpMatch m;
         init_RegExpMatch(&m);
         if (matchRange_RegExp(pattern, line, &m)) {
+            /* Later lines of the journal override earlier ones. */
+            numLines++;
             iBeginCollect();
             const iRangecc key   = capturedRange_RegExpMatch(&m, 1);
             const iRangecc until = capturedRange_RegExpMatch(&m, 2);
@@ -527,12 +668,21 @@ void deserializeTrusted_GmCerts(iGmCerts *d, iStream *ins, enum iImportMethod me
     }
     unlock_Mutex(d->mtx);
     iRelease(pattern);
+    return numLines;
+}
+
+void deserializeTrusted_GmCerts(iGmCerts *d, iStream *ins, enum iImportMethod method) {
+    deserializeTrusted_GmCerts_(d, ins, method);
+    iGuardMutex(d->mtx, {
+        d->needTrustSnapshot = iTrue;
+    });
+    postCommand_App("certs.trust.changed");
 }
 
 static void load_GmCerts_(iGmCerts *d) {
     iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, trustedFilename_GmCerts_)));
     if (open_File(f, readOnly_FileMode | text_FileMode)) {
-        deserializeTrusted_GmCerts(d, stream_File(f), all_ImportMethod);
+        d->numTrustLines = deserializeTrusted_GmCerts_(d, stream_File(f), all_ImportMethod);
     }
     iRelease(f);
     loadIdentities_GmCerts_(d);
@@ -563,20 +713,28 @@ void init_GmCerts(iGmCerts *d, const char *saveDir) {
     d->mtx = new_Mutex();
     initCStr_String(&d->saveDir, saveDir);
     d->trusted = new_StringHash();
+    init_String(&d->trustJournal);
+    d->numTrustLines = 0;
+    d->needTrustSnapshot = iFalse;
     init_PtrArray(&d->idents);
+    init_Array(&d->urlTrie, sizeof(iUrlTrieNode));
+    d->urlTrieGeneration = value_Atomic(&useUrlsGeneration_GmIdentity_) - 1;
     load_GmCerts_(d);
     setVerifyFunc_TlsRequest(verify_GmCerts_);
 }
 
 void deinit_GmCerts(iGmCerts *d) {
     setVerifyFunc_TlsRequest(NULL);
+    saveTrusted_GmCerts(d);
     iGuardMutex(d->mtx, {
         saveIdentities_GmCerts(d);
         iForEach(PtrArray, i, &d->idents) {
             delete_GmIdentity(i.ptr);
         }
         deinit_PtrArray(&d->idents);
+        deinit_Array(&d->urlTrie);
         iRelease(d->trusted);
+        deinit_String(&d->trustJournal);
         deinit_String(&d->saveDir);
     });
     delete_Mutex(d->mtx);
@@ -616,6 +774,19 @@ static void makeTrustKey_(iRangecc domain, uint16_t port, iString *key_out) {
     appendFormat_String(key_out, ";%u", port ? port : GEMINI_DEFAULT_PORT);
 }
 
+static void updateTrust_GmCerts_(iGmCerts *d, const iString *key, iTrustEntry *trust,
+                                 const iBlock *fingerprint, const iDate *validUntil) {
+    iTime until;
+    init_Time(&until, validUntil);
+    if (integralSeconds_Time(&until) == integralSeconds_Time(&trust->validUntil) &&
+        !cmp_Block(fingerprint, &trust->fingerprint)) {
+        return; /* nothing to save */
+    }
+    trust->validUntil = until;
+    set_Block(&trust->fingerprint, fingerprint);
+    journalTrust_GmCerts_(d, key, trust);
+}
+
 iBool checkTrust_GmCerts(iGmCerts *d, iRangecc domain, uint16_t port, const iTlsCertificate *cert) {
     if (!cert) {
         return iFalse;
@@ -651,18 +822,15 @@ iBool checkTrust_GmCerts(iGmCerts *d, iRangecc domain, uint16_t port, const iTls
         }
         /* Update the trusted cert. */
         if (ok) {
-            init_Time(&trust->validUntil, &until);
-            set_Block(&trust->fingerprint, fingerprint);
+            updateTrust_GmCerts_(d, &key, trust, fingerprint, &until);
         }
     }
     else {
         if (ok) {
-            insert_StringHash(d->trusted, &key, iClob(new_TrustEntry(fingerprint, &until)));
+            insert_StringHash(d->trusted, &key, iClob(trust = new_TrustEntry(fingerprint, &until)));
+            journalTrust_GmCerts_(d, &key, trust);
         }
     }
-    if (ok) {
-        save_GmCerts_(d);
-    }
     unlock_Mutex(d->mtx);
     delete_Block(fingerprint);
     deinit_String(&key);
@@ -677,13 +845,12 @@ void setTrusted_GmCerts(iGmCerts *d, iRangecc domain, uint16_t port, const iBloc
     lock_Mutex(d->mtx);
     iTrustEntry *trust = value_StringHash(d->trusted, &key);
     if (trust) {
-        init_Time(&trust->validUntil, validUntil);
-        set_Block(&trust->fingerprint, fingerprint);
+        updateTrust_GmCerts_(d, &key, trust, fingerprint, validUntil);
     }
     else {
         insert_StringHash(d->trusted, &key, iClob(trust = new_TrustEntry(fingerprint, validUntil)));
+        journalTrust_GmCerts_(d, &key, trust);
     }
-    save_GmCerts_(d);
     unlock_Mutex(d->mtx);
     deinit_String(&key);
 }
@@ -712,36 +879,60 @@ const iGmIdentity *constIdentity_GmCerts(const iGmCerts *d, unsigned int id) {
     return constAt_PtrArray(&d->idents, id);
 }
 
-const iGmIdentity *identityForUrl_GmCerts(const iGmCerts *d, const iString *url) {
-    if (isEmpty_String(url)) {
-        return NULL;
-    }
-    /* Get rid of the default port for consistent formatting. */ {
-        iString *clean = copy_String(url);
-        stripDefaultUrlPort_String(clean);
-        url = collect_String(clean);
+static void updateUrlTrie_GmCerts_(iGmCerts *d) {
+    /* Called with the mutex locked. */
+    const int gen = value_Atomic(&useUrlsGeneration_GmIdentity_);
+    if (d->urlTrieGeneration == gen) {
+        return;
     }
-    lock_Mutex(d->mtx);
-    const iGmIdentity *found = NULL;
+    clear_Array(&d->urlTrie);
+    pushBack_Array(&d->urlTrie, &(iUrlTrieNode){ 0 }); /* root */
     iConstForEach(PtrArray, i, &d->idents) {
         const iGmIdentity *ident = i.ptr;
         iConstForEach(StringSet, j, ident->useUrls) {
-            const iString *used = j.value;
-            if (startsWithCase_String(url, cstr_String(used))) {
-                found = ident;
-                goto done;
-            }
+            insert_UrlTrie_(&d->urlTrie, j.value, ident);
         }
     }
-done:
-    unlock_Mutex(d->mtx);
+    d->urlTrieGeneration = gen;
+}
+
+static size_t lookupRanges_(const iString *url, iBool asGemini, iRangecc *ranges_out) {
+    /* The default port is skipped for consistent formatting, like stripDefaultUrlPort_String()
+       would do, but without making a copy of the URL. */
+    iUrl parts;
+    init_Url(&parts, url);
+    iRangecc rest  = range_String(url);
+    size_t   count = 0;
+    if (asGemini) {
+        ranges_out[count++] = range_CStr("gemini");
+        rest.start = parts.scheme.end;
+    }
+    if ((asGemini || equalCase_Rangecc(parts.scheme, "gemini")) &&
+        equal_Rangecc(parts.port, GEMINI_DEFAULT_PORT_CSTR)) {
+        /* Always preceded by a colon. */
+        ranges_out[count++] = (iRangecc){ rest.start, parts.port.start - 1 };
+        ranges_out[count++] = (iRangecc){ parts.port.end, rest.end };
+    }
+    else {
+        ranges_out[count++] = rest;
+    }
+    return count;
+}
+
+const iGmIdentity *identityForUrl_GmCerts(const iGmCerts *d, const iString *url) {
+    if (isEmpty_String(url)) {
+        return NULL;
+    }
+    iRangecc ranges[3];
+    lock_Mutex(d->mtx);
+    updateUrlTrie_GmCerts_(iConstCast(iGmCerts *, d));
+    const iGmIdentity *found =
+        findLongest_UrlTrie_(&d->urlTrie, ranges, lookupRanges_(url, iFalse, ranges));
     /* Fallback: Titan URLs use the Gemini identities, if not otherwise specified. */
     if (!found && startsWithCase_String(url, "titan://")) {
-        iString *mod = copy_String(url);
-        remove_Block(&mod->chars, 0, 5);
-        prependCStr_String(mod, "gemini");
-        found = identityForUrl_GmCerts(d, collect_String(mod));
+        found = findLongest_UrlTrie_(&d->urlTrie, ranges, lookupRanges_(url, iTrue, ranges));
     }
+    unlock_Mutex(d->mtx);
     return found;
 }
 
@@ -813,6 +1004,7 @@ void deleteIdentity_GmCerts(iGmCerts *d, iGmIdentity *identity) {
         remove(format_CStr("%s.key", filename));
     }
     removeOne_PtrArray(&d->idents, identity);
+    add_Atomic(&useUrlsGeneration_GmIdentity_, 1); /* destroyed only later */
     collect_GmIdentity(identity);
     unlock_Mutex(d->mtx);
 }
@@ -69,6 +69,7 @@ iBool               checkTrust_GmCerts      (iGmCerts *, iRangecc domain, uint16
 void                setTrusted_GmCerts      (iGmCerts *, iRangecc domain, uint16_t port,
                                              const iBlock *fingerprint, const iDate *validUntil);
 iTime               domainValidUntil_GmCerts(const iGmCerts *, iRangecc domain, uint16_t port);
+void                saveTrusted_GmCerts     (iGmCerts *); /* appends changes since last save */
 
 /**
  * Create a new self-signed TLS client certificate for identifying the user.
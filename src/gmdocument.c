@@ -24,6 +24,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "gmtypesetter.h"
 #include "gmutil.h"
 #include "lang.h"
+#include "markdown.h"
 #include "ui/color.h"
 #include "ui/text.h"
 #include "ui/metrics.h"
@@ -33,15 +34,20 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "bookmarks.h"
 #include "app.h"
 #include "defs.h"
+#include "profiler.h"
 
+#include <the_Foundation/atomic.h>
 #include <the_Foundation/intset.h>
+#include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/ptrarray.h>
 #include <the_Foundation/regexp.h>
 #include <the_Foundation/stringarray.h>
 #include <the_Foundation/stringset.h>
+#include <the_Foundation/thread.h>
 
 #include <ctype.h>
+#include <limits.h>
 
 iBool isDark_GmDocumentTheme(enum iGmDocumentTheme d) {
     if (d == gray_GmDocumentTheme || d == oceanic_GmDocumentTheme || d == sepia_GmDocumentTheme) {
@@ -153,6 +159,46 @@ static uint32_t themeHash_(const iBlock *data) {
 
 /*----------------------------------------------------------------------------------------------*/
 
+iDeclareType(GmRunIndex)
+
+/* Running maxima of the run extents, one entry per run in layout order. Runs are mostly
+   but not strictly sorted vertically (e.g., decorations and icons may be offset from their
+   paragraph), so lookups need to find the first run whose extent reaches past a given
+   point. The maxima are monotonic, so that run can be found with a binary search. */
+struct Impl_GmRunIndex {
+    int         visBottom; /* bottom of `visBounds` */
+    int         hitBottom; /* bottom of `bounds` (non-decoration runs; at least top + 1) */
+    const char *textEnd;   /* end of `text` (non-decoration runs) */
+};
+
+iDeclareType(GmLayoutCheckpoint)
+
+/* Layout state at the start of a line outside preformatted blocks. When more source is
+   appended, the layout is rewound to the last checkpoint and continued from there. */
+struct Impl_GmLayoutCheckpoint {
+    size_t           sourcePos; /* start of the line in `source`; zero if layout must restart */
+    size_t           numRuns;
+    size_t           numLinks;
+    size_t           numHeadings;
+    size_t           numPreMeta;
+    size_t           numAuxText;
+    int              contentWidth;
+    iInt2            pos;
+    uint16_t         preId;
+    enum iGmLineType prevType;
+    enum iGmLineType prevNonBlankType;
+    iBool            isFirstText;
+    iBool            addQuoteIcon;
+    iBool            enableIndents;
+    iBool            followsBlank;
+    iBool            hasTitle;
+    iBool            hasFirstContentLine;
+};
+
+iDeclareType(GmLayoutJob)
+
+/*----------------------------------------------------------------------------------------------*/
+
 struct Impl_GmDocument {
     iObject object;
     enum iSourceFormat origFormat;
@@ -160,15 +206,20 @@ struct Impl_GmDocument {
     enum iSourceFormat format;
     iString   origSource; /* original (unnormalized) source */
     iString   source;     /* normalized (possibly converted) source */
+    size_t    importPos;  /* bytes of `origSource` already imported to `source` */
+    size_t    sourceReserve; /* bytes reserved for appending to `source` */
     iString   url;        /* for resolving relative links */
     iString   localHost;
     iInt2     size;
     int       contentWidth; /* some runs may extend past the requested width */
     int       outsideMargin;
     iArray    layout; /* contents of source, laid out in document space */
+    iArray    runIndex; /* GmRunIndex for each run in `layout` */
     iStringArray auxText; /* generated text that appears on the page but is not part of the source */
     iPtrArray links;
     iString   title; /* the first top-level title */
+    iString   firstContentLine; /* may be used as a title if one isn't specified */
+    iGmLayoutCheckpoint checkpoint;
     iArray    headings;
     iArray    preMeta; /* metadata about preformatted blocks */
     iGmTheme  theme;
@@ -178,6 +229,8 @@ struct Impl_GmDocument {
     iStringSet *openURLs; /* currently open URLs for highlighting links */
     int       warnings;
     iColor    palette[tmMax_ColorId]; /* copy of the color palette */
+    iGmLayoutJob *layoutJob;   /* layout being prepared in the background */
+    iAtomicInt   *abortLayout; /* set when a background layout is no longer needed */
     struct {
         iBool enableCommandLinks : 1; /* `about:command?` only allowed on selected pages */
         iBool isSpartan : 1;
@@ -185,12 +238,16 @@ struct Impl_GmDocument {
         iBool isLayoutInvalidated : 1;
         iBool isPaletteValid : 1;
         iBool isGopherMenu : 1;
+        iBool isAppendedSource : 1; /* `origSource` has been received via appendSource */
+        iBool isPartialSource : 1; /* more source will be appended; last line may be incomplete */
+        iBool isImportPreformat : 1; /* normalization state at `importPos` */
     } flags;
 };
 
 iDefineObjectConstruction(GmDocument)
 
 static void import_GmDocument_(iGmDocument *);
+static void cancelLayout_GmDocument_(iGmDocument *);
 
 static iBool isForcedMonospace_GmDocument_(const iGmDocument *d) {
     if (d->flags.isNex) {
@@ -708,6 +765,53 @@ static iBool typesetOneLine_RunTypesetter_(iWrapText *wrap, iRangecc wrapRange,
     return iTrue; /* continue to next wrapped line */
 }
 
+static void updateRunIndex_GmDocument_(iGmDocument *d, size_t firstRun) {
+    iGmRunIndex max = { INT_MIN, INT_MIN, NULL };
+    if (firstRun > 0) {
+        max = constValue_Array(&d->runIndex, firstRun - 1, iGmRunIndex);
+    }
+    resize_Array(&d->runIndex, size_Array(&d->layout));
+    iGmRunIndex *index = (iGmRunIndex *) data_Array(&d->runIndex) + firstRun;
+    for (size_t i = firstRun; i < size_Array(&d->layout); i++) {
+        const iGmRun *run = constAt_Array(&d->layout, i);
+        max.visBottom = iMax(max.visBottom, bottom_Rect(run->visBounds));
+        if (~run->flags & decoration_GmRunFlag) {
+            /* Empty runs must not be skipped when they are exactly at the lookup point. */
+            max.hitBottom = iMax(max.hitBottom,
+                                 iMax(bottom_Rect(run->bounds), top_Rect(run->bounds) + 1));
+            if (run->text.end > max.textEnd) {
+                max.textEnd = run->text.end;
+            }
+        }
+        *index++ = max;
+    }
+}
+
+enum iRunIndexKey {
+    visBottom_RunIndexKey,
+    hitBottom_RunIndexKey,
+};
+
+static size_t findFirstRunIndex_GmDocument_(const iGmDocument *d, enum iRunIndexKey key,
+                                            int minValue) {
+    /* Binary search for the first run whose indexed extent reaches `minValue`. */
+    const iGmRunIndex *index = constData_Array(&d->runIndex);
+    size_t first = 0;
+    size_t last  = size_Array(&d->runIndex);
+    while (first < last) {
+        const size_t mid   = first + (last - first) / 2;
+        const int    value = (key == visBottom_RunIndexKey ? index[mid].visBottom
+                                                           : index[mid].hitBottom);
+        if (value < minValue) {
+            first = mid + 1;
+        }
+        else {
+            last = mid;
+        }
+    }
+    return first;
+}
+
 static iBool isHRule_(iRangecc line) {
     /* This is used in Markdown sources. */
     if (!startsWith_Rangecc(line, "---")) {
@@ -723,7 +827,45 @@ static iBool isHRule_(iRangecc line) {
     return n >= 3;
 }
 
-static void doLayout_GmDocument_(iGmDocument *d) {
+static void rewindLayout_GmDocument_(iGmDocument *d, const iGmLayoutCheckpoint *cp) {
+    /* Discard everything that was laid out after the checkpoint. */
+    resize_Array(&d->layout, cp->numRuns);
+    resize_Array(&d->runIndex, cp->numRuns);
+    while (size_StringArray(&d->auxText) > cp->numAuxText) {
+        remove_StringArray(&d->auxText, size_StringArray(&d->auxText) - 1);
+    }
+    while (size_PtrArray(&d->links) > cp->numLinks) {
+        iGmLink *link;
+        take_PtrArray(&d->links, size_PtrArray(&d->links) - 1, (void **) &link);
+        delete_GmLink(link);
+    }
+    resize_Array(&d->headings, cp->numHeadings);
+    resize_Array(&d->preMeta, cp->numPreMeta);
+    if (!cp->hasTitle) {
+        clear_String(&d->title);
+    }
+    if (!cp->hasFirstContentLine) {
+        clear_String(&d->firstContentLine);
+    }
+    d->contentWidth = cp->contentWidth;
+}
+
+static void rebaseRunRanges_GmDocument_(iGmDocument *d, const iGmRun *oldLayout,
+                                        size_t numPreMeta) {
+    /* The layout array was reallocated while appending runs. */
+    const iGmRun *layout = constData_Array(&d->layout);
+    for (size_t i = 0; i < numPreMeta; i++) {
+        iGmPreMeta *meta = at_Array(&d->preMeta, i);
+        if (meta->runRange.start) {
+            meta->runRange.start = layout + ((intptr_t) meta->runRange.start -
+                                             (intptr_t) oldLayout) / (intptr_t) sizeof(iGmRun);
+            meta->runRange.end   = layout + ((intptr_t) meta->runRange.end -
+                                             (intptr_t) oldLayout) / (intptr_t) sizeof(iGmRun);
+        }
+    }
+}
+
+static void doLayout_GmDocument_(iGmDocument *d, iBool isAppending) {
     static iRegExp *ansiPattern_;
     if (!ansiPattern_) {
         ansiPattern_ = makeAnsiEscapePattern_Text(iTrue /* with ESC */);
@@ -737,6 +879,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
     const iBool   isExtremelyNarrow = d->size.x <= 60 * gap_Text * aspect_UI;
     const iBool   isFullWidthImages = (d->outsideMargin < 5 * gap_UI * aspect_UI);
 
+    cancelLayout_GmDocument_(d); /* this layout supersedes it */
     initTheme_GmDocument_(d);
     d->flags.isLayoutInvalidated = iFalse;
     /* TODO: Collect these parameters into a GmTheme. */
@@ -772,18 +915,35 @@ static void doLayout_GmDocument_(iGmDocument *d) {
     static const char *pointingFinger  = "\U0001f449";
     static const char *uploadArrow     = upload_Icon;
     static const char *image           = photo_Icon;
-    clear_Array(&d->layout);
-    clear_StringArray(&d->auxText);
-    clearLinks_GmDocument_(d);
-    clear_Array(&d->headings);
+    /* When appending, layout continues from the last checkpoint since the source up to that
+       point remains unchanged. */
+    const iGmLayoutCheckpoint resume      = d->checkpoint;
+    const iBool               isContinued = isAppending && resume.sourcePos > 0 &&
+                                            resume.sourcePos <= size_String(&d->source);
     const iArray *oldPreMeta = collect_Array(copy_Array(&d->preMeta)); /* remember fold states */
-    clear_Array(&d->preMeta);
-    clear_String(&d->title);
-    d->contentWidth = 0;
+    const iGmRun *oldLayout  = constData_Array(&d->layout);
+    if (isContinued) {
+        rewindLayout_GmDocument_(d, &resume);
+    }
+    else {
+        clear_Array(&d->layout);
+        clear_Array(&d->runIndex);
+        clear_StringArray(&d->auxText);
+        clearLinks_GmDocument_(d);
+        clear_Array(&d->headings);
+        clear_Array(&d->preMeta);
+        clear_String(&d->title);
+        clear_String(&d->firstContentLine);
+        iZap(d->checkpoint);
+        d->contentWidth = 0;
+    }
     if (d->size.x <= 0 || isEmpty_String(&d->source)) {
         return;
     }
-    updateOpenURLs_GmDocument_(d);
+    beginZone_Profiler("doLayout_GmDocument_");
+    if (!d->abortLayout) {
+        updateOpenURLs_GmDocument_(d); /* background layouts are given a list beforehand */
+    }
     const iRangecc   content       = range_String(&d->source);
     iRangecc         contentLine   = iNullRange;
     iInt2            pos           = zero_I2();
@@ -798,8 +958,6 @@ static void doLayout_GmDocument_(iGmDocument *d) {
     enum iGmLineType prevType      = text_GmLineType;
     enum iGmLineType prevNonBlankType = undefined_GmLineType;
     iBool            followsBlank  = iFalse;
-    iString          firstContentLine; /* may be used as a title if one isn't specified */
-    init_String(&firstContentLine);
     if (isGopher && !prefs->geminiStyledGopher) {
         isFirstText = iFalse;
     }
@@ -807,10 +965,50 @@ static void doLayout_GmDocument_(iGmDocument *d) {
         isPreformat = iTrue;
         isFirstText = iFalse;
     }
-    d->warnings &= ~missingGlyphs_GmDocumentWarning;
+    if (isContinued) {
+        /* The next split will begin at the checkpoint. */
+        contentLine      = (iRangecc){ content.start + resume.sourcePos - 1,
+                                       content.start + resume.sourcePos - 1 };
+        pos              = resume.pos;
+        isFirstText      = resume.isFirstText;
+        addQuoteIcon     = resume.addQuoteIcon;
+        preId            = resume.preId;
+        enableIndents    = resume.enableIndents;
+        prevType         = resume.prevType;
+        prevNonBlankType = resume.prevNonBlankType;
+        followsBlank     = resume.followsBlank;
+    }
+    else {
+        d->warnings &= ~missingGlyphs_GmDocumentWarning;
+    }
     checkMissing_Text(); /* clear the flag */
     setAnsiFlags_Text(d->theme.ansiEscapes);
     while (nextSplit_Rangecc(content, "\n", &contentLine)) {
+        if (d->abortLayout && value_Atomic(d->abortLayout)) {
+            break; /* the result would be discarded */
+        }
+        if (!isPreformat || d->format == plainText_SourceFormat) {
+            /* Layout can be continued from the start of this line. */
+            d->checkpoint = (iGmLayoutCheckpoint){
+                .sourcePos           = contentLine.start - content.start,
+                .numRuns             = size_Array(&d->layout),
+                .numLinks            = size_PtrArray(&d->links),
+                .numHeadings         = size_Array(&d->headings),
+                .numPreMeta          = size_Array(&d->preMeta),
+                .numAuxText          = size_StringArray(&d->auxText),
+                .contentWidth        = d->contentWidth,
+                .pos                 = pos,
+                .preId               = preId,
+                .prevType            = prevType,
+                .prevNonBlankType    = prevNonBlankType,
+                .isFirstText         = isFirstText,
+                .addQuoteIcon        = addQuoteIcon,
+                .enableIndents       = enableIndents,
+                .followsBlank        = followsBlank,
+                .hasTitle            = !isEmpty_String(&d->title),
+                .hasFirstContentLine = !isEmpty_String(&d->firstContentLine),
+            };
+        }
         iRangecc line = contentLine; /* `line` will be trimmed; modifying would confuse `nextSplit_Rangecc` */
         if (*line.end == '\r') {
             line.end--; /* trim CR always */
@@ -1008,9 +1206,9 @@ static void doLayout_GmDocument_(iGmDocument *d) {
             replaceRegExp_String(&d->title, ansiPattern_, "", NULL, NULL);
         }
         else if (type != preformatted_GmLineType && type != heading1_GmLineType &&
-                 isEmpty_String(&firstContentLine) && size_Range(&line) >= 3) {
-            setRange_String(&firstContentLine, line);
-            replaceRegExp_String(&firstContentLine, ansiPattern_, "", NULL, NULL);
+                 isEmpty_String(&d->firstContentLine) && size_Range(&line) >= 3) {
+            setRange_String(&d->firstContentLine, line);
+            replaceRegExp_String(&d->firstContentLine, ansiPattern_, "", NULL, NULL);
         }
         /* List bullet. */
         if (type == bullet_GmLineType) {
@@ -1369,9 +1567,13 @@ static void doLayout_GmDocument_(iGmDocument *d) {
     if (checkMissing_Text()) {
         d->warnings |= missingGlyphs_GmDocumentWarning;
     }
+    const size_t firstNewRun = (isContinued ? resume.numRuns : 0);
+    if (isContinued && oldLayout != constData_Array(&d->layout)) {
+        rebaseRunRanges_GmDocument_(d, oldLayout, resume.numPreMeta);
+    }
     /* Go over the preformatted blocks and mark them wide if at least one run is wide. */ {
-        iForEach(Array, i, &d->layout) {
-            iGmRun *run = i.value;
+        for (size_t i = firstNewRun; i < size_Array(&d->layout); i++) {
+            iGmRun *run = at_Array(&d->layout, i);
             if (preId_GmRun(run) && run->flags & wide_GmRunFlag) {
                 iGmPreMeta *meta = at_Array(&d->preMeta, preId_GmRun(run) - 1);
                 meta->runRange = findPreformattedRange_GmDocument(d, run);
@@ -1382,14 +1584,15 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                     iChangeFlags(jRun->flags, endOfLine_GmRunFlag, j + 1 == meta->runRange.end);
                 }
                 /* Skip to the end of the block. */
-                i.pos = meta->runRange.end - (const iGmRun *) constData_Array(&d->layout) - 1;
+                i = meta->runRange.end - (const iGmRun *) constData_Array(&d->layout) - 1;
             }
         }
     }
     setAnsiFlags_Text(allowAll_AnsiFlag);
+    updateRunIndex_GmDocument_(d, firstNewRun);
     /* If a title wasn't found, use the first content line but truncate it if it's long. */
     if (isEmpty_String(&d->title)) {
-        set_String(&d->title, &firstContentLine);
+        set_String(&d->title, &d->firstContentLine);
         if (length_String(&d->title) > 40) {
             truncate_String(&d->title, 40);
             /* Find a word boundary. */
@@ -1399,7 +1602,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
         }
         trim_String(&d->title);
     }
-    deinit_String(&firstContentLine);
+    endZone_Profiler();
 #if  0
     printf("[GmDocument] layout size: %zu runs (%zu bytes), layout width: %d, content width: %d\n",
            size_Array(&d->layout),
@@ -1415,14 +1618,19 @@ void init_GmDocument(iGmDocument *d) {
     d->viewFormat = gemini_SourceFormat; /* user's preference */
     init_String(&d->origSource);
     init_String(&d->source);
+    d->importPos = 0;
+    d->sourceReserve = 0;
     init_String(&d->url);
     init_String(&d->localHost);
     d->outsideMargin = 0;
     d->size = zero_I2();
     init_Array(&d->layout, sizeof(iGmRun));
+    init_Array(&d->runIndex, sizeof(iGmRunIndex));
     init_StringArray(&d->auxText);
     init_PtrArray(&d->links);
     init_String(&d->title);
+    init_String(&d->firstContentLine);
+    iZap(d->checkpoint);
     init_Array(&d->headings, sizeof(iGmHeading));
     init_Array(&d->preMeta, sizeof(iGmPreMeta));
     d->themeSeed = 0;
@@ -1431,22 +1639,30 @@ void init_GmDocument(iGmDocument *d) {
     d->openURLs = NULL;
     d->warnings = 0;
     iZap(d->palette);
+    d->layoutJob = NULL;
+    d->abortLayout = NULL;
     d->flags.enableCommandLinks = iFalse;
     d->flags.isSpartan = iFalse;
     d->flags.isNex = iFalse;
     d->flags.isLayoutInvalidated = iFalse;
     d->flags.isPaletteValid = iFalse;
+    d->flags.isAppendedSource = iFalse;
+    d->flags.isPartialSource = iFalse;
+    d->flags.isImportPreformat = iFalse;
 }
 
 void deinit_GmDocument(iGmDocument *d) {
+    cancelLayout_GmDocument_(d);
     iReleasePtr(&d->openURLs);
     delete_Media(d->media);
+    deinit_String(&d->firstContentLine);
     deinit_String(&d->title);
     clearLinks_GmDocument_(d);
     deinit_PtrArray(&d->links);
     deinit_Array(&d->preMeta);
     deinit_Array(&d->headings);
     deinit_StringArray(&d->auxText);
+    deinit_Array(&d->runIndex);
     deinit_Array(&d->layout);
     deinit_String(&d->localHost);
     deinit_String(&d->url);
@@ -2149,10 +2365,245 @@ enum iSourceFormat viewFormat_GmDocument(const iGmDocument *d) {
     return d->viewFormat;
 }
 
+/*----------------------------------------------------------------------------------------------*/
+
+/* Laying out a very long document may take long enough to stall the UI, so when the width
+   changes, the new layout can be prepared in a background thread. The layout is done in a
+   copy of the document that shares the same source, using a measurement-only Text that has
+   no glyph cache. The previous layout remains in use until the new one is taken into use. */
+
+static const size_t minBackgroundLayoutSize_GmDocument_ = 128 * 1024; /* bytes of source */
+
+struct Impl_GmLayoutJob {
+    iGmDocument *orig;   /* NULL if the document no longer wants the result */
+    iGmDocument *copy;   /* lays out the same source */
+    iText *      text;   /* `layoutText_` */
+    uint32_t     fontsSerial;     /* `fontsSerial_Text()` when the job was created */
+    float        contentFontSize; /* of `current_Text()` when the job was created */
+    iAtomicInt   isAborted;
+    iBool        isFinished;
+};
+
+static iMutex *      layoutMutex_;
+static iThread *     layoutWorker_;
+static iBool         isLayoutWorkerRunning_;
+static iPtrArray     layoutJobs_;       /* waiting to be started */
+static iGmLayoutJob *currentLayoutJob_; /* being laid out by the worker */
+static iText *       layoutText_;       /* measurement only; kept so shaped text remains cached */
+static uint32_t      layoutTextFonts_;  /* `fontsSerial_Text()` when `layoutText_` was created */
+
+static void delete_GmLayoutJob_(iGmLayoutJob *d) {
+    iRelease(d->copy);
+    free(d);
+}
+
+static iText *layoutText_GmDocument_(void) {
+    /* Called with `layoutMutex_` locked. Returns NULL if the Text must be replaced but
+       the worker may still be using it. */
+    const iText *text = current_Text();
+    if (layoutText_ && (layoutTextFonts_ != fontsSerial_Text() ||
+                        iAbs(layoutText_->contentFontSize - text->contentFontSize) > 0.001f)) {
+        if (isLayoutWorkerRunning_) {
+            return NULL;
+        }
+        delete_Text(layoutText_);
+        layoutText_ = NULL;
+    }
+    if (!layoutText_) {
+        layoutText_      = new_Text(NULL, text->contentFontSize / contentScale_Text);
+        layoutTextFonts_ = fontsSerial_Text();
+    }
+    return layoutText_;
+}
+
+static void detachLayoutJob_(iGmLayoutJob *job) {
+    /* Called with `layoutMutex_` locked. */
+    if (job->orig) {
+        job->orig->layoutJob = NULL;
+        job->orig = NULL;
+    }
+    set_Atomic(&job->isAborted, iTrue);
+    if (job == currentLayoutJob_) {
+        return; /* the worker will delete it */
+    }
+    removeOne_PtrArray(&layoutJobs_, job);
+    delete_GmLayoutJob_(job);
+}
+
+static iThreadResult runLayoutJobs_GmDocument_(iThread *thread) {
+    iUnused(thread);
+    lock_Mutex(layoutMutex_);
+    while (!isEmpty_PtrArray(&layoutJobs_)) {
+        iGmLayoutJob *job;
+        take_PtrArray(&layoutJobs_, 0, (void **) &job);
+        currentLayoutJob_ = job;
+        unlock_Mutex(layoutMutex_);
+        iBeginCollect();
+        setThreadCurrent_Text(job->text);
+        doLayout_GmDocument_(job->copy, iFalse);
+        setThreadCurrent_Text(NULL);
+        iEndCollect();
+        lock_Mutex(layoutMutex_);
+        currentLayoutJob_ = NULL;
+        if (value_Atomic(&job->isAborted)) {
+            delete_GmLayoutJob_(job);
+        }
+        else {
+            job->isFinished = iTrue;
+            postCommandf_App("document.layout.finished doc:%p", job->orig);
+        }
+    }
+    isLayoutWorkerRunning_ = iFalse;
+    unlock_Mutex(layoutMutex_);
+    return 0;
+}
+
+static void cancelLayout_GmDocument_(iGmDocument *d) {
+    if (d->layoutJob) {
+        iGuardMutex(layoutMutex_, detachLayoutJob_(d->layoutJob));
+        iAssert(d->layoutJob == NULL);
+    }
+}
+
+static iGmDocument *newLayoutCopy_GmDocument_(const iGmDocument *d, int width, int canvasWidth) {
+    iGmDocument *copy = new_GmDocument();
+    copy->origFormat    = d->origFormat;
+    copy->viewFormat    = d->viewFormat;
+    copy->format        = d->format;
+    set_String(&copy->source, &d->source); /* shared, not duplicated */
+    set_String(&copy->url, &d->url);
+    set_String(&copy->localHost, &d->localHost);
+    copy->size.x        = width;
+    copy->outsideMargin = iMax(0, (canvasWidth - width) / 2);
+    copy->theme         = d->theme;
+    copy->themeSeed     = d->themeSeed;
+    copy->siteIcon      = d->siteIcon;
+    copy->openURLs      = listOpenURLs_App(); /* can't be listed in the worker */
+    copy->warnings      = d->warnings;
+    copy->flags         = d->flags;
+    pushBackN_Array(&copy->preMeta, constData_Array(&d->preMeta), size_Array(&d->preMeta));
+    return copy;
+}
+
+iBool layoutInBackground_GmDocument(iGmDocument *d, int width, int canvasWidth) {
+    if (isTerminal_Platform() || d->flags.isPartialSource || isEmpty_Array(&d->layout) ||
+        size_String(&d->source) < minBackgroundLayoutSize_GmDocument_ ||
+        !isEmpty_Media(d->media)) {
+        /* Small documents are quick to lay out, and media would need to be shared. */
+        return iFalse;
+    }
+    cancelLayout_GmDocument_(d);
+    if (!layoutMutex_) {
+        layoutMutex_ = new_Mutex();
+        init_PtrArray(&layoutJobs_);
+    }
+    lock_Mutex(layoutMutex_);
+    iText *text = layoutText_GmDocument_();
+    if (!text) {
+        unlock_Mutex(layoutMutex_);
+        return iFalse;
+    }
+    iGmLayoutJob *job = iMalloc(GmLayoutJob);
+    job->orig = d;
+    job->copy = newLayoutCopy_GmDocument_(d, width, canvasWidth);
+    job->text = text;
+    job->fontsSerial     = layoutTextFonts_;
+    job->contentFontSize = current_Text()->contentFontSize;
+    set_Atomic(&job->isAborted, iFalse);
+    job->isFinished = iFalse;
+    job->copy->abortLayout = &job->isAborted;
+    d->layoutJob = job;
+    pushBack_PtrArray(&layoutJobs_, job);
+    if (!isLayoutWorkerRunning_) {
+        if (layoutWorker_) {
+            join_Thread(layoutWorker_); /* already exiting */
+            iRelease(layoutWorker_);
+        }
+        layoutWorker_ = new_Thread(runLayoutJobs_GmDocument_);
+        isLayoutWorkerRunning_ = iTrue;
+        start_Thread(layoutWorker_);
+    }
+    unlock_Mutex(layoutMutex_);
+    return iTrue;
+}
+
+iBool isLayoutPending_GmDocument(const iGmDocument *d) {
+    return d->layoutJob != NULL;
+}
+
+void cancelBackgroundLayout_GmDocument(iGmDocument *d) {
+    cancelLayout_GmDocument_(d);
+}
+
+iBool takeBackgroundLayout_GmDocument(iGmDocument *d) {
+    iGmLayoutJob *job = d->layoutJob;
+    if (!job) {
+        return iFalse;
+    }
+    lock_Mutex(layoutMutex_);
+    if (!job->isFinished) {
+        unlock_Mutex(layoutMutex_);
+        return iFalse;
+    }
+    job->orig    = NULL;
+    d->layoutJob = NULL;
+    unlock_Mutex(layoutMutex_);
+    iGmDocument *copy = job->copy;
+    /* The layout is only valid if it refers to the current source and was measured with
+       the current fonts. */
+    const iBool isValid = constBegin_String(&copy->source) == constBegin_String(&d->source) &&
+                          size_String(&copy->source) == size_String(&d->source) &&
+                          job->fontsSerial == fontsSerial_Text() &&
+                          iAbs(job->contentFontSize - current_Text()->contentFontSize) <= 0.001f;
+    if (isValid) {
+        iSwap(iArray, d->layout, copy->layout);
+        iSwap(iArray, d->runIndex, copy->runIndex);
+        iSwap(iStringArray, d->auxText, copy->auxText);
+        iSwap(iPtrArray, d->links, copy->links);
+        iSwap(iString, d->title, copy->title);
+        iSwap(iString, d->firstContentLine, copy->firstContentLine);
+        iSwap(iArray, d->headings, copy->headings);
+        iSwap(iArray, d->preMeta, copy->preMeta);
+        d->checkpoint    = copy->checkpoint;
+        d->size          = copy->size;
+        d->contentWidth  = copy->contentWidth;
+        d->outsideMargin = copy->outsideMargin;
+        iChangeFlags(d->warnings, missingGlyphs_GmDocumentWarning,
+                     copy->warnings & missingGlyphs_GmDocumentWarning);
+        d->flags.isLayoutInvalidated = iFalse;
+    }
+    delete_GmLayoutJob_(job);
+    return isValid;
+}
+
+void waitForBackgroundLayouts_GmDocument(void) {
+    if (!layoutMutex_) {
+        return;
+    }
+    lock_Mutex(layoutMutex_);
+    while (!isEmpty_PtrArray(&layoutJobs_)) {
+        detachLayoutJob_(back_PtrArray(&layoutJobs_));
+    }
+    if (currentLayoutJob_) {
+        detachLayoutJob_(currentLayoutJob_);
+    }
+    iThread *worker = layoutWorker_;
+    layoutWorker_ = NULL;
+    unlock_Mutex(layoutMutex_);
+    if (worker) {
+        join_Thread(worker);
+        iRelease(worker);
+    }
+    if (layoutText_) {
+        delete_Text(layoutText_);
+        layoutText_ = NULL;
+    }
+}
+
 void setWidth_GmDocument(iGmDocument *d, int width, int canvasWidth) {
     d->size.x        = width;
     d->outsideMargin = iMax(0, (canvasWidth - width) / 2); /* distance to edge of the canvas */
-    doLayout_GmDocument_(d); /* TODO: just flag need-layout and do it later */
+    doLayout_GmDocument_(d, iFalse); /* TODO: just flag need-layout and do it later */
 }
 
 iBool updateWidth_GmDocument(iGmDocument *d, int width, int canvasWidth) {
@@ -2168,7 +2619,7 @@ int contentWidth_GmDocument(const iGmDocument *d) {
 }
 
 void redoLayout_GmDocument(iGmDocument *d) {
-    doLayout_GmDocument_(d);
+    doLayout_GmDocument_(d, iFalse);
 }
 
 void invalidateLayout_GmDocument(iGmDocument *d) {
@@ -2218,50 +2669,120 @@ iLocalDef iBool isNormalizableSpace_(char ch) {
     return ch == ' ' || ch == '\t';
 }
 
-static void normalize_GmDocument(iGmDocument *d) {
-    iString *normalized = new_String();
-    iRangecc src = range_String(&d->source);
-    /* Check for a BOM. In UTF-8, the BOM can just be skipped if present. */ {
+iLocalDef void appendSpan_(iString *d, const char *start, const char *end) {
+    if (end > start) {
+        appendData_Block(&d->chars, start, end - start);
+    }
+}
+
+static iRangecc nextLine_(const char **pos, const char *end) {
+    /* CRLF line endings are treated as LF. */
+    const char *lineEnd = memchr(*pos, '\n', end - *pos);
+    iRangecc    line    = { *pos, lineEnd ? lineEnd : end };
+    *pos = line.end + 1;
+    if (lineEnd && line.end > line.start && line.end[-1] == '\r') {
+        line.end--;
+    }
+    return line;
+}
+
+static const char *ansiCursorForward_(const char *esc, const char *end, int *num_out) {
+    /* Matches "ESC [ <digits> C". Returns the end of the sequence, or NULL. */
+    const char *pos = esc + 1;
+    int         num = 0;
+    if (pos >= end || *pos++ != '[' || pos >= end || !isdigit((unsigned char) *pos)) {
+        return NULL;
+    }
+    for (; pos < end && isdigit((unsigned char) *pos); pos++) {
+        num = iMin(num * 10 + (*pos - '0'), 10000);
+    }
+    if (pos >= end || *pos != 'C') {
+        return NULL;
+    }
+    *num_out = num;
+    return pos + 1;
+}
+
+static void appendNormalizedPreformat_(iString *normalized, iRangecc line) {
+    /* Vertical tabs are dropped, and ANSI cursor forward sequences are emulated with spaces. */
+    const char *span = line.start;
+    for (const char *ch = line.start; ch < line.end; ch++) {
+        if (*ch == '\v') {
+            appendSpan_(normalized, span, ch);
+            span = ch + 1;
+        }
+        else if (*ch == 0x1b) {
+            int num = 0;
+            const char *seqEnd = ansiCursorForward_(ch, line.end, &num);
+            if (seqEnd) {
+                appendSpan_(normalized, span, ch);
+                if (num > 0 && num < 200 /* arbitrary sanity limit */) {
+                    const size_t pos = size_Block(&normalized->chars);
+                    resize_Block(&normalized->chars, pos + num);
+                    memset(data_Block(&normalized->chars) + pos, ' ', num);
+                }
+                ch   = seqEnd - 1;
+                span = seqEnd;
+            }
+        }
+    }
+    appendSpan_(normalized, span, line.end);
+    pushBack_Block(&normalized->chars, '\n');
+}
+
+static void appendNormalizedLine_(iString *normalized, iRangecc line) {
+    /* Runs of spaces and tabs are collapsed into a single space, and vertical tabs are
+       dropped. Unchanged text is copied in spans. */
+    const char *span = line.start;
+    for (const char *ch = line.start; ch < line.end; ) {
+        const char c = *ch;
+        if (c == '\v' || (c == ' ' && (ch + 1 == line.end || (!isNormalizableSpace_(ch[1]) &&
+                                                               ch[1] != '\v')))) {
+            if (c == '\v') {
+                appendSpan_(normalized, span, ch);
+                span = ch + 1;
+            }
+            ch++;
+            continue;
+        }
+        if (!isNormalizableSpace_(c)) {
+            ch++;
+            continue;
+        }
+        appendSpan_(normalized, span, ch);
+        int spaceCount = 0;
+        for (; ch < line.end && (isNormalizableSpace_(*ch) || *ch == '\v'); ch++) {
+            if (*ch != '\v') {
+                spaceCount++;
+            }
+        }
+        /* Several consecutive space characters: the author likely really wants to have some
+           space here, so normalize to a tab stop. */
+        pushBack_Block(&normalized->chars, spaceCount > 8 ? '\t' : ' ');
+        span = ch;
+    }
+    appendSpan_(normalized, span, line.end);
+    pushBack_Block(&normalized->chars, '\n');
+}
+
+static void normalize_GmDocument_(iGmDocument *d, iRangecc src, iString *normalized) {
+    /* Lines are normalized one at a time, so the source can be given in pieces as long as
+       each piece ends at a line boundary. `isImportPreformat` carries over to the next piece.
+       The output is never longer than the input, except for emulated ANSI cursor movement. */
+    if (isEmpty_String(&d->source)) {
+        /* Check for a BOM. In UTF-8, the BOM can just be skipped if present. */
         iChar ch = 0;
         decodeBytes_MultibyteChar(src.start, src.end, &ch);
         if (ch == 0xfeff) /* zero-width non-breaking space */ {
             src.start += 3;
         }
     }
-    iRangecc line = iNullRange;
-    iBool isPreformat = iFalse;
-    if (d->format == plainText_SourceFormat) {
-        isPreformat = iTrue; /* Cannot be turned off. */
-    }
-    iBool wasNormalized = iFalse;
-    iRegExp *ansiCursorFwdPattern = new_RegExp("^\x1b\\[([0-9]+)C", 0);
-    while (nextSplit_Rangecc(src, "\n", &line)) {
+    reserve_Block(&normalized->chars, size_String(normalized) + size_Range(&src) + 1);
+    iBool isPreformat = d->flags.isImportPreformat;
+    for (const char *pos = src.start; pos < src.end; ) {
+        const iRangecc line = nextLine_(&pos, src.end);
         if (isPreformat) {
-            for (const char *ch = line.start; ch != line.end; ch++) {
-                if (*ch == 0x1b) {
-                    /* We can emulate an ANSI cursor forward sequence by adding spaces. */
-                    iRegExpMatch m;
-                    init_RegExpMatch(&m);
-                    if (matchRange_RegExp(ansiCursorFwdPattern, (iRangecc){ ch, line.end }, &m)) {
-                        int num = strtoul(capturedRange_RegExpMatch(&m, 1).start, NULL, 10);
-                        if (num > 0 && num < 200 /* arbitrary sanity limit */) {
-                            for (int i = 0; i < num; i++) {
-                                appendData_Block(&normalized->chars, " ", 1);
-                            }
-                        }
-                        ch = end_RegExpMatch(&m) - 1;
-                        wasNormalized = iTrue;
-                        continue;
-                    }
-                }
-                if (*ch != '\v') {
-                    appendCStrN_String(normalized, ch, 1);
-                }
-                else {
-                    wasNormalized = iTrue;
-                }
-            }
-            appendCStr_String(normalized, "\n");
+            appendNormalizedPreformat_(normalized, line);
             if (d->format == gemini_SourceFormat &&
                 lineType_GmDocument_(d, line) == preformatted_GmLineType) {
                 isPreformat = iFalse;
@@ -2270,50 +2791,13 @@ static void normalize_GmDocument(iGmDocument *d) {
         }
         if (lineType_GmDocument_(d, line) == preformatted_GmLineType) {
             isPreformat = iTrue;
-            appendRange_String(normalized, line);
-            appendCStr_String(normalized, "\n");
+            appendSpan_(normalized, line.start, line.end);
+            pushBack_Block(&normalized->chars, '\n');
             continue;
         }
-        iBool isPrevSpace = iFalse;
-        int spaceCount = 0;
-        for (const char *ch = line.start; ch != line.end; ch++) {
-            char c = *ch;
-            if (c == '\v') {
-                wasNormalized = iTrue;
-                continue;
-            }
-            if (isNormalizableSpace_(c)) {
-                if (isPrevSpace) {
-                    if (++spaceCount == 8) {
-                        /* There are several consecutive space characters. The author likely
-                           really wants to have some space here, so normalize to a tab stop. */
-                        popBack_Block(&normalized->chars);
-                        pushBack_Block(&normalized->chars, '\t');
-                    }
-                    wasNormalized = iTrue;
-                    continue; /* skip repeated spaces */
-                }
-                if (c != ' ') {
-                    c = ' ';
-                    wasNormalized = iTrue;
-                }
-                isPrevSpace = iTrue;
-            }
-            else {
-                isPrevSpace = iFalse;
-                spaceCount = 0;
-            }
-            appendCStrN_String(normalized, &c, 1);
-        }
-        appendCStr_String(normalized, "\n");
+        appendNormalizedLine_(normalized, line);
     }
-    iUnused(wasNormalized);
-    iRelease(ansiCursorFwdPattern);
-//    printf("wasNormalized: %d\n", wasNormalized);
-//    fflush(stdout);
-    set_String(&d->source, collect_String(normalized));
-    //normalize_String(&d->source); /* NFC */
-//    printf("orig:%zu norm:%zu\n", size_String(&d->origSource), size_String(&d->source));
+    d->flags.isImportPreformat = isPreformat;
 }
 
 void setUrl_GmDocument(iGmDocument *d, const iString *url) {
@@ -2324,7 +2808,7 @@ void setUrl_GmDocument(iGmDocument *d, const iString *url) {
     init_Url(&parts, url);
     setRange_String(&d->localHost, parts.host);
     updateIconBasedOnUrl_GmDocument_(d);
-    if (!cmp_String(url, "about:fonts")) {
+    if (!cmp_String(url, "about:fonts") || !cmp_String(url, "about:debug")) {
         /* This is an interactive internal page. */
         d->flags.enableCommandLinks = iTrue;
     }
@@ -2335,187 +2819,178 @@ void setUrl_GmDocument(iGmDocument *d, const iString *url) {
                             startsWith_Rangecc(parts.path, "/1");
 }
 
-iDeclareType(PendingLink)
-struct Impl_PendingLink {
-    iString *url;
-    iString *title;
-};
+static void convertMarkdownToGemtext_GmDocument_(iGmDocument *d) {
+    iAssert(d->origFormat == markdown_SourceFormat);
+    iString *gemtext = collectNew_String();
+    convertToGemtext_Markdown(range_String(&d->source), gemtext);
+    set_String(&d->source, gemtext);
+    d->format = gemini_SourceFormat;
+}
 
-static void addPendingLink_(void *context, const iRegExpMatch *m) {
-    pushBack_Array(context, &(iPendingLink){
-        .url   = captured_RegExpMatch(m, 2),
-        .title = captured_RegExpMatch(m, 1)
-    });
-}
-
-static void addPendingNamedLink_(void *context, const iRegExpMatch *m) {
-    pushBack_Array(context, &(iPendingLink){
-        .url   = newFormat_String("[]%s", cstr_Rangecc(capturedRange_RegExpMatch(m, 2))),
-        .title = captured_RegExpMatch(m, 1)
-    });
-}
-
-static void flushPendingLinks_(iArray *links, const iString *source, iString *out) {
-    iRegExp *namePattern = new_RegExp("\n\\s*\\[(.+?)\\]\\s*:\\s*([^\n]+)", 0);
-    if (!endsWith_String(out, "\n")) {
-        appendCStr_String(out, "\n");
-    }
-    iForEach(Array, i, links) {
-        iPendingLink *pending = i.value;
-        const char *url = cstr_String(pending->url);
-        if (startsWith_CStr(url, "[]")) {
-            /* Find the matching named link. */
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            while (matchString_RegExp(namePattern, source, &m)) {
-                if (equal_Rangecc(capturedRange_RegExpMatch(&m, 1), url + 2)) {
-                    url = cstrCollect_String(captured_RegExpMatch(&m, 2));
-                    break;
-                }
+static void rebaseSource_GmDocument_(iGmDocument *d, const char *oldStart, size_t oldSize) {
+    /* `source` has been moved in memory, so all ranges that point to it must be moved, too.
+       Other ranges (e.g., to static strings or `auxText`) are left alone. */
+    const uintptr_t oldBegin = (uintptr_t) oldStart;
+    const uintptr_t oldEnd   = oldBegin + oldSize;
+    const intptr_t  delta    = (intptr_t) constBegin_String(&d->source) - (intptr_t) oldStart;
+#define rebase_(r) \
+    if ((uintptr_t) (r).start >= oldBegin && (uintptr_t) (r).start <= oldEnd) { \
+        (r).start = (const char *) ((intptr_t) (r).start + delta); \
+        (r).end   = (const char *) ((intptr_t) (r).end + delta); \
+    }
+    iForEach(Array, i, &d->layout) {
+        iGmRun *run = i.value;
+        rebase_(run->text);
+    }
+    iForEach(PtrArray, j, &d->links) {
+        iGmLink *link = j.ptr;
+        rebase_(link->urlRange);
+        rebase_(link->labelRange);
+        rebase_(link->labelIcon);
+    }
+    iForEach(Array, k, &d->headings) {
+        iGmHeading *head = k.value;
+        rebase_(head->text);
+    }
+    iForEach(Array, m, &d->preMeta) {
+        iGmPreMeta *meta = m.value;
+        rebase_(meta->bounds);
+        rebase_(meta->altText);
+        rebase_(meta->contents);
+    }
+#undef rebase_
+    updateRunIndex_GmDocument_(d, 0);
+}
+
+static void appendToSource_GmDocument_(iGmDocument *d, iRangecc text) {
+    cancelLayout_GmDocument_(d); /* any layout in progress would be missing the new text */
+    const char  *oldStart = constBegin_String(&d->source);
+    const size_t oldSize  = size_String(&d->source);
+    const size_t newSize  = oldSize + size_Range(&text);
+    if (newSize > d->sourceReserve) {
+        /* Reserve geometrically more space so the source is rarely moved. */
+        d->sourceReserve = iMax(newSize, 2 * d->sourceReserve);
+        reserve_Block(&d->source.chars, d->sourceReserve);
+    }
+    appendRange_String(&d->source, text);
+    if (oldSize > 0 && constBegin_String(&d->source) != oldStart) {
+        rebaseSource_GmDocument_(d, oldStart, oldSize);
+    }
+}
+
+static iBool hasAnsiEscapes_(iRangecc text) {
+    /* Equivalent to matching "\x1b[[()]([0-9;AB]*?)[ABCDEFGHJKSTfimn]". */
+    for (const char *esc = text.start;
+         esc < text.end && (esc = memchr(esc, 0x1b, text.end - esc)) != NULL;
+         esc++) {
+        const char *pos = esc + 1;
+        if (pos == text.end || (*pos != '[' && *pos != '(' && *pos != ')')) {
+            continue;
+        }
+        for (pos++; pos < text.end; pos++) {
+            if (*pos && strchr("ABCDEFGHJKSTfimn", *pos)) {
+                return iTrue;
+            }
+            if (!isdigit((unsigned char) *pos) && *pos != ';') {
+                break;
             }
         }
-        appendFormat_String(out, "\n=> %s %s", url, cstr_String(pending->title));
-        delete_String(pending->url);
-        delete_String(pending->title);
     }
-    clear_Array(links);
-    iRelease(namePattern);
+    return iFalse;
 }
 
-static void convertMarkdownToGemtext_GmDocument_(iGmDocument *d) {
-    iAssert(d->origFormat == markdown_SourceFormat);
-    /* Get rid of indented preformats. */ {
-        iArray        *pendingLinks     = collectNew_Array(sizeof(iPendingLink));
-        const iRegExp *imageLinkPattern = iClob(new_RegExp("\n?!\\[(.+)\\]\\(([^)]+)\\)\n?", 0));
-        const iRegExp *linkPattern      = iClob(new_RegExp("\\[(.+?)\\]\\(([^)]+)\\)", 0));
-        const iRegExp *standaloneLinkPattern = iClob(new_RegExp("^[\\s*_]*\\[(.+?)\\]\\(([^)]+)\\)[\\s*_]*$", 0));
-        const iRegExp *namedLinkPattern = iClob(new_RegExp("\\[(.+?)\\]\\[(.+?)\\]", 0));
-        const iRegExp *namePattern      = iClob(new_RegExp("\\s*\\[(.+?)\\]\\s*:\\s*([^\n]+)", 0));
-        iString result;
-        init_String(&result);
-        replace_String(&d->source, "&nbsp;", "\u00a0");
-        replaceRegExp_String(&d->source, iClob(new_RegExp("```", 0)), "\n```\n", NULL, NULL);
-        iRangecc line = iNullRange;
-        iBool isPre = iFalse;
-        iBool isBlock = iFalse;
-        iBool isLastEmpty = iFalse;
-        while (nextSplit_Rangecc(range_String(&d->source), "\n", &line)) {
-            if (!isPre && !isBlock) {
-                if (equal_Rangecc(line, "```")) {
-                    isBlock = iTrue;
-                    appendCStr_String(&result, "\n```");
-                    continue;
-                }
-                if (*line.start == '#') {
-                    flushPendingLinks_(pendingLinks, &d->source, &result);
-                }
-                if (isEmpty_Range(&line)) {
-                    isLastEmpty = iTrue;
-                    continue;
-                }
-                if (isLastEmpty) {
-                    appendCStr_String(&result, "\n\n");
-                }
-                else if (size_Range(&line) >= 2 && isdigit(line.start[0]) &&
-                         (line.start[1] == '.' ||
-                          (isdigit(line.start[1]) && line.start[2] == '.'))) {
-                    appendCStr_String(&result, "\n\n");
-                }
-                else if (endsWith_String(&result, "  ") ||
-                         *line.start == '*' || *line.start == '>' || *line.start == '#' ||
-                         (*line.start == '|' && endsWith_String(&result, "|"))) {
-                    appendCStr_String(&result, "\n");
-                }
-                else {
-                    appendCStr_String(&result, " ");
-                }
-                isLastEmpty = iFalse;
-            }
-            else if (isBlock) {
-                if (equal_Rangecc(line, "```")) {
-                    isBlock = iFalse;
-                    appendCStr_String(&result, "\n```\n");
-                }
-                else {
-                    appendCStr_String(&result, "\n");
-                    appendRange_String(&result, line);
-                }
-                continue;
-            }
-            if (startsWith_Rangecc(line, "    ")) {
-                line.start += 4;
-                if (!isPre) {
-                    appendCStr_String(&result, "```\n");
-                    isPre = iTrue;
-                }
-            }
-            else if (isPre) {
-                if (!endsWith_String(&result, "\n")) {
-                    appendCStr_String(&result, "\n");
-                }
-                appendCStr_String(&result, "```\n");
-                if (equal_Rangecc(line, "```")) {
-                    line.start = line.end; /* don't repeat it */
-                }
-                isPre = iFalse;
-            }
-            if (isPre) {
-                appendRange_String(&result, line);
-                appendCStr_String(&result, "\n");
-            }
-            else {
-                iString ln;
-                initRange_String(&ln, line);
-                replaceRegExp_String(&ln, namePattern, "", NULL, 0);
-                replaceRegExp_String(&ln, standaloneLinkPattern, "\n=> \\2 \\1", NULL, NULL);
-                replaceRegExp_String(&ln, imageLinkPattern, "\n=> \\2 \\1\n", NULL, NULL);
-                replaceRegExp_String(&ln, namedLinkPattern, "\\1", addPendingNamedLink_, pendingLinks);
-                replaceRegExp_String(&ln, linkPattern, "\\1", addPendingLink_, pendingLinks);
-                replaceRegExp_String(&ln, iClob(new_RegExp("\\*\\*(.+?)\\*\\*", 0)), "\x1b[1m\\1\x1b[0m", NULL, NULL);
-                replaceRegExp_String(&ln, iClob(new_RegExp("__(.+?)__", 0)), "\x1b[1m\\1\x1b[0m", NULL, NULL);
-                replaceRegExp_String(&ln, iClob(new_RegExp("\\*(.+?)\\*", 0)), "\x1b[3m\\1\x1b[0m", NULL, NULL);
-                replaceRegExp_String(&ln, iClob(new_RegExp("\\b_([^_]+?)_\\b", 0)), "\x1b[3m\\1\x1b[0m", NULL, NULL);
-                replaceRegExp_String(&ln, iClob(new_RegExp("(?<!`)`([^`]+?)`(?!`)", 0)), "\x1b[11m\\1\x1b[0m", NULL, NULL);
-                replace_String(&ln, "\\_", "_");
-                append_String(&result, &ln);
-                deinit_String(&ln);
-            }
-        }
-        flushPendingLinks_(pendingLinks, &d->source, &result);
-        set_String(&d->source, &result);
-        deinit_String(&result);
-    }
-    /* Replace Markdown syntax with equivalent Gemtext, where possible. */
-    replaceRegExp_String(&d->source, iClob(new_RegExp("(\\s*\n){2,}", 0)), "\n\n", NULL, NULL); /* normalize paragraph breaks */
-//    printf("Converted:\n%s", cstr_String(&d->source));
-    d->format = gemini_SourceFormat;
+static void shareUnchangedSource_GmDocument_(iGmDocument *d) {
+    /* When importing didn't change anything, the source can refer to the original source data
+       instead of being a copy of it. */
+    const size_t size = size_String(&d->source);
+    if (d->layoutJob || d->flags.isPartialSource || size == 0 ||
+        size != size_String(&d->origSource) ||
+        constBegin_String(&d->source) == constBegin_String(&d->origSource) ||
+        memcmp(constBegin_String(&d->source), constBegin_String(&d->origSource), size)) {
+        return;
+    }
+    const char *oldStart = constBegin_String(&d->source);
+    set_String(&d->source, &d->origSource); /* implicitly shared */
+    d->sourceReserve = size;
+    rebaseSource_GmDocument_(d, oldStart, size);
 }
 
-static void import_GmDocument_(iGmDocument *d) {
-    d->format = d->origFormat;
-    set_String(&d->source, &d->origSource);
-    replace_String(&d->source, "\r\n", "\n");
-    /* Remove any null characters. */ {
-        const char *ch = constBegin_String(&d->source);
-        for (size_t pos = 0; pos < size_String(&d->source); pos++, ch++) {
-            if (*ch == 0) {
-                remove_Block(&d->source.chars, pos, 1);
-                pos--;
-                ch--;
-            }
+static void importPending_GmDocument_(iGmDocument *d) {
+    /* Import the part of `origSource` that hasn't been imported yet. A partial source may end
+       with an incomplete line, which is left for later. */
+    iRangecc src = { constBegin_String(&d->origSource) + d->importPos,
+                     constEnd_String(&d->origSource) };
+    if (d->flags.isPartialSource) {
+        while (src.end > src.start && src.end[-1] != '\n') {
+            src.end--;
         }
     }
-    /* Detect use of ANSI escapes. */ {
-        iRegExp *ansiEsc = new_RegExp("\x1b[[()]([0-9;AB]*?)[ABCDEFGHJKSTfimn]", 0);
-        iRegExpMatch m;
-        init_RegExpMatch(&m);
-        const iBool found = matchString_RegExp(ansiEsc, &d->origSource, &m);
-        iChangeFlags(d->warnings, ansiEscapes_GmDocumentWarning, found);
-        iRelease(ansiEsc);
+    if (isEmpty_Range(&src)) {
+        return;
+    }
+    d->importPos = src.end - constBegin_String(&d->origSource);
+    /* Detect use of ANSI escapes. */
+    if (~d->warnings & ansiEscapes_GmDocumentWarning && hasAnsiEscapes_(src)) {
+        d->warnings |= ansiEscapes_GmDocumentWarning;
+    }
+    /* Remove any null characters. These are rare, so it's done as a separate pass. */
+    if (memchr(src.start, 0, size_Range(&src))) {
+        iString *noNulls = collectNew_String();
+        reserve_Block(&noNulls->chars, size_Range(&src));
+        for (const char *pos = src.start; pos < src.end; ) {
+            const char *nul = memchr(pos, 0, src.end - pos);
+            appendSpan_(noNulls, pos, nul ? nul : src.end);
+            pos = (nul ? nul + 1 : src.end);
+        }
+        src = range_String(noNulls);
+    }
+    /* Markdown is normalized after it has been converted as a whole. */
+    if (d->format != markdown_SourceFormat && shouldBeNormalized_GmDocument_(d)) {
+        iString *normalized = collectNew_String();
+        normalize_GmDocument_(d, src, normalized);
+        appendToSource_GmDocument_(d, range_String(normalized));
+    }
+    else if (memchr(src.start, '\r', size_Range(&src))) {
+        iString *unixLines = collectNew_String();
+        reserve_Block(&unixLines->chars, size_Range(&src));
+        for (const char *pos = src.start; pos < src.end; ) {
+            const iRangecc line = nextLine_(&pos, src.end);
+            appendSpan_(unixLines, line.start, line.end);
+            if (pos <= src.end) {
+                pushBack_Block(&unixLines->chars, '\n');
+            }
+        }
+        appendToSource_GmDocument_(d, range_String(unixLines));
+    }
+    else if (isEmpty_String(&d->source) && !d->flags.isPartialSource &&
+             src.start == constBegin_String(&d->origSource) &&
+             src.end == constEnd_String(&d->origSource)) {
+        /* The entire source is used as-is. */
+        cancelLayout_GmDocument_(d);
+        set_String(&d->source, &d->origSource);
+        d->sourceReserve = size_String(&d->source);
+    }
+    else {
+        appendToSource_GmDocument_(d, src);
     }
+}
+
+static void import_GmDocument_(iGmDocument *d) {
+    cancelLayout_GmDocument_(d);
+    d->format = d->origFormat;
     if (d->viewFormat == plainText_SourceFormat) {
         d->format = plainText_SourceFormat;
+    }
+    clear_String(&d->source);
+    d->sourceReserve = 0;
+    d->importPos = 0;
+    d->flags.isImportPreformat = (d->format == plainText_SourceFormat); /* cannot be turned off */
+    iZap(d->checkpoint); /* layout must be redone */
+    iChangeFlags(d->warnings, ansiEscapes_GmDocumentWarning, iFalse);
+    if (d->format == plainText_SourceFormat) {
         d->theme.ansiEscapes = allowAll_AnsiFlag;
+        importPending_GmDocument_(d);
+        shareUnchangedSource_GmDocument_(d);
         return;
     }
     /* Do an internal format conversion to Gemtext. */
@@ -2523,36 +2998,109 @@ static void import_GmDocument_(iGmDocument *d) {
     if (d->format == gemini_SourceFormat) {
         d->theme.ansiEscapes = prefs_App()->gemtextAnsiEscapes;
     }
-    else if (d->format == markdown_SourceFormat) {
-        convertMarkdownToGemtext_GmDocument_(d);
-        d->theme.ansiEscapes = allowAll_AnsiFlag; /* escapes are used for styling */
-    }
     else {
-        d->theme.ansiEscapes = allowAll_AnsiFlag;
+        d->theme.ansiEscapes = allowAll_AnsiFlag; /* Markdown uses escapes for styling */
     }
-    if (shouldBeNormalized_GmDocument_(d)) {
-        normalize_GmDocument(d);
+    importPending_GmDocument_(d);
+    if (d->format == markdown_SourceFormat) {
+        convertMarkdownToGemtext_GmDocument_(d);
+        if (shouldBeNormalized_GmDocument_(d)) {
+            iString converted;
+            initCopy_String(&converted, &d->source);
+            clear_String(&d->source);
+            normalize_GmDocument_(d, range_String(&converted), &d->source);
+            deinit_String(&converted);
+        }
+        return;
     }
+    shareUnchangedSource_GmDocument_(d);
+}
+
+static iBool isAppendable_GmDocument_(const iGmDocument *d) {
+    /* Markdown is converted to Gemtext as a whole, so it can't be imported piece by piece. */
+    const enum iSourceFormat importFormat =
+        (d->viewFormat == plainText_SourceFormat ? plainText_SourceFormat : d->origFormat);
+    return d->importPos > 0 && importFormat != markdown_SourceFormat && d->format == importFormat;
 }
 
 void setSource_GmDocument(iGmDocument *d, const iString *source, int width, int canvasWidth,
                           enum iGmDocumentUpdate updateType) {
-    /* TODO: This API has been set up to allow partial/progressive updating of the content.
-       Currently the entire source is replaced every time, though. */
+    /* Progressively received content should use `appendSource_GmDocument()` instead so only
+       the new lines need to be processed. */
+    iUnused(updateType);
 //    printf("[GmDocument] source update (%zu bytes), width:%d, final:%d\n",
 //           size_String(source), width, updateType == final_GmDocumentUpdate);
-    if (size_String(source) == size_String(&d->origSource)) {
+    d->flags.isAppendedSource = iFalse;
+    if (!d->flags.isPartialSource && size_String(source) == size_String(&d->origSource)) {
         iAssert(equal_String(source, &d->origSource));
 //        printf("[GmDocument] source is unchanged!\n");
         updateWidth_GmDocument(d, width, canvasWidth);
         return; /* Nothing to do. */
     }
     /* Normalize and convert to Gemtext if needed. */
+    d->flags.isPartialSource = iFalse;
     set_String(&d->origSource, source);
     import_GmDocument_(d);
     setWidth_GmDocument(d, width, canvasWidth); /* re-do layout */
 }
 
+void appendSource_GmDocument(iGmDocument *d, iRangecc source, int width, int canvasWidth,
+                             enum iGmDocumentUpdate updateType) {
+    const size_t oldSize = size_String(&d->origSource);
+    d->flags.isPartialSource = (updateType == partial_GmDocumentUpdate);
+    if ((!d->flags.isAppendedSource && oldSize > 0) || size_Range(&source) < oldSize) {
+        /* This isn't a continuation of the current source, so start over. */
+        d->flags.isAppendedSource = iTrue;
+        setRange_String(&d->origSource, source);
+        import_GmDocument_(d);
+        setWidth_GmDocument(d, width, canvasWidth);
+        return;
+    }
+    d->flags.isAppendedSource = iTrue;
+    iAssert(memcmp(source.start, constBegin_String(&d->origSource), oldSize) == 0);
+    appendCStrN_String(&d->origSource, source.start + oldSize, size_Range(&source) - oldSize);
+    if (!isAppendable_GmDocument_(d)) {
+        import_GmDocument_(d);
+        setWidth_GmDocument(d, width, canvasWidth);
+        return;
+    }
+    const size_t oldSourceSize = size_String(&d->source);
+    importPending_GmDocument_(d);
+    shareUnchangedSource_GmDocument_(d);
+    if (size_String(&d->source) == oldSourceSize) {
+        updateWidth_GmDocument(d, width, canvasWidth); /* no new lines */
+        return;
+    }
+    if (d->size.x == width && d->outsideMargin == iMax(0, (canvasWidth - width) / 2) &&
+        !d->flags.isLayoutInvalidated) {
+        doLayout_GmDocument_(d, iTrue); /* only the new lines */
+    }
+    else {
+        setWidth_GmDocument(d, width, canvasWidth);
+    }
+}
+
+void shareSource_GmDocument(iGmDocument *d, const iBlock *source) {
+    /* The original source was appended piece by piece, so it is a copy of the received data.
+       Refer to the received data instead, e.g., a response body in the navigation cache. */
+    const size_t size = size_Block(source);
+    if (d->flags.isPartialSource || size == 0 || size != size_String(&d->origSource) ||
+        constData_Block(source) == constBegin_String(&d->origSource) ||
+        memcmp(constData_Block(source), constBegin_String(&d->origSource), size)) {
+        return;
+    }
+    const iBool isSourceShared = (constBegin_String(&d->source) == constBegin_String(&d->origSource));
+    set_Block(&d->origSource.chars, source);
+    if (isSourceShared && !d->layoutJob) {
+        const char *oldStart = constBegin_String(&d->source);
+        set_String(&d->source, &d->origSource);
+        rebaseSource_GmDocument_(d, oldStart, size);
+    }
+    else {
+        shareUnchangedSource_GmDocument_(d);
+    }
+}
+
 void foldPre_GmDocument(iGmDocument *d, uint16_t preId) {
     if (preId > 0 && preId <= size_Array(&d->preMeta)) {
         iGmPreMeta *meta = at_Array(&d->preMeta, preId - 1);
@@ -2590,21 +3138,15 @@ const iGmPreMeta *preMeta_GmDocument(const iGmDocument *d, uint16_t preId) {
 
 void render_GmDocument(const iGmDocument *d, iRangei visRangeY, iGmDocumentRenderFunc render,
                        void *context) {
-    iBool isInside = iFalse;
     setAnsiFlags_Text(d->theme.ansiEscapes);
-    /* TODO: Check lookup table for quick starting position. */
-    iConstForEach(Array, i, &d->layout) {
-        const iGmRun *run = i.value;
-        if (isInside) {
-            if (top_Rect(run->visBounds) > visRangeY.end) {
-                break;
-            }
-            render(context, run);
-        }
-        else if (bottom_Rect(run->visBounds) >= visRangeY.start) {
-            isInside = iTrue;
-            render(context, run);
+    /* All runs before the first one reaching the visible range can be skipped. */
+    const size_t first = findFirstRunIndex_GmDocument_(d, visBottom_RunIndexKey, visRangeY.start);
+    for (size_t i = first; i < size_Array(&d->layout); i++) {
+        const iGmRun *run = constAt_Array(&d->layout, i);
+        if (i > first && top_Rect(run->visBounds) > visRangeY.end) {
+            break;
         }
+        render(context, run);
     }
     setAnsiFlags_Text(allowAll_AnsiFlag);
 }
@@ -2684,13 +3226,29 @@ iGmRunRange runRange_GmDocument(const iGmDocument *d) {
 }
 
 size_t memorySize_GmDocument(const iGmDocument *d) {
+    const iBool isSourceShared = (constBegin_String(&d->source) == constBegin_String(&d->origSource));
     return size_String(&d->origSource) +
-           size_String(&d->source) +
-           size_Array(&d->layout) * sizeof(iGmRun) +
+           (isSourceShared ? 0 : size_String(&d->source)) +
+           size_Array(&d->layout) * (sizeof(iGmRun) + sizeof(iGmRunIndex)) +
            size_Array(&d->links)  * sizeof(iGmLink) +
            memorySize_Media(d->media);
 }
 
+size_t sharedMemorySize_GmDocument(const iGmDocument *d, const iBlock *data) {
+    if (!data || isEmpty_Block(data)) {
+        return 0;
+    }
+    size_t size = 0;
+    if (constData_Block(data) == constBegin_String(&d->origSource)) {
+        size += size_String(&d->origSource);
+    }
+    if (constBegin_String(&d->source) != constBegin_String(&d->origSource) &&
+        constData_Block(data) == constBegin_String(&d->source)) {
+        size += size_String(&d->source);
+    }
+    return size;
+}
+
 void setWarning_GmDocument(iGmDocument *d, int warning, iBool set) {
     iChangeFlags(d->warnings, warning, set);
 }
@@ -2741,11 +3299,20 @@ iGmRunRange findPreformattedRange_GmDocument(const iGmDocument *d, const iGmRun
 }
 
 const iGmRun *findRun_GmDocument(const iGmDocument *d, iInt2 pos) {
-    /* TODO: Perf optimization likely needed; use a block map? */
     const iGmRun *last = NULL;
     iBool isFirstNonDecoration = iTrue;
-    iConstForEach(Array, i, &d->layout) {
-        const iGmRun *run = i.value;
+    /* Runs that end above the point can be skipped, except for the last one of them, which
+       is the result if nothing closer is found. */
+    size_t start = findFirstRunIndex_GmDocument_(d, hitBottom_RunIndexKey, pos.y + 1);
+    while (start > 0 && ((const iGmRun *) constAt_Array(&d->layout, start - 1))->flags &
+                        decoration_GmRunFlag) {
+        start--;
+    }
+    if (start > 0) {
+        start--;
+    }
+    for (size_t i = start; i < size_Array(&d->layout); i++) {
+        const iGmRun *run = constAt_Array(&d->layout, i);
         if (run->flags & decoration_GmRunFlag) {
             continue;
         }
@@ -2781,8 +3348,21 @@ iRangecc findLoc_GmDocument(const iGmDocument *d, iInt2 pos) {
 }
 
 const iGmRun *findRunAtLoc_GmDocument(const iGmDocument *d, const char *textCStr) {
-    iConstForEach(Array, i, &d->layout) {
-        const iGmRun *run = i.value;
+    /* Binary search for the first run whose text ends past the location. */
+    const iGmRunIndex *index = constData_Array(&d->runIndex);
+    size_t first = 0;
+    size_t last  = size_Array(&d->runIndex);
+    while (first < last) {
+        const size_t mid = first + (last - first) / 2;
+        if (index[mid].textEnd <= textCStr) {
+            first = mid + 1;
+        }
+        else {
+            last = mid;
+        }
+    }
+    for (size_t i = first; i < size_Array(&d->layout); i++) {
+        const iGmRun *run = constAt_Array(&d->layout, i);
         if (run->flags & decoration_GmRunFlag) {
             continue;
         }
@@ -207,11 +207,19 @@ void    setWidth_GmDocument     (iGmDocument *, int width, int canvasWidth);
 iBool   updateWidth_GmDocument  (iGmDocument *, int width, int canvasWidth);
 void    redoLayout_GmDocument   (iGmDocument *);
 void    invalidateLayout_GmDocument(iGmDocument *); /* will have to be redone later */
+iBool   layoutInBackground_GmDocument(iGmDocument *, int width, int canvasWidth); /* returns False if not worthwhile */
+iBool   isLayoutPending_GmDocument(const iGmDocument *);
+iBool   takeBackgroundLayout_GmDocument(iGmDocument *); /* returns True if layout was changed */
+void    cancelBackgroundLayout_GmDocument(iGmDocument *);
+void    waitForBackgroundLayouts_GmDocument(void); /* aborts all; fonts may be unloaded afterwards */
 int     contentWidth_GmDocument (const iGmDocument *); /* may exceed the layout width; unwrappable lines */
 iBool   updateOpenURLs_GmDocument(iGmDocument *);
 void    setUrl_GmDocument       (iGmDocument *, const iString *url);
 void    setSource_GmDocument    (iGmDocument *, const iString *source, int width, int canvasWidth,
                                  enum iGmDocumentUpdate updateType);
+void    appendSource_GmDocument (iGmDocument *, iRangecc source, int width, int canvasWidth,
+                                 enum iGmDocumentUpdate updateType); /* `source` begins with previous source */
+void    shareSource_GmDocument  (iGmDocument *, const iBlock *source); /* complete source received */
 void    setWarning_GmDocument   (iGmDocument *, int warning, iBool set);
 void    foldPre_GmDocument      (iGmDocument *, uint16_t preId);
 
@@ -237,6 +245,7 @@ const iArray *  headings_GmDocument         (const iGmDocument *); /* array of G
 const iString * source_GmDocument           (const iGmDocument *);
 iGmRunRange     runRange_GmDocument         (const iGmDocument *);
 size_t          memorySize_GmDocument       (const iGmDocument *); /* bytes */
+size_t          sharedMemorySize_GmDocument (const iGmDocument *, const iBlock *data); /* bytes shared with `data` */
 int             warnings_GmDocument         (const iGmDocument *);
 
 iRangecc        findText_GmDocument                 (const iGmDocument *, const iString *text, const char *start);
@@ -28,12 +28,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "app.h" /* dataDir_App() */
 #include "mimehooks.h"
 #include "feeds.h"
+#include "profiler.h"
 #include "bookmarks.h"
 #include "ui/text.h"
 #include "resources.h"
 #include "sitespec.h"
 #include "defs.h"
 
+#include <ctype.h>
 #include <errno.h>
 
 #include <the_Foundation/archive.h>
@@ -41,6 +43,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/fileinfo.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
+#include <the_Foundation/ptrarray.h>
 #include <the_Foundation/regexp.h>
 #include <the_Foundation/socket.h>
 #include <the_Foundation/tlsrequest.h>
@@ -176,6 +179,9 @@ struct Impl_GmRequest {
     iGuppy *             guppy;
     iSocket *            plainSocket; /* non-TLS socket for Spartan, Nex */
     iGmResponse *        resp;
+    iPtrArray            bodyChunks; /* received data not yet joined to `resp->body` */
+    size_t               bodyChunksSize;
+    size_t               discardedBodySize; /* received but no longer in `resp->body` */
     iBool                isProxy;
     iBool                isFilterEnabled;
     iBool                isRespLocked;
@@ -222,41 +228,104 @@ static void checkServerCertificate_GmRequest_(iGmRequest *d) {
     }
 }
 
-static int processIncomingData_GmRequest_(iGmRequest *d, const iBlock *data) {
+/* Received body data is kept as a chain of blocks, as returned by the socket, and only joined
+   into the response body when someone needs to look at it. Mutex must be locked. */
+
+static void appendBodyChunk_GmRequest_(iGmRequest *d, iBlock *chunk) {
+    if (isEmpty_Block(chunk)) {
+        delete_Block(chunk);
+        return;
+    }
+    d->bodyChunksSize += size_Block(chunk);
+    pushBack_PtrArray(&d->bodyChunks, chunk); /* takes ownership */
+}
+
+static void flushBody_GmRequest_(iGmRequest *d) {
+    if (isEmpty_PtrArray(&d->bodyChunks)) {
+        return;
+    }
+    iBlock *body = &d->resp->body;
+    if (isEmpty_Block(body) && size_PtrArray(&d->bodyChunks) == 1) {
+        set_Block(body, front_PtrArray(&d->bodyChunks)); /* shares the data */
+    }
+    else {
+        reserve_Block(body, size_Block(body) + d->bodyChunksSize);
+        iConstForEach(PtrArray, i, &d->bodyChunks) {
+            append_Block(body, i.ptr);
+        }
+    }
+    iForEach(PtrArray, j, &d->bodyChunks) {
+        delete_Block(j.ptr);
+    }
+    clear_PtrArray(&d->bodyChunks);
+    d->bodyChunksSize = 0;
+}
+
+static void clearBody_GmRequest_(iGmRequest *d) {
+    iForEach(PtrArray, i, &d->bodyChunks) {
+        delete_Block(i.ptr);
+    }
+    clear_PtrArray(&d->bodyChunks);
+    d->bodyChunksSize = 0;
+    clear_Block(&d->resp->body);
+}
+
+static size_t headerLineEnd_(const iString *partialHeader, iRangecc data) {
+    /* Returns the position in `data` following the CRLF that ends the header line. The CR may
+       have arrived at the end of the previous read. */
+    for (const char *pos = data.start; pos < data.end; pos++) {
+        pos = memchr(pos, '\n', data.end - pos);
+        if (!pos) {
+            break;
+        }
+        if (pos > data.start ? pos[-1] == '\r' : endsWith_String(partialHeader, "\r")) {
+            return pos + 1 - data.start;
+        }
+    }
+    return iInvalidPos;
+}
+
+static int parseStatusLine_(iString *header) {
+    /* Gemini: <STATUS><SPACE><META>, where the status has two digits. Returns zero if the
+       header is malformed, otherwise leaves just the <META> in `header`. */
+    /* TODO: Empty <META> means no <SPACE>? Not according to the spec? */
+    const char *line = constBegin_String(header);
+    if (size_String(header) < 2 || !isdigit((unsigned char) line[0]) ||
+        !isdigit((unsigned char) line[1])) {
+        return 0;
+    }
+    const int code = (line[0] - '0') * 10 + (line[1] - '0');
+    remove_Block(&header->chars, 0, 2);
+    trimStart_String(header);
+    return code;
+}
+
+static int processIncomingData_GmRequest_(iGmRequest *d, iBlock *data) {
+    /* Takes ownership of `data`. */
     iBool        notifyUpdate = iFalse;
     iBool        notifyDone   = iFalse;
     iGmResponse *resp         = d->resp;
     if (d->state == receivingHeader_GmRequestState) {
-        appendCStrN_String(&resp->meta, constData_Block(data), size_Block(data));
-        /* Check if the header line is complete. */
-        size_t endPos = indexOfCStr_String(&resp->meta, "\r\n");
-        if (endPos != iInvalidPos) {
-            /* Move remainder to the body. */
-            setData_Block(&resp->body,
-                          constBegin_String(&resp->meta) + endPos + 2,
-                          size_String(&resp->meta) - endPos - 2);
-            remove_Block(&resp->meta.chars, endPos, iInvalidSize);
-            /* Parse and remove the code. */
-            iRegExp *metaPattern = new_RegExp("^([0-9][0-9])(( )(.*))?", 0);
-            /* TODO: Empty <META> means no <SPACE>? Not according to the spec? */
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            int code = 0;
-            if (matchString_RegExp(metaPattern, &resp->meta, &m)) {
-                code = atoi(capturedRange_RegExpMatch(&m, 1).start);
-                remove_Block(&resp->meta.chars,
-                             0,
-                             capturedRange_RegExpMatch(&m, 1).end -
-                                 constBegin_String(&resp->meta)); /* leave just the <META> */
-                trimStart_String(&resp->meta);
-            }
+        const size_t headerEnd = headerLineEnd_(&resp->meta, range_Block(data));
+        if (headerEnd == iInvalidPos) {
+            append_Block(&resp->meta.chars, data);
+            delete_Block(data);
+        }
+        else {
+            appendData_Block(&resp->meta.chars, constData_Block(data), headerEnd);
+            truncate_Block(&resp->meta.chars, size_String(&resp->meta) - 2); /* CRLF */
+            /* The remainder is the beginning of the body. */
+            remove_Block(data, 0, headerEnd);
+            const int code = parseStatusLine_(&resp->meta);
             if (code == 0) {
+                delete_Block(data);
                 clear_String(&resp->meta);
                 resp->statusCode = invalidHeader_GmStatusCode;
                 d->state         = finished_GmRequestState;
                 notifyDone       = iTrue;
             }
             else {
+                appendBodyChunk_GmRequest_(d, data);
                 if (code == success_GmStatusCode && isEmpty_String(&resp->meta)) {
                     setCStr_String(&resp->meta, "text/gemini; charset=utf-8"); /* default */
                 }
@@ -268,13 +337,15 @@ static int processIncomingData_GmRequest_(iGmRequest *d, const iBlock *data) {
                 }
             }
             checkServerCertificate_GmRequest_(d);
-            iRelease(metaPattern);
         }
     }
     else if (d->state == receivingBody_GmRequestState) {
-        append_Block(&resp->body, data);
+        appendBodyChunk_GmRequest_(d, data);
         notifyUpdate = iTrue;
     }
+    else {
+        delete_Block(data);
+    }
     return (notifyUpdate ? 1 : 0) | (notifyDone ? 2 : 0);
 }
 
@@ -287,13 +358,14 @@ static void readIncoming_GmRequest_(iGmRequest *d, iTlsRequest *req) {
         unlock_Mutex(d->mtx);
         return;
     }
+    beginZone_Profiler("readIncoming_GmRequest_");
     iBlock *  data         = readAll_TlsRequest(req);
     const int ubits        = processIncomingData_GmRequest_(d, data);
     iBool     notifyUpdate = (ubits & 1) != 0;
     iBool     notifyDone   = (ubits & 2) != 0;
     initCurrent_Time(&resp->when);
-    delete_Block(data);
     unlock_Mutex(d->mtx);
+    endZone_Profiler();
     if (notifyUpdate && !d->isRespFiltered) {
         const iBool allowed = exchange_Atomic(&d->allowUpdate, iFalse);
         if (allowed) {
@@ -311,7 +383,7 @@ static void applyFilter_GmRequest_(iGmRequest *d) {
     if (xbody) {
         lock_Mutex(d->mtx);
         clear_String(&d->resp->meta);
-        clear_Block(&d->resp->body);
+        clearBody_GmRequest_(d);
         d->state = receivingHeader_GmRequestState;
         processIncomingData_GmRequest_(d, xbody);
         d->state = finished_GmRequestState;
@@ -328,6 +400,7 @@ static void requestFinished_GmRequest_(iGmRequest *d, iTlsRequest *req) {
         delete_Block(data);
         initCurrent_Time(&d->resp->when);
     }
+    flushBody_GmRequest_(d);
     if (d->state == receivingHeader_GmRequestState &&
         status_TlsRequest(req) != error_TlsRequestStatus) {
         d->state = failure_GmRequestState;
@@ -458,6 +531,7 @@ static void plainSocketDisconnected_GmRequest_(iGmRequest *d, iSocket *socket) {
         d->state = finished_GmRequestState;
         notify = iTrue;
     }
+    flushBody_GmRequest_(d);
     unlock_Mutex(d->mtx);
     if (notify) {
         iNotifyAudience(d, finished, GmRequestFinished);
@@ -474,7 +548,7 @@ static void plainSocketError_GmRequest_(iGmRequest *d, iSocket *socket, int erro
     d->state = failure_GmRequestState;
     d->resp->statusCode = tlsFailure_GmStatusCode; /* TODO: add a plain socket error message */
     format_String(&d->resp->meta, "%s (errno %d)", msg, error);
-    clear_Block(&d->resp->body);
+    clearBody_GmRequest_(d);
     unlock_Mutex(d->mtx);
     iNotifyAudience(d, finished, GmRequestFinished);
 }
@@ -484,12 +558,18 @@ static void gopherRead_GmRequest_(iGmRequest *d, iSocket *socket) {
     lock_Mutex(d->mtx);
     d->resp->statusCode = success_GmStatusCode;
     iBlock *data = readAll_Socket(socket);
-    if (!isEmpty_Block(data)) {
-        if (processResponse_Gopher(&d->gopher, data)) {
-            notifyUpdate = iTrue;
-        }
+    if (isEmpty_Block(data)) {
+        delete_Block(data);
+    }
+    else if (!isMenu_Gopher(&d->gopher)) {
+        /* Passed through as-is. */
+        appendBodyChunk_GmRequest_(d, data);
+        notifyUpdate = iTrue;
+    }
+    else {
+        notifyUpdate = processResponse_Gopher(&d->gopher, data);
+        delete_Block(data);
     }
-    delete_Block(data);
     unlock_Mutex(d->mtx);
     if (notifyUpdate) {
         iNotifyAudience(d, updated, GmRequestUpdated);
@@ -520,11 +600,8 @@ static void nexRead_GmRequest_(iGmRequest *d, iSocket *socket) {
     lock_Mutex(d->mtx);
     d->resp->statusCode = success_GmStatusCode;
     iBlock *data = readAll_Socket(socket);
-    if (!isEmpty_Block(data)) {
-        append_Block(&d->resp->body, data);
-        notifyUpdate = iTrue;
-    }
-    delete_Block(data);
+    notifyUpdate = !isEmpty_Block(data);
+    appendBodyChunk_GmRequest_(d, data);
     unlock_Mutex(d->mtx);
     if (notifyUpdate) {
         iNotifyAudience(d, updated, GmRequestUpdated);
@@ -581,7 +658,7 @@ static void guppyTimeout_GmRequest_(iGmRequest *d) {
     d->state = failure_GmRequestState;
     d->resp->statusCode = temporaryFailure_GmStatusCode;
     setCStr_String(&d->resp->meta, strerror(ETIMEDOUT));
-    clear_Block(&d->resp->body);
+    clearBody_GmRequest_(d);
     unlock_Mutex(d->mtx);
     iNotifyAudience(d, finished, GmRequestFinished);
 }
@@ -607,71 +684,76 @@ static void beginGuppyConnection_GmRequest_(iGmRequest *d, const iString *host,
     open_Guppy(d->guppy, host, port);
 }
 
+static int parseSpartanStatusLine_(iString *header) {
+    /* Spartan: <DIGIT><SPACE><META>. Returns zero if the header is malformed, otherwise leaves
+       just the <META> in `header`. */
+    const char *line = constBegin_String(header);
+    if (size_String(header) < 2 || !isdigit((unsigned char) line[0]) || line[1] != ' ') {
+        return 0;
+    }
+    const int code = line[0] - '0';
+    remove_Block(&header->chars, 0, 2);
+    const size_t lineEnd = indexOf_String(header, '\n');
+    if (lineEnd != iInvalidPos) {
+        truncate_Block(&header->chars, lineEnd);
+    }
+    return code;
+}
+
 static void spartanRead_GmRequest_(iGmRequest *d, iSocket *socket) {
     iBool notifyUpdate = iFalse;
     iBool notifyDone   = iFalse;
     lock_Mutex(d->mtx);
     iBlock *data = readAll_Socket(socket);
-    if (!isEmpty_Block(data)) {
-        if (d->state == receivingHeader_GmRequestState) {
+    if (d->state == receivingHeader_GmRequestState) {
+        const size_t headerEnd = headerLineEnd_(&d->resp->meta, range_Block(data));
+        if (headerEnd == iInvalidPos) {
             append_Block(&d->resp->meta.chars, data);
-            size_t crlf = indexOfCStr_String(&d->resp->meta, "\r\n");
-            if (crlf != iInvalidPos) {
-                setData_Block(&d->resp->body, constBegin_String(&d->resp->meta) + crlf + 2,
-                              size_Block(&d->resp->meta.chars) - crlf - 2);
-                if (!isEmpty_Block(&d->resp->body)) {
-                    notifyUpdate = iTrue;
-                }
-                truncate_Block(&d->resp->meta.chars, crlf);
-                d->state = receivingBody_GmRequestState;
-                iRegExp *metaPattern = new_RegExp("^([0-9]) (.*)", 0);
-                iRegExpMatch m;
-                init_RegExpMatch(&m);
-                if (matchString_RegExp(metaPattern, &d->resp->meta, &m)) {
-                    switch (toInt_String(collect_String(captured_RegExpMatch(&m, 1)))) {
-                        case 2:
-                            d->resp->statusCode = success_GmStatusCode;
-                            set_String(&d->resp->meta, collect_String(captured_RegExpMatch(&m, 2)));
-                            break;
-                        case 3:
-                            d->resp->statusCode = redirectTemporary_GmStatusCode;
-                            d->state = finished_GmRequestState;
-                            set_String(&d->resp->meta, collect_String(captured_RegExpMatch(&m, 2)));
-                            notifyDone = iTrue;
-                            break;
-                        case 4:
-                            d->resp->statusCode = badRequest_GmStatusCode;
-                            d->state = finished_GmRequestState;
-                            set_String(&d->resp->meta, collect_String(captured_RegExpMatch(&m, 2)));
-                            notifyDone = iTrue;
-                            break;
-                        case 5:
-                            d->resp->statusCode = permanentFailure_GmStatusCode;
-                            d->state = finished_GmRequestState;
-                            set_String(&d->resp->meta, collect_String(captured_RegExpMatch(&m, 2)));
-                            notifyDone = iTrue;
-                            break;
-                        default:
-                            d->resp->statusCode = invalidHeader_GmStatusCode;
-                            d->state            = finished_GmRequestState;
-                            notifyDone          = iTrue;
-                            break;
-                    }
-                }
-                else {
+            delete_Block(data);
+        }
+        else {
+            appendData_Block(&d->resp->meta.chars, constData_Block(data), headerEnd);
+            truncate_Block(&d->resp->meta.chars, size_String(&d->resp->meta) - 2); /* CRLF */
+            remove_Block(data, 0, headerEnd);
+            if (!isEmpty_Block(data)) {
+                notifyUpdate = iTrue;
+            }
+            appendBodyChunk_GmRequest_(d, data);
+            d->state = receivingBody_GmRequestState;
+            switch (parseSpartanStatusLine_(&d->resp->meta)) {
+                case 2:
+                    d->resp->statusCode = success_GmStatusCode;
+                    break;
+                case 3:
+                    d->resp->statusCode = redirectTemporary_GmStatusCode;
+                    d->state = finished_GmRequestState;
+                    notifyDone = iTrue;
+                    break;
+                case 4:
+                    d->resp->statusCode = badRequest_GmStatusCode;
+                    d->state = finished_GmRequestState;
+                    notifyDone = iTrue;
+                    break;
+                case 5:
+                    d->resp->statusCode = permanentFailure_GmStatusCode;
+                    d->state = finished_GmRequestState;
+                    notifyDone = iTrue;
+                    break;
+                default:
                     d->resp->statusCode = invalidHeader_GmStatusCode;
                     d->state            = finished_GmRequestState;
                     notifyDone          = iTrue;
-                }
-                iRelease(metaPattern);
+                    break;
             }
         }
-        else if (d->state == receivingBody_GmRequestState) {
-            append_Block(&d->resp->body, data);
-            notifyUpdate = iTrue;
-        }
     }
-    delete_Block(data);
+    else if (d->state == receivingBody_GmRequestState && !isEmpty_Block(data)) {
+        appendBodyChunk_GmRequest_(d, data);
+        notifyUpdate = iTrue;
+    }
+    else {
+        delete_Block(data);
+    }
     unlock_Mutex(d->mtx);
     if (notifyUpdate) {
         iNotifyAudience(d, updated, GmRequestUpdated);
@@ -727,6 +809,9 @@ void init_GmRequest(iGmRequest *d, iGmCerts *certs) {
     init_Gopher(&d->gopher);
     d->guppy        = NULL;
     d->plainSocket  = NULL;
+    init_PtrArray(&d->bodyChunks);
+    d->bodyChunksSize = 0;
+    d->discardedBodySize = 0;
     d->upload       = NULL;
     d->certs        = certs;
     d->req          = NULL;
@@ -761,6 +846,8 @@ void deinit_GmRequest(iGmRequest *d) {
     iRelease(d->plainSocket);
     delete_Audience(d->finished);
     delete_Audience(d->updated);
+    clearBody_GmRequest_(d);
+    deinit_PtrArray(&d->bodyChunks);
     delete_GmResponse(d->resp);
     deinit_String(&d->url);
     delete_Mutex(d->mtx);
@@ -1170,6 +1257,7 @@ void submit_GmRequest(iGmRequest *d) {
     set_Atomic(&d->allowUpdate, iTrue);
     iGmResponse *resp = d->resp;
     clear_GmResponse(resp);
+    d->discardedBodySize = 0;
 #if !defined (NDEBUG) && !defined (iPlatformTerminal)
     fprintf(stderr, "[GmRequest] URL: %s\n", cstr_String(&d->url)); fflush(stderr);
 #endif
@@ -1270,6 +1358,7 @@ iGmResponse *lockResponse_GmRequest(iGmRequest *d) {
     iAssert(!d->isRespLocked);
     lock_Mutex(d->mtx);
     d->isRespLocked = iTrue;
+    flushBody_GmRequest_(d);
     return d->resp;
 }
 
@@ -1316,15 +1405,29 @@ const iString *meta_GmRequest(const iGmRequest *d) {
 
 const iBlock *body_GmRequest(const iGmRequest *d) {
     iAssert(isFinished_GmRequest(d));
+    iGuardMutex(d->mtx, flushBody_GmRequest_(iConstCast(iGmRequest *, d)));
     return &d->resp->body;
 }
 
 size_t bodySize_GmRequest(const iGmRequest *d) {
     size_t size;
-    iGuardMutex(d->mtx, size = size_Block(&d->resp->body));
+    iGuardMutex(d->mtx,
+                size = d->discardedBodySize + size_Block(&d->resp->body) + d->bodyChunksSize);
     return size;
 }
 
+void discardBody_GmRequest(iGmRequest *d) {
+    iAssert(d->isRespLocked);
+    d->discardedBodySize += size_Block(&d->resp->body);
+    clear_Block(&d->resp->body);
+}
+
+iBool isBodyDiscarded_GmRequest(const iGmRequest *d) {
+    size_t size;
+    iGuardMutex(d->mtx, size = d->discardedBodySize);
+    return size > 0;
+}
+
 const iString *url_GmRequest(const iGmRequest *d) {
     return &d->url;
 }
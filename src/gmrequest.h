@@ -88,7 +88,9 @@ iBool               filtersEnabled_GmRequest    (const iGmRequest *);
 enum iGmStatusCode  status_GmRequest            (const iGmRequest *);
 const iString *     meta_GmRequest              (const iGmRequest *);
 const iBlock  *     body_GmRequest              (const iGmRequest *);
-size_t              bodySize_GmRequest          (const iGmRequest *);
+size_t              bodySize_GmRequest          (const iGmRequest *); /* includes discarded */
+void                discardBody_GmRequest       (iGmRequest *); /* response must be locked */
+iBool               isBodyDiscarded_GmRequest   (const iGmRequest *);
 const iString *     url_GmRequest               (const iGmRequest *);
 iBool               isProxy_GmRequest           (const iGmRequest *); /* was sent to a proxy */
 const iAddress *    address_GmRequest           (const iGmRequest *);
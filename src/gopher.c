@@ -330,7 +330,7 @@ void cancel_Gopher(iGopher *d) {
 
 iBool processResponse_Gopher(iGopher *d, const iBlock *data) {
     iBool changed = iFalse;
-    if (d->type == '1' || d->type == '7') {
+    if (isMenu_Gopher(d)) {
         append_Block(&d->source, data);
         if (convertSource_Gopher_(d)) {
             changed = iTrue;
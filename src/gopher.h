@@ -41,6 +41,10 @@ struct Impl_Gopher {
 
 iDeclareTypeConstruction(Gopher)
 
+iLocalDef iBool isMenu_Gopher(const iGopher *d) {
+    return d->type == '1' || d->type == '7'; /* converted to Gemtext; other types are passed through */
+}
+
 void    open_Gopher             (iGopher *, const iString *url);
 iBool   processResponse_Gopher  (iGopher *, const iBlock *data);
 void    cancel_Gopher           (iGopher *);
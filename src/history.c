@@ -21,6 +21,7 @@ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "history.h"
+#include "responsecache.h"
 #include "ui/root.h"
 #include "app.h"
 
@@ -28,7 +29,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/stringset.h>
+#include <the_Foundation/thread.h>
+#include <ctype.h>
 #include <math.h>
+#include <stdlib.h>
 
 static const size_t maxStack_History_ = 50; /* back/forward navigable items */
 
@@ -38,6 +42,7 @@ void init_RecentUrl(iRecentUrl *d) {
     d->cachedResponse = NULL;
     d->cachedDoc      = NULL;
     d->flags          = 0;
+    d->contentId      = 0;
     init_Block(&d->setIdentity, 0);
 }
 
@@ -57,6 +62,7 @@ iRecentUrl *copy_RecentUrl(const iRecentUrl *d) {
     copy->cachedResponse = d->cachedResponse ? copy_GmResponse(d->cachedResponse) : NULL;
     copy->cachedDoc      = ref_Object(d->cachedDoc);
     copy->flags          = d->flags;
+    copy->contentId      = 0; /* IDs are specific to a History */
     set_Block(&copy->setIdentity, &d->setIdentity);
     return copy;
 }
@@ -73,17 +79,306 @@ size_t cacheSize_RecentUrl(const iRecentUrl *d) {
 size_t memorySize_RecentUrl(const iRecentUrl *d) {
     size_t size = cacheSize_RecentUrl(d);
     if (d->cachedDoc) {
-        size += memorySize_GmDocument(d->cachedDoc);
+        /* The document may refer to the cached response body instead of having a copy. */
+        size += memorySize_GmDocument(d->cachedDoc) -
+                sharedMemorySize_GmDocument(d->cachedDoc,
+                                            d->cachedResponse ? &d->cachedResponse->body : NULL);
     }
     return size;
 }
 
+static iBool isIndexable_RecentUrl_(const iRecentUrl *d) {
+    const iGmResponse *resp = d->cachedResponse;
+    return resp && category_GmStatusCode(resp->statusCode) == categorySuccess_GmStatusCode &&
+           indexOfCStrSc_String(&resp->meta, "text/", &iCaseInsensitive) != iInvalidPos;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+/* Inverted index of the words in cached responses, so they can be searched without scanning
+   through all the content. Each word (lowercased) has a list of postings, one per document
+   where the word appears. Documents are identified by `contentId` of RecentUrl. When a cached
+   response goes away, its postings are left in place as stale until there are enough of them
+   to make compacting the index worthwhile. */
+
+iDeclareType(ContentPosting)
+iDeclareType(ContentTerm)
+iDeclareType(ContentDoc)
+iDeclareType(ContentToken)
+iDeclareType(ContentIndex)
+
+struct Impl_ContentPosting {
+    uint32_t docId;
+    uint32_t offset; /* first occurrence in the response body */
+    uint16_t length; /* of the first occurrence, in bytes */
+    uint16_t count;  /* number of occurrences */
+};
+
+struct Impl_ContentTerm {
+    iBlock token;    /* lowercase UTF-8 */
+    iArray postings; /* ContentPostings in ascending docId order */
+};
+
+struct Impl_ContentDoc {
+    uint32_t docId;
+    size_t   numPostings;
+};
+
+struct Impl_ContentToken {
+    const char *token; /* points to the lowercased text */
+    uint16_t    size;
+    uint16_t    length; /* in the original text */
+    uint32_t    pos;    /* in the lowercased text */
+    uint32_t    offset; /* in the original text */
+};
+
+struct Impl_ContentIndex {
+    iPtrArray terms;  /* ContentTerms sorted by token */
+    iArray    docs;   /* ContentDocs of the indexed responses, in ascending docId order */
+    uint32_t  lastDocId;
+    size_t    numPostings;
+    size_t    numStalePostings;
+};
+
+enum { maxTokenSize_ContentIndex_ = 64 };
+
+static iContentTerm *new_ContentTerm_(const char *token, size_t size) {
+    iContentTerm *d = iMalloc(ContentTerm);
+    init_Block(&d->token, 0);
+    setData_Block(&d->token, token, size);
+    init_Array(&d->postings, sizeof(iContentPosting));
+    return d;
+}
+
+static void delete_ContentTerm_(iContentTerm *d) {
+    deinit_Array(&d->postings);
+    deinit_Block(&d->token);
+    free(d);
+}
+
+static int cmpToken_(const char *a, size_t aSize, const char *b, size_t bSize) {
+    const int cmp = memcmp(a, b, iMin(aSize, bSize));
+    return cmp ? cmp : iCmp(aSize, bSize);
+}
+
+static int cmp_ContentToken_(const void *a, const void *b) {
+    const iContentToken *i = a, *j = b;
+    const int cmp = cmpToken_(i->token, i->size, j->token, j->size);
+    return cmp ? cmp : iCmp(i->offset, j->offset);
+}
+
+static int cmpDocId_ContentDoc_(const void *a, const void *b) {
+    return iCmp(((const iContentDoc *) a)->docId, ((const iContentDoc *) b)->docId);
+}
+
+static void init_ContentIndex(iContentIndex *d) {
+    init_PtrArray(&d->terms);
+    init_Array(&d->docs, sizeof(iContentDoc));
+    d->lastDocId        = 0;
+    d->numPostings      = 0;
+    d->numStalePostings = 0;
+}
+
+static void clear_ContentIndex(iContentIndex *d) {
+    iForEach(PtrArray, i, &d->terms) {
+        delete_ContentTerm_(i.ptr);
+    }
+    clear_PtrArray(&d->terms);
+    clear_Array(&d->docs);
+    d->numPostings      = 0;
+    d->numStalePostings = 0;
+}
+
+static void deinit_ContentIndex(iContentIndex *d) {
+    clear_ContentIndex(d);
+    deinit_Array(&d->docs);
+    deinit_PtrArray(&d->terms);
+}
+
+static const iContentDoc *findDoc_ContentIndex_(const iContentIndex *d, uint32_t docId) {
+    const iContentDoc key = { .docId = docId };
+    return bsearch(&key,
+                   constData_Array(&d->docs),
+                   size_Array(&d->docs),
+                   sizeof(iContentDoc),
+                   cmpDocId_ContentDoc_);
+}
+
+static size_t lowerBound_ContentIndex_(const iContentIndex *d, const char *token, size_t size) {
+    size_t lo = 0, hi = size_PtrArray(&d->terms);
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        const iContentTerm *term = constAt_PtrArray(&d->terms, mid);
+        if (cmpToken_(constData_Block(&term->token), size_Block(&term->token), token, size) < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void compact_ContentIndex_(iContentIndex *d) {
+    /* Remove the postings of documents that are no longer indexed. */
+    iPtrArray live;
+    init_PtrArray(&live);
+    iForEach(PtrArray, i, &d->terms) {
+        iContentTerm *term = i.ptr;
+        iContentPosting *postings = data_Array(&term->postings);
+        size_t numLive = 0;
+        for (size_t j = 0; j < size_Array(&term->postings); j++) {
+            if (findDoc_ContentIndex_(d, postings[j].docId)) {
+                postings[numLive++] = postings[j];
+            }
+        }
+        if (numLive == 0) {
+            delete_ContentTerm_(term);
+            continue;
+        }
+        resize_Array(&term->postings, numLive);
+        pushBack_PtrArray(&live, term);
+    }
+    iSwap(iPtrArray, d->terms, live);
+    deinit_PtrArray(&live);
+    d->numPostings -= d->numStalePostings;
+    d->numStalePostings = 0;
+}
+
+static void remove_ContentIndex(iContentIndex *d, uint32_t docId) {
+    const iContentDoc *doc = findDoc_ContentIndex_(d, docId);
+    if (doc) {
+        d->numStalePostings += doc->numPostings;
+        remove_Array(&d->docs, doc - (const iContentDoc *) constData_Array(&d->docs));
+        if (d->numStalePostings > d->numPostings / 2) {
+            compact_ContentIndex_(d);
+        }
+    }
+}
+
+static void tokenize_ContentIndex_(iRangecc text, iBlock *lowered, iArray *tokens) {
+    const char *pos = text.start;
+    iContentToken tok;
+    iBool inToken = iFalse;
+    iZap(tok);
+    while (pos < text.end) {
+        const char *chStart = pos;
+        iChar ch = *(const uint8_t *) pos;
+        if (ch < 0x80) {
+            pos++;
+        }
+        else {
+            const int len = decodeBytes_MultibyteChar(pos, text.end, &ch);
+            if (len <= 0) {
+                pos++;
+                ch = 0;
+            }
+            else {
+                pos += len;
+            }
+        }
+        const iBool isWordChar = (ch < 0x80 ? isalnum((int) ch) : isAlphaNumeric_Char(ch)) != 0;
+        if (isWordChar) {
+            if (!inToken) {
+                inToken    = iTrue;
+                tok.pos    = (uint32_t) size_Block(lowered);
+                tok.offset = (uint32_t) (chStart - text.start);
+            }
+            if (size_Block(lowered) - tok.pos < maxTokenSize_ContentIndex_) {
+                if (ch < 0x80) {
+                    appendData_Block(lowered, &(char){ (char) tolower((int) ch) }, 1);
+                }
+                else {
+                    iMultibyteChar mb;
+                    init_MultibyteChar(&mb, lower_Char(ch));
+                    appendData_Block(lowered, mb.bytes, strlen(mb.bytes));
+                }
+            }
+        }
+        if (inToken && (!isWordChar || pos >= text.end)) {
+            inToken    = iFalse;
+            tok.size   = (uint16_t) (size_Block(lowered) - tok.pos);
+            tok.length = (uint16_t) iMin((isWordChar ? pos : chStart) - text.start - tok.offset,
+                                         0xffff);
+            pushBack_Array(tokens, &tok);
+        }
+    }
+    /* Now that the text is complete, the token pointers will remain valid. */
+    iForEach(Array, i, tokens) {
+        iContentToken *t = i.value;
+        t->token = cstr_Block(lowered) + t->pos;
+    }
+}
+
+static uint32_t add_ContentIndex(iContentIndex *d, const iArray *tokens) {
+    /* `tokens` must be sorted with cmp_ContentToken_. */
+    const uint32_t docId = ++d->lastDocId;
+    /* Merge the document's sorted terms with the index. */
+    iPtrArray merged;
+    init_PtrArray(&merged);
+    const iContentToken *toks = constData_Array(tokens);
+    const size_t numToks = size_Array(tokens);
+    size_t termPos = 0;
+    size_t numPostings = 0;
+    for (size_t i = 0; i < numToks; ) {
+        /* Occurrences of the same token are consecutive, in order of appearance. */
+        size_t j = i + 1;
+        while (j < numToks &&
+               !cmpToken_(toks[i].token, toks[i].size, toks[j].token, toks[j].size)) {
+            j++;
+        }
+        while (termPos < size_PtrArray(&d->terms)) {
+            const iContentTerm *term = constAt_PtrArray(&d->terms, termPos);
+            if (cmpToken_(constData_Block(&term->token), size_Block(&term->token),
+                          toks[i].token, toks[i].size) >= 0) {
+                break;
+            }
+            pushBack_PtrArray(&merged, term);
+            termPos++;
+        }
+        iContentTerm *term = NULL;
+        if (termPos < size_PtrArray(&d->terms)) {
+            term = at_PtrArray(&d->terms, termPos);
+            if (!cmpToken_(constData_Block(&term->token), size_Block(&term->token),
+                           toks[i].token, toks[i].size)) {
+                termPos++;
+            }
+            else {
+                term = NULL;
+            }
+        }
+        if (!term) {
+            term = new_ContentTerm_(toks[i].token, toks[i].size);
+        }
+        pushBack_Array(&term->postings,
+                       &(iContentPosting){ .docId  = docId,
+                                           .offset = toks[i].offset,
+                                           .length = toks[i].length,
+                                           .count  = (uint16_t) iMin(j - i, 0xffff) });
+        pushBack_PtrArray(&merged, term);
+        numPostings++;
+        i = j;
+    }
+    for (; termPos < size_PtrArray(&d->terms); termPos++) {
+        pushBack_PtrArray(&merged, at_PtrArray(&d->terms, termPos));
+    }
+    iSwap(iPtrArray, d->terms, merged);
+    deinit_PtrArray(&merged);
+    pushBack_Array(&d->docs, &(iContentDoc){ docId, numPostings });
+    d->numPostings += numPostings;
+    return docId;
+}
+
 /*----------------------------------------------------------------------------------------------*/
 
 struct Impl_History {
     iMutex *mtx;
     iArray recent;    /* TODO: should be specific to a DocumentWidget */
     size_t recentPos; /* zero at the latest item */
+    iContentIndex index; /* words in cached responses */
+    iThread *indexer;    /* indexes cached responses in the background */
+    iBool    isIndexing;
+    iBool    stopIndexing;
 };
 
 iDefineTypeConstruction(History)
@@ -92,16 +387,106 @@ void init_History(iHistory *d) {
     d->mtx = new_Mutex();
     init_Array(&d->recent, sizeof(iRecentUrl));
     d->recentPos = 0;
+    init_ContentIndex(&d->index);
+    d->indexer      = NULL;
+    d->isIndexing   = iFalse;
+    d->stopIndexing = iFalse;
 }
 
 void deinit_History(iHistory *d) {
+    lock_Mutex(d->mtx);
+    d->stopIndexing = iTrue;
+    iThread *indexer = d->indexer;
+    d->indexer = NULL;
+    unlock_Mutex(d->mtx);
+    if (indexer) {
+        join_Thread(indexer);
+        iRelease(indexer);
+    }
     iGuardMutex(d->mtx, {
         clear_History(d);
         deinit_Array(&d->recent);
+        deinit_ContentIndex(&d->index);
     });
     delete_Mutex(d->mtx);
 }
 
+static iThreadResult index_History_(iThread *thread) {
+    /* Responses are tokenized one at a time with the mutex unlocked, so the history remains
+       usable while a large backlog is being indexed. */
+    iHistory *d = userData_Thread(thread);
+    for (;;) {
+        const iGmResponse *resp = NULL;
+        iBlock body;
+        lock_Mutex(d->mtx);
+        if (!d->stopIndexing) {
+            iConstForEach(Array, i, &d->recent) {
+                const iRecentUrl *item = i.value;
+                if (!item->contentId && isIndexable_RecentUrl_(item)) {
+                    resp = item->cachedResponse;
+                    initCopy_Block(&body, &resp->body); /* shares the data */
+                    break;
+                }
+            }
+        }
+        if (!resp) {
+            d->isIndexing = iFalse;
+            unlock_Mutex(d->mtx);
+            break;
+        }
+        unlock_Mutex(d->mtx);
+        iBlock lowered;
+        iArray tokens;
+        init_Block(&lowered, 0);
+        init_Array(&tokens, sizeof(iContentToken));
+        tokenize_ContentIndex_(range_Block(&body), &lowered, &tokens);
+        sort_Array(&tokens, cmp_ContentToken_);
+        lock_Mutex(d->mtx);
+        iForEach(Array, j, &d->recent) {
+            iRecentUrl *item = j.value;
+            /* The response may have been replaced or released meanwhile. */
+            if (item->cachedResponse == resp && !item->contentId &&
+                constData_Block(&resp->body) == constData_Block(&body)) {
+                item->contentId = add_ContentIndex(&d->index, &tokens);
+                break;
+            }
+        }
+        unlock_Mutex(d->mtx);
+        deinit_Array(&tokens);
+        deinit_Block(&lowered);
+        deinit_Block(&body);
+    }
+    return 0;
+}
+
+static void startIndexing_History_(iHistory *d) {
+    /* Mutex must be locked. */
+    if (d->isIndexing || d->stopIndexing) {
+        return;
+    }
+    if (d->indexer) {
+        join_Thread(d->indexer); /* already exiting */
+        iRelease(d->indexer);
+    }
+    d->indexer = new_Thread(index_History_);
+    setUserData_Thread(d->indexer, d);
+    d->isIndexing = iTrue;
+    start_Thread(d->indexer);
+}
+
+static void forgetContent_History_(iHistory *d, iRecentUrl *item) {
+    if (item->contentId) {
+        remove_ContentIndex(&d->index, item->contentId);
+        item->contentId = 0;
+    }
+}
+
+static void releaseCachedResponse_History_(iHistory *d, iRecentUrl *item) {
+    forgetContent_History_(d, item);
+    delete_GmResponse(item->cachedResponse);
+    item->cachedResponse = NULL;
+}
+
 iHistory *copy_History(const iHistory *d) {
     lock_Mutex(d->mtx);
     iHistory *copy = new_History();
@@ -109,6 +494,7 @@ iHistory *copy_History(const iHistory *d) {
         pushBack_Array(&copy->recent, copy_RecentUrl(i.value));
     }
     copy->recentPos = d->recentPos;
+    iGuardMutex(copy->mtx, startIndexing_History_(copy));
     unlock_Mutex(d->mtx);
     return copy;
 }
@@ -169,10 +555,14 @@ iString *debugInfo_History(const iHistory *d) {
     appendFormat_String(str,
                         "Total cached data: %.3f MB\n"
                         "Total memory usage: %.3f MB\n"
-                        "Navigation position: %zu\n\n",
+                        "Navigation position: %zu\n"
+                        "Content index: %zu words, %zu postings (%zu stale)\n\n",
                         totalCache / 1.0e6f,
                         totalMemory / 1.0e6f,
-                        d->recentPos);
+                        d->recentPos,
+                        size_PtrArray(&d->index.terms),
+                        d->index.numPostings,
+                        d->index.numStalePostings);
     return str;
 }
 
@@ -189,7 +579,10 @@ void serializeWithContent_History(const iHistory *d, iStream *outs, iBool withCo
         serialize_String(&item->url, outs);
         write32_Stream(outs, item->normScrollY * 1.0e6f);
         writeU16_Stream(outs, item->flags);
-        if (withContent && item->cachedResponse) {
+        /* Responses in the disk cache are loaded from there when the page is revisited.
+           If the entry has been removed by then, the page is fetched again. */
+        if (withContent && item->cachedResponse &&
+            !contains_ResponseCache(&item->url, &item->cachedResponse->identityFingerprint)) {
             write8_Stream(outs, 1);
             serialize_GmResponse(item->cachedResponse, outs);
         }
@@ -224,6 +617,7 @@ void deserialize_History(iHistory *d, iStream *ins) {
         }
         pushBack_Array(&d->recent, &item);
     }
+    startIndexing_History_(d);
     unlock_Mutex(d->mtx);
 }
 
@@ -233,6 +627,7 @@ void clear_History(iHistory *d) {
         deinit_RecentUrl(s.value);
     }
     clear_Array(&d->recent);
+    clear_ContentIndex(&d->index);
     unlock_Mutex(d->mtx);
 }
 
@@ -300,6 +695,7 @@ void add_History(iHistory *d, const iString *url) {
     /* Cut the trailing history items. */
     if (d->recentPos > 0) {
         for (size_t i = 0; i < d->recentPos - 1; i++) {
+            forgetContent_History_(d, recentUrl_History(d, i));
             deinit_RecentUrl(recentUrl_History(d, i));
         }
         removeN_Array(&d->recent, size_Array(&d->recent) - d->recentPos, iInvalidSize);
@@ -314,6 +710,7 @@ void add_History(iHistory *d, const iString *url) {
         pushBack_Array(&d->recent, &item);
         /* Limit the number of items. */
         if (size_Array(&d->recent) > maxStack_History_) {
+            forgetContent_History_(d, front_Array(&d->recent));
             deinit_RecentUrl(front_Array(&d->recent));
             remove_Array(&d->recent, 0);
         }
@@ -324,6 +721,7 @@ void add_History(iHistory *d, const iString *url) {
 void undo_History(iHistory *d) {
     lock_Mutex(d->mtx);
     if (!isEmpty_Array(&d->recent) || d->recentPos != 0) {
+        forgetContent_History_(d, back_Array(&d->recent));
         deinit_RecentUrl(back_Array(&d->recent));
         popBack_Array(&d->recent);
     }
@@ -432,10 +830,10 @@ void setCachedResponse_History(iHistory *d, const iGmResponse *response) {
     lock_Mutex(d->mtx);
     iRecentUrl *item = mostRecentUrl_History(d);
     if (item) {
-        delete_GmResponse(item->cachedResponse);
-        item->cachedResponse = NULL;
+        releaseCachedResponse_History_(d, item);
         if (category_GmStatusCode(response->statusCode) == categorySuccess_GmStatusCode) {
             item->cachedResponse = copy_GmResponse(response);
+            startIndexing_History_(d);
         }
     }
     unlock_Mutex(d->mtx);
@@ -490,8 +888,7 @@ void clearCache_History(iHistory *d) {
     iForEach(Array, i, &d->recent) {
         iRecentUrl *url = i.value;
         if (url->cachedResponse) {
-            delete_GmResponse(url->cachedResponse);
-            url->cachedResponse = NULL;
+            releaseCachedResponse_History_(d, url);
         }
         iReleasePtr(&url->cachedDoc); /* release all cached documents and media as well */
     }
@@ -531,8 +928,7 @@ size_t pruneLeastImportant_History(iHistory *d) {
     if (chosen != iInvalidPos) {
         iRecentUrl *url = at_Array(&d->recent, chosen);
         delta = cacheSize_RecentUrl(url);
-        delete_GmResponse(url->cachedResponse);
-        url->cachedResponse = NULL;
+        releaseCachedResponse_History_(d, url);
         iReleasePtr(&url->cachedDoc);
     }
     unlock_Mutex(d->mtx);
@@ -584,53 +980,200 @@ void invalidateTheme_History(iHistory *d) {
     unlock_Mutex(d->mtx);
 }
 
-const iStringArray *searchContents_History(const iHistory *d, const iRegExp *pattern) {
+iDeclareType(ContentMatch)
+
+struct Impl_ContentMatch {
+    uint32_t docId;
+    uint32_t offset;
+    uint16_t length;
+    uint16_t numWords; /* how many of the search words were found */
+    float    score;
+};
+
+static int cmpDocId_ContentMatch_(const void *a, const void *b) {
+    return iCmp(((const iContentMatch *) a)->docId, ((const iContentMatch *) b)->docId);
+}
+
+static int cmpScore_ContentMatch_(const void *a, const void *b) {
+    return iCmp(((const iContentMatch *) a)->score, ((const iContentMatch *) b)->score);
+}
+
+static void matchWord_ContentIndex_(const iContentIndex *d, const char *word, size_t size,
+                                    iBool isFirst, iArray *matches) {
+    /* All terms that begin with `word` are matches. Results are accumulated in `matches`,
+       which is kept sorted by docId. Postings of all the matching terms are collected first
+       and then sorted once, so documents matching several terms can be combined. */
+    const size_t numDocs = iMax(1u, size_Array(&d->docs));
+    iArray found;
+    init_Array(&found, sizeof(iContentMatch));
+    for (size_t i = lowerBound_ContentIndex_(d, word, size); i < size_PtrArray(&d->terms); i++) {
+        const iContentTerm *term = constAt_PtrArray(&d->terms, i);
+        if (size_Block(&term->token) < size ||
+            memcmp(constData_Block(&term->token), word, size)) {
+            break;
+        }
+        /* Rare words are more significant. */
+        const float idf = logf(1.0f + (float) numDocs / size_Array(&term->postings));
+        iConstForEach(Array, p, &term->postings) {
+            const iContentPosting *post = p.value;
+            if (!findDoc_ContentIndex_(d, post->docId)) {
+                continue; /* stale */
+            }
+            pushBack_Array(&found, &(iContentMatch){ post->docId, post->offset, post->length, 1,
+                                                     idf * logf(1.0f + post->count) });
+        }
+    }
+    sort_Array(&found, cmpDocId_ContentMatch_);
+    if (!isEmpty_Array(&found)) {
+        iContentMatch *f = data_Array(&found);
+        size_t numFound = 1;
+        for (size_t i = 1; i < size_Array(&found); i++) {
+            iContentMatch *last = &f[numFound - 1];
+            if (f[i].docId == last->docId) {
+                last->score += f[i].score;
+                if (f[i].offset < last->offset) {
+                    last->offset = f[i].offset;
+                    last->length = f[i].length;
+                }
+            }
+            else {
+                f[numFound++] = f[i];
+            }
+        }
+        resize_Array(&found, numFound);
+    }
+    /* Combine with the matches of the previous words. */
+    if (isFirst) {
+        setCopy_Array(matches, &found);
+    }
+    else {
+        iForEach(Array, i, matches) {
+            iContentMatch *m = i.value;
+            const iContentMatch *f = bsearch(m, constData_Array(&found), size_Array(&found),
+                                             sizeof(iContentMatch), cmpDocId_ContentMatch_);
+            if (f) {
+                m->score += f->score;
+                m->numWords++;
+            }
+        }
+    }
+    deinit_Array(&found);
+}
+
+static uint16_t search_ContentIndex_(const iContentIndex *d, iRangecc query, iArray *matches) {
+    /* The query is tokenized like the indexed content, so punctuation separates words in both.
+       Returns the number of words; matching documents must contain all of them. */
+    iBlock lowered;
+    iArray tokens;
+    init_Block(&lowered, 0);
+    init_Array(&tokens, sizeof(iContentToken));
+    tokenize_ContentIndex_(query, &lowered, &tokens);
+    uint16_t numWords = 0;
+    iConstForEach(Array, i, &tokens) {
+        const iContentToken *tok = i.value;
+        matchWord_ContentIndex_(d, tok->token, tok->size, numWords == 0, matches);
+        numWords++;
+    }
+    deinit_Array(&tokens);
+    deinit_Block(&lowered);
+    return numWords;
+}
+
+#if !defined (NDEBUG)
+static void checkSearch_ContentIndex_(void) {
+    /* Queries with punctuation must find the pages they appear on. */
+    static const char *content = "Notes on C++ and foo.bar: see gemini://host.example/ "
+                                 "but don't panic.";
+    static const char *queries[] = { "c++", "foo.bar", "gemini://host", "don't", "Panic!" };
+    iContentIndex index;
+    iBlock        lowered;
+    iArray        tokens;
+    init_ContentIndex(&index);
+    init_Block(&lowered, 0);
+    init_Array(&tokens, sizeof(iContentToken));
+    tokenize_ContentIndex_(range_CStr(content), &lowered, &tokens);
+    sort_Array(&tokens, cmp_ContentToken_);
+    const uint32_t docId = add_ContentIndex(&index, &tokens);
+    iForIndices(i, queries) {
+        iArray matches;
+        init_Array(&matches, sizeof(iContentMatch));
+        const uint16_t numWords = search_ContentIndex_(&index, range_CStr(queries[i]), &matches);
+        iAssert(numWords > 0);
+        iAssert(size_Array(&matches) == 1);
+        iAssert(((const iContentMatch *) constAt_Array(&matches, 0))->docId == docId);
+        iAssert(((const iContentMatch *) constAt_Array(&matches, 0))->numWords == numWords);
+        deinit_Array(&matches);
+    }
+    deinit_Array(&tokens);
+    deinit_Block(&lowered);
+    deinit_ContentIndex(&index);
+}
+#endif
+
+const iStringArray *searchContents_History(const iHistory *d, const iString *words) {
+#if !defined (NDEBUG)
+    static iBool isChecked_;
+    if (!isChecked_) {
+        checkSearch_ContentIndex_();
+        isChecked_ = iTrue;
+    }
+#endif
+    /* Responses cached very recently may still be waiting to be indexed. */
     iStringArray *urls = iClob(new_StringArray());
     lock_Mutex(d->mtx);
+    iArray matches;
+    init_Array(&matches, sizeof(iContentMatch));
+    const uint16_t numWords = search_ContentIndex_(&d->index, range_String(words), &matches);
+    sort_Array(&matches, cmpScore_ContentMatch_);
     iStringSet inserted;
     init_StringSet(&inserted);
-    iReverseConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        const iGmResponse *resp = url->cachedResponse;
-        if (resp && category_GmStatusCode(resp->statusCode) == categorySuccess_GmStatusCode) {
-            if (indexOfCStrSc_String(&resp->meta, "text/", &iCaseInsensitive) == iInvalidPos) {
-                continue;
-            }
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            if (matchRange_RegExp(pattern, range_Block(&resp->body), &m)) {
-                iString entry;
-                init_String(&entry);
-                iRangei cap = m.range;
-                const int prefix = iMin(10, cap.start);
-                cap.start   = cap.start - prefix;
-                cap.end     = iMin(cap.end + 30, (int) size_Block(&resp->body));
-                const size_t maxLen = 60;
-                if (size_Range(&cap) > maxLen) {
-                    cap.end = cap.start + maxLen;
-                }
-                iString content;
-                initRange_String(&content, (iRangecc){ m.subject + cap.start, m.subject + cap.end });
-                /* This needs cleaning up; highlight the matched word. */
-                replace_Block(&content.chars, '\n', ' ');
-                replace_Block(&content.chars, '\r', ' ');
-                if (prefix + size_Range(&m.range) < size_String(&content)) {
-                    insertData_Block(&content.chars, prefix + size_Range(&m.range), uiText_ColorEscape, 2);
-                }
-                insertData_Block(&content.chars, prefix, uiTextStrong_ColorEscape, 2);
-                format_String(
-                    &entry, "match len:%zu str:%s", size_String(&content), cstr_String(&content));
-                deinit_String(&content);
-                appendFormat_String(&entry, " url:%s", cstr_String(&url->url));
-                if (!contains_StringSet(&inserted, &url->url)) {
-                    pushFront_StringArray(urls, &entry);
-                    insert_StringSet(&inserted, &url->url);
-                }
-                deinit_String(&entry);
+    iReverseConstForEach(Array, i, &matches) {
+        const iContentMatch *match = i.value;
+        if (match->numWords < numWords) {
+            continue;
+        }
+        const iRecentUrl *url = NULL;
+        iConstForEach(Array, r, &d->recent) {
+            if (((const iRecentUrl *) r.value)->contentId == match->docId) {
+                url = r.value;
+                break;
             }
         }
+        if (!url || contains_StringSet(&inserted, &url->url)) {
+            continue;
+        }
+        const iBlock *body = &url->cachedResponse->body;
+        iString entry;
+        init_String(&entry);
+        iRangei cap = { match->offset, match->offset + match->length };
+        const int prefix = iMin(10, cap.start);
+        cap.start   = cap.start - prefix;
+        cap.end     = iMin(cap.end + 30, (int) size_Block(body));
+        const size_t maxLen = 60;
+        if (size_Range(&cap) > maxLen) {
+            cap.end = cap.start + maxLen;
+        }
+        iString content;
+        initRange_String(&content, (iRangecc){ cstr_Block(body) + cap.start,
+                                               cstr_Block(body) + cap.end });
+        /* This needs cleaning up; highlight the matched word. */
+        replace_Block(&content.chars, '\n', ' ');
+        replace_Block(&content.chars, '\r', ' ');
+        if (prefix + match->length < size_String(&content)) {
+            insertData_Block(&content.chars, prefix + match->length, uiText_ColorEscape, 2);
+        }
+        insertData_Block(&content.chars, prefix, uiTextStrong_ColorEscape, 2);
+        format_String(
+            &entry, "match len:%zu str:%s", size_String(&content), cstr_String(&content));
+        deinit_String(&content);
+        appendFormat_String(&entry, " url:%s", cstr_String(&url->url));
+        /* The best match ends up last. */
+        pushFront_StringArray(urls, &entry);
+        insert_StringSet(&inserted, &url->url);
+        deinit_String(&entry);
     }
     deinit_StringSet(&inserted);
+    deinit_Array(&matches);
     unlock_Mutex(d->mtx);
     return urls;
 }
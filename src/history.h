@@ -41,6 +41,7 @@ struct Impl_RecentUrl {
     iGmDocument *cachedDoc;      /* cached copy of the presentation: layout and media (not serialized) */
     iBlock       setIdentity;    /* fingerprint of identity that was pinned*/
     uint16_t     flags;
+    uint32_t     contentId;      /* cached response in the History's content index (not serialized) */
 };
 
 iDeclareType(MemInfo)
@@ -85,7 +86,7 @@ void        invalidateCachedLayout_History      (iHistory *);
 iBool       atNewest_History            (const iHistory *);
 iBool       atOldest_History            (const iHistory *);
 
-const iStringArray *   searchContents_History   (const iHistory *, const iRegExp *pattern); /* chronologically ascending */
+const iStringArray *   searchContents_History   (const iHistory *, const iString *words); /* ascending relevance */
 
 const iString *
             url_History                 (const iHistory *, size_t pos);
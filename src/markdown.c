@@ -0,0 +1,647 @@
+/* Copyright 2023 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "markdown.h"
+
+#include <the_Foundation/array.h>
+#include <ctype.h>
+
+/* The conversion is done line by line in a single pass over the document, with hand-written
+   matching of the inline syntax. Each inline rule behaves like the corresponding regular
+   expression (noted in the comments) that was used for the conversion previously. */
+
+iDeclareType(MarkdownLink)
+iDeclareType(MarkdownRef)
+iDeclareType(Markdown)
+
+struct Impl_MarkdownLink {
+    iString *url; /* "[]name" for references */
+    iString *title;
+};
+
+struct Impl_MarkdownRef {
+    iRangecc name;
+    iRangecc url;
+};
+
+struct Impl_Markdown {
+    iRangecc source;
+    iString *out;
+    iArray   pendingLinks; /* MarkdownLink; output after the paragraph or section */
+    iArray   refs;         /* MarkdownRef; link reference definitions */
+    iBool    isRefsFound;
+    iString  line;
+    iString  work;
+};
+
+iLocalDef iBool isSpace_(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\v' || ch == '\f' || ch == '\r';
+}
+
+iLocalDef iBool isWordChar_(char ch) {
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') ||
+           ch == '_';
+}
+
+iLocalDef iBool isDecoration_(char ch) {
+    return isSpace_(ch) || ch == '*' || ch == '_';
+}
+
+iLocalDef void appendSpan_(iString *d, const char *start, const char *end) {
+    if (end > start) {
+        appendData_Block(&d->chars, start, end - start);
+    }
+}
+
+static const char *skipSpace_(const char *pos, const char *end) {
+    while (pos < end && isSpace_(*pos)) {
+        pos++;
+    }
+    return pos;
+}
+
+static void pushLink_Markdown_(iMarkdown *d, iString *url, iRangecc title) {
+    pushBack_Array(&d->pendingLinks, &(iMarkdownLink){ url, newRange_String(title) });
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static const char *matchRef_(const char *pos, const char *end, iRangecc *name, iRangecc *url) {
+    /* \s*\[(.+?)\]\s*:\s*([^\n]+) */
+    const char *open = skipSpace_(pos, end);
+    if (open == end || *open != '[') {
+        return NULL;
+    }
+    for (const char *close = open + 2; close < end && close[-1] != '\n'; close++) {
+        if (*close != ']') {
+            continue;
+        }
+        const char *colon = skipSpace_(close + 1, end);
+        if (colon == end || *colon != ':') {
+            continue;
+        }
+        const char *value = skipSpace_(colon + 1, end);
+        if (value == end) {
+            /* Only whitespace remains; the value is the last non-newline character. */
+            for (value = end; value > colon + 1 && value[-1] == '\n'; value--) {}
+            if (value == colon + 1) {
+                continue;
+            }
+            value--;
+        }
+        const char *valueEnd = memchr(value, '\n', end - value);
+        *name = (iRangecc){ open + 1, close };
+        *url  = (iRangecc){ value, valueEnd ? valueEnd : end };
+        return url->end;
+    }
+    return NULL;
+}
+
+static iBool removeRef_(iRangecc src, iString *out) {
+    /* \s*\[(.+?)\]\s*:\s*([^\n]+) => "" */
+    if (!memchr(src.start, ':', size_Range(&src))) {
+        return iFalse;
+    }
+    for (const char *pos = src.start; pos < src.end; pos++) {
+        iRangecc name, url;
+        if ((*pos == '[' || isSpace_(*pos)) && matchRef_(pos, src.end, &name, &url)) {
+            appendSpan_(out, src.start, pos);
+            return iTrue; /* the rest of the line is the definition */
+        }
+    }
+    return iFalse;
+}
+
+static iBool standaloneLink_(iRangecc src, iString *out) {
+    /* ^[\s*_]*\[(.+?)\]\(([^)]+)\)[\s*_]*$ => "\n=> \2 \1" */
+    const char *open = src.start;
+    while (open < src.end && isDecoration_(*open)) {
+        open++;
+    }
+    if (open == src.end || *open != '[') {
+        return iFalse;
+    }
+    for (const char *close = open + 2; close + 1 < src.end; close++) {
+        if (close[0] != ']' || close[1] != '(') {
+            continue;
+        }
+        const char *url    = close + 2;
+        const char *urlEnd = memchr(url, ')', src.end - url);
+        if (!urlEnd) {
+            return iFalse;
+        }
+        if (urlEnd == url) {
+            continue;
+        }
+        const char *rest = urlEnd + 1;
+        while (rest < src.end && isDecoration_(*rest)) {
+            rest++;
+        }
+        if (rest != src.end) {
+            continue;
+        }
+        appendCStr_String(out, "\n=> ");
+        appendSpan_(out, url, urlEnd);
+        appendCStr_String(out, " ");
+        appendSpan_(out, open + 1, close);
+        return iTrue;
+    }
+    return iFalse;
+}
+
+static const char *matchImage_(const char *bang, const char *end, iRangecc *title, iRangecc *url) {
+    /* !\[(.+)\]\(([^)]+)\) -- note that the title is greedy */
+    const char *open    = bang + 1;
+    const char *lineEnd = memchr(open, '\n', end - open);
+    for (const char *close = (lineEnd ? lineEnd : end) - 1; close >= open + 2; close--) {
+        if (close[0] != ']' || close + 1 >= end || close[1] != '(') {
+            continue;
+        }
+        const char *urlStart = close + 2;
+        const char *urlEnd   = memchr(urlStart, ')', end - urlStart);
+        if (!urlEnd || urlEnd == urlStart) {
+            continue;
+        }
+        *title = (iRangecc){ open + 1, close };
+        *url   = (iRangecc){ urlStart, urlEnd };
+        return urlEnd + 1;
+    }
+    return NULL;
+}
+
+static iBool imageLinks_(iRangecc src, iString *out) {
+    /* \n?!\[(.+)\]\(([^)]+)\)\n? => "\n=> \2 \1\n" */
+    if (!memchr(src.start, '!', size_Range(&src))) {
+        return iFalse;
+    }
+    iBool       found = iFalse;
+    const char *span  = src.start;
+    for (const char *pos = src.start; pos < src.end; ) {
+        const char *bang = (*pos == '\n' ? pos + 1 : pos);
+        const char *matchEnd;
+        iRangecc    title, url;
+        if (bang + 1 < src.end && bang[0] == '!' && bang[1] == '[' &&
+            (matchEnd = matchImage_(bang, src.end, &title, &url)) != NULL) {
+            if (matchEnd < src.end && *matchEnd == '\n') {
+                matchEnd++;
+            }
+            appendSpan_(out, span, pos);
+            appendCStr_String(out, "\n=> ");
+            appendSpan_(out, url.start, url.end);
+            appendCStr_String(out, " ");
+            appendSpan_(out, title.start, title.end);
+            appendCStr_String(out, "\n");
+            pos = span = matchEnd;
+            found = iTrue;
+            continue;
+        }
+        pos++;
+    }
+    if (found) {
+        appendSpan_(out, span, src.end);
+    }
+    return found;
+}
+
+static iBool namedLinks_Markdown_(iMarkdown *d, iRangecc src, iString *out) {
+    /* \[(.+?)\]\[(.+?)\] => "\1", with the link pending */
+    iBool       found = iFalse;
+    const char *span  = src.start;
+    for (const char *pos = src.start; pos < src.end; pos++) {
+        if (*pos != '[') {
+            continue;
+        }
+        for (const char *close = pos + 2; close + 1 < src.end && close[-1] != '\n'; close++) {
+            if (close[0] != ']' || close[1] != '[') {
+                continue;
+            }
+            const char *ref    = close + 2;
+            const char *refEnd = NULL;
+            for (const char *ch = ref + 1; ch < src.end && ch[-1] != '\n'; ch++) {
+                if (*ch == ']') {
+                    refEnd = ch;
+                    break;
+                }
+            }
+            if (!refEnd) {
+                break; /* a longer title wouldn't help */
+            }
+            pushLink_Markdown_(d,
+                               newFormat_String("[]%s", cstr_Rangecc((iRangecc){ ref, refEnd })),
+                               (iRangecc){ pos + 1, close });
+            appendSpan_(out, span, pos);
+            appendSpan_(out, pos + 1, close);
+            pos   = refEnd;
+            span  = refEnd + 1;
+            found = iTrue;
+            break;
+        }
+    }
+    if (found) {
+        appendSpan_(out, span, src.end);
+    }
+    return found;
+}
+
+static iBool links_Markdown_(iMarkdown *d, iRangecc src, iString *out) {
+    /* \[(.+?)\]\(([^)]+)\) => "\1", with the link pending */
+    iBool       found = iFalse;
+    const char *span  = src.start;
+    for (const char *pos = src.start; pos < src.end; pos++) {
+        if (*pos != '[') {
+            continue;
+        }
+        for (const char *close = pos + 2; close + 1 < src.end && close[-1] != '\n'; close++) {
+            if (close[0] != ']' || close[1] != '(') {
+                continue;
+            }
+            const char *url    = close + 2;
+            const char *urlEnd = memchr(url, ')', src.end - url);
+            if (!urlEnd) {
+                break;
+            }
+            if (urlEnd == url) {
+                continue;
+            }
+            pushLink_Markdown_(d, newRange_String((iRangecc){ url, urlEnd }),
+                               (iRangecc){ pos + 1, close });
+            appendSpan_(out, span, pos);
+            appendSpan_(out, pos + 1, close);
+            pos   = urlEnd;
+            span  = urlEnd + 1;
+            found = iTrue;
+            break;
+        }
+    }
+    if (found) {
+        appendSpan_(out, span, src.end);
+    }
+    return found;
+}
+
+static iBool emphasis_(iRangecc src, const char *delim, const char *escape, iString *out) {
+    /* <delim>(.+?)<delim> => "\x1b[<escape>\1\x1b[0m" */
+    const size_t len   = strlen(delim);
+    iBool        found = iFalse;
+    const char  *span  = src.start;
+    for (const char *pos = src.start; pos + len <= src.end; pos++) {
+        if (memcmp(pos, delim, len)) {
+            continue;
+        }
+        const char *text = pos + len;
+        if (text == src.end || *text == '\n') {
+            continue;
+        }
+        for (const char *ch = text + 1; ch < src.end; ch++) {
+            if (ch + len <= src.end && !memcmp(ch, delim, len)) {
+                appendSpan_(out, span, pos);
+                appendFormat_String(out, "\x1b[%sm", escape);
+                appendSpan_(out, text, ch);
+                appendCStr_String(out, "\x1b[0m");
+                pos   = ch + len - 1;
+                span  = ch + len;
+                found = iTrue;
+                break;
+            }
+            if (*ch == '\n') {
+                break;
+            }
+        }
+    }
+    if (found) {
+        appendSpan_(out, span, src.end);
+    }
+    return found;
+}
+
+static iBool underscoreItalics_(iRangecc src, iString *out) {
+    /* \b_([^_]+?)_\b => "\x1b[3m\1\x1b[0m" */
+    iBool       found = iFalse;
+    const char *span  = src.start;
+    for (const char *pos = src.start; pos < src.end; pos++) {
+        if (*pos != '_' || (pos > src.start && isWordChar_(pos[-1]))) {
+            continue;
+        }
+        const char *close = memchr(pos + 1, '_', src.end - pos - 1);
+        if (!close || close == pos + 1 || (close + 1 < src.end && isWordChar_(close[1]))) {
+            continue;
+        }
+        appendSpan_(out, span, pos);
+        appendCStr_String(out, "\x1b[3m");
+        appendSpan_(out, pos + 1, close);
+        appendCStr_String(out, "\x1b[0m");
+        pos   = close;
+        span  = close + 1;
+        found = iTrue;
+    }
+    if (found) {
+        appendSpan_(out, span, src.end);
+    }
+    return found;
+}
+
+static iBool codeSpans_(iRangecc src, iString *out) {
+    /* (?<!`)`([^`]+?)`(?!`) => "\x1b[11m\1\x1b[0m" */
+    iBool       found = iFalse;
+    const char *span  = src.start;
+    for (const char *pos = src.start; pos < src.end; pos++) {
+        if (*pos != '`' || (pos > src.start && pos[-1] == '`')) {
+            continue;
+        }
+        const char *close = memchr(pos + 1, '`', src.end - pos - 1);
+        if (!close || close == pos + 1 || (close + 1 < src.end && close[1] == '`')) {
+            continue;
+        }
+        appendSpan_(out, span, pos);
+        appendCStr_String(out, "\x1b[11m");
+        appendSpan_(out, pos + 1, close);
+        appendCStr_String(out, "\x1b[0m");
+        pos   = close;
+        span  = close + 1;
+        found = iTrue;
+    }
+    if (found) {
+        appendSpan_(out, span, src.end);
+    }
+    return found;
+}
+
+static iBool unescapeUnderscores_(iRangecc src, iString *out) {
+    /* \_ => _ */
+    iBool       found = iFalse;
+    const char *span  = src.start;
+    for (const char *pos = src.start; pos + 1 < src.end; pos++) {
+        if (pos[0] == '\\' && pos[1] == '_') {
+            appendSpan_(out, span, pos);
+            span  = pos + 1;
+            found = iTrue;
+            pos++;
+        }
+    }
+    if (found) {
+        appendSpan_(out, span, src.end);
+    }
+    return found;
+}
+
+static void convertInline_Markdown_(iMarkdown *d, iRangecc text) {
+    /* The rules are applied in order, each one to the result of the previous one. */
+    iString *ln   = &d->line;
+    iString *work = &d->work;
+    setRange_String(ln, text);
+#define apply_(rule) \
+    clear_String(work); \
+    if (rule) { \
+        iSwap(iString, *ln, *work); \
+    }
+    apply_(removeRef_(range_String(ln), work));
+    apply_(standaloneLink_(range_String(ln), work));
+    apply_(imageLinks_(range_String(ln), work));
+    if (memchr(cstr_String(ln), '[', size_String(ln))) {
+        apply_(namedLinks_Markdown_(d, range_String(ln), work));
+        apply_(links_Markdown_(d, range_String(ln), work));
+    }
+    if (memchr(cstr_String(ln), '*', size_String(ln))) {
+        apply_(emphasis_(range_String(ln), "**", "1", work));
+    }
+    if (memchr(cstr_String(ln), '_', size_String(ln))) {
+        apply_(emphasis_(range_String(ln), "__", "1", work));
+    }
+    if (memchr(cstr_String(ln), '*', size_String(ln))) {
+        apply_(emphasis_(range_String(ln), "*", "3", work));
+    }
+    if (memchr(cstr_String(ln), '_', size_String(ln))) {
+        apply_(underscoreItalics_(range_String(ln), work));
+    }
+    if (memchr(cstr_String(ln), '`', size_String(ln))) {
+        apply_(codeSpans_(range_String(ln), work));
+    }
+    if (memchr(cstr_String(ln), '_', size_String(ln))) {
+        apply_(unescapeUnderscores_(range_String(ln), work));
+    }
+#undef apply_
+    append_String(d->out, ln);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static void findRefs_Markdown_(iMarkdown *d) {
+    /* \n\s*\[(.+?)\]\s*:\s*([^\n]+) anywhere in the document */
+    const char *end = d->source.end;
+    for (const char *pos = d->source.start; pos < end; ) {
+        const char *nl = memchr(pos, '\n', end - pos);
+        iMarkdownRef ref;
+        if (!nl) {
+            break;
+        }
+        const char *refEnd = matchRef_(nl + 1, end, &ref.name, &ref.url);
+        if (refEnd) {
+            pushBack_Array(&d->refs, &ref);
+            pos = refEnd;
+        }
+        else {
+            pos = nl + 1;
+        }
+    }
+    d->isRefsFound = iTrue;
+}
+
+static const iMarkdownRef *findRef_Markdown_(iMarkdown *d, iRangecc name) {
+    if (!d->isRefsFound) {
+        findRefs_Markdown_(d);
+    }
+    iConstForEach(Array, i, &d->refs) {
+        const iMarkdownRef *ref = i.value;
+        if (size_Range(&ref->name) == size_Range(&name) &&
+            !memcmp(ref->name.start, name.start, size_Range(&name))) {
+            return ref;
+        }
+    }
+    return NULL;
+}
+
+static void flushPendingLinks_Markdown_(iMarkdown *d) {
+    if (!endsWith_String(d->out, "\n")) {
+        appendCStr_String(d->out, "\n");
+    }
+    iForEach(Array, i, &d->pendingLinks) {
+        iMarkdownLink *pending = i.value;
+        const char    *url     = cstr_String(pending->url);
+        if (startsWith_CStr(url, "[]")) {
+            const iMarkdownRef *ref = findRef_Markdown_(d, range_CStr(url + 2));
+            if (ref) {
+                url = cstr_Rangecc(ref->url);
+            }
+        }
+        appendFormat_String(d->out, "\n=> %s %s", url, cstr_String(pending->title));
+        delete_String(pending->url);
+        delete_String(pending->title);
+    }
+    clear_Array(&d->pendingLinks);
+}
+
+static void prepare_Markdown_(iRangecc src, iString *out) {
+    /* Non-breaking spaces are resolved, and code fences are put on their own lines. */
+    reserve_Block(&out->chars, size_Range(&src) + size_Range(&src) / 16);
+    const char *span = src.start;
+    for (const char *pos = src.start; pos < src.end; ) {
+        if (*pos == '&' && src.end - pos >= 6 && !memcmp(pos, "&nbsp;", 6)) {
+            appendSpan_(out, span, pos);
+            appendCStr_String(out, "\u00a0");
+            span = pos += 6;
+        }
+        else if (*pos == '`' && src.end - pos >= 3 && pos[1] == '`' && pos[2] == '`') {
+            appendSpan_(out, span, pos);
+            appendCStr_String(out, "\n```\n");
+            span = pos += 3;
+        }
+        else {
+            pos++;
+        }
+    }
+    appendSpan_(out, span, src.end);
+}
+
+static void collapseParagraphBreaks_(iRangecc src, iString *out) {
+    /* (\s*\n){2,} => "\n\n" */
+    reserve_Block(&out->chars, size_Range(&src));
+    const char *span = src.start;
+    for (const char *pos = src.start; pos < src.end; ) {
+        if (!isSpace_(*pos)) {
+            pos++;
+            continue;
+        }
+        const char *runEnd = skipSpace_(pos, src.end);
+        const char *lastNewline = NULL;
+        int numNewlines = 0;
+        for (const char *ch = pos; ch < runEnd; ch++) {
+            if (*ch == '\n') {
+                lastNewline = ch;
+                numNewlines++;
+            }
+        }
+        if (numNewlines >= 2) {
+            appendSpan_(out, span, pos);
+            appendCStr_String(out, "\n\n");
+            span = lastNewline + 1;
+        }
+        pos = runEnd;
+    }
+    appendSpan_(out, span, src.end);
+}
+
+void convertToGemtext_Markdown(iRangecc markdown, iString *gemtext_out) {
+    iString prepared;
+    iString result;
+    init_String(&prepared);
+    init_String(&result);
+    prepare_Markdown_(markdown, &prepared);
+    reserve_Block(&result.chars, size_String(&prepared));
+    iMarkdown md = { .source = range_String(&prepared), .out = &result };
+    iMarkdown *d = &md;
+    init_Array(&d->pendingLinks, sizeof(iMarkdownLink));
+    init_Array(&d->refs, sizeof(iMarkdownRef));
+    init_String(&d->line);
+    init_String(&d->work);
+    iString *out = d->out;
+    iRangecc line = iNullRange;
+    iBool isPre = iFalse;
+    iBool isBlock = iFalse;
+    iBool isLastEmpty = iFalse;
+    while (nextSplit_Rangecc(d->source, "\n", &line)) {
+        if (!isPre && !isBlock) {
+            if (equal_Rangecc(line, "```")) {
+                isBlock = iTrue;
+                appendCStr_String(out, "\n```");
+                continue;
+            }
+            if (*line.start == '#') {
+                flushPendingLinks_Markdown_(d);
+            }
+            if (isEmpty_Range(&line)) {
+                isLastEmpty = iTrue;
+                continue;
+            }
+            if (isLastEmpty) {
+                appendCStr_String(out, "\n\n");
+            }
+            else if (size_Range(&line) >= 2 && isdigit(line.start[0]) &&
+                     (line.start[1] == '.' ||
+                      (isdigit(line.start[1]) && line.start[2] == '.'))) {
+                appendCStr_String(out, "\n\n");
+            }
+            else if (endsWith_String(out, "  ") ||
+                     *line.start == '*' || *line.start == '>' || *line.start == '#' ||
+                     (*line.start == '|' && endsWith_String(out, "|"))) {
+                appendCStr_String(out, "\n");
+            }
+            else {
+                appendCStr_String(out, " ");
+            }
+            isLastEmpty = iFalse;
+        }
+        else if (isBlock) {
+            if (equal_Rangecc(line, "```")) {
+                isBlock = iFalse;
+                appendCStr_String(out, "\n```\n");
+            }
+            else {
+                appendCStr_String(out, "\n");
+                appendRange_String(out, line);
+            }
+            continue;
+        }
+        if (startsWith_Rangecc(line, "    ")) {
+            line.start += 4;
+            if (!isPre) {
+                appendCStr_String(out, "```\n");
+                isPre = iTrue;
+            }
+        }
+        else if (isPre) {
+            if (!endsWith_String(out, "\n")) {
+                appendCStr_String(out, "\n");
+            }
+            appendCStr_String(out, "```\n");
+            if (equal_Rangecc(line, "```")) {
+                line.start = line.end; /* don't repeat it */
+            }
+            isPre = iFalse;
+        }
+        if (isPre) {
+            appendRange_String(out, line);
+            appendCStr_String(out, "\n");
+        }
+        else {
+            convertInline_Markdown_(d, line);
+        }
+    }
+    flushPendingLinks_Markdown_(d);
+    clear_String(gemtext_out);
+    collapseParagraphBreaks_(range_String(out), gemtext_out);
+    deinit_String(&d->work);
+    deinit_String(&d->line);
+    deinit_Array(&d->refs);
+    deinit_Array(&d->pendingLinks);
+    deinit_String(&result);
+    deinit_String(&prepared);
+}
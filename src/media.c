@@ -35,8 +35,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #endif
 
 #include <the_Foundation/file.h>
+#include <the_Foundation/mutex.h>
 #include <the_Foundation/ptrarray.h>
 #include <the_Foundation/stringlist.h>
+#include <the_Foundation/thread.h>
+#include <SDL_cpuinfo.h>
 #include <SDL_hints.h>
 #include <SDL_render.h>
 #include <SDL_timer.h>
@@ -65,30 +68,52 @@ static void deinit_GmMediaProps_(iGmMediaProps *d) {
 /*----------------------------------------------------------------------------------------------*/
 
 iDeclareType(GmImage)
+iDeclareType(GmImageJob)
 
 struct Impl_GmImage {
     iGmMediaProps props;
-    iBlock        partialData; /* cleared when image is converted to texture */
+    iBlock        partialData; /* cleared when image is handed over for decoding */
     iInt2         size;
     size_t        numBytes;
     SDL_Texture * texture;
+    iGmImageJob * job;         /* decoding in the background */
 };
 
+static void cancelDecode_GmImage_(iGmImage *d);
+
 void init_GmImage(iGmImage *d, const iBlock *data) {
     init_GmMediaProps_(&d->props);
     initCopy_Block(&d->partialData, data);
     d->size     = zero_I2();
     d->numBytes = 0;
     d->texture  = NULL;
+    d->job      = NULL;
 }
 
 void deinit_GmImage(iGmImage *d) {
+    cancelDecode_GmImage_(d);
     deinit_Block(&d->partialData);
     SDL_DestroyTexture(d->texture);
     deinit_GmMediaProps_(&d->props);
 }
 
-static void applyImageStyle_(enum iImageStyle style, iInt2 size, uint8_t *imgData) {
+iDeclareType(ImageStyleColors)
+
+/* Theme colors for styling an image, so the palette isn't accessed outside the main thread. */
+struct Impl_ImageStyleColors {
+    iColor background;
+    iColor paragraph;
+    iColor preformatted;
+};
+
+static iImageStyleColors currentImageStyleColors_(void) {
+    return (iImageStyleColors){ get_Color(tmBackground_ColorId),
+                                get_Color(tmParagraph_ColorId),
+                                get_Color(tmPreformatted_ColorId) };
+}
+
+static void applyImageStyle_(enum iImageStyle style, const iImageStyleColors *colors, iInt2 size,
+                             uint8_t *imgData) {
     if (style == original_ImageStyle) {
         return;
     }
@@ -96,8 +121,8 @@ static void applyImageStyle_(enum iImageStyle style, iInt2 size, uint8_t *imgDat
     size_t   numPixels = size.x * size.y;
     float    brighten  = 0.0f;
     if (style == bgFg_ImageStyle) {
-        iColor dark  = get_Color(tmBackground_ColorId);
-        iColor light = get_Color(tmParagraph_ColorId);
+        iColor dark  = colors->background;
+        iColor light = colors->paragraph;
         if (hsl_Color(dark).lum > hsl_Color(light).lum) {
             iSwap(iColor, dark, light);
         }
@@ -114,8 +139,7 @@ static void applyImageStyle_(enum iImageStyle style, iInt2 size, uint8_t *imgDat
     }
     iColor colorize = (iColor){ 255, 255, 255, 255 };
     if (style != grayscale_ImageStyle) {
-        colorize = get_Color(style == textColorized_ImageStyle ? tmParagraph_ColorId
-                                                               : tmPreformatted_ColorId);
+        colorize = style == textColorized_ImageStyle ? colors->paragraph : colors->preformatted;
         /* Compensate for change in mid-tones. */
         const int colMax = iMax(iMax(colorize.r, colorize.g), colorize.b);
         brighten = iClamp(1.0f - (colorize.r + colorize.g + colorize.b) / (colMax * 3), 0.0f, 0.5f);
@@ -133,70 +157,274 @@ static void applyImageStyle_(enum iImageStyle style, iInt2 size, uint8_t *imgDat
     }
 }
 
-void makeTexture_GmImage(iGmImage *d) {
-    iBlock *data     = &d->partialData;
-    d->numBytes      = size_Block(data);
+/* Decoding and downscaling a large image may take long enough to stall the UI, so it is done
+   in a small pool of background threads. The image size is read from the header right away
+   so the document can be laid out with a placeholder; only the texture upload happens in the
+   main thread, after the worker has posted "media.image.decoded". */
+
+enum { maxDecodeWorkers_GmImage_ = 3 };
+
+struct Impl_GmImageJob {
+    const iMedia *   media;   /* only used for identifying the owner in the posted command */
+    iGmLinkId        linkId;
+    iBlock           data;
+    iBool            isWebP;
+    iInt2            size;    /* original */
+    iInt2            texSize; /* decoded */
+    enum iImageStyle style;
+    iImageStyleColors styleColors;
+    uint8_t *        pixels;  /* RGBA, `texSize`; NULL if decoding failed */
+    iBool            isStarted;
+    iBool            isFinished;
+    iBool            isAbandoned;
+};
+
+static iMutex *   decodeMutex_;
+static iPtrArray  decodeJobs_; /* waiting to be started */
+static iThread *  decodeWorkers_[maxDecodeWorkers_GmImage_];
+static iBool      isDecodeWorkerRunning_[maxDecodeWorkers_GmImage_];
+
+static void delete_GmImageJob_(iGmImageJob *d) {
+    deinit_Block(&d->data);
+    free(d->pixels);
+    free(d);
+}
+
+static void decode_GmImageJob_(iGmImageJob *d) {
     uint8_t *imgData = NULL;
-    if (cmp_String(&d->props.mime, "image/webp") == 0) {
+    if (d->isWebP) {
 #if defined (LAGRANGE_ENABLE_WEBP)
-        imgData = WebPDecodeRGBA(constData_Block(data), size_Block(data), &d->size.x, &d->size.y);
+        /* libwebp can scale while decoding, so the full-size image is never needed. */
+        WebPDecoderConfig config;
+        if (WebPInitDecoderConfig(&config)) {
+            const size_t bufSize = 4 * d->texSize.x * d->texSize.y;
+            imgData = malloc(bufSize);
+            config.options.use_scaling       = !isEqual_I2(d->texSize, d->size);
+            config.options.scaled_width      = d->texSize.x;
+            config.options.scaled_height     = d->texSize.y;
+            config.output.colorspace         = MODE_RGBA;
+            config.output.is_external_memory = 1;
+            config.output.u.RGBA.rgba        = imgData;
+            config.output.u.RGBA.stride      = 4 * d->texSize.x;
+            config.output.u.RGBA.size        = bufSize;
+            if (WebPDecode(constData_Block(&d->data), size_Block(&d->data), &config) !=
+                VP8_STATUS_OK) {
+                free(imgData);
+                imgData = NULL;
+            }
+            WebPFreeDecBuffer(&config.output);
+        }
 #endif
     }
     else {
+        iInt2 decSize;
         imgData = stbi_load_from_memory(
-            constData_Block(data), (int) size_Block(data), &d->size.x, &d->size.y, NULL, 4);
+            constData_Block(&d->data), (int) size_Block(&d->data), &decSize.x, &decSize.y, NULL, 4);
         if (!imgData) {
             fprintf(stderr, "[media] image load failed: %s\n", stbi_failure_reason());
         }
+        else if (!isEqual_I2(decSize, d->texSize)) {
+            /* stb_image has no scaled decoding (e.g., JPEG DCT scaling), so resize afterwards. */
+            uint8_t *scaledImgData = malloc(d->texSize.x * d->texSize.y * 4);
+            stbir_resize_uint8_linear(imgData,
+                                      decSize.x, decSize.y, 4 * decSize.x,
+                                      scaledImgData,
+                                      d->texSize.x, d->texSize.y, 4 * d->texSize.x,
+                                      STBIR_RGBA);
+            free(imgData);
+            imgData = scaledImgData;
+        }
+    }
+    if (imgData) {
+        /* TODO: Save some memory by checking if the alpha channel is actually in use. */
+        /* Cheaper after downscaling. */
+        applyImageStyle_(d->style, &d->styleColors, d->texSize, imgData);
+    }
+    d->pixels = imgData;
+}
+
+static iThreadResult runDecodeJobs_GmImage_(iThread *thread) {
+    iBool *isRunning = userData_Thread(thread);
+    lock_Mutex(decodeMutex_);
+    while (!isEmpty_PtrArray(&decodeJobs_)) {
+        iGmImageJob *job;
+        take_PtrArray(&decodeJobs_, 0, (void **) &job);
+        job->isStarted = iTrue;
+        unlock_Mutex(decodeMutex_);
+        decode_GmImageJob_(job);
+        lock_Mutex(decodeMutex_);
+        if (job->isAbandoned) {
+            delete_GmImageJob_(job);
+        }
+        else {
+            job->isFinished = iTrue;
+            postCommandf_App("media.image.decoded media:%p link:%u", job->media, job->linkId);
+        }
     }
-    if (!imgData) {
-        d->size    = zero_I2();
-        d->texture = NULL;
+    *isRunning = iFalse;
+    unlock_Mutex(decodeMutex_);
+    return 0;
+}
+
+static void cancelDecode_GmImage_(iGmImage *d) {
+    iGmImageJob *job = d->job;
+    if (!job) {
+        return;
+    }
+    lock_Mutex(decodeMutex_);
+    if (job->isStarted && !job->isFinished) {
+        job->isAbandoned = iTrue; /* the worker will delete it */
     }
     else {
-        applyImageStyle_(prefs_App()->imageStyle, d->size, imgData);
-        /* TODO: Save some memory by checking if the alpha channel is actually in use. */
-        iWindow *window  = get_Window();
-        iInt2    texSize = d->size;
-        /* Resize down to min(maximum texture size, window size). */ {
-            SDL_Rect dispRect;
-            SDL_GetDisplayBounds(SDL_GetWindowDisplayIndex(window->win), &dispRect);
-            const iInt2 maxSize = min_I2(isEqual_I2(maxTextureSize_Window(window), zero_I2()) ?
-                                         texSize : maxTextureSize_Window(window),
-                                         coord_Window(window, dispRect.w, dispRect.h));
-            iInt2 scaled = d->size;
-            if (scaled.x > maxSize.x) {
-                scaled.y = scaled.y * maxSize.x / scaled.x;
-                scaled.x = maxSize.x;
-            }
-            if (scaled.y > maxSize.y) {
-                scaled.x = scaled.x * maxSize.y / scaled.y;
-                scaled.y = maxSize.y;
-            }
-            if (!isEqual_I2(scaled, d->size)) {
-                uint8_t *scaledImgData = malloc(scaled.x * scaled.y * 4);
-                stbir_resize_uint8_linear(imgData,
-                                          d->size.x, d->size.y, 4 * d->size.x,
-                                          scaledImgData,
-                                          scaled.x, scaled.y, scaled.x * 4,
-                                          STBIR_RGBA);
-                free(imgData);
-                imgData = scaledImgData;
-                texSize = scaled;
-                /* We keep d->size for the UI. */
+        removeOne_PtrArray(&decodeJobs_, job);
+        delete_GmImageJob_(job);
+    }
+    unlock_Mutex(decodeMutex_);
+    d->job = NULL;
+}
+
+static iInt2 textureSize_GmImage_(const iGmImage *d) {
+    /* Resize down to min(maximum texture size, window size). */
+    iWindow *window = get_Window();
+    SDL_Rect dispRect;
+    SDL_GetDisplayBounds(SDL_GetWindowDisplayIndex(window->win), &dispRect);
+    const iInt2 maxSize = min_I2(isEqual_I2(maxTextureSize_Window(window), zero_I2()) ?
+                                 d->size : maxTextureSize_Window(window),
+                                 coord_Window(window, dispRect.w, dispRect.h));
+    iInt2 scaled = d->size;
+    if (scaled.x > maxSize.x) {
+        scaled.y = iMax(1, scaled.y * maxSize.x / scaled.x);
+        scaled.x = maxSize.x;
+    }
+    if (scaled.y > maxSize.y) {
+        scaled.x = iMax(1, scaled.x * maxSize.y / scaled.y);
+        scaled.y = maxSize.y;
+    }
+    return scaled; /* we keep d->size for the UI */
+}
+
+static void startDecode_GmImage_(iGmImage *d, const iMedia *media) {
+    cancelDecode_GmImage_(d);
+    iBlock *data = &d->partialData;
+    d->numBytes  = size_Block(data);
+    d->size      = zero_I2();
+    SDL_DestroyTexture(d->texture);
+    d->texture   = NULL;
+    const iBool isWebP = cmp_String(&d->props.mime, "image/webp") == 0;
+    /* Only the header is parsed here. */
+    if (isWebP) {
+#if defined (LAGRANGE_ENABLE_WEBP)
+        if (!WebPGetInfo(constData_Block(data), size_Block(data), &d->size.x, &d->size.y)) {
+            d->size = zero_I2();
+        }
+#endif
+    }
+    else if (!stbi_info_from_memory(
+                 constData_Block(data), (int) size_Block(data), &d->size.x, &d->size.y, NULL)) {
+        fprintf(stderr, "[media] image load failed: %s\n", stbi_failure_reason());
+        d->size = zero_I2();
+    }
+    if (d->size.x <= 0 || d->size.y <= 0) {
+        d->size = zero_I2();
+        clear_Block(data);
+        return;
+    }
+    iGmImageJob *job = iMalloc(GmImageJob);
+    job->media       = media;
+    job->linkId      = d->props.linkId;
+    init_Block(&job->data, 0);
+    iSwap(iBlock, job->data, *data); /* `partialData` is no longer needed */
+    job->isWebP      = isWebP;
+    job->size        = d->size;
+    job->texSize     = textureSize_GmImage_(d);
+    job->style       = prefs_App()->imageStyle;
+    job->styleColors = currentImageStyleColors_();
+    job->pixels      = NULL;
+    job->isStarted   = iFalse;
+    job->isFinished  = iFalse;
+    job->isAbandoned = iFalse;
+    d->job = job;
+    if (!decodeMutex_) {
+        decodeMutex_ = new_Mutex();
+        init_PtrArray(&decodeJobs_);
+    }
+    lock_Mutex(decodeMutex_);
+    pushBack_PtrArray(&decodeJobs_, job);
+    /* Start more workers if there are more jobs waiting than there are workers running. */
+    const int maxWorkers = iClamp(SDL_GetCPUCount() - 1, 1, maxDecodeWorkers_GmImage_);
+    int       numRunning = 0;
+    for (int i = 0; i < maxWorkers; i++) {
+        numRunning += isDecodeWorkerRunning_[i] ? 1 : 0;
+    }
+    for (int i = 0; i < maxWorkers && numRunning < (int) size_PtrArray(&decodeJobs_); i++) {
+        if (!isDecodeWorkerRunning_[i]) {
+            if (decodeWorkers_[i]) {
+                join_Thread(decodeWorkers_[i]); /* already exiting */
+                iRelease(decodeWorkers_[i]);
             }
+            decodeWorkers_[i] = new_Thread(runDecodeJobs_GmImage_);
+            setUserData_Thread(decodeWorkers_[i], &isDecodeWorkerRunning_[i]);
+            isDecodeWorkerRunning_[i] = iTrue;
+            start_Thread(decodeWorkers_[i]);
+            numRunning++;
         }
+    }
+    unlock_Mutex(decodeMutex_);
+}
+
+static iBool finishDecode_GmImage_(iGmImage *d) {
+    iGmImageJob *job = d->job;
+    if (!job) {
+        return iFalse;
+    }
+    lock_Mutex(decodeMutex_);
+    const iBool isFinished = job->isFinished;
+    unlock_Mutex(decodeMutex_);
+    if (!isFinished) {
+        return iFalse;
+    }
+    d->job = NULL;
+    if (job->pixels) {
         /* Create the texture. */
-        SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(
-            imgData, texSize.x, texSize.y, 32, texSize.x * 4, SDL_PIXELFORMAT_ABGR8888);
+        SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(job->pixels,
+                                                                  job->texSize.x,
+                                                                  job->texSize.y,
+                                                                  32,
+                                                                  job->texSize.x * 4,
+                                                                  SDL_PIXELFORMAT_ABGR8888);
         /* TODO: In multiwindow case, all windows must have the same shared renderer?
            Or at least a shared context. */
         SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1"); /* linear scaling */
-        d->texture = SDL_CreateTextureFromSurface(renderer_Window(window), surface);
+        d->texture = SDL_CreateTextureFromSurface(renderer_Window(get_Window()), surface);
         SDL_FreeSurface(surface);
-        free(imgData);
     }
-    clear_Block(data);
+    delete_GmImageJob_(job);
+    return iTrue;
+}
+
+void waitForImageDecodes_Media(void) {
+    if (!decodeMutex_) {
+        return;
+    }
+    lock_Mutex(decodeMutex_);
+    /* Jobs that haven't been started are left undecoded; their images delete them. */
+    while (!isEmpty_PtrArray(&decodeJobs_)) {
+        iGmImageJob *job;
+        take_PtrArray(&decodeJobs_, 0, (void **) &job);
+        job->isFinished = iTrue;
+    }
+    iThread *workers[maxDecodeWorkers_GmImage_];
+    iForIndices(i, decodeWorkers_) {
+        workers[i] = decodeWorkers_[i];
+        decodeWorkers_[i] = NULL;
+    }
+    unlock_Mutex(decodeMutex_);
+    iForIndices(i, workers) {
+        if (workers[i]) {
+            join_Thread(workers[i]);
+            iRelease(workers[i]);
+        }
+    }
 }
 
 iDefineTypeConstructionArgs(GmImage, (const iBlock *data), data)
@@ -214,6 +442,7 @@ void init_GmAudio(iGmAudio *d) {
     init_GmMediaProps_(&d->props);
 #if defined (LAGRANGE_ENABLE_AUDIO)
     d->player = new_Player();
+    setInputWindow_Player(d->player, (size_t) prefs_App()->audioBufferSize * 1000000);
 #endif
 }
 
@@ -338,6 +567,9 @@ size_t memorySize_Media(const iMedia *d) {
             const iInt2 texSize = size_SDLTexture(img->texture);
             memSize += 4 * texSize.x * texSize.y; /* RGBA */
         }
+        else if (img->job) {
+            memSize += img->numBytes; /* being decoded */
+        }
         else {
             memSize += size_Block(&img->partialData);
         }
@@ -399,7 +631,7 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
             iAssert(equal_String(&img->props.mime, mime)); /* MIME cannot change */
             set_Block(&img->partialData, data);
             if (!isPartial) {
-                makeTexture_GmImage(img);
+                startDecode_GmImage_(img, d);
             }
         }
     }
@@ -413,7 +645,11 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
         else {
             audio = at_PtrArray(&d->items[audio_MediaType], existingIndex);
             iAssert(equal_String(&audio->props.mime, mime)); /* MIME cannot change */
-            updateSourceData_Player(audio->player, mime, data, append_PlayerUpdate);
+            updateSourceData_Player(audio->player,
+                                    mime,
+                                    data,
+                                    flags & newDataOnly_MediaFlag ? appendNew_PlayerUpdate
+                                                                  : append_PlayerUpdate);
             if (!isPartial) {
                 updateSourceData_Player(audio->player, NULL, NULL, complete_PlayerUpdate);
             }
@@ -446,14 +682,14 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
     }
     else if (!isDeleting) {
         if (startsWith_String(mime, "image/")) {
-            /* Copy the image to a texture. */
+            /* The image is decoded to a texture in the background. */
             iGmImage *img = new_GmImage(data);
             img->props.linkId = linkId; /* TODO: use a hash? */
             img->props.isPermanent = !allowHide;
             set_String(&img->props.mime, mime);
             pushBack_PtrArray(&d->items[image_MediaType], img);
             if (!isPartial) {
-                makeTexture_GmImage(img);
+                startDecode_GmImage_(img, d);
             }
             isNew = iTrue;
         }
@@ -506,6 +742,15 @@ iMediaId findMediaForLink_Media(const iMedia *d, iGmLinkId linkId, enum iMediaTy
     return mid;
 }
 
+iBool isEmpty_Media(const iMedia *d) {
+    iForIndices(i, d->items) {
+        if (!isEmpty_PtrArray(&d->items[i])) {
+            return iFalse;
+        }
+    }
+    return iTrue;
+}
+
 size_t numAudio_Media(const iMedia *d) {
     return size_PtrArray(&d->items[audio_MediaType]);
 }
@@ -520,6 +765,26 @@ iInt2 imageSize_Media(const iMedia *d, iMediaId imageId) {
     return zero_I2();
 }
 
+iBool isImageDecoding_Media(const iMedia *d, iMediaId imageId) {
+    iAssert(imageId.type == image_MediaType);
+    const size_t index = index_MediaId(imageId);
+    if (index < size_PtrArray(&d->items[image_MediaType])) {
+        const iGmImage *img = constAt_PtrArray(&d->items[image_MediaType], index);
+        return img->job != NULL;
+    }
+    return iFalse;
+}
+
+iBool finishImageDecodes_Media(iMedia *d) {
+    iBool isChanged = iFalse;
+    iForEach(PtrArray, i, &d->items[image_MediaType]) {
+        if (finishDecode_GmImage_(i.ptr)) {
+            isChanged = iTrue;
+        }
+    }
+    return isChanged;
+}
+
 SDL_Texture *imageTexture_Media(const iMedia *d, iMediaId imageId) {
     iAssert(imageId.type == image_MediaType);
     const size_t index = index_MediaId(imageId);
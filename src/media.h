@@ -45,6 +45,7 @@ iDeclareTypeConstruction(Media)
 enum iMediaFlags {
     allowHide_MediaFlag   = iBit(1),
     partialData_MediaFlag = iBit(2),
+    newDataOnly_MediaFlag = iBit(3), /* audio: data follows what was previously set */
 };
 
 enum iMediaType { /* Note: There is a limited number of bits for these; see GmRun. */
@@ -72,6 +73,7 @@ iBool           setUrl_Media            (iMedia *, uint16_t linkId, enum iMediaT
 iBool           setData_Media           (iMedia *, uint16_t linkId, const iString *mime, const iBlock *data, int flags);
 
 size_t          memorySize_Media        (const iMedia *);
+iBool           isEmpty_Media           (const iMedia *);
 iMediaId        findMediaForLink_Media  (const iMedia *, uint16_t linkId, enum iMediaType mediaType);
 
 iMediaId        id_Media        (const iMedia *, uint16_t linkId, enum iMediaType type);
@@ -99,6 +101,10 @@ iLocalDef iBool downloadInfo_Media(const iMedia *d, uint16_t mediaId, iGmMediaIn
 
 iInt2           imageSize_Media         (const iMedia *, iMediaId imageId);
 SDL_Texture *   imageTexture_Media      (const iMedia *, iMediaId imageId);
+iBool           isImageDecoding_Media   (const iMedia *, iMediaId imageId);
+iBool           finishImageDecodes_Media(iMedia *); /* uploads decoded images as textures */
+
+void            waitForImageDecodes_Media(void); /* drops queued jobs, joins the workers */
 
 size_t          numAudio_Media          (const iMedia *);
 iPlayer *       audioPlayer_Media       (const iMedia *, iMediaId audioId);
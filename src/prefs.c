@@ -82,6 +82,8 @@ void init_Prefs(iPrefs *d) {
     d->detachedPrefs     = iTrue;
     d->pinSplit          = 1;
     d->feedInterval      = fourHours_FeedInterval;
+    d->maxFeedRequests   = 10;
+    d->maxFeedRequestsPerHost = 2;
     d->time24h           = iTrue;
     d->returnKey         = default_ReturnKeyBehavior;
     d->retainTabs        = iTrue;
@@ -107,6 +109,8 @@ void init_Prefs(iPrefs *d) {
     d->maxCacheSize      = 10;
     d->maxMemorySize     = 200;
     d->maxUrlSize        = 8192;
+    d->maxGlyphCacheSize = 64;
+    d->audioBufferSize   = 4;
     setCStr_String(&d->strings[uiFont_PrefsString], "default");
     setCStr_String(&d->strings[headingFont_PrefsString], "default");
     setCStr_String(&d->strings[bodyFont_PrefsString], "default");
@@ -222,6 +222,8 @@ struct Impl_Prefs {
     /* Behavior */
     int              pinSplit; /* 0: no pinning, 1: left doc, 2: right doc */
     enum iFeedInterval feedInterval;
+    int              maxFeedRequests; /* concurrent requests when refreshing feeds */
+    int              maxFeedRequestsPerHost;
     int              returnKey;
     int              smoothScrollSpeed[max_ScrollType];
     enum iCollapse   collapsePre;
@@ -229,6 +231,8 @@ struct Impl_Prefs {
     int              maxCacheSize; /* MB */
     int              maxMemorySize; /* MB */
     int              maxUrlSize; /* bytes; longer ones will be disregarded */
+    int              maxGlyphCacheSize; /* MB; at least one cache page is used */
+    int              audioBufferSize; /* MB; received audio kept in memory behind the playback position */
     /* Style */
     iStringSet *     disabledFontPacks;
     int              gemtextAnsiEscapes;
@@ -0,0 +1,294 @@
+/* Copyright 2023 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "profiler.h"
+
+#include <the_Foundation/atomic.h>
+#include <the_Foundation/file.h>
+#include <the_Foundation/mutex.h>
+#include <SDL_timer.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define numRingEvents_Profiler_     8192 /* per thread; must be a power of two */
+#define maxThreads_Profiler_        128 /* at the same time; slots of exited threads are reused */
+#define numFrameTimes_Profiler_     1024
+
+iDeclareType(ProfilerEvent)
+
+struct Impl_ProfilerEvent {
+    const char *zone; /* NULL at the end of a zone */
+    uint64_t    time; /* performance counter */
+};
+
+iDeclareType(ProfilerThread)
+
+struct Impl_ProfilerThread {
+    int            id;
+    const char *   name;
+    int            epoch;
+    iBool          isExited; /* slot can be reused; events are kept until then */
+    iAtomicInt     count; /* total number of recorded events; the ring has the latest ones */
+    iProfilerEvent events[numRingEvents_Profiler_];
+};
+
+static struct {
+    iAtomicInt       isEnabled;
+    iAtomicInt       epoch; /* incremented when a new recording is started */
+    uint64_t         startTime;
+    iMutex *         mtx;
+    iProfilerThread *threads[maxThreads_Profiler_];
+    size_t           numThreads;
+    int              nextThreadId;
+    pthread_key_t    exitKey; /* destructor notices when a recording thread exits */
+    uint64_t         frameStartTime;
+    uint32_t         frameTimes[numFrameTimes_Profiler_]; /* microseconds; a ring */
+    size_t           numFrames;
+} profiler_;
+
+static _Thread_local iProfilerThread *thread_Profiler_;
+static _Thread_local const char      *threadName_Profiler_;
+static _Thread_local iBool            isThreadRejected_Profiler_;
+
+static void threadExited_Profiler_(void *ptr) {
+    iProfilerThread *d = ptr;
+    lock_Mutex(profiler_.mtx);
+    d->isExited = iTrue;
+    unlock_Mutex(profiler_.mtx);
+}
+
+void init_Profiler(void) {
+    profiler_.mtx = new_Mutex();
+    pthread_key_create(&profiler_.exitKey, threadExited_Profiler_);
+}
+
+void deinit_Profiler(void) {
+    set_Atomic(&profiler_.isEnabled, iFalse);
+    pthread_key_delete(profiler_.exitKey); /* no more exit notifications */
+    lock_Mutex(profiler_.mtx);
+    for (size_t i = 0; i < profiler_.numThreads; i++) {
+        free(profiler_.threads[i]);
+    }
+    profiler_.numThreads = 0;
+    unlock_Mutex(profiler_.mtx);
+    delete_Mutex(profiler_.mtx);
+    profiler_.mtx = NULL;
+    thread_Profiler_ = NULL;
+}
+
+void setEnabled_Profiler(iBool enable) {
+    if (!profiler_.mtx || enable == isEnabled_Profiler()) {
+        return;
+    }
+    if (enable) {
+        /* Threads notice the new epoch and reset their own rings. */
+        profiler_.startTime = SDL_GetPerformanceCounter();
+        add_Atomic(&profiler_.epoch, 1);
+    }
+    set_Atomic(&profiler_.isEnabled, enable);
+}
+
+iBool isEnabled_Profiler(void) {
+    return value_Atomic(&profiler_.isEnabled) != 0;
+}
+
+void setThreadName_Profiler(const char *name) {
+    threadName_Profiler_ = name;
+    if (thread_Profiler_) {
+        thread_Profiler_->name = name;
+    }
+}
+
+static iProfilerThread *newThread_Profiler_(const char *firstZone) {
+    iProfilerThread *d = NULL;
+    lock_Mutex(profiler_.mtx);
+    /* Threads are often short-lived (e.g., one per feed refresh), so reuse a ring. */
+    for (size_t i = 0; i < profiler_.numThreads; i++) {
+        if (profiler_.threads[i]->isExited) {
+            d = profiler_.threads[i];
+            break;
+        }
+    }
+    if (!d && profiler_.numThreads < maxThreads_Profiler_) {
+        d = calloc(1, sizeof(iProfilerThread));
+        profiler_.threads[profiler_.numThreads++] = d;
+    }
+    if (d) {
+        d->id       = ++profiler_.nextThreadId;
+        d->name     = threadName_Profiler_ ? threadName_Profiler_ : firstZone;
+        d->epoch    = -1;
+        d->isExited = iFalse;
+        set_Atomic(&d->count, 0);
+        pthread_setspecific(profiler_.exitKey, d);
+    }
+    unlock_Mutex(profiler_.mtx);
+    return d;
+}
+
+static void record_Profiler_(const char *zone) {
+    if (!value_Atomic(&profiler_.isEnabled)) {
+        return;
+    }
+    iProfilerThread *d = thread_Profiler_;
+    if (!d) {
+        if (isThreadRejected_Profiler_ || !profiler_.mtx) {
+            return;
+        }
+        d = thread_Profiler_ = newThread_Profiler_(zone ? zone : "thread");
+        if (!d) {
+            isThreadRejected_Profiler_ = iTrue; /* too many threads at once */
+            return;
+        }
+    }
+    const int epoch = value_Atomic(&profiler_.epoch);
+    if (d->epoch != epoch) {
+        d->epoch = epoch;
+        set_Atomic(&d->count, 0);
+    }
+    const int count = value_Atomic(&d->count);
+    iProfilerEvent *ev = &d->events[count & (numRingEvents_Profiler_ - 1)];
+    ev->zone = zone;
+    ev->time = SDL_GetPerformanceCounter();
+    set_Atomic(&d->count, count + 1); /* publish */
+}
+
+void beginZone_Profiler(const char *zone) {
+    record_Profiler_(zone);
+}
+
+void endZone_Profiler(void) {
+    record_Profiler_(NULL);
+}
+
+void beginFrame_Profiler(void) {
+    profiler_.frameStartTime = SDL_GetPerformanceCounter();
+    record_Profiler_("frame");
+}
+
+void endFrame_Profiler(void) {
+    record_Profiler_(NULL);
+    const uint64_t elapsed = SDL_GetPerformanceCounter() - profiler_.frameStartTime;
+    profiler_.frameTimes[profiler_.numFrames++ % numFrameTimes_Profiler_] =
+        (uint32_t) (elapsed * 1000000 / SDL_GetPerformanceFrequency());
+}
+
+static double micros_Profiler_(uint64_t time) {
+    return (double) (int64_t) (time - profiler_.startTime) * 1.0e6 / SDL_GetPerformanceFrequency();
+}
+
+iBool save_Profiler(const char *path) {
+    if (!profiler_.mtx) {
+        return iFalse;
+    }
+    iFile *f = newCStr_File(path);
+    if (!open_File(f, writeOnly_FileMode | text_FileMode)) {
+        iRelease(f);
+        return iFalse;
+    }
+    const int epoch = value_Atomic(&profiler_.epoch);
+    iString *out = new_String();
+    iBool isFirst = iTrue;
+    appendCStr_String(out, "{\"traceEvents\":[\n");
+    lock_Mutex(profiler_.mtx);
+    for (size_t i = 0; i < profiler_.numThreads; i++) {
+        const iProfilerThread *d = profiler_.threads[i];
+        if (d->epoch != epoch) {
+            continue; /* nothing recorded during this session */
+        }
+        appendFormat_String(out,
+                            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                            "\"args\":{\"name\":\"%s\"}}",
+                            isFirst ? "" : ",\n", d->id, d->name);
+        isFirst = iFalse;
+        /* The thread may still be recording, so skip the oldest events that might be
+           getting overwritten right now. */
+        const int count = value_Atomic(&d->count);
+        const int first = iMax(0, count - numRingEvents_Profiler_ + 64);
+        for (int j = first; j < count; j++) {
+            const iProfilerEvent *ev = &d->events[j & (numRingEvents_Profiler_ - 1)];
+            if (ev->zone) {
+                appendFormat_String(out,
+                                    ",\n{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                                    ev->zone, micros_Profiler_(ev->time), d->id);
+            }
+            else {
+                appendFormat_String(out,
+                                    ",\n{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                                    micros_Profiler_(ev->time), d->id);
+            }
+        }
+        write_File(f, utf8_String(out));
+        clear_String(out);
+    }
+    unlock_Mutex(profiler_.mtx);
+    appendCStr_String(out, "\n]}\n");
+    write_File(f, utf8_String(out));
+    delete_String(out);
+    iRelease(f);
+    return iTrue;
+}
+
+static int cmpFrameTime_Profiler_(const void *a, const void *b) {
+    const uint32_t x = *(const uint32_t *) a;
+    const uint32_t y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+const iString *debugInfo_Profiler(void) {
+    iString *msg = collectNew_String();
+    const size_t numFrames = iMin(profiler_.numFrames, (size_t) numFrameTimes_Profiler_);
+    if (numFrames) {
+        uint32_t sorted[numFrameTimes_Profiler_];
+        memcpy(sorted, profiler_.frameTimes, sizeof(uint32_t) * numFrames);
+        qsort(sorted, numFrames, sizeof(uint32_t), cmpFrameTime_Profiler_);
+        appendFormat_String(msg,
+                            "Frame times (latest %zu): p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+                            numFrames,
+                            sorted[numFrames / 2] / 1000.0,
+                            sorted[iMin(numFrames - 1, numFrames * 99 / 100)] / 1000.0,
+                            sorted[numFrames - 1] / 1000.0);
+    }
+    else {
+        appendCStr_String(msg, "No frames drawn yet.\n");
+    }
+    size_t numThreads = 0;
+    size_t numEvents  = 0;
+    if (profiler_.mtx) {
+        const int epoch = value_Atomic(&profiler_.epoch);
+        lock_Mutex(profiler_.mtx);
+        for (size_t i = 0; i < profiler_.numThreads; i++) {
+            const iProfilerThread *d = profiler_.threads[i];
+            if (d->epoch == epoch) {
+                numThreads++;
+                numEvents += iMin(value_Atomic(&d->count), numRingEvents_Profiler_);
+            }
+        }
+        unlock_Mutex(profiler_.mtx);
+    }
+    appendFormat_String(msg,
+                        "Profiler: %s, %zu events from %zu threads\n",
+                        isEnabled_Profiler() ? "recording" : "stopped",
+                        numEvents,
+                        numThreads);
+    return msg;
+}
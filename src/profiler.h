@@ -0,0 +1,45 @@
+/* Copyright 2023 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include <the_Foundation/string.h>
+
+/* Lightweight profiler of named zones. While enabled, each thread records the begin and end
+   times of zones into its own ring buffer, so only the latest events are kept. The recording
+   can be saved as a Chrome trace (chrome://tracing, Perfetto). Frame times are collected
+   even when the profiler is disabled. */
+
+void    init_Profiler           (void);
+void    deinit_Profiler         (void);
+
+void    setEnabled_Profiler     (iBool enable); /* enabling discards the previous recording */
+iBool   isEnabled_Profiler      (void);
+void    setThreadName_Profiler  (const char *name); /* name must remain valid */
+
+void    beginZone_Profiler      (const char *zone); /* zone name must remain valid */
+void    endZone_Profiler        (void);
+void    beginFrame_Profiler     (void);
+void    endFrame_Profiler       (void);
+
+iBool   save_Profiler           (const char *path); /* Chrome trace JSON */
+const iString *debugInfo_Profiler(void);
@@ -0,0 +1,426 @@
+/* Copyright 2023 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "responsecache.h"
+#include "app.h"
+#include "defs.h"
+
+#include <the_Foundation/buffer.h>
+#include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
+#include <the_Foundation/hash.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/path.h>
+#include <the_Foundation/ptrarray.h>
+#include <the_Foundation/thread.h>
+#include <stdio.h>
+
+iDeclareType(CacheEntry)
+iDeclareType(CacheWrite)
+iDeclareType(ResponseCache)
+
+/* Each cached response is in its own file, named after a checksum of the URL and identity.
+   The file also contains the URL and identity so a checksum collision is detected as a miss.
+   The index file remembers the sizes and last use times of the entries, for eviction. */
+
+struct Impl_CacheEntry {
+    iHashNode node;     /* key is a checksum of the URL and identity */
+    uint32_t  size;     /* bytes on disk */
+    uint64_t  lastUsed; /* seconds */
+};
+
+/* Entry files are written in a background thread so storing a response doesn't stall the
+   UI. An entry is added to the index only after its file has been fully written. */
+
+struct Impl_CacheWrite {
+    uint32_t key;
+    iBlock * data;
+    uint32_t generation; /* `generation` of the cache when queued */
+};
+
+struct Impl_ResponseCache {
+    iMutex *  mtx;
+    iString   dir;
+    iHash     entries;
+    size_t    totalSize;
+    iBool     isIndexChanged;
+    iPtrArray pendingWrites;
+    iThread * writer;
+    iBool     isWriterRunning;
+    uint32_t  generation; /* incremented when cleared; pending writes are discarded */
+};
+
+static iResponseCache responseCache_;
+
+static const char *indexFileName_ResponseCache_ = "index.lgr";
+static const char *magicIndex_ResponseCache_    = "lgRi";
+static const char *magicEntry_ResponseCache_    = "lgRe";
+static const int   maxAge_ResponseCache_        = 30 * 24 * 3600; /* unused for a month */
+
+enum iResponseCacheIndexVersion {
+    initial_ResponseCacheIndexVersion = 1,
+    /* meta */
+    latest_ResponseCacheIndexVersion = initial_ResponseCacheIndexVersion,
+};
+
+static iBool isInitialized_ResponseCache_(const iResponseCache *d) {
+    return d->mtx != NULL;
+}
+
+static iBool isCacheable_ResponseCache_(const iString *url) {
+    /* Local content is always available anyway. */
+    return !startsWithCase_String(url, "about:") && !startsWithCase_String(url, "file:") &&
+           !startsWithCase_String(url, "data:");
+}
+
+static uint32_t key_ResponseCache_(const iString *url, const iBlock *identity) {
+    iBlock *id = copy_Block(&url->chars);
+    pushBack_Block(id, 0);
+    if (identity) {
+        append_Block(id, identity);
+    }
+    const uint32_t key = iCrc32(constData_Block(id), size_Block(id));
+    delete_Block(id);
+    return key;
+}
+
+static const char *entryPath_ResponseCache_(const iResponseCache *d, uint32_t key) {
+    return concatPath_CStr(cstr_String(&d->dir), format_CStr("%08x.lgr", key));
+}
+
+static uint64_t now_ResponseCache_(void) {
+    iTime now;
+    initCurrent_Time(&now);
+    return integralSeconds_Time(&now);
+}
+
+static void loadIndex_ResponseCache_(iResponseCache *d) {
+    iFile *f = newCStr_File(concatPath_CStr(cstr_String(&d->dir), indexFileName_ResponseCache_));
+    if (open_File(f, readOnly_FileMode)) {
+        char magic[4];
+        readData_File(f, 4, magic);
+        if (!memcmp(magic, magicIndex_ResponseCache_, 4) &&
+            readU32_File(f) <= latest_ResponseCacheIndexVersion) {
+            iStream *ins = stream_File(f);
+            for (uint32_t count = readU32_Stream(ins); count > 0 && !atEnd_File(f); count--) {
+                iCacheEntry *entry = iMalloc(CacheEntry);
+                entry->node.key = readU32_Stream(ins);
+                entry->size     = readU32_Stream(ins);
+                entry->lastUsed = readU64_Stream(ins);
+                iCacheEntry *old = (iCacheEntry *) insert_Hash(&d->entries, &entry->node);
+                if (old) {
+                    d->totalSize -= old->size;
+                    free(old);
+                }
+                d->totalSize += entry->size;
+            }
+        }
+    }
+    iRelease(f);
+    d->isIndexChanged = iFalse;
+}
+
+static iBool writeFile_ResponseCache_(const char *path, const iBlock *data) {
+    /* The old file is replaced only after the new contents have been written in full. */
+    const char *tempPath = format_CStr("%s.tmp", path);
+    iFile *     f        = newCStr_File(tempPath);
+    iBool       ok       = iFalse;
+    if (open_File(f, writeOnly_FileMode)) {
+        ok = (write_File(f, data) == size_Block(data));
+        close_File(f);
+    }
+    iRelease(f);
+    if (ok) {
+        commitFile_App(path, tempPath);
+    }
+    else {
+        remove(tempPath);
+    }
+    return ok;
+}
+
+static void saveIndex_ResponseCache_(iResponseCache *d) {
+    iBuffer *buf = new_Buffer();
+    openEmpty_Buffer(buf);
+    iStream *outs = stream_Buffer(buf);
+    writeData_Stream(outs, magicIndex_ResponseCache_, 4);
+    writeU32_Stream(outs, latest_ResponseCacheIndexVersion);
+    writeU32_Stream(outs, (uint32_t) size_Hash(&d->entries));
+    iConstForEach(Hash, i, &d->entries) {
+        const iCacheEntry *entry = (const iCacheEntry *) i.value;
+        writeU32_Stream(outs, entry->node.key);
+        writeU32_Stream(outs, entry->size);
+        writeU64_Stream(outs, entry->lastUsed);
+    }
+    if (writeFile_ResponseCache_(
+            concatPath_CStr(cstr_String(&d->dir), indexFileName_ResponseCache_),
+            data_Buffer(buf))) {
+        d->isIndexChanged = iFalse;
+    }
+    iRelease(buf);
+}
+
+static void removeEntry_ResponseCache_(iResponseCache *d, iCacheEntry *entry) {
+    remove(entryPath_ResponseCache_(d, entry->node.key));
+    remove_Hash(&d->entries, entry->node.key);
+    d->totalSize -= entry->size;
+    d->isIndexChanged = iTrue;
+    free(entry);
+}
+
+static void delete_CacheWrite_(iCacheWrite *d) {
+    delete_Block(d->data);
+    free(d);
+}
+
+static iThreadResult writeEntries_ResponseCache_(iThread *thread) {
+    iResponseCache *d = userData_Thread(thread);
+    lock_Mutex(d->mtx);
+    while (!isEmpty_PtrArray(&d->pendingWrites)) {
+        iCacheWrite *job;
+        take_PtrArray(&d->pendingWrites, 0, (void **) &job);
+        unlock_Mutex(d->mtx);
+        iBeginCollect();
+        const char *path = entryPath_ResponseCache_(d, job->key);
+        const iBool ok   = writeFile_ResponseCache_(path, job->data);
+        lock_Mutex(d->mtx);
+        if (ok && job->generation != d->generation) {
+            remove(path); /* cache was cleared meanwhile */
+        }
+        else if (ok) {
+            iCacheEntry *entry = (iCacheEntry *) value_Hash(&d->entries, job->key);
+            if (!entry) {
+                entry = iMalloc(CacheEntry);
+                entry->node.key = job->key;
+                entry->size     = 0;
+                insert_Hash(&d->entries, &entry->node);
+            }
+            d->totalSize -= entry->size;
+            entry->size     = (uint32_t) size_Block(job->data);
+            entry->lastUsed = now_ResponseCache_();
+            d->totalSize += entry->size;
+            d->isIndexChanged = iTrue;
+        }
+        iEndCollect();
+        delete_CacheWrite_(job);
+    }
+    d->isWriterRunning = iFalse;
+    unlock_Mutex(d->mtx);
+    return 0;
+}
+
+void init_ResponseCache(const char *saveDir) {
+    iResponseCache *d = &responseCache_;
+    d->mtx = new_Mutex();
+    initCStr_String(&d->dir, concatPath_CStr(saveDir, "cache"));
+    makeDirs_Path(&d->dir);
+    init_Hash(&d->entries);
+    d->totalSize = 0;
+    init_PtrArray(&d->pendingWrites);
+    d->writer          = NULL;
+    d->isWriterRunning = iFalse;
+    d->generation      = 0;
+    loadIndex_ResponseCache_(d);
+}
+
+void deinit_ResponseCache(void) {
+    iResponseCache *d = &responseCache_;
+    if (!isInitialized_ResponseCache_(d)) {
+        return;
+    }
+    /* Finish writing the pending entries. */
+    if (d->writer) {
+        join_Thread(d->writer);
+        iRelease(d->writer);
+        d->writer = NULL;
+    }
+    deinit_PtrArray(&d->pendingWrites);
+    save_ResponseCache();
+    iForEach(Hash, i, &d->entries) {
+        free(remove_HashIterator(&i));
+    }
+    deinit_Hash(&d->entries);
+    deinit_String(&d->dir);
+    delete_Mutex(d->mtx);
+    d->mtx = NULL;
+}
+
+void save_ResponseCache(void) {
+    iResponseCache *d = &responseCache_;
+    iGuardMutex(d->mtx, {
+        if (d->isIndexChanged) {
+            saveIndex_ResponseCache_(d);
+        }
+    });
+}
+
+void store_ResponseCache(const iString *url, const iGmResponse *resp) {
+    iResponseCache *d = &responseCache_;
+    if (!isInitialized_ResponseCache_(d) || !isCacheable_ResponseCache_(url) ||
+        category_GmStatusCode(resp->statusCode) != categorySuccess_GmStatusCode) {
+        return;
+    }
+    const uint32_t key = key_ResponseCache_(url, &resp->identityFingerprint);
+    iBuffer *buf = new_Buffer();
+    openEmpty_Buffer(buf);
+    iStream *outs = stream_Buffer(buf);
+    writeData_Stream(outs, magicEntry_ResponseCache_, 4);
+    writeU32_Stream(outs, latest_FileVersion);
+    serialize_String(url, outs);
+    serialize_Block(&resp->identityFingerprint, outs);
+    serialize_GmResponse(resp, outs);
+    iCacheWrite *job = iMalloc(CacheWrite);
+    job->key  = key;
+    job->data = copy_Block(data_Buffer(buf));
+    iRelease(buf);
+    lock_Mutex(d->mtx);
+    job->generation = d->generation;
+    pushBack_PtrArray(&d->pendingWrites, job);
+    if (!d->isWriterRunning) {
+        if (d->writer) {
+            join_Thread(d->writer); /* already exiting */
+            iRelease(d->writer);
+        }
+        d->writer = new_Thread(writeEntries_ResponseCache_);
+        setUserData_Thread(d->writer, d);
+        d->isWriterRunning = iTrue;
+        start_Thread(d->writer);
+    }
+    unlock_Mutex(d->mtx);
+}
+
+iGmResponse *load_ResponseCache(const iString *url, const iBlock *identity) {
+    iResponseCache *d = &responseCache_;
+    if (!isInitialized_ResponseCache_(d) || !isCacheable_ResponseCache_(url)) {
+        return NULL;
+    }
+    const uint32_t key  = key_ResponseCache_(url, identity);
+    iGmResponse *   resp = NULL;
+    lock_Mutex(d->mtx);
+    iCacheEntry *entry = (iCacheEntry *) value_Hash(&d->entries, key);
+    if (entry) {
+        iFile *f = newCStr_File(entryPath_ResponseCache_(d, key));
+        if (open_File(f, readOnly_FileMode)) {
+            iStream *ins = stream_File(f);
+            char magic[4];
+            readData_File(f, 4, magic);
+            const uint32_t version = readU32_Stream(ins);
+            if (!memcmp(magic, magicEntry_ResponseCache_, 4) && version <= latest_FileVersion) {
+                setVersion_Stream(ins, version);
+                iString *entryUrl      = new_String();
+                iBlock  *entryIdentity = new_Block(0);
+                deserialize_String(entryUrl, ins);
+                deserialize_Block(entryIdentity, ins);
+                if (equal_String(entryUrl, url) &&
+                    (identity ? !cmp_Block(entryIdentity, identity)
+                              : isEmpty_Block(entryIdentity))) {
+                    resp = new_GmResponse();
+                    deserialize_GmResponse(resp, ins);
+                    entry->lastUsed   = now_ResponseCache_();
+                    d->isIndexChanged = iTrue;
+                }
+                delete_Block(entryIdentity);
+                delete_String(entryUrl);
+            }
+            iRelease(f);
+        }
+        else {
+            /* The file has gone missing. */
+            iRelease(f);
+            removeEntry_ResponseCache_(d, entry);
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return resp;
+}
+
+iBool contains_ResponseCache(const iString *url, const iBlock *identity) {
+    iResponseCache *d = &responseCache_;
+    if (!isInitialized_ResponseCache_(d) || !isCacheable_ResponseCache_(url)) {
+        return iFalse;
+    }
+    const uint32_t key = key_ResponseCache_(url, identity);
+    iBool contains;
+    iGuardMutex(d->mtx, contains = (value_Hash(&d->entries, key) != NULL));
+    return contains;
+}
+
+static int cmpLastUsed_CacheEntryPtr_(const void *a, const void *b) {
+    const iCacheEntry *i = *(const void **) a, *j = *(const void **) b;
+    return iCmp(i->lastUsed, j->lastUsed);
+}
+
+void trim_ResponseCache(size_t maxSize) {
+    iResponseCache *d = &responseCache_;
+    if (!isInitialized_ResponseCache_(d)) {
+        return;
+    }
+    const uint64_t now = now_ResponseCache_();
+    lock_Mutex(d->mtx);
+    /* Entries that haven't been used in a long time are removed regardless of size. */
+    iPtrArray *byAge = new_PtrArray();
+    iConstForEach(Hash, i, &d->entries) {
+        pushBack_PtrArray(byAge, i.value);
+    }
+    sort_Array(byAge, cmpLastUsed_CacheEntryPtr_);
+    iForEach(PtrArray, j, byAge) {
+        iCacheEntry *entry = j.ptr;
+        if (d->totalSize <= maxSize && entry->lastUsed + maxAge_ResponseCache_ >= now) {
+            break;
+        }
+        removeEntry_ResponseCache_(d, entry);
+    }
+    iRelease(byAge);
+    unlock_Mutex(d->mtx);
+}
+
+void clear_ResponseCache(void) {
+    iResponseCache *d = &responseCache_;
+    if (!isInitialized_ResponseCache_(d)) {
+        return;
+    }
+    lock_Mutex(d->mtx);
+    iForEach(PtrArray, w, &d->pendingWrites) {
+        delete_CacheWrite_(w.ptr);
+    }
+    clear_PtrArray(&d->pendingWrites);
+    d->generation++;
+    iForEach(Hash, i, &d->entries) {
+        free(remove_HashIterator(&i));
+    }
+    d->totalSize = 0;
+    /* Also remove any files that are not in the index. */
+    iForEach(DirFileInfo, i, iClob(new_DirFileInfo(&d->dir))) {
+        remove(cstr_String(path_FileInfo(i.value)));
+    }
+    d->isIndexChanged = iTrue;
+    unlock_Mutex(d->mtx);
+}
+
+size_t size_ResponseCache(void) {
+    iResponseCache *d = &responseCache_;
+    size_t size = 0;
+    if (isInitialized_ResponseCache_(d)) {
+        iGuardMutex(d->mtx, size = d->totalSize);
+    }
+    return size;
+}
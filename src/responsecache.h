@@ -0,0 +1,40 @@
+/* Copyright 2023 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include "gmrequest.h"
+
+/* Successful responses are also stored on disk so any tab can use them when revisiting a
+   page via the navigation history, even after the in-memory copy has been dropped. Entries
+   are identified by the URL and the fingerprint of the identity used for the request. */
+
+void            init_ResponseCache      (const char *saveDir);
+void            deinit_ResponseCache    (void);
+void            save_ResponseCache      (void); /* writes the index */
+
+void            store_ResponseCache     (const iString *url, const iGmResponse *resp); /* written in the background */
+iGmResponse *   load_ResponseCache      (const iString *url, const iBlock *identity); /* returns NULL if not cached */
+iBool           contains_ResponseCache  (const iString *url, const iBlock *identity);
+void            trim_ResponseCache      (size_t maxSize);
+void            clear_ResponseCache     (void);
+size_t          size_ResponseCache      (void); /* total bytes on disk */
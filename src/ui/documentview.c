@@ -33,6 +33,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "gmutil.h"
 #include "media.h"
 #include "paint.h"
+#include "profiler.h"
 #include "root.h"
 #include "mediaui.h"
 #include "touch.h"
@@ -736,16 +737,15 @@ static const iGmRun *middleRun_DocumentView_(const iDocumentView *d) {
     return params.closest;
 }
 
-void allocVisBuffer_DocumentView(const iDocumentView *d) {
+iBool allocVisBuffer_DocumentView(const iDocumentView *d) {
     const iWidget *w         = constAs_Widget(d->owner);
     const iBool    isVisible = isVisible_Widget(w);
     const iInt2    size      = bounds_Widget(w).size;
     if (isVisible) {
-        alloc_VisBuf(d->visBuf, size, 1);
-    }
-    else {
-        dealloc_VisBuf(d->visBuf);
+        return alloc_VisBuf(d->visBuf, size, 1);
     }
+    park_VisBuf(d->visBuf); /* keep the rendered contents for switching back */
+    return iFalse;
 }
 
 size_t visibleLinkOrdinal_DocumentView(const iDocumentView *d, iGmLinkId linkId) {
@@ -765,11 +765,8 @@ size_t visibleLinkOrdinal_DocumentView(const iDocumentView *d, iGmLinkId linkId)
     return iInvalidPos;
 }
 
-iBool updateDocumentWidthRetainingScrollPosition_DocumentView(iDocumentView *d, iBool keepCenter) {
-    const int newWidth = documentWidth_DocumentView(d);
-    if (newWidth == size_GmDocument(d->doc).x && !keepCenter /* not a font change */) {
-        return iFalse;
-    }
+static iBool relayoutRetainingScrollPosition_DocumentView_(iDocumentView *d, iBool keepCenter,
+                                                           iBool takeBackgroundLayout) {
     /* Font changes (i.e., zooming) will keep the view centered, otherwise keep the top
        of the visible area fixed. */
     const iGmRun *run     = keepCenter ? middleRun_DocumentView_(d) : d->visibleRuns.start;
@@ -781,8 +778,15 @@ iBool updateDocumentWidthRetainingScrollPosition_DocumentView(iDocumentView *d,
         voffset = visibleRange_DocumentView(d).start - top_Rect(run->visBounds);
     }
     run = NULL;
-    setWidth_GmDocument(d->doc, newWidth, width_Widget(d->owner));
-    setWidth_Banner(d->banner, newWidth);
+    if (takeBackgroundLayout) {
+        if (!takeBackgroundLayout_GmDocument(d->doc)) {
+            return iFalse;
+        }
+    }
+    else {
+        setWidth_GmDocument(d->doc, documentWidth_DocumentView(d), width_Widget(d->owner));
+    }
+    setWidth_Banner(d->banner, size_GmDocument(d->doc).x);
     documentRunsInvalidated_DocumentWidget(d->owner);
     if (runLoc && !keepCenter) {
         run = findRunAtLoc_GmDocument(d->doc, runLoc);
@@ -800,6 +804,24 @@ iBool updateDocumentWidthRetainingScrollPosition_DocumentView(iDocumentView *d,
     return iTrue;
 }
 
+iBool updateDocumentWidthRetainingScrollPosition_DocumentView(iDocumentView *d, iBool keepCenter) {
+    const int newWidth = documentWidth_DocumentView(d);
+    if (newWidth == size_GmDocument(d->doc).x && !keepCenter /* not a font change */) {
+        cancelBackgroundLayout_GmDocument(d->doc); /* back to the laid out width */
+        return iFalse;
+    }
+    /* When resizing, a long document is laid out in the background while the current
+       layout remains visible. Font changes would look broken with the old layout. */
+    if (!keepCenter && layoutInBackground_GmDocument(d->doc, newWidth, width_Widget(d->owner))) {
+        return iFalse;
+    }
+    return relayoutRetainingScrollPosition_DocumentView_(d, keepCenter, iFalse);
+}
+
+iBool takeBackgroundLayout_DocumentView(iDocumentView *d) {
+    return relayoutRetainingScrollPosition_DocumentView_(d, iFalse, iTrue);
+}
+
 iRect runRect_DocumentView(const iDocumentView *d, const iGmRun *run) {
     const iRect docBounds = documentBounds_DocumentView(d);
     return moved_Rect(run->bounds, addY_I2(topLeft_Rect(docBounds), viewPos_DocumentView(d)));
@@ -917,6 +939,11 @@ static void drawRun_DrawContext_(void *context, const iGmRun *run) {
             SDL_RenderCopy(d->paint.dst->render, tex, NULL,
                            &(SDL_Rect){ dst.pos.x, dst.pos.y, dst.size.x, dst.size.y });
         }
+        else if (isImageDecoding_Media(media_GmDocument(d->view->doc), mediaId_GmRun(run))) {
+            /* Placeholder until the background decoding finishes. */
+            drawRect_Paint(&d->paint, dst, tmQuoteIcon_ColorId);
+            drawCentered_Text(uiLabel_FontId, dst, iFalse, tmQuote_ColorId, hourglass_Icon);
+        }
         else {
             drawRect_Paint(&d->paint, dst, tmQuoteIcon_ColorId);
             drawCentered_Text(uiLabel_FontId,
@@ -1394,6 +1421,7 @@ static iBool render_DocumentView_(const iDocumentView *d, iDrawContext *ctx, iBo
     if (isEmpty_Range(&full)) {
         return didDraw;
     }
+    beginZone_Profiler("render_DocumentView_");
     d->drawBufs->lastRenderTime = SDL_GetTicks();
     /* Swap buffers around to have room available both before and after the visible region. */
     allocVisBuffer_DocumentView(d);
@@ -1566,6 +1594,7 @@ static iBool render_DocumentView_(const iDocumentView *d, iDrawContext *ctx, iBo
             clear_PtrSet(d->invalidRuns);
         }
     }
+    endZone_Profiler();
     return didDraw;
 }
 
@@ -77,7 +77,7 @@ iDeclareTypeConstruction(DocumentView)
 
 void    setOwner_DocumentView           (iDocumentView *, iDocumentWidget *doc);
 void    swap_DocumentView               (iDocumentView *, iDocumentView *swapBuffersWith); /* TODO: Remove this! */
-void    allocVisBuffer_DocumentView     (const iDocumentView *);
+iBool   allocVisBuffer_DocumentView     (const iDocumentView *); /* returns true if contents were lost */
 
 void    invalidate_DocumentView         (iDocumentView *);
 void    invalidateLink_DocumentView     (iDocumentView *, iGmLinkId id);
@@ -90,6 +90,7 @@ void    updateSideOpacity_DocumentView  (iDocumentView *, iBool isAnimated);
 void    updateDrawBufs_DocumentView     (iDocumentView *, int drawBufsFlags);
 iBool   updateWidth_DocumentView        (iDocumentView *);
 iBool   updateDocumentWidthRetainingScrollPosition_DocumentView (iDocumentView *, iBool keepCenter);
+iBool   takeBackgroundLayout_DocumentView   (iDocumentView *); /* returns True if layout was updated */
 int     updateScrollMax_DocumentView    (iDocumentView *);
 void    clampScroll_DocumentView        (iDocumentView *);
 void    immediateScroll_DocumentView    (iDocumentView *, int offset);
@@ -38,6 +38,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "gmrequest.h"
 #include "gmutil.h"
 #include "gopher.h"
+#include "responsecache.h"
 #include "history.h"
 #include "indicatorwidget.h"
 #include "inputwidget.h"
@@ -293,6 +294,7 @@ struct Impl_DocumentWidget {
     iString        sourceHeader;
     iString        sourceMime;
     iBlock         sourceContent; /* original content as received, for saving; set on request finish */
+    size_t         sourceUtf8Size; /* bytes of response body verified as UTF-8; iInvalidSize if not */
     iTime          sourceTime;
     iGempub *      sourceGempub; /* NULL unless the page is Gempub content */
     iBanner *      banner;
@@ -921,6 +923,8 @@ static void replaceDocument_DocumentWidget_(iDocumentWidget *d, iGmDocument *new
     pauseAllPlayers_Media(media_GmDocument(d->view->doc), iTrue);
     releaseViewDocument_DocumentWidget_(d);
     d->view->doc = ref_Object(newDoc);
+    /* Images may have been decoded while the document was in the history cache. */
+    finishImageDecodes_Media(media_GmDocument(d->view->doc));
     documentWasChanged_DocumentWidget_(d);
 }
 
@@ -1281,6 +1285,19 @@ static void postProcessRequestContent_DocumentWidget_(iDocumentWidget *d, iBool
     }
 }
 
+static void appendSource_DocumentWidget_(iDocumentWidget *d, iRangecc source) {
+    setUrl_GmDocument(d->view->doc, d->mod.url);
+    const int docWidth = documentWidth_DocumentView(d->view);
+    appendSource_GmDocument(d->view->doc,
+                            source,
+                            docWidth,
+                            width_Widget(d),
+                            isFinished_GmRequest(d->request) ? final_GmDocumentUpdate
+                                                             : partial_GmDocumentUpdate);
+    setWidth_Banner(d->banner, docWidth);
+    documentWasChanged_DocumentWidget_(d);
+}
+
 static void updateDocument_DocumentWidget_(iDocumentWidget *d,
                                            const iGmResponse *response,
                                            iGmDocument *cachedDoc,
@@ -1288,12 +1305,16 @@ static void updateDocument_DocumentWidget_(iDocumentWidget *d,
     if (d->state == ready_RequestState) {
         return;
     }
+    if (isInitialUpdate) {
+        d->sourceUtf8Size = 0;
+    }
     const iBool isRequestFinished = isFinished_GmRequest(d->request);
-    /* TODO: Do document update in the background. However, that requires a text metrics calculator
-       that does not try to cache the glyph bitmaps. */
+    /* TODO: Do document update in the background, too. Relayouts after a width change already
+       are (see `layoutInBackground_GmDocument`); new source could use the same mechanism. */
     const enum iGmStatusCode statusCode = response->statusCode;
     if (category_GmStatusCode(statusCode) != categoryInput_GmStatusCode) {
         iBool setSource = iTrue;
+        iBool isBodySource = iTrue; /* `str` is the response body as-is */
         iString str;
         invalidate_DocumentWidget_(d);
         if (document_App() == d) {
@@ -1367,6 +1388,7 @@ static void updateDocument_DocumentWidget_(iDocumentWidget *d,
                 }
                 else if (isRequestFinished && equal_Rangecc(param, "font/ttf")) {
                     clear_String(&str);
+                    isBodySource = iFalse;
                     docFormat = gemini_SourceFormat;
                     setRange_String(&d->sourceMime, param);
                     format_String(&str, "# TrueType Font\n");
@@ -1407,6 +1429,7 @@ static void updateDocument_DocumentWidget_(iDocumentWidget *d,
                           endsWithCase_Rangecc(param, "+zip")))) {
                     iArray *footerItems = collectNew_Array(sizeof(iMenuItem));
                     clear_String(&str);
+                    isBodySource = iFalse;
                     docFormat = gemini_SourceFormat;
                     setRange_String(&d->sourceMime, param);
                     iArchive *zip = new_Archive();
@@ -1504,6 +1527,7 @@ static void updateDocument_DocumentWidget_(iDocumentWidget *d,
                     const iBool isAudio = startsWith_Rangecc(param, "audio/");
                     /* Make a simple document with an image or audio player. */
                     clear_String(&str);
+                    isBodySource = iFalse;
                     docFormat = gemini_SourceFormat;
                     setRange_String(&d->sourceMime, param);
                     const iGmLinkId imgLinkId = 1; /* there's only the one link */
@@ -1576,6 +1600,31 @@ static void updateDocument_DocumentWidget_(iDocumentWidget *d,
                 }
             }
             setFormat_GmDocument(d->view->doc, docFormat);
+            /* Content received so far can be appended to the document as long as it stays
+               valid UTF-8. Only the newly received bytes need to be checked. */
+            if (isBodySource && setSource && !cachedDoc && d->sourceUtf8Size != iInvalidSize &&
+                equalCase_Rangecc(charset, "utf-8")) {
+                const iRangecc body = range_Block(&response->body);
+                iRangecc       pending = { body.start + iMin(d->sourceUtf8Size, size_Range(&body)),
+                                           body.end };
+                if (!isRequestFinished) {
+                    /* A multibyte character may be incomplete at the end. */
+                    while (pending.end > pending.start && pending.end[-1] != '\n') {
+                        pending.end--;
+                    }
+                }
+                if (isUtf8_Rangecc(pending)) {
+                    d->sourceUtf8Size = pending.end - body.start;
+                    appendSource_DocumentWidget_(d, body);
+                    if (isRequestFinished) {
+                        /* No need to keep a separate copy of the received data. */
+                        shareSource_GmDocument(d->view->doc, &response->body);
+                    }
+                    deinit_String(&str);
+                    return;
+                }
+                d->sourceUtf8Size = iInvalidSize;
+            }
             /* Convert the source to UTF-8 if needed. */
             if (equalCase_Rangecc(charset, "utf-8")) {
                 /* Verify that it actually is valid UTF-8. */
@@ -1704,7 +1753,9 @@ static void cacheDocumentGlyphs_DocumentWidget_(const iDocumentWidget *d) {
         if (maxY == 0) {
             maxY = size_GmDocument(d->view->doc).y;
         }
+        beginCacheBatch_Text();
         render_GmDocument(d->view->doc, (iRangei){ 0, maxY }, cacheRunGlyphs_, NULL);
+        endCacheBatch_Text();
     }
 }
 
@@ -1825,7 +1876,26 @@ static void updateFromCachedResponse_DocumentWidget_(iDocumentWidget *d, float n
         as_Widget(d)->root, "document.changed doc:%p url:%s", d, cstr_String(d->mod.url));
 }
 
+static void loadCachedResponse_DocumentWidget_(iDocumentWidget *d, const iRecentUrl *recent) {
+    /* The response may still be in the disk cache even though the history doesn't have it
+       in memory. */
+    if (!recent || recent->cachedResponse || !equalCase_String(&recent->url, d->mod.url)) {
+        return;
+    }
+    const iBlock *identity = &recent->setIdentity;
+    if (isEmpty_Block(identity)) {
+        const iGmIdentity *urlIdent = identityForUrl_GmCerts(certs_App(), d->mod.url);
+        identity = urlIdent ? &urlIdent->fingerprint : NULL;
+    }
+    iGmResponse *resp = load_ResponseCache(d->mod.url, identity);
+    if (resp) {
+        setCachedResponse_History(d->mod.history, resp);
+        delete_GmResponse(resp);
+    }
+}
+
 static iBool updateFromHistory_DocumentWidget_(iDocumentWidget *d, iBool useCachedDoc) {
+    loadCachedResponse_DocumentWidget_(d, constMostRecentUrl_History(d->mod.history));
     const iRecentUrl *recent = constMostRecentUrl_History(d->mod.history);
     setIdentity_DocumentWidget(d, recent ? &recent->setIdentity : NULL);
     if (recent && recent->cachedResponse && equalCase_String(&recent->url, d->mod.url)) {
@@ -2446,16 +2516,28 @@ static iBool handleMediaCommand_DocumentWidget_(iDocumentWidget *d, const char *
         const enum iGmStatusCode code = status_GmRequest(req->req);
         if (isSuccess_GmStatusCode(code)) {
             iGmResponse *resp = lockResponse_GmRequest(req->req);
-            if (isDownloadRequest_DocumentWidget(d, req) ||
-                startsWith_String(&resp->meta, "audio/")) {
+            const iBool  isAudio = !isDownloadRequest_DocumentWidget(d, req) &&
+                                   startsWith_String(&resp->meta, "audio/");
+            /* After a discard, the body only has data that the player hasn't seen. */
+            const iBool  isNewDataOnly = isAudio && isBodyDiscarded_GmRequest(req->req);
+            if (isDownloadRequest_DocumentWidget(d, req) || isAudio) {
                 /* TODO: Use a helper? This is same as below except for the partialData flag. */
                 if (setData_Media(media_GmDocument(d->view->doc),
                                   req->linkId,
                                   &resp->meta,
                                   &resp->body,
-                                  partialData_MediaFlag | allowHide_MediaFlag)) {
+                                  partialData_MediaFlag | allowHide_MediaFlag |
+                                      (isNewDataOnly ? newDataOnly_MediaFlag : 0))) {
                     redoLayout_GmDocument(d->view->doc);
                 }
+#if defined (LAGRANGE_ENABLE_AUDIO)
+                if (isNewDataOnly || (isAudio && size_Block(&resp->body) >
+                                                     (size_t) prefs_App()->audioBufferSize * 1000000)) {
+                    /* Too long to keep a second copy; it may be a stream without an end.
+                       The player keeps the data it needs. */
+                    discardBody_GmRequest(req->req);
+                }
+#endif
                 updateVisible_DocumentView(d->view);
                 invalidate_DocumentWidget_(d);
                 refresh_Widget(as_Widget(d));
@@ -2478,7 +2560,9 @@ static iBool handleMediaCommand_DocumentWidget_(iDocumentWidget *d, const char *
                               req->linkId,
                               meta_GmRequest(req->req),
                               body_GmRequest(req->req),
-                              allowHide_MediaFlag);
+                              allowHide_MediaFlag |
+                                  (isBodyDiscarded_GmRequest(req->req) ? newDataOnly_MediaFlag
+                                                                       : 0));
                 redoLayout_GmDocument(d->view->doc);
                 documentRunsInvalidated_DocumentWidget(d);
                 updateVisible_DocumentView(d->view);
@@ -2875,6 +2959,26 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
         showOrHideIndicators_DocumentWidget_(d);
         refresh_Widget(w);
     }
+    else if (equal_Command(cmd, "document.layout.finished") &&
+             pointerLabel_Command(cmd, "doc") == d->view->doc) {
+        if (takeBackgroundLayout_DocumentView(d->view)) {
+            resetWideRuns_DocumentView(d->view);
+            updateDrawBufs_DocumentView(d->view, updateSideBuf_DrawBufsFlag);
+            updateVisible_DocumentView(d->view);
+            invalidate_DocumentWidget_(d);
+            dealloc_VisBuf(d->view->visBuf);
+            refresh_Widget(w);
+        }
+        return iFalse;
+    }
+    else if (equal_Command(cmd, "media.image.decoded") &&
+             pointerLabel_Command(cmd, "media") == media_GmDocument(d->view->doc)) {
+        if (finishImageDecodes_Media(media_GmDocument(d->view->doc))) {
+            invalidate_DocumentWidget_(d);
+            refresh_Widget(w);
+        }
+        return iFalse;
+    }
     else if (equal_Command(cmd, "window.focus.lost")) {
         if (d->flags & showLinkNumbers_DocumentWidgetFlag) {
             setLinkNumberMode_DocumentWidget_(d, iFalse);
@@ -2918,7 +3022,15 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
             /* Set palette for our document. */
             updateTheme_DocumentWidget_(d);
             updateTrust_DocumentWidget_(d, NULL);
-            updateSize_DocumentWidget(d);
+            if (allocVisBuffer_DocumentView(d->view) ||
+                documentWidth_DocumentView(d->view) != size_GmDocument(d->view->doc).x) {
+                updateSize_DocumentWidget(d);
+            }
+            else {
+                /* Still rendered from when the tab was last shown, and the layout is unchanged. */
+                updateVisible_DocumentView(d->view);
+                arrange_Widget(d->footerButtons);
+            }
             showOrHideIndicators_DocumentWidget_(d);
             updateFetchProgress_DocumentWidget_(d);
             updateHover_Window(window_Widget(w));
@@ -3310,7 +3422,9 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
             if (!equal_Rangecc(urlScheme_String(d->mod.url), "about") &&
                 (startsWithCase_String(meta_GmRequest(d->request), "text/") ||
                  !cmp_String(&d->sourceMime, mimeType_Gempub))) {
-                setCachedResponse_History(d->mod.history, lockResponse_GmRequest(d->request));
+                const iGmResponse *resp = lockResponse_GmRequest(d->request);
+                setCachedResponse_History(d->mod.history, resp);
+                store_ResponseCache(d->mod.url, resp);
                 unlockResponse_GmRequest(d->request);
             }
         }
@@ -4396,7 +4510,7 @@ static iWidget *makeLinkContextMenuWithParameters_DocumentWidget_(iDocumentWidge
     iMediaRequest *mediaReq;
     if ((mediaReq = findMediaRequest_DocumentWidget(d, linkId)) != NULL &&
         linkMediaType != download_MediaType) {
-        if (isFinished_GmRequest(mediaReq->req)) {
+        if (isFinished_GmRequest(mediaReq->req) && !isBodyDiscarded_GmRequest(mediaReq->req)) {
             pushBack_Array(
                 items,
                 &(iMenuItem){ download_Icon " " saveToDownloads_Label,
@@ -4932,6 +5046,13 @@ static iBool processEvent_DocumentWidget_(iDocumentWidget *d, const SDL_Event *e
                             else {
                                 /* Show the existing content again if we have it. */
                                 iMediaRequest *req = findMediaRequest_DocumentWidget(d, linkId);
+                                if (req && isBodyDiscarded_GmRequest(req->req)) {
+                                    /* Streamed audio was not kept, so fetch it again. */
+                                    removeMediaRequest_DocumentWidget_(d, linkId);
+                                    requestMedia_DocumentWidget_(d, linkId, iTrue);
+                                    refresh_Widget(w);
+                                    return iTrue;
+                                }
                                 if (req) {
                                     setData_Media(media_GmDocument(view->doc),
                                                   linkId,
@@ -5295,6 +5416,7 @@ void init_DocumentWidget(iDocumentWidget *d) {
     init_String(&d->sourceHeader);
     init_String(&d->sourceMime);
     init_Block(&d->sourceContent, 0);
+    d->sourceUtf8Size = 0;
     iZap(d->sourceTime);
     d->sourceGempub    = NULL;
     d->initNormScrollY = 0;
@@ -5471,7 +5593,11 @@ void deserializeState_DocumentWidget(iDocumentWidget *d, iStream *ins) {
     if (d) {
         deserialize_PersistentDocumentState(&d->mod, ins);
         parseUser_DocumentWidget_(d);
-        updateFromHistory_DocumentWidget_(d, iTrue);
+        if (!updateFromHistory_DocumentWidget_(d, iTrue) && !isEmpty_String(d->mod.url) &&
+            !isTitanUrl_String(d->mod.url)) {
+            /* The response was left in the disk cache but isn't there any more. */
+            fetch_DocumentWidget_(d);
+        }
     }
     else {
         /* Read and throw away the data. */
@@ -46,6 +46,7 @@ iDeclareType(LookupJob)
 
 struct Impl_LookupJob {
     iRegExp *term;
+    iString words; /* the search term as entered */
     iTime now;
     iObjectList *docs;
     iPtrArray results;
@@ -53,6 +54,7 @@ struct Impl_LookupJob {
 
 static void init_LookupJob(iLookupJob *d) {
     d->term = NULL;
+    init_String(&d->words);
     initCurrent_Time(&d->now);
     d->docs = NULL;
     init_PtrArray(&d->results);
@@ -65,6 +67,7 @@ static void deinit_LookupJob(iLookupJob *d) {
     deinit_PtrArray(&d->results);
     iRelease(d->docs);
     iRelease(d->term);
+    deinit_String(&d->words);
 }
 
 iDefineTypeConstruction(LookupJob)
@@ -288,7 +291,7 @@ static void searchHistory_LookupJob_(iLookupJob *d) {
     size_t index = 0;
     iForEach(ObjectList, i, d->docs) {
         iConstForEach(StringArray, j,
-                      searchContents_History(history_DocumentWidget(i.object), d->term)) {
+                      searchContents_History(history_DocumentWidget(i.object), &d->words)) {
             const char *match = cstr_String(j.value);
             const size_t matchLen = argLabel_Command(match, "len");
             iRangecc text;
@@ -392,6 +395,7 @@ static iThreadResult worker_LookupWidget_(iThread *thread) {
             job->term = new_RegExp(cstr_String(pattern), caseInsensitive_RegExpOption);
             delete_String(pattern);
         }
+        set_String(&job->words, &d->pendingTerm);
         const size_t termLen = length_String(&d->pendingTerm); /* characters */
         const iBool snippetsOnly = !cmp_String(&d->pendingTerm, "!");
         clear_String(&d->pendingTerm);
@@ -32,6 +32,11 @@ iLocalDef SDL_Renderer *renderer_Paint_(const iPaint *d) {
     return d->dst->render;
 }
 
+static iBool isDamageClipped_Paint_(const iPaint *d) {
+    /* Only the damaged area of the window is being redrawn. */
+    return d->dst->damageTarget && SDL_GetRenderTarget(renderer_Paint_(d)) == d->dst->damageTarget;
+}
+
 static void setColor_Paint_(const iPaint *d, int color) {
     const iColor clr = get_Color(color & mask_ColorId);
     SDL_SetRenderDrawColor(renderer_Paint_(d), clr.r, clr.g, clr.b,
@@ -62,7 +67,7 @@ void beginTarget_Paint(iPaint *d, SDL_Texture *target) {
 
 void endTarget_Paint(iPaint *d) {
     if (d->setTarget) {
-        SDL_SetRenderTarget(renderer_Paint_(d), d->oldTarget);
+        restoreTarget_Paint(renderer_Paint_(d), d->oldTarget);
         origin_Paint = d->oldOrigin;
         d->oldOrigin = zero_I2();
         d->oldTarget = NULL;
@@ -70,6 +75,15 @@ void endTarget_Paint(iPaint *d) {
     }
 }
 
+void restoreTarget_Paint(SDL_Renderer *render, SDL_Texture *target) {
+    SDL_SetRenderTarget(render, target);
+    /* Changing the render target resets the clip rectangle. */
+    const iWindow *win = get_Window();
+    if (win && target && target == win->damageTarget) {
+        SDL_RenderSetClipRect(render, (const SDL_Rect *) &win->damageClip);
+    }
+}
+
 void setClip_Paint(iPaint *d, iRect rect) {
     addv_I2(&rect.pos, origin_Paint);
     iRect targetRect = zero_Rect();
@@ -82,6 +96,9 @@ void setClip_Paint(iPaint *d, iRect rect) {
     if (isEqual_I2(zero_I2(), origin_Paint)) {
         rect = intersect_Rect(rect, rect_Root(get_Root()));
     }
+    if (isDamageClipped_Paint_(d)) {
+        rect = intersect_Rect(rect, d->dst->damageClip);
+    }
     if (isEmpty_Rect(rect)) {
         rect = init_Rect(0, 0, 1, 1);
     }
@@ -93,6 +110,10 @@ void unsetClip_Paint(iPaint *d) {
         setClip_Paint(d, rect_Root(get_Root()));
         return;
     }
+    if (isDamageClipped_Paint_(d)) {
+        SDL_RenderSetClipRect(renderer_Paint_(d), (const SDL_Rect *) &d->dst->damageClip);
+        return;
+    }
 #if SDL_VERSION_ATLEAST(2, 0, 12)
     SDL_RenderSetClipRect(renderer_Paint_(d), NULL);
 #else
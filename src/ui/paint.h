@@ -43,6 +43,7 @@ void    init_Paint          (iPaint *);
 
 void    beginTarget_Paint   (iPaint *, SDL_Texture *target);
 void    endTarget_Paint     (iPaint *);
+void    restoreTarget_Paint (SDL_Renderer *, SDL_Texture *target); /* keeps the window's damage clip */
 
 void    setClip_Paint       (iPaint *, iRect rect);
 void    unsetClip_Paint     (iPaint *);
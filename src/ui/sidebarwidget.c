@@ -38,6 +38,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "mobile.h"
 #include "keys.h"
 #include "paint.h"
+#include "responsecache.h"
 #include "root.h"
 #include "scrollwidget.h"
 #include "touch.h"
@@ -2019,6 +2020,7 @@ static iBool processEvent_SidebarWidget_(iSidebarWidget *d, const SDL_Event *ev)
             }
             else {
                 clear_Visited(visited_App());
+                clear_ResponseCache(); /* pages of the forgotten history */
                 updateItems_SidebarWidget_(d);
                 scrollOffset_ListWidget(d->list, 0);
             }
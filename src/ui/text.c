@@ -36,6 +36,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #endif
 
 static iText *current_Text_;
+static _Thread_local iText *threadCurrent_Text_; /* e.g., measurement-only Text of a worker */
 
 int   gap_Text;                           /* cf. gap_UI in metrics.h */
 
@@ -56,8 +57,12 @@ void setCurrent_Text(iText *d) {
     current_Text_ = d;
 }
 
+void setThreadCurrent_Text(iText *d) {
+    threadCurrent_Text_ = d;
+}
+
 iText *current_Text(void) {
-    return current_Text_;
+    return threadCurrent_Text_ ? threadCurrent_Text_ : current_Text_;
 }
 
 void setDocumentFontSize_Text(iText *d, float fontSizeFactor) {
@@ -70,17 +75,17 @@ void setDocumentFontSize_Text(iText *d, float fontSizeFactor) {
 }
 
 void setBaseAttributes_Text(int fontId, int fgColorId) {
-    iText *d = current_Text_;
+    iText *d = current_Text();
     d->baseFontId    = fontId;
     d->baseFgColorId = fgColorId;
 }
 
 void setAnsiFlags_Text(int ansiFlags) {
-    current_Text_->ansiFlags = ansiFlags;
+    current_Text()->ansiFlags = ansiFlags;
 }
 
 int ansiFlags_Text(void) {
-    return current_Text_->ansiFlags;
+    return current_Text()->ansiFlags;
 }
 
 iRegExp *makeAnsiEscapePattern_Text(iBool includeEscChar) {
@@ -356,7 +361,7 @@ void init_TextBuf(iTextBuf *d, iWrapText *wrapText, int font, int color) {
         SDL_SetRenderDrawColor(render, 255, 255, 255, 0);
         SDL_RenderClear(render);
         draw_WrapText(wrapText, font, zero_I2(), color | fillBackground_ColorId);
-        SDL_SetRenderTarget(render, oldTarget);
+        restoreTarget_Paint(render, oldTarget);
         origin_Paint = oldOrigin;
         SDL_SetTextureBlendMode(d->texture, SDL_BLENDMODE_BLEND);
         setBaseAttributes_Text(-1, -1);
@@ -49,17 +49,19 @@ struct Impl_Text {
 
 iRegExp *makeAnsiEscapePattern_Text(iBool includeEscChar);
 
-iText * new_Text                (SDL_Renderer *render, float documentFontSizeFactor);
+iText * new_Text                (SDL_Renderer *render, float documentFontSizeFactor); /* NULL render: measurement only */
 void    delete_Text             (iText *);
 
 void    init_Text               (iText *, SDL_Renderer *, float documentFontSizeFactor);
 void    deinit_Text             (iText *);
 
 void    setCurrent_Text         (iText *);
+void    setThreadCurrent_Text   (iText *); /* overrides `setCurrent_Text` in the calling thread */
 iText * current_Text            (void);
 
 void    setDocumentFontSize_Text(iText *, float fontSizeFactor); /* affects all except `default*` fonts */
 void    resetFonts_Text         (iText *);
+uint32_t fontsSerial_Text       (void); /* changes whenever fonts are reset in any Text */
 void    resetFontCache_Text     (iText *);
 
 enum iAnsiFlag {
@@ -78,6 +80,7 @@ iChar   missing_Text            (size_t index);
 void    resetMissing_Text       (iText *);
 iBool   checkMissing_Text       (void); /* returns the flag, and clears it */
 SDL_Texture *glyphCache_Text    (void);
+const iString *debugInfo_Text  (const iText *); /* glyph cache statistics */
 
 /*----------------------------------------------------------------------------------------------*/
 
@@ -105,6 +108,8 @@ enum iAlignment {
 };
 
 void    cache_Text              (int fontId, iRangecc text); /* pre-render glyphs */
+void    beginCacheBatch_Text    (void); /* glyphs of cache_Text() calls are deferred... */
+void    endCacheBatch_Text      (void); /* ...and rasterized in parallel here */
 
 void    draw_Text               (int fontId, iInt2 pos, int color, const char *text, ...);
 void    drawAlign_Text          (int fontId, iInt2 pos, int color, enum iAlignment align, const char *text, ...);
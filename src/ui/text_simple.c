@@ -82,7 +82,7 @@ static void runSimple_Font_(iFont *d, const iRunArgs *args) {
     const char *        lastWordEnd = args->text.start;
     SDL_Renderer *render = current_Text()->render;
 #if defined (LAGRANGE_ENABLE_STB_TRUETYPE)
-    SDL_Texture *cache = current_StbText_()->cache;
+    iStbText *tx = current_StbText_();
 #endif
     iAssert(args->text.end >= args->text.start);
     if (wrap) {
@@ -101,7 +101,8 @@ static void runSimple_Font_(iFont *d, const iRunArgs *args) {
     if (mode & draw_RunMode) {
         const iColor clr = get_Color(args->color);
 #if defined (LAGRANGE_ENABLE_STB_TRUETYPE)
-        SDL_SetTextureColorMod(cache, clr.r, clr.g, clr.b);
+        tx->drawSerial++;
+        setCacheColorMod_StbText_(tx, clr);
 #endif
 #if defined (SDL_SEAL_CURSES)
         const enum iFontStyle style = style_FontId(fontId_Text(d));
@@ -152,7 +153,7 @@ static void runSimple_Font_(iFont *d, const iRunArgs *args) {
                                      NULL,
                                      NULL);
 #if defined (LAGRANGE_ENABLE_STB_TRUETYPE)
-                    SDL_SetTextureColorMod(cache, clr.r, clr.g, clr.b);
+                    setCacheColorMod_StbText_(tx, clr);
 #endif
 #if defined (SDL_SEAL_CURSES)
                     SDL_SetRenderTextColor(render, clr.r, clr.g, clr.b);
@@ -246,7 +247,7 @@ static void runSimple_Font_(iFont *d, const iRunArgs *args) {
                 if (mode & draw_RunMode && ~mode & permanentColorFlag_RunMode) {
                     const iColor clr = get_Color(colorNum);
 #if defined (LAGRANGE_ENABLE_STB_TRUETYPE)
-                    SDL_SetTextureColorMod(cache, clr.r, clr.g, clr.b);
+                    setCacheColorMod_StbText_(tx, clr);
 #endif
 #if defined (SDL_SEAL_CURSES)
                     SDL_SetRenderTextColor(render, clr.r, clr.g, clr.b);
@@ -271,7 +272,7 @@ static void runSimple_Font_(iFont *d, const iRunArgs *args) {
 //            printf("[Text] missing from cache: %lc (%x)\n", (int) ch, ch);
             //cacheTextGlyphs_Font_(d, args->text);
             cacheSingleGlyph_Font_(glyph->font, index_Glyph_(glyph));
-            glyph = glyph_Font_(d, ch); /* cache may have been reset */
+            glyph = glyph_Font_(d, ch); /* a cache page may have been cleared */
         }
         int x2 = x1 + glyph->rect[hoff].size.x;
         if (isHitPointOnThisLine) {
@@ -362,7 +363,7 @@ static void runSimple_Font_(iFont *d, const iRunArgs *args) {
                 SDL_RenderFillRect(render, &dst);
             }
 #if defined (LAGRANGE_ENABLE_STB_TRUETYPE)
-            SDL_RenderCopy(render, cache, &src, &dst);
+            SDL_RenderCopy(render, useCachePage_StbText_(tx, glyph->cachePage), &src, &dst);
 #endif
 #if defined (SDL_SEAL_CURSES)
             SDL_RenderDrawUnicode(render, dst.x, dst.y, ch);
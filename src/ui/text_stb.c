@@ -22,9 +22,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 /* Overview of types:
 
-- Text : top-level text renderer instance (one per window)
+- Text : top-level text renderer instance (one per window; or measurement-only, without glyphs)
 - Font : a font's assets for rendering, e.g., metrics and cached glyphs
-- Glyph : hash node; a single cached glyph, with Rect in cache texture
+- Glyph : a single cached glyph, with Rect in cache texture
+- GlyphTable : a Font's glyphs in pages indexed by glyph index, and cached glyph indices
 - AttributedText : text string to be drawn that is split into sub-runs by attributes (font, color)
 - AttributedRun : a run inside AttributedText
 - GlyphBuffer : HarfBuzz-shaped glyphs corresponding to an AttributedRun
@@ -48,6 +49,7 @@ Optimization notes:
 #include "window.h"
 #include "paint.h"
 #include "app.h"
+#include "profiler.h"
 
 #include <the_Foundation/array.h>
 #include <the_Foundation/file.h>
@@ -58,7 +60,9 @@ Optimization notes:
 #include <the_Foundation/regexp.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/ptrset.h>
+#include <the_Foundation/thread.h>
 #include <the_Foundation/vec2.h>
+#include <SDL_cpuinfo.h>
 #include <SDL_surface.h>
 #include <SDL_render.h>
 #include <SDL_hints.h>
@@ -86,7 +90,6 @@ Optimization notes:
 
 iDeclareType(Font)
 iDeclareType(Glyph)
-iDeclareTypeConstructionArgs(Glyph, iChar ch)
 
 enum iGlyphFlag {
     rasterized0_GlyphFlag = iBit(1),    /* zero offset */
@@ -120,29 +123,27 @@ static int makeRasterizedAll_GlyphFlag_(int n) {
 }
 
 struct Impl_Glyph {
-    iHashNode node;
+    uint32_t  index;   /* glyph index in the font */
     int       flags;
-    iFont    *font;    /* may come from symbols/emoji */
+    uint16_t  cachePage; /* all offsets are allocated in the same page */
+    iFont    *font;    /* may come from symbols/emoji; NULL if not allocated yet */
     float     advance; /* scaled */
     iRect     rect[4]; /* zero and half pixel offset */
     iInt2     d[4];
 };
 
-void init_Glyph(iGlyph *d, uint32_t glyphIndex) {
-    d->node.key   = glyphIndex;
-    d->flags      = 0;
-    d->font       = NULL;
-    d->advance    = 0.0f;
+static void init_Glyph(iGlyph *d, uint32_t glyphIndex) {
+    d->index     = glyphIndex;
+    d->flags     = 0;
+    d->cachePage = 0;
+    d->font    = NULL;
+    d->advance = 0.0f;
     iZap(d->rect);
     iZap(d->d);
 }
 
-void deinit_Glyph(iGlyph *d) {
-    iUnused(d);
-}
-
 static uint32_t index_Glyph_(const iGlyph *d) {
-    return d->node.key;
+    return d->index;
 }
 
 iLocalDef iBool isRasterized_Glyph_(const iGlyph *d, int hoff) {
@@ -157,38 +158,121 @@ iLocalDef void setRasterized_Glyph_(iGlyph *d, int hoff) {
     d->flags |= rasterized0_GlyphFlag << hoff;
 }
 
-iDefineTypeConstructionArgs(Glyph, (iChar ch), ch)
-
 /*-----------------------------------------------------------------------------------------------*/
 
 static iGlyph *glyph_Font_(iFont *d, iChar ch);
 
 iDeclareType(GlyphTable)
+iDeclareType(GlyphIndexBlock)
+
+enum iGlyphTableSizes {
+    glyphPageBits_GlyphTable_       = 6, /* glyphs allocated at a time */
+    glyphIndexBlockBits_GlyphTable_ = 7, /* code points of a cached block of glyph indices */
+};
+
+/* Glyph indices of consecutive code points. Text is usually written in one script at a time,
+   so the same block gets used repeatedly. */
+struct Impl_GlyphIndexBlock {
+    iHashNode node; /* key is code point >> glyphIndexBlockBits_GlyphTable_ */
+    uint32_t  indices[1 << glyphIndexBlockBits_GlyphTable_]; /* ~0 if not looked up yet */
+};
 
 struct Impl_GlyphTable {
-    iHash          glyphs; /* key is glyph index in the font */
-    /* TODO: `glyphs` does not need to be a Hash.
-       We could lazily allocate an array with glyphCount elements instead. */
-    uint32_t       indexTable[128 - 32]; /* quick ASCII lookup */
+    iGlyph **         glyphPages; /* lazily allocated pages of glyphs, indexed by glyph index */
+    size_t            numGlyphPages;
+    uint32_t          indexTable[128 - 32]; /* quick ASCII lookup */
+    iHash             indexBlocks; /* GlyphIndexBlocks for code points outside ASCII */
+    iGlyphIndexBlock *lastIndexBlock; /* most recently used block */
 };
 
 static void clearGlyphs_GlyphTable_(iGlyphTable *d) {
+    /* Pages are kept allocated so glyph pointers remain valid. */
     if (d) {
-        iForEach(Hash, i, &d->glyphs) {
-            delete_Glyph((iGlyph *) i.value);
+        for (size_t i = 0; i < d->numGlyphPages; i++) {
+            iGlyph *page = d->glyphPages[i];
+            if (page) {
+                for (size_t j = 0; j < (1u << glyphPageBits_GlyphTable_); j++) {
+                    init_Glyph(&page[j], (uint32_t) ((i << glyphPageBits_GlyphTable_) + j));
+                }
+            }
+        }
+    }
+}
+
+static void releaseCachePage_GlyphTable_(iGlyphTable *d, uint16_t cachePage) {
+    /* Glyphs in the page will be allocated and rasterized again when needed. */
+    if (d) {
+        for (size_t i = 0; i < d->numGlyphPages; i++) {
+            iGlyph *page = d->glyphPages[i];
+            if (page) {
+                for (size_t j = 0; j < (1u << glyphPageBits_GlyphTable_); j++) {
+                    if (page[j].font && page[j].cachePage == cachePage) {
+                        init_Glyph(&page[j], page[j].index);
+                    }
+                }
+            }
         }
-        clear_Hash(&d->glyphs);
     }
 }
 
 static void init_GlyphTable(iGlyphTable *d) {
-    init_Hash(&d->glyphs);
+    d->glyphPages    = NULL;
+    d->numGlyphPages = 0;
     memset(d->indexTable, 0xff, sizeof(d->indexTable));
+    init_Hash(&d->indexBlocks);
+    d->lastIndexBlock = NULL;
 }
 
 static void deinit_GlyphTable(iGlyphTable *d) {
-    clearGlyphs_GlyphTable_(d);
-    deinit_Hash(&d->glyphs);
+    for (size_t i = 0; i < d->numGlyphPages; i++) {
+        free(d->glyphPages[i]);
+    }
+    free(d->glyphPages);
+    iForEach(Hash, i, &d->indexBlocks) {
+        free(i.value);
+    }
+    deinit_Hash(&d->indexBlocks);
+}
+
+static iGlyph *glyph_GlyphTable_(iGlyphTable *d, uint32_t glyphIndex) {
+    /* Returns the glyph even if it hasn't been allocated yet. */
+    const size_t pageIndex = glyphIndex >> glyphPageBits_GlyphTable_;
+    if (pageIndex >= d->numGlyphPages) {
+        const size_t oldCount = d->numGlyphPages;
+        d->numGlyphPages = pageIndex + 1;
+        d->glyphPages = realloc(d->glyphPages, sizeof(iGlyph *) * d->numGlyphPages);
+        memset(d->glyphPages + oldCount, 0, sizeof(iGlyph *) * (d->numGlyphPages - oldCount));
+    }
+    iGlyph *page = d->glyphPages[pageIndex];
+    if (!page) {
+        const size_t pageSize = 1u << glyphPageBits_GlyphTable_;
+        page = d->glyphPages[pageIndex] = malloc(sizeof(iGlyph) * pageSize);
+        for (size_t j = 0; j < pageSize; j++) {
+            init_Glyph(&page[j], (uint32_t) ((pageIndex << glyphPageBits_GlyphTable_) + j));
+        }
+    }
+    return &page[glyphIndex & ((1u << glyphPageBits_GlyphTable_) - 1)];
+}
+
+static uint32_t *cachedIndex_GlyphTable_(iGlyphTable *d, iChar ch) {
+    /* Returns where the glyph index of `ch` is cached. */
+    const size_t entry = ch - 32;
+    if (entry < iElemCount(d->indexTable)) {
+        return &d->indexTable[entry];
+    }
+    const uint32_t    key   = ch >> glyphIndexBlockBits_GlyphTable_;
+    iGlyphIndexBlock *block = d->lastIndexBlock;
+    if (!block || block->node.key != key) {
+        block = (iGlyphIndexBlock *) value_Hash(&d->indexBlocks, key);
+        if (!block) {
+            block = iMalloc(GlyphIndexBlock);
+            block->node.key = key;
+            memset(block->indices, 0xff, sizeof(block->indices));
+            insert_Hash(&d->indexBlocks, &block->node);
+        }
+        d->lastIndexBlock = block;
+    }
+    return &block->indices[ch & ((1u << glyphIndexBlockBits_GlyphTable_) - 1)];
 }
 
 iDefineTypeConstruction(GlyphTable)
@@ -232,19 +316,14 @@ static void deinit_Font(iFont *d) {
 }
 
 static uint32_t glyphIndex_Font_(iFont *d, iChar ch) {
-    /* TODO: Add a small cache of ~5 most recently found indices. */
-    const size_t entry = ch - 32;
     if (!d->table) {
         d->table = new_GlyphTable();
     }
-    iGlyphTable *table = d->table;
-    if (entry < iElemCount(table->indexTable)) {
-        if (table->indexTable[entry] == ~0u) {
-            table->indexTable[entry] = findGlyphIndex_FontFile(d->font.file, ch);
-        }
-        return table->indexTable[entry];
+    uint32_t *index = cachedIndex_GlyphTable_(d->table, ch);
+    if (*index == ~0u) {
+        *index = findGlyphIndex_FontFile(d->font.file, ch);
     }
-    return findGlyphIndex_FontFile(d->font.file, ch);
+    return *index;
 }
 
 /*----------------------------------------------------------------------------------------------*/
@@ -256,6 +335,26 @@ struct Impl_CacheRow {
     iInt2 pos;
 };
 
+iDeclareType(GlyphCachePage)
+
+/* One texture of the glyph cache. Glyphs are allocated in rows of fixed heights. When all
+   the allowed pages are full, the least recently drawn page is cleared for reuse. */
+struct Impl_GlyphCachePage {
+    SDL_Texture *texture;
+    iArray       rows; /* CacheRows */
+    int          bottom;
+    uint32_t     lastUsed; /* `drawSerial` of the latest glyph drawn from the page */
+    iColor       colorMod; /* currently applied to `texture` */
+};
+
+iDeclareType(GlyphCacheStats)
+
+struct Impl_GlyphCacheStats {
+    uint64_t hits;      /* glyphs drawn that were already rasterized */
+    uint64_t misses;    /* glyphs rasterized into the cache (each subpixel offset) */
+    uint64_t evictions; /* pages cleared for reuse */
+};
+
 iDeclareType(PrioMapItem)
 struct Impl_PrioMapItem {
     int      priority;
@@ -280,22 +379,42 @@ struct Impl_StbText {
     int            overrideFontId; /* always checked for glyphs first, regardless of which font is used */
     iFontSpec      iosevkaFallback; /* copy of Iosevka as a low-priority spec */
     iArray         fontPriorityOrder;
-    SDL_Texture *  cache;
-    iInt2          cacheSize;
+    iArray         cachePages; /* GlyphCachePages */
+    size_t         cachePageIndex; /* new glyphs are allocated here */
+    size_t         maxCachePages;
+    iInt2          cacheSize; /* of each page */
     int            cacheRowAllocStep;
-    int            cacheBottom;
-    iArray         cacheRows;
+    iColor         cacheColorMod; /* applied to pages when drawing from them */
+    uint32_t       drawSerial; /* incremented for each drawn run of text */
+    iGlyphCacheStats cacheStats;
     SDL_Palette *  grayscale;
     SDL_Palette *  blackAndWhite; /* unsmoothed glyph palette */
     iBool          missingGlyphs;  /* true if a glyph couldn't be found */
     iChar          missingChars[20]; /* rotating buffer of the latest missing characters */
-    iFontRun *     cachedFontRuns[16]; /* recently generated HarfBuzz glyph buffers */
+    iHash          fontRuns; /* recently generated HarfBuzz glyph buffers (FontRuns) */
+    size_t         numFontRuns;
+    size_t         fontRunsSize; /* approximate bytes used by the FontRuns */
+    iFontRun *     newestFontRun; /* FontRuns are in order of use, for evicting the oldest */
+    iFontRun *     oldestFontRun;
+    iArray *       cacheBatch; /* GlyphRefs waiting to be cached, if batching */
 };
 
+#if defined (LAGRANGE_ENABLE_HARFBUZZ)
+static void clearFontRuns_StbText_(iStbText *);
+#endif
+static void useRasterPool_      (void);
+static void releaseRasterPool_  (void);
+
 iLocalDef iStbText *current_StbText_(void) {
     return (iStbText *) current_Text();
 }
 
+iLocalDef iBool hasGlyphCache_StbText_(const iStbText *d) {
+    /* Without a renderer, the Text is only used for measuring and glyphs are never rasterized.
+       This kind of Text can be used in a background thread. */
+    return d->base.render != NULL;
+}
+
 iLocalDef iFont *font_Text_(enum iFontId id) {
     iAssert(current_StbText_());
     return at_Array(&current_StbText_()->fonts, id & mask_FontId);
@@ -409,8 +528,42 @@ static int maxGlyphHeight_Text_(const iText *d) {
     return 4 * d->contentFontSize * fontSize_UI;
 }
 
+static void clearRows_GlyphCachePage_(iGlyphCachePage *d) {
+    iForEach(Array, i, &d->rows) {
+        *(iCacheRow *) i.value = (iCacheRow){ .height = 0 };
+    }
+    d->bottom = 0;
+}
+
+static void addCachePage_StbText_(iStbText *d) {
+    const int textSize = d->base.contentFontSize * fontSize_UI;
+    iGlyphCachePage page = { .bottom = 0, .lastUsed = d->drawSerial, .colorMod = d->cacheColorMod };
+    init_Array(&page.rows, sizeof(iCacheRow));
+    /* Allocate initial (empty) rows. These will be assigned actual locations in the cache
+       once at least one glyph is stored. */
+    for (int h = d->cacheRowAllocStep;
+         h <= 5 * textSize + d->cacheRowAllocStep;
+         h += d->cacheRowAllocStep) {
+        pushBack_Array(&page.rows, &(iCacheRow){ .height = 0 });
+    }
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+    page.texture = SDL_CreateTexture(d->base.render,
+                                     SDL_PIXELFORMAT_RGBA4444,
+                                     SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET,
+                                     d->cacheSize.x,
+                                     d->cacheSize.y);
+    SDL_SetTextureBlendMode(page.texture, SDL_BLENDMODE_BLEND);
+    SDL_SetTextureColorMod(page.texture, page.colorMod.r, page.colorMod.g, page.colorMod.b);
+    SDL_SetTextureAlphaMod(page.texture, page.colorMod.a);
+    pushBack_Array(&d->cachePages, &page);
+}
+
+iLocalDef iGlyphCachePage *cachePage_StbText_(iStbText *d, size_t index) {
+    return at_Array(&d->cachePages, index);
+}
+
 static void initCache_StbText_(iStbText *d) {
-    init_Array(&d->cacheRows, sizeof(iCacheRow));
+    init_Array(&d->cachePages, sizeof(iGlyphCachePage));
     const int textSize = d->base.contentFontSize * fontSize_UI;
     iAssert(textSize > 0);
     numOffsetSteps_Glyph_   = get_Window()->pixelRatio < 2.0f   ? 4
@@ -429,26 +582,73 @@ static void initCache_StbText_(iStbText *d) {
         d->cacheSize.x = renderInfo.max_texture_width;
     }
     d->cacheRowAllocStep = iMax(2, textSize / 6);
-    /* Allocate initial (empty) rows. These will be assigned actual locations in the cache
-       once at least one glyph is stored. */
-    for (int h = d->cacheRowAllocStep;
-         h <= 5 * textSize + d->cacheRowAllocStep;
-         h += d->cacheRowAllocStep) {
-        pushBack_Array(&d->cacheRows, &(iCacheRow){ .height = 0 });
-    }
-    d->cacheBottom = 0;
-    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
-    d->cache = SDL_CreateTexture(d->base.render,
-                                 SDL_PIXELFORMAT_RGBA4444,
-                                 SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET,
-                                 d->cacheSize.x,
-                                 d->cacheSize.y);
-    SDL_SetTextureBlendMode(d->cache, SDL_BLENDMODE_BLEND);
+    /* More pages are added as needed, up to the memory limit. */
+    const size_t pageBytes = 2 * (size_t) d->cacheSize.x * d->cacheSize.y; /* RGBA4444 */
+    d->maxCachePages  = iClamp((size_t) prefs_App()->maxGlyphCacheSize * 1000000 / pageBytes,
+                               1u, UINT16_MAX);
+    d->cachePageIndex = 0;
+    addCachePage_StbText_(d);
 }
 
 static void deinitCache_StbText_(iStbText *d) {
-    deinit_Array(&d->cacheRows);
-    SDL_DestroyTexture(d->cache);
+    iForEach(Array, i, &d->cachePages) {
+        iGlyphCachePage *page = i.value;
+        deinit_Array(&page->rows);
+        SDL_DestroyTexture(page->texture);
+    }
+    deinit_Array(&d->cachePages);
+}
+
+static void evictCachePage_StbText_(iStbText *d, size_t pageIndex) {
+#if !defined (NDEBUG)
+    printf("[Text] glyph cache page %zu is being reused\n", pageIndex); fflush(stdout);
+#endif
+    iForEach(Array, i, &d->fonts) {
+        releaseCachePage_GlyphTable_(((iFont *) i.value)->table, (uint16_t) pageIndex);
+    }
+    clearRows_GlyphCachePage_(cachePage_StbText_(d, pageIndex));
+    d->cacheStats.evictions++;
+}
+
+static void reserveCacheSpace_StbText_(iStbText *d) {
+    /* Ensures that a glyph of any size fits in the current page. */
+    if (cachePage_StbText_(d, d->cachePageIndex)->bottom <=
+        d->cacheSize.y - maxGlyphHeight_Text_(&d->base)) {
+        return;
+    }
+    if (size_Array(&d->cachePages) < d->maxCachePages) {
+        d->cachePageIndex = size_Array(&d->cachePages);
+        addCachePage_StbText_(d);
+        return;
+    }
+    /* Reuse the page that has gone unused for the longest time. */
+    size_t   oldest    = 0;
+    uint32_t oldestAge = 0;
+    iConstForEach(Array, i, &d->cachePages) {
+        const uint32_t age = d->drawSerial - ((const iGlyphCachePage *) i.value)->lastUsed;
+        if (age >= oldestAge) {
+            oldest    = index_ArrayConstIterator(&i);
+            oldestAge = age;
+        }
+    }
+    evictCachePage_StbText_(d, oldest);
+    d->cachePageIndex = oldest;
+}
+
+static SDL_Texture *useCachePage_StbText_(iStbText *d, uint16_t pageIndex) {
+    /* Returns the page texture with the current color and opacity applied. */
+    iGlyphCachePage *page = cachePage_StbText_(d, pageIndex);
+    page->lastUsed = d->drawSerial;
+    if (memcmp(&page->colorMod, &d->cacheColorMod, sizeof(iColor))) {
+        page->colorMod = d->cacheColorMod;
+        SDL_SetTextureColorMod(page->texture, page->colorMod.r, page->colorMod.g, page->colorMod.b);
+        SDL_SetTextureAlphaMod(page->texture, page->colorMod.a);
+    }
+    return page->texture;
+}
+
+iLocalDef void setCacheColorMod_StbText_(iStbText *d, iColor color) {
+    d->cacheColorMod = (iColor){ color.r, color.g, color.b, d->cacheColorMod.a };
 }
 
 void init_StbText(iStbText *d, SDL_Renderer *render, float documentFontSizeFactor) {
@@ -459,8 +659,21 @@ void init_StbText(iStbText *d, SDL_Renderer *render, float documentFontSizeFacto
     init_Array(&d->fontPriorityOrder, sizeof(iPrioMapItem));
     d->missingGlyphs   = iFalse;
     iZap(d->missingChars);
-    iZap(d->cachedFontRuns);
-    /* A grayscale palette for rasterized glyphs. */ {
+    init_Hash(&d->fontRuns);
+    d->numFontRuns   = 0;
+    d->fontRunsSize  = 0;
+    d->newestFontRun = NULL;
+    d->oldestFontRun = NULL;
+    d->grayscale     = NULL;
+    d->blackAndWhite = NULL;
+    d->cachePageIndex = 0;
+    d->maxCachePages  = 0;
+    d->cacheColorMod  = (iColor){ 255, 255, 255, 255 };
+    d->drawSerial     = 0;
+    d->cacheBatch     = NULL;
+    iZap(d->cacheStats);
+    if (hasGlyphCache_StbText_(d)) {
+        /* A grayscale palette for rasterized glyphs. */
         SDL_Color colors[256];
         for (int i = 0; i < 256; ++i) {
             /* TODO: On dark backgrounds, applying a gamma curve of some sort might be helpful. */
@@ -468,30 +681,34 @@ void init_StbText(iStbText *d, SDL_Renderer *render, float documentFontSizeFacto
         }
         d->grayscale = SDL_AllocPalette(256);
         SDL_SetPaletteColors(d->grayscale, colors, 0, 256);
-    }
-    /* Black-and-white palette for unsmoothed glyphs. */ {
-        SDL_Color colors[256];
+        /* Black-and-white palette for unsmoothed glyphs. */
         for (int i = 0; i < 256; ++i) {
             colors[i] = (SDL_Color){ 255, 255, 255, i < 100 ? 0 : 255 };
         }
         d->blackAndWhite = SDL_AllocPalette(256);
         SDL_SetPaletteColors(d->blackAndWhite, colors, 0, 256);
+        initCache_StbText_(d);
+        useRasterPool_();
     }
-    initCache_StbText_(d);
     initFonts_StbText_(d);
     setCurrent_Text(oldActive);
 }
 
 void deinit_StbText(iStbText *d) {
 #if defined (LAGRANGE_ENABLE_HARFBUZZ)
-    iForIndices(i, d->cachedFontRuns) {
-        delete_FontRun(d->cachedFontRuns[i]);
-    }
+    clearFontRuns_StbText_(d);
 #endif
-    SDL_FreePalette(d->blackAndWhite);
-    SDL_FreePalette(d->grayscale);
+    deinit_Hash(&d->fontRuns);
     deinitFonts_StbText_(d);
-    deinitCache_StbText_(d);
+    if (hasGlyphCache_StbText_(d)) {
+        SDL_FreePalette(d->blackAndWhite);
+        SDL_FreePalette(d->grayscale);
+        deinitCache_StbText_(d);
+        releaseRasterPool_();
+    }
+    if (d->cacheBatch) {
+        delete_Array(d->cacheBatch);
+    }
     deinit_Array(&d->fontPriorityOrder);
     deinit_Array(&d->fonts);
     deinit_Text(&d->base);
@@ -509,10 +726,13 @@ void delete_Text(iText *d) {
 }
 
 void setOpacity_Text(float opacity) {
-    SDL_SetTextureAlphaMod(current_StbText_()->cache, iClamp(opacity, 0.0f, 1.0f) * 255 + 0.5f);
+    current_StbText_()->cacheColorMod.a = iClamp(opacity, 0.0f, 1.0f) * 255 + 0.5f;
 }
 
 static void resetCache_StbText_(iStbText *d) {
+    if (!hasGlyphCache_StbText_(d)) {
+        return;
+    }
     deinitCache_StbText_(d);
     iForEach(Array, i, &d->fonts) {
         clearGlyphs_GlyphTable_(((iFont *) i.value)->table);
@@ -520,13 +740,25 @@ static void resetCache_StbText_(iStbText *d) {
     initCache_StbText_(d);
 }
 
+static uint32_t fontsSerial_Text_;
+
+uint32_t fontsSerial_Text(void) {
+    return fontsSerial_Text_;
+}
+
 void resetFonts_Text(iText *d) {
     iText *oldActive = current_Text();
     iStbText *s = (iStbText *) d;
+    fontsSerial_Text_++;
     setCurrent_Text(d); /* some routines rely on the global `activeText_` pointer */
+#if defined (LAGRANGE_ENABLE_HARFBUZZ)
+    clearFontRuns_StbText_(s); /* they refer to the fonts */
+#endif
     deinitFonts_StbText_(s);
-    deinitCache_StbText_(s);
-    initCache_StbText_(s);
+    if (hasGlyphCache_StbText_(s)) {
+        deinitCache_StbText_(s);
+        initCache_StbText_(s);
+    }
     initFonts_StbText_(s);
     setCurrent_Text(oldActive);
 }
@@ -543,10 +775,8 @@ static SDL_Palette *glyphPalette_(void) {
                                       : current_StbText_()->blackAndWhite;
 }
 
-static SDL_Surface *rasterizeGlyph_Font_(const iFont *d, uint32_t glyphIndex, float xShift) {
-    int w, h;
-    uint8_t *bmp = rasterizeGlyph_FontFile(d->font.file, d->xScale, d->yScale, xShift, glyphIndex,
-                                           &w, &h);
+static SDL_Surface *glyphSurface_(uint8_t *bmp, int w, int h) {
+    /* Takes ownership of `bmp`. */
     SDL_Surface *surface8 =
         SDL_CreateRGBSurfaceWithFormatFrom(bmp, w, h, 8, w, SDL_PIXELFORMAT_INDEX8);
     SDL_SetSurfaceBlendMode(surface8, SDL_BLENDMODE_NONE);
@@ -563,27 +793,33 @@ static SDL_Surface *rasterizeGlyph_Font_(const iFont *d, uint32_t glyphIndex, fl
 #endif
 }
 
-iLocalDef iCacheRow *cacheRow_StbText_(iStbText *d, int height) {
-    return at_Array(&d->cacheRows, (height - 1) / d->cacheRowAllocStep);
+static SDL_Surface *rasterizeGlyph_Font_(const iFont *d, uint32_t glyphIndex, float xShift) {
+    int w, h;
+    uint8_t *bmp = rasterizeGlyph_FontFile(d->font.file, d->xScale, d->yScale, xShift, glyphIndex,
+                                           &w, &h);
+    return glyphSurface_(bmp, w, h);
+}
+
+iLocalDef iCacheRow *cacheRow_StbText_(iStbText *d, iGlyphCachePage *page, int height) {
+    return at_Array(&page->rows, (height - 1) / d->cacheRowAllocStep);
 }
 
 static iInt2 assignCachePos_Text_(iStbText *d, iInt2 size) {
-    iCacheRow *cur = cacheRow_StbText_(d, size.y);
+    iGlyphCachePage *page = cachePage_StbText_(d, d->cachePageIndex);
+    iCacheRow *cur = cacheRow_StbText_(d, page, size.y);
     if (cur->height == 0) {
         /* Begin a new row height. */
         cur->height = (1 + (size.y - 1) / d->cacheRowAllocStep) * d->cacheRowAllocStep;
-        cur->pos.y = d->cacheBottom;
-        d->cacheBottom = cur->pos.y + cur->height;
+        cur->pos.y = page->bottom;
+        page->bottom = cur->pos.y + cur->height;
     }
     iAssert(cur->height >= size.y);
-    /* TODO: Automatically enlarge the cache if running out of space?
-       Maybe make it paged, but beware of texture swapping too often inside a text string. */
     if (cur->pos.x + size.x > d->cacheSize.x) {
-        /* Does not fit on this row, advance to a new location in the cache. */
-        cur->pos.y = d->cacheBottom;
+        /* Does not fit on this row, advance to a new location in the page. */
+        cur->pos.y = page->bottom;
         cur->pos.x = 0;
-        d->cacheBottom += cur->height;
-        iAssert(d->cacheBottom <= d->cacheSize.y);
+        page->bottom += cur->height;
+        iAssert(page->bottom <= d->cacheSize.y);
     }
     const iInt2 assigned = cur->pos;
     cur->pos.x += size.x;
@@ -598,7 +834,9 @@ static void allocate_Font_(iFont *d, iGlyph *glyph, int hoff) {
                           &x0, &y0, &x1, &y1);
     glRect->size = init_I2(x1 - x0, y1 - y0);
     /* Determine placement in the glyph cache texture, advancing in rows. */
-    glRect->pos    = assignCachePos_Text_(current_StbText_(), glRect->size);
+    if (hasGlyphCache_StbText_(current_StbText_())) {
+        glRect->pos = assignCachePos_Text_(current_StbText_(), glRect->size);
+    }
     glyph->d[hoff] = init_I2(x0, y0);
     glyph->d[hoff].y += d->vertOffset;
     if (hoff == 0) { /* hoff>=1 uses same metrics as `glyph` */
@@ -678,28 +916,20 @@ static iGlyph *glyphByIndex_Font_(iFont *d, uint32_t glyphIndex) {
     if (!d->table) {
         d->table = new_GlyphTable();
     }
-    iGlyph* glyph = NULL;
-    void *  node = value_Hash(&d->table->glyphs, glyphIndex);
-    if (node) {
-        glyph = node;
-    }
-    else {
+    iGlyph *glyph = glyph_GlyphTable_(d->table, glyphIndex);
+    if (!glyph->font) {
         iStbText *tx = current_StbText_();
-        /* If the cache is running out of space, clear it and we'll recache what's needed currently. */
-        if (tx->cacheBottom > tx->cacheSize.y - maxGlyphHeight_Text_(&tx->base)) {
-#if !defined (NDEBUG)
-            printf("[Text] glyph cache is full, clearing!\n"); fflush(stdout);
-#endif
-            resetCache_StbText_(tx);
+        if (hasGlyphCache_StbText_(tx)) {
+            /* If the current page is running out of space, continue on another page. */
+            reserveCacheSpace_StbText_(tx);
+            glyph->cachePage = (uint16_t) tx->cachePageIndex;
         }
-        glyph = new_Glyph(glyphIndex);
         glyph->font = d;
         /* New glyphs are always allocated at least. This reserves a position in the cache
            and updates the glyph metrics. */
         for (int offsetIndex = 0; offsetIndex < numOffsetSteps_Glyph_; offsetIndex++) {
             allocate_Font_(d, glyph, offsetIndex);
         }
-        insert_Hash(&d->table->glyphs, &glyph->node);
     }
     return glyph;
 }
@@ -735,6 +965,269 @@ static iChar nextChar_(const char **chPos, const char *end) {
 
 /*----------------------------------------------------------------------------------------------*/
 
+/* Rasterizing is the slowest part of caching new glyphs. When there are many glyphs to cache
+   at once, their bitmaps are first rasterized in parallel using a pool of worker threads.
+   Only the font file is accessed during rasterization, which is safe to do concurrently.
+   Copying the bitmaps to the cache textures is always done on the main thread. */
+
+iDeclareType(GlyphBitmap)
+iDeclareType(GlyphRef)
+iDeclareType(RasterPool)
+
+struct Impl_GlyphBitmap {
+    const iFont *font;
+    uint32_t     glyphIndex;
+    int          hoff;
+    float        xShift;
+    uint8_t *    pixels; /* NULL until rasterized, or after being taken */
+    int          w, h;
+};
+
+struct Impl_GlyphRef {
+    iFont *  font;
+    uint32_t glyphIndex;
+};
+
+static int cmp_GlyphBitmap_(const void *a, const void *b) {
+    const iGlyphBitmap *i = a, *j = b;
+    if (i->font != j->font) {
+        return (uintptr_t) i->font < (uintptr_t) j->font ? -1 : 1;
+    }
+    if (i->glyphIndex != j->glyphIndex) {
+        return iCmp(i->glyphIndex, j->glyphIndex);
+    }
+    return iCmp(i->hoff, j->hoff);
+}
+
+static int cmp_GlyphRef_(const void *a, const void *b) {
+    const iGlyphRef *i = a, *j = b;
+    if (i->font != j->font) {
+        return (uintptr_t) i->font < (uintptr_t) j->font ? -1 : 1;
+    }
+    return iCmp(i->glyphIndex, j->glyphIndex);
+}
+
+static void rasterize_GlyphBitmap_(iGlyphBitmap *d) {
+    d->pixels = rasterizeGlyph_FontFile(d->font->font.file,
+                                        d->font->xScale,
+                                        d->font->yScale,
+                                        d->xShift,
+                                        d->glyphIndex,
+                                        &d->w,
+                                        &d->h);
+}
+
+enum { maxWorkers_RasterPool_ = 4, minParallelBitmaps_RasterPool_ = 16 };
+
+struct Impl_RasterPool {
+    int           numUsers; /* Texts with a glyph cache */
+    iMutex *      mtx;
+    iCondition    workAvailable;
+    iCondition    workFinished;
+    iThread *     workers[maxWorkers_RasterPool_];
+    int           numWorkers;
+    int           numActive; /* workers currently outside the mutex */
+    uint32_t      batch;     /* incremented when new work is available */
+    iBool         quit;
+    iGlyphBitmap *bitmaps;
+    size_t        numBitmaps;
+    size_t        numDone;
+    iAtomicInt    next; /* index of the next bitmap to rasterize */
+};
+
+static iRasterPool rasterPool_;
+
+static size_t rasterizeAvailable_RasterPool_(iRasterPool *d, iGlyphBitmap *bitmaps,
+                                             size_t numBitmaps) {
+    /* Returns the number of bitmaps rasterized by the calling thread. The batch is passed
+       as arguments because workers must not read it outside the mutex. */
+    size_t count = 0;
+    for (;;) {
+        const size_t index = add_Atomic(&d->next, 1);
+        if (index >= numBitmaps) {
+            break;
+        }
+        rasterize_GlyphBitmap_(&bitmaps[index]);
+        count++;
+    }
+    return count;
+}
+
+static iThreadResult worker_RasterPool_(iThread *thread) {
+    iRasterPool *d = userData_Thread(thread);
+    uint32_t batch = 0;
+    lock_Mutex(d->mtx);
+    for (;;) {
+        while (!d->quit && d->batch == batch) {
+            wait_Condition(&d->workAvailable, d->mtx);
+        }
+        if (d->quit) {
+            break;
+        }
+        batch = d->batch;
+        if (!d->bitmaps || d->numDone == d->numBitmaps) {
+            continue; /* woke up too late, the batch is already done */
+        }
+        iGlyphBitmap *bitmaps    = d->bitmaps;
+        const size_t  numBitmaps = d->numBitmaps;
+        d->numActive++; /* the batch remains valid until we are no longer active */
+        unlock_Mutex(d->mtx);
+        const size_t count = rasterizeAvailable_RasterPool_(d, bitmaps, numBitmaps);
+        lock_Mutex(d->mtx);
+        d->numActive--;
+        d->numDone += count;
+        if (d->numDone == d->numBitmaps && d->numActive == 0) {
+            signal_Condition(&d->workFinished);
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return 0;
+}
+
+static void useRasterPool_(void) {
+    iRasterPool *d = &rasterPool_;
+    if (d->numUsers++ > 0) {
+        return;
+    }
+    /* Leave one core for the main thread, which participates in the work anyway. */
+    d->numWorkers = iClamp(SDL_GetCPUCount() - 1, 0, maxWorkers_RasterPool_);
+    if (d->numWorkers == 0) {
+        return;
+    }
+    d->mtx = new_Mutex();
+    init_Condition(&d->workAvailable);
+    init_Condition(&d->workFinished);
+    d->numActive  = 0;
+    d->batch      = 0;
+    d->quit       = iFalse;
+    d->bitmaps    = NULL;
+    d->numBitmaps = 0;
+    d->numDone    = 0;
+    set_Atomic(&d->next, 0);
+    for (int i = 0; i < d->numWorkers; i++) {
+        d->workers[i] = new_Thread(worker_RasterPool_);
+        setUserData_Thread(d->workers[i], d);
+        start_Thread(d->workers[i]);
+    }
+}
+
+static void releaseRasterPool_(void) {
+    iRasterPool *d = &rasterPool_;
+    iAssert(d->numUsers > 0);
+    if (--d->numUsers > 0 || d->numWorkers == 0) {
+        return;
+    }
+    iGuardMutex(d->mtx, {
+        d->quit = iTrue;
+        for (int i = 0; i < d->numWorkers; i++) {
+            signal_Condition(&d->workAvailable);
+        }
+    });
+    for (int i = 0; i < d->numWorkers; i++) {
+        join_Thread(d->workers[i]);
+        iRelease(d->workers[i]);
+        d->workers[i] = NULL;
+    }
+    d->numWorkers = 0;
+    deinit_Condition(&d->workFinished);
+    deinit_Condition(&d->workAvailable);
+    delete_Mutex(d->mtx);
+    d->mtx = NULL;
+}
+
+static void rasterize_RasterPool_(iRasterPool *d, iGlyphBitmap *bitmaps, size_t count) {
+    if (d->numWorkers == 0 || count < minParallelBitmaps_RasterPool_) {
+        for (size_t i = 0; i < count; i++) {
+            rasterize_GlyphBitmap_(&bitmaps[i]);
+        }
+        return;
+    }
+    lock_Mutex(d->mtx);
+    while (d->numActive > 0) {
+        wait_Condition(&d->workFinished, d->mtx);
+    }
+    d->bitmaps    = bitmaps;
+    d->numBitmaps = count;
+    d->numDone    = 0;
+    set_Atomic(&d->next, 0);
+    d->batch++;
+    for (int i = 0; i < d->numWorkers; i++) {
+        signal_Condition(&d->workAvailable);
+    }
+    unlock_Mutex(d->mtx);
+    const size_t numDone = rasterizeAvailable_RasterPool_(d, bitmaps, count);
+    lock_Mutex(d->mtx);
+    d->numDone += numDone;
+    while (d->numDone < d->numBitmaps || d->numActive > 0) {
+        wait_Condition(&d->workFinished, d->mtx);
+    }
+    d->bitmaps    = NULL;
+    d->numBitmaps = 0;
+    d->numDone    = 0;
+    unlock_Mutex(d->mtx);
+}
+
+static void addBitmaps_Font_(iFont *d, const uint32_t *glyphIndices, size_t numGlyphIndices,
+                             iArray *bitmaps) {
+    /* Finds the glyph offsets that still need to be rasterized. New glyphs are not allocated
+       here; that happens later while copying them to the cache. */
+    if (!d->table) {
+        d->table = new_GlyphTable();
+    }
+    for (size_t i = 0; i < numGlyphIndices; i++) {
+        const iGlyph *glyph = glyph_GlyphTable_(d->table, glyphIndices[i]);
+        for (int hoff = 0; hoff < numOffsetSteps_Glyph_; hoff++) {
+            if (!isRasterized_Glyph_(glyph, hoff)) {
+                pushBack_Array(bitmaps, &(iGlyphBitmap){ .font       = d,
+                                                         .glyphIndex = glyphIndices[i],
+                                                         .hoff       = hoff,
+                                                         .xShift = hoff * offsetStep_Glyph_() });
+            }
+        }
+    }
+}
+
+static void rasterizeBitmaps_(iArray *bitmaps) {
+    /* The same glyph may be requested many times. */
+    sort_Array(bitmaps, cmp_GlyphBitmap_);
+    size_t numUnique = 0;
+    for (size_t i = 0; i < size_Array(bitmaps); i++) {
+        if (numUnique == 0 ||
+            cmp_GlyphBitmap_(at_Array(bitmaps, numUnique - 1), at_Array(bitmaps, i))) {
+            if (numUnique != i) {
+                memcpy(at_Array(bitmaps, numUnique), at_Array(bitmaps, i), sizeof(iGlyphBitmap));
+            }
+            numUnique++;
+        }
+    }
+    resize_Array(bitmaps, numUnique);
+    rasterize_RasterPool_(&rasterPool_, data_Array(bitmaps), numUnique);
+}
+
+static SDL_Surface *takeRasterizedGlyph_(iArray *bitmaps, const iGlyph *glyph, int hoff) {
+    if (bitmaps) {
+        const iGlyphBitmap key = { .font = glyph->font, .glyphIndex = index_Glyph_(glyph),
+                                   .hoff = hoff };
+        iGlyphBitmap *bmp = bsearch(&key, data_Array(bitmaps), size_Array(bitmaps),
+                                    sizeof(iGlyphBitmap), cmp_GlyphBitmap_);
+        if (bmp && bmp->pixels) {
+            SDL_Surface *surf = glyphSurface_(bmp->pixels, bmp->w, bmp->h);
+            bmp->pixels = NULL;
+            return surf;
+        }
+    }
+    return rasterizeGlyph_Font_(glyph->font, index_Glyph_(glyph), hoff * offsetStep_Glyph_());
+}
+
+static void deleteBitmaps_(iArray *bitmaps) {
+    iForEach(Array, i, bitmaps) {
+        free(((iGlyphBitmap *) i.value)->pixels); /* ones that weren't needed after all */
+    }
+    delete_Array(bitmaps);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
 iDeclareType(RasterGlyph)
 
 struct Impl_RasterGlyph {
@@ -743,7 +1236,8 @@ struct Impl_RasterGlyph {
     iRect   rect;
 };
 
-static void cacheGlyphs_Font_(iFont *d, const uint32_t *glyphIndices, size_t numGlyphIndices) {
+static void cacheRasterizedGlyphs_Font_(iFont *d, const uint32_t *glyphIndices,
+                                        size_t numGlyphIndices, iArray *bitmaps) {
     /* TODO: Make this an object so it can be used sequentially without reallocating buffers. */
     SDL_Surface *buf     = NULL;
     const iInt2  bufSize = init_I2(iMin(512, d->font.height * iMin(2 * numGlyphIndices, 20)),
@@ -758,11 +1252,11 @@ static void cacheGlyphs_Font_(iFont *d, const uint32_t *glyphIndices, size_t num
     while (index < numGlyphIndices) {
         for (; index < numGlyphIndices; index++) {
             const uint32_t glyphIndex = glyphIndices[index];
-            const int lastCacheBottom = current_StbText_()->cacheBottom;
+            const uint64_t lastEvictions = current_StbText_()->cacheStats.evictions;
             iGlyph *glyph = glyphByIndex_Font_(d, glyphIndex);
-            if (current_StbText_()->cacheBottom < lastCacheBottom) {
-                /* The cache was reset due to running out of space. We need to restart from
-                   the beginning! */
+            if (current_StbText_()->cacheStats.evictions != lastEvictions) {
+                /* A cache page was cleared to make room, possibly including some of the
+                   buffered glyphs. We need to restart from the beginning! */
                 bufX = 0;
                 if (rasters) {
                     clear_Array(rasters);
@@ -784,9 +1278,7 @@ static void cacheGlyphs_Font_(iFont *d, const uint32_t *glyphIndices, size_t num
                 SDL_Surface *surfaces[4] = { NULL, NULL, NULL, NULL };
                 for (int si = 0; si < numOffsetSteps_Glyph_; si++) {
                     surfaces[si] = !isRasterized_Glyph_(glyph, si)
-                                       ? rasterizeGlyph_Font_(glyph->font,
-                                                              index_Glyph_(glyph),
-                                                              si * offsetStep_Glyph_())
+                                       ? takeRasterizedGlyph_(bitmaps, glyph, si)
                                        : NULL;
                 }
                 iBool outOfSpace = iFalse;
@@ -825,17 +1317,24 @@ static void cacheGlyphs_Font_(iFont *d, const uint32_t *glyphIndices, size_t num
         }
         /* Finished or the buffer is full, copy the glyphs to the cache texture. */
         if (!isEmpty_Array(rasters)) {
-            SDL_Renderer *render = current_Text()->render;
-            SDL_Texture *bufTex = SDL_CreateTextureFromSurface(render, buf);
+            iStbText     *tx     = current_StbText_();
+            SDL_Renderer *render = tx->base.render;
+            SDL_Texture  *bufTex = SDL_CreateTextureFromSurface(render, buf);
+            SDL_Texture  *target = NULL;
             SDL_SetTextureBlendMode(bufTex, SDL_BLENDMODE_NONE);
             if (!isTargetChanged) {
                 isTargetChanged = iTrue;
                 oldTarget = SDL_GetRenderTarget(render);
-                SDL_SetRenderTarget(render, current_StbText_()->cache);
             }
 //            printf("copying %zu rasters from %p\n", size_Array(rasters), bufTex); fflush(stdout);
             iConstForEach(Array, i, rasters) {
                 const iRasterGlyph *rg = i.value;
+                SDL_Texture *pageTex = cachePage_StbText_(tx, rg->glyph->cachePage)->texture;
+                if (pageTex != target) {
+                    /* Glyphs of one batch may be in different pages. */
+                    SDL_SetRenderTarget(render, pageTex);
+                    target = pageTex;
+                }
 //                iAssert(isEqual_I2(rg->rect.size, rg->glyph->rect[rg->hoff].size));
                 const iRect *glRect = &rg->glyph->rect[rg->hoff];
                 SDL_RenderCopy(render,
@@ -843,6 +1342,7 @@ static void cacheGlyphs_Font_(iFont *d, const uint32_t *glyphIndices, size_t num
                                (const SDL_Rect *) &rg->rect,
                                (const SDL_Rect *) glRect);
                 setRasterized_Glyph_(rg->glyph, rg->hoff);
+                tx->cacheStats.misses++;
 //                printf(" - %u (hoff %d)\n", index_Glyph_(rg->glyph), rg->hoff);
             }
             SDL_DestroyTexture(bufTex);
@@ -858,10 +1358,25 @@ static void cacheGlyphs_Font_(iFont *d, const uint32_t *glyphIndices, size_t num
         SDL_FreeSurface(buf);
     }
     if (isTargetChanged) {
-        SDL_SetRenderTarget(current_Text()->render, oldTarget);
+        restoreTarget_Paint(current_Text()->render, oldTarget);
     }
 }
 
+static void cacheGlyphs_Font_(iFont *d, const uint32_t *glyphIndices, size_t numGlyphIndices) {
+    iArray *bitmaps = new_Array(sizeof(iGlyphBitmap));
+    addBitmaps_Font_(d, glyphIndices, numGlyphIndices, bitmaps);
+    if (isEmpty_Array(bitmaps)) {
+        /* Everything is already cached. */
+        delete_Array(bitmaps);
+        return;
+    }
+    beginZone_Profiler("cacheGlyphs_Font_");
+    rasterizeBitmaps_(bitmaps);
+    cacheRasterizedGlyphs_Font_(d, glyphIndices, numGlyphIndices, bitmaps);
+    deleteBitmaps_(bitmaps);
+    endZone_Profiler();
+}
+
 iLocalDef void cacheSingleGlyph_Font_(iFont *d, uint32_t glyphIndex) {
     cacheGlyphs_Font_(d, &glyphIndex, 1);
 }
@@ -892,10 +1407,67 @@ static void cacheTextGlyphs_Font_(iFont *d, const iRangecc text) {
     }
     deinit_AttributedText(&attrText);
     /* TODO: Cache glyphs from ALL the fonts we encountered above. */
-    cacheGlyphs_Font_(d, constData_Array(&glyphIndices), size_Array(&glyphIndices));
+    iArray *batch = current_StbText_()->cacheBatch;
+    if (batch) {
+        iConstForEach(Array, g, &glyphIndices) {
+            pushBack_Array(batch, &(iGlyphRef){ d, *(const uint32_t *) g.value });
+        }
+    }
+    else {
+        cacheGlyphs_Font_(d, constData_Array(&glyphIndices), size_Array(&glyphIndices));
+    }
     deinit_Array(&glyphIndices);
 }
 
+void beginCacheBatch_Text(void) {
+    iStbText *tx = current_StbText_();
+    if (hasGlyphCache_StbText_(tx) && !tx->cacheBatch) {
+        tx->cacheBatch = new_Array(sizeof(iGlyphRef));
+    }
+}
+
+void endCacheBatch_Text(void) {
+    iStbText *tx = current_StbText_();
+    iArray *batch = tx->cacheBatch;
+    if (!batch) {
+        return;
+    }
+    tx->cacheBatch = NULL;
+    if (isEmpty_Array(batch)) {
+        delete_Array(batch);
+        return;
+    }
+    /* Rasterize the glyphs of all the fonts together, and then cache them one font at a time. */
+    sort_Array(batch, cmp_GlyphRef_);
+    iArray *bitmaps = new_Array(sizeof(iGlyphBitmap));
+    iArray  indices;
+    init_Array(&indices, sizeof(uint32_t));
+    const iGlyphRef *refs = constData_Array(batch);
+    const size_t     numRefs = size_Array(batch);
+    for (size_t i = 0; i < numRefs; i++) {
+        pushBack_Array(&indices, &refs[i].glyphIndex);
+        if (i == numRefs - 1 || refs[i + 1].font != refs[i].font) {
+            addBitmaps_Font_(refs[i].font, constData_Array(&indices), size_Array(&indices),
+                             bitmaps);
+            clear_Array(&indices);
+        }
+    }
+    if (!isEmpty_Array(bitmaps)) {
+        rasterizeBitmaps_(bitmaps);
+        for (size_t i = 0; i < numRefs; i++) {
+            pushBack_Array(&indices, &refs[i].glyphIndex);
+            if (i == numRefs - 1 || refs[i + 1].font != refs[i].font) {
+                cacheRasterizedGlyphs_Font_(refs[i].font, constData_Array(&indices),
+                                            size_Array(&indices), bitmaps);
+                clear_Array(&indices);
+            }
+        }
+    }
+    deinit_Array(&indices);
+    deleteBitmaps_(bitmaps);
+    delete_Array(batch);
+}
+
 void cache_Text(int fontId, iRangecc text) {
     cacheTextGlyphs_Font_(font_Text_(fontId), text);
 }
@@ -1118,10 +1690,14 @@ iLocalDef iBool equal_FontRunArgs(const iFontRunArgs *a, const iFontRunArgs *b)
 }
 
 struct Impl_FontRun {
+    iHashNode       node; /* key is `textCrc32` combined with a checksum of `args` */
+    iFontRun *      newer;
+    iFontRun *      older;
     uint32_t        textCrc32;
     iFontRunArgs    args;
     iAttributedText attrText;
     iArray          buffers; /* GlyphBuffers */
+    size_t          memSize; /* approximate, for limiting the size of the cache */
 };
 
 #if defined (LAGRANGE_ENABLE_HARFBUZZ)
@@ -1139,6 +1715,9 @@ static const hb_script_t hbScripts_[max_Script] = {
 #endif
 
 void init_FontRun(iFontRun *d, const iFontRunArgs *args, const iRangecc text, uint32_t crc) {
+    d->node.key  = crc ^ iCrc32((const char *) args, sizeof(*args));
+    d->newer     = NULL;
+    d->older     = NULL;
     d->textCrc32 = crc;
     d->args = *args;
     /* Split the text into a number of attributed runs that specify exactly which
@@ -1192,6 +1771,13 @@ void init_FontRun(iFontRun *d, const iFontRunArgs *args, const iRangecc text, ui
     for (size_t runIndex = 0; runIndex < runCount; runIndex++) {
         alignOtherFontsVertically_GlyphBuffer_(at_Array(&d->buffers, runIndex), args->font);
     }
+    const size_t numChars = size_Array(&d->attrText.logical);
+    d->memSize = sizeof(*d) + runCount * (sizeof(iAttributedRun) + sizeof(iGlyphBuffer)) +
+                 numChars * (2 * sizeof(iChar) + 3 * sizeof(int) + 1);
+    iConstForEach(Array, b, &d->buffers) {
+        const iGlyphBuffer *buf = b.value;
+        d->memSize += buf->glyphCount * (sizeof(hb_glyph_info_t) + sizeof(hb_glyph_position_t));
+    }
 }
 
 void deinit_FontRun(iFontRun *d) {
@@ -1349,17 +1935,24 @@ void process_RunLayer_(iRunLayer *d, int layerIndex) {
                 }
                 if (layerIndex == foreground_RunLayerType && !isSpace) {
                     /* Draw the glyph. */
+                    iStbText *tx = current_StbText_();
                     if (!isRasterized_Glyph_(glyph, hoff)) {
-                        cacheSingleGlyph_Font_(runFont, glyphId); /* may cause cache reset */
+                        cacheSingleGlyph_Font_(runFont, glyphId); /* may clear a cache page */
                         glyph = glyphByIndex_Font_(runFont, glyphId);
                         iAssert(isRasterized_Glyph_(glyph, hoff));
                     }
+                    else {
+                        tx->cacheStats.hits++;
+                    }
                     if (~d->mode & permanentColorFlag_RunMode) {
-                        SDL_SetTextureColorMod(current_StbText_()->cache, fgClr.r, fgClr.g, fgClr.b);
+                        setCacheColorMod_StbText_(tx, fgClr);
                     }
                     SDL_Rect src;
                     memcpy(&src, &glyph->rect[hoff], sizeof(SDL_Rect));
-                    SDL_RenderCopy(current_Text()->render, current_StbText_()->cache, &src, &dst);
+                    SDL_RenderCopy(tx->base.render,
+                                   useCachePage_StbText_(tx, glyph->cachePage),
+                                   &src,
+                                   &dst);
                 }
 #if 0
                 /* Show spaces and direction. */
@@ -1388,6 +1981,52 @@ void process_RunLayer_(iRunLayer *d, int layerIndex) {
 static unsigned fontRunCacheHits_  = 0;
 static unsigned fontRunCacheTotal_ = 0;
 
+enum { maxFontRunsSize_StbText_ = 16 * 1000000 }; /* bytes; enough for the lines of a long document */
+
+static void unlinkFontRun_StbText_(iStbText *d, iFontRun *run) {
+    if (run->newer) {
+        run->newer->older = run->older;
+    }
+    else {
+        d->newestFontRun = run->older;
+    }
+    if (run->older) {
+        run->older->newer = run->newer;
+    }
+    else {
+        d->oldestFontRun = run->newer;
+    }
+    run->newer = run->older = NULL;
+}
+
+static void linkNewestFontRun_StbText_(iStbText *d, iFontRun *run) {
+    run->older = d->newestFontRun;
+    run->newer = NULL;
+    if (d->newestFontRun) {
+        d->newestFontRun->newer = run;
+    }
+    d->newestFontRun = run;
+    if (!d->oldestFontRun) {
+        d->oldestFontRun = run;
+    }
+}
+
+static void removeFontRun_StbText_(iStbText *d, iFontRun *run) {
+    unlinkFontRun_StbText_(d, run);
+    remove_Hash(&d->fontRuns, run->node.key);
+    d->numFontRuns--;
+    d->fontRunsSize -= run->memSize;
+    delete_FontRun(run);
+}
+
+static void clearFontRuns_StbText_(iStbText *d) {
+    while (d->oldestFontRun) {
+        removeFontRun_StbText_(d, d->oldestFontRun);
+    }
+    iAssert(d->numFontRuns == 0);
+    iAssert(d->fontRunsSize == 0);
+}
+
 static iFontRun *makeOrFindCachedFontRun_StbText_(iStbText *d, const iFontRunArgs *runArgs,
                                                   const iRangecc text, iBool *wasFound) {
     fontRunCacheTotal_++;
@@ -1401,22 +2040,31 @@ static iFontRun *makeOrFindCachedFontRun_StbText_(iStbText *d, const iFontRunArg
     }
 #endif
     const uint32_t crc = iCrc32(text.start, size_Range(&text));
-    iForIndices(i, d->cachedFontRuns) {
-        if (d->cachedFontRuns[i] && d->cachedFontRuns[i]->textCrc32 == crc &&
-            equal_FontRunArgs(runArgs, &d->cachedFontRuns[i]->args)) {
-            d->cachedFontRuns[i]->attrText.source = text;
+    const uint32_t key = crc ^ iCrc32((const char *) runArgs, sizeof(*runArgs));
+    iFontRun *run = (iFontRun *) value_Hash(&d->fontRuns, key);
+    if (run) {
+        if (run->textCrc32 == crc && equal_FontRunArgs(runArgs, &run->args)) {
+            unlinkFontRun_StbText_(d, run);
+            linkNewestFontRun_StbText_(d, run);
+            run->attrText.source = text;
             fontRunCacheHits_++;
             *wasFound = iTrue;
-            return d->cachedFontRuns[i];
+            return run;
         }
+        removeFontRun_StbText_(d, run); /* same key, different text or arguments */
     }
     *wasFound = iFalse;
-    delete_FontRun(d->cachedFontRuns[iElemCount(d->cachedFontRuns) - 1]);
-    memmove(d->cachedFontRuns + 1,
-            d->cachedFontRuns,
-            sizeof(d->cachedFontRuns) - sizeof(d->cachedFontRuns[0]));
-    d->cachedFontRuns[0] = new_FontRun(runArgs, text, crc);
-    return d->cachedFontRuns[0];
+    run = new_FontRun(runArgs, text, crc);
+    iAssert(run->node.key == key);
+    insert_Hash(&d->fontRuns, &run->node);
+    linkNewestFontRun_StbText_(d, run);
+    d->numFontRuns++;
+    d->fontRunsSize += run->memSize;
+    /* The new run is kept even if it alone exceeds the limit. */
+    while (d->fontRunsSize > maxFontRunsSize_StbText_ && d->oldestFontRun != run) {
+        removeFontRun_StbText_(d, d->oldestFontRun);
+    }
+    return run;
 }
 
 static void run_Font_(iFont *d, const iRunArgs *args) {
@@ -1430,14 +2078,16 @@ static void run_Font_(iFont *d, const iRunArgs *args) {
     iWrapText  *wrap         = args->wrap;
     iFontRun   *fontRun;
     iBool       didFindCachedFontRun = iFalse;
+    iAssert(~mode & draw_RunMode || hasGlyphCache_StbText_(current_StbText_()));
     /* Set the default text foreground color. */
     if (mode & draw_RunMode) {
-        const iColor clr = get_Color(args->color);
-        SDL_SetTextureColorMod(current_StbText_()->cache, clr.r, clr.g, clr.b);
+        current_StbText_()->drawSerial++;
+        setCacheColorMod_StbText_(current_StbText_(), get_Color(args->color));
     }
     iAssert(args->text.end >= args->text.start);
-    /* We keep a small cache of recently shaped runs because preparing these can be expensive.
-       Quite frequently the same text is quickly re-drawn and/or measured (e.g., InputWidget). */
+    /* We keep a cache of recently shaped runs because preparing these can be expensive.
+       Quite frequently the same text is quickly re-drawn and/or measured (e.g., InputWidget),
+       and documents are measured line by line again when the width changes. */
     fontRun = makeOrFindCachedFontRun_StbText_(
         current_StbText_(),
         &(iFontRunArgs){ args->maxLen,
@@ -1840,5 +2490,28 @@ void resetMissing_Text(iText *d) {
 }
 
 SDL_Texture *glyphCache_Text(void) {
-    return current_StbText_()->cache;
+    iStbText *d = current_StbText_();
+    return hasGlyphCache_StbText_(d) ? cachePage_StbText_(d, d->cachePageIndex)->texture : NULL;
+}
+
+const iString *debugInfo_Text(const iText *text) {
+    const iStbText *d   = (const iStbText *) text;
+    iString        *msg = collectNew_String();
+    if (!hasGlyphCache_StbText_(d)) {
+        return msg;
+    }
+    const iGlyphCacheStats *stats = &d->cacheStats;
+    const uint64_t          draws = stats->hits + stats->misses;
+    appendFormat_String(msg, "Pages: %zu of %zu (%dx%d)\n",
+                        size_Array(&d->cachePages), d->maxCachePages,
+                        d->cacheSize.x, d->cacheSize.y);
+    appendFormat_String(msg, "Hits: %llu (%.1f%%)\n",
+                        (unsigned long long) stats->hits,
+                        draws ? 100.0 * stats->hits / draws : 0.0);
+    appendFormat_String(msg, "Misses: %llu\n", (unsigned long long) stats->misses);
+    appendFormat_String(msg, "Evictions: %llu\n", (unsigned long long) stats->evictions);
+    appendFormat_String(msg, "Shaped runs: %zu (%.1f of %.1f MB)\n",
+                        d->numFontRuns, d->fontRunsSize / 1.0e6,
+                        maxFontRunsSize_StbText_ / 1.0e6);
+    return msg;
 }
@@ -162,6 +162,10 @@ void delete_Text(iText *d) {
 
 void resetFonts_Text(iText *d) {}
 
+uint32_t fontsSerial_Text(void) {
+    return 0;
+}
+
 void resetFontCache_Text(iText *d) {}
 
 iChar missing_Text(size_t index) {
@@ -179,11 +183,18 @@ SDL_Texture *glyphCache_Text(void) {
     return NULL;
 }
 
+const iString *debugInfo_Text(const iText *d) {
+    iUnused(d);
+    return collectNew_String();
+}
+
 void setOpacity_Text(float opacity) {
     iUnused(opacity);
 }
 
 void cache_Text(int fontId, iRangecc text) {}
+void beginCacheBatch_Text(void) {}
+void endCacheBatch_Text(void) {}
 
 static iChar nextChar_(const char **chPos, const char *end) {
     if (*chPos == end) {
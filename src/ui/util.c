@@ -778,6 +778,7 @@ static iBool isCommandIgnoredByMenus_(const char *cmd) {
     /* TODO: Perhaps a common way of indicating which commands are notifications and should not
        be reacted to by menus?! A prefix character could do the trick. */
     return equal_Command(cmd, "media.updated") ||
+           equal_Command(cmd, "media.image.decoded") ||
            equal_Command(cmd, "media.player.update") ||
            startsWith_CStr(cmd, "feeds.update.") ||
            equal_Command(cmd, "bookmarks.request.started") ||
@@ -2785,6 +2786,7 @@ static iBool messageHandler_(iWidget *msg, const char *cmd) {
     /* Almost any command dismisses the sheet. */
     /* TODO: Add a "notification" type of user events to separate them from user actions. */
     if (!(equal_Command(cmd, "media.updated") ||
+          equal_Command(cmd, "media.image.decoded") ||
           equal_Command(cmd, "media.player.update") ||
           equal_Command(cmd, "bookmarks.request.finished") ||
           equal_Command(cmd, "bookmarks.changed") ||
@@ -25,12 +25,176 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "window.h"
 #include "util.h"
 
+#include <the_Foundation/array.h>
+#include <the_Foundation/ptrarray.h>
+
+/* Texture pool shared by all VisBufs. Released textures are reused by the next VisBuf of
+   the same size, and VisBufs that are not currently shown (e.g., background tabs) keep their
+   rendered contents until the memory budget runs out. */
+
+iDeclareType(VisBufPool)
+iDeclareType(PooledTexture)
+
+struct Impl_PooledTexture {
+    SDL_Renderer *render;
+    SDL_Texture  *texture;
+    iInt2         size;
+};
+
+struct Impl_VisBufPool {
+    iBool     isInit;
+    iArray    free;        /* PooledTexture; oldest first */
+    iPtrArray parked;      /* VisBufs not in use; least recently used first */
+    size_t    totalBytes;  /* all textures, including ones in use */
+    uint64_t  numCreated;
+    uint64_t  numReused;
+    uint64_t  numEvicted;  /* parked VisBufs that lost their contents */
+};
+
+static iVisBufPool pool_;
+
+static const size_t maxFree_VisBufPool_ = 2 * numBuffers_VisBuf;
+
+static size_t budget_VisBufPool_(void) {
+    return (isMobile_Platform() ? 64 : 256) * 1000000;
+}
+
+static size_t textureBytes_(iInt2 size) {
+    return (size_t) size.x * (size_t) size.y * 4;
+}
+
+static iVisBufPool *pool_VisBufPool_(void) {
+    iVisBufPool *d = &pool_;
+    if (!d->isInit) {
+        init_Array(&d->free, sizeof(iPooledTexture));
+        init_PtrArray(&d->parked);
+        d->isInit = iTrue;
+    }
+    return d;
+}
+
+static void destroyFront_VisBufPool_(iVisBufPool *d) {
+    const iPooledTexture *pt = constFront_Array(&d->free);
+    SDL_DestroyTexture(pt->texture);
+    d->totalBytes -= textureBytes_(pt->size);
+    remove_Array(&d->free, 0);
+}
+
+static SDL_Texture *acquire_VisBufPool_(iVisBufPool *d, SDL_Renderer *render, iInt2 size) {
+    for (size_t i = size_Array(&d->free); i-- > 0; ) {
+        const iPooledTexture *pt = constAt_Array(&d->free, i);
+        if (pt->render == render && isEqual_I2(pt->size, size)) {
+            SDL_Texture *tex = pt->texture;
+            remove_Array(&d->free, i);
+            d->numReused++;
+            return tex;
+        }
+    }
+    SDL_Texture *tex = SDL_CreateTexture(render,
+                                         SDL_PIXELFORMAT_RGBA8888,
+                                         SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET,
+                                         size.x,
+                                         size.y);
+    SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_NONE);
+    d->totalBytes += textureBytes_(size);
+    d->numCreated++;
+    return tex;
+}
+
+static void releaseTextures_VisBuf_(iVisBuf *d) {
+    iVisBufPool *pool = pool_VisBufPool_();
+    if (d->isParked) {
+        removeOne_PtrArray(&pool->parked, d);
+        d->isParked = iFalse;
+    }
+    iForIndices(i, d->buffers) {
+        if (d->buffers[i].texture) {
+            pushBack_Array(&pool->free,
+                           &(iPooledTexture){ d->render, d->buffers[i].texture, d->texSize });
+            d->buffers[i].texture = NULL;
+        }
+    }
+    d->texSize = zero_I2();
+}
+
+static void trim_VisBufPool_(iVisBufPool *d) {
+    while (size_Array(&d->free) > maxFree_VisBufPool_) {
+        destroyFront_VisBufPool_(d);
+    }
+    while (d->totalBytes > budget_VisBufPool_()) {
+        if (!isEmpty_Array(&d->free)) {
+            destroyFront_VisBufPool_(d);
+        }
+        else if (!isEmpty_PtrArray(&d->parked)) {
+            /* The textures go to the free list and will be destroyed on the next round. */
+            releaseTextures_VisBuf_(at_PtrArray(&d->parked, 0));
+            d->numEvicted++;
+        }
+        else {
+            break; /* everything is in use */
+        }
+    }
+}
+
+void purgePool_VisBuf(SDL_Renderer *render) {
+    iVisBufPool *d = &pool_;
+    if (!d->isInit) {
+        return;
+    }
+    for (size_t i = 0; i < size_PtrArray(&d->parked); ) {
+        iVisBuf *buf = at_PtrArray(&d->parked, i);
+        if (buf->render == render) {
+            releaseTextures_VisBuf_(buf); /* removed from `parked` */
+        }
+        else i++;
+    }
+    for (size_t i = 0; i < size_Array(&d->free); ) {
+        const iPooledTexture *pt = constAt_Array(&d->free, i);
+        if (pt->render == render) {
+            SDL_DestroyTexture(pt->texture);
+            d->totalBytes -= textureBytes_(pt->size);
+            remove_Array(&d->free, i);
+        }
+        else i++;
+    }
+    if (isEmpty_Array(&d->free) && isEmpty_PtrArray(&d->parked)) {
+        deinit_Array(&d->free);
+        deinit_PtrArray(&d->parked);
+        d->isInit = iFalse;
+    }
+}
+
+const iString *debugInfoPool_VisBuf(void) {
+    const iVisBufPool *d   = &pool_;
+    iString           *msg = collectNew_String();
+    appendFormat_String(msg, "Textures: %.1f MB of %.1f MB\n",
+                        d->totalBytes / 1.0e6f, budget_VisBufPool_() / 1.0e6f);
+    if (d->isInit) {
+        size_t parkedBytes = 0;
+        iConstForEach(PtrArray, i, &d->parked) {
+            const iVisBuf *buf = i.ptr;
+            parkedBytes += numBuffers_VisBuf * textureBytes_(buf->texSize);
+        }
+        appendFormat_String(msg, "Kept for hidden views: %zu (%.1f MB)\n",
+                            size_PtrArray(&d->parked), parkedBytes / 1.0e6f);
+        appendFormat_String(msg, "Free: %zu\n", size_Array(&d->free));
+    }
+    appendFormat_String(msg, "Created: %llu\n", (unsigned long long) d->numCreated);
+    appendFormat_String(msg, "Reused: %llu\n", (unsigned long long) d->numReused);
+    appendFormat_String(msg, "Evicted: %llu\n", (unsigned long long) d->numEvicted);
+    return msg;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
 iDefineTypeConstruction(VisBuf)
 
 void init_VisBuf(iVisBuf *d) {
     d->texSize = zero_I2();
     iZap(d->buffers);
     iZap(d->vis);
+    d->render = NULL;
+    d->isParked = iFalse;
     d->bufferInvalidated = NULL;
 }
 
@@ -51,23 +215,22 @@ void invalidate_VisBuf(iVisBuf *d) {
 }
 
 iBool alloc_VisBuf(iVisBuf *d, const iInt2 size, int granularity) {
-    const iInt2 texSize = init_I2(size.x, (size.y / 2 / granularity + 1) * granularity);
-    if (!d->buffers[0].texture || !isEqual_I2(texSize, d->texSize)) {
+    const iInt2   texSize = init_I2(size.x, (size.y / 2 / granularity + 1) * granularity);
+    SDL_Renderer *rend    = renderer_Window(get_Window());
+    iVisBufPool  *pool    = pool_VisBufPool_();
+    if (d->isParked) {
+        /* Back in use, with the previously rendered contents. */
+        removeOne_PtrArray(&pool->parked, d);
+        d->isParked = iFalse;
+    }
+    if (!d->buffers[0].texture || !isEqual_I2(texSize, d->texSize) || d->render != rend) {
+        releaseTextures_VisBuf_(d);
         d->texSize = texSize;
+        d->render  = rend;
         iForIndices(i, d->buffers) {
-            iVisBufTexture *tex = &d->buffers[i];
-            if (tex->texture) {
-                SDL_DestroyTexture(tex->texture);
-            }
-            SDL_Renderer *rend = renderer_Window(get_Window());
-            tex->texture =
-                SDL_CreateTexture(rend,
-                                  SDL_PIXELFORMAT_RGBA8888,
-                                  SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET,
-                                  texSize.x,
-                                  texSize.y);
-            SDL_SetTextureBlendMode(tex->texture, SDL_BLENDMODE_NONE);
+            d->buffers[i].texture = acquire_VisBufPool_(pool, rend, texSize);
         }
+        trim_VisBufPool_(pool);
         invalidate_VisBuf(d);
         return iTrue;
     }
@@ -75,11 +238,21 @@ iBool alloc_VisBuf(iVisBuf *d, const iInt2 size, int granularity) {
 }
 
 void dealloc_VisBuf(iVisBuf *d) {
+    if (d->buffers[0].texture || d->isParked) {
+        releaseTextures_VisBuf_(d);
+        trim_VisBufPool_(&pool_);
+    }
     d->texSize = zero_I2();
-    iForIndices(i, d->buffers) {
-        SDL_DestroyTexture(d->buffers[i].texture);
-        d->buffers[i].texture = NULL;
+}
+
+void park_VisBuf(iVisBuf *d) {
+    if (!d->buffers[0].texture || d->isParked) {
+        return;
     }
+    iVisBufPool *pool = pool_VisBufPool_();
+    pushBack_PtrArray(&pool->parked, d);
+    d->isParked = iTrue;
+    trim_VisBufPool_(pool);
 }
 
 static void roll_VisBuf_(iVisBuf *d, int dir) {
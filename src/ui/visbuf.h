@@ -23,6 +23,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #pragma once
 
 #include <the_Foundation/range.h>
+#include <the_Foundation/string.h>
 #include <the_Foundation/vec2.h>
 #include <SDL_render.h>
 
@@ -42,14 +43,17 @@ struct Impl_VisBuf {
     iInt2 texSize;
     iRangei vis;
     iVisBufTexture buffers[numBuffers_VisBuf];
+    SDL_Renderer *render; /* owner of the textures */
+    iBool isParked;
     void (*bufferInvalidated)(iVisBuf *, size_t index);
 };
 
 iDeclareTypeConstruction(VisBuf)
 
 void    invalidate_VisBuf       (iVisBuf *);
-iBool   alloc_VisBuf            (iVisBuf *, const iInt2 size, int granularity);
+iBool   alloc_VisBuf            (iVisBuf *, const iInt2 size, int granularity); /* returns true if contents were lost */
 void    dealloc_VisBuf          (iVisBuf *);
+void    park_VisBuf             (iVisBuf *); /* keep contents while unused, if the budget allows */
 iBool   reposition_VisBuf       (iVisBuf *, const iRangei vis); /* returns true if `vis` changes */
 void    validate_VisBuf         (iVisBuf *);
 
@@ -57,3 +61,7 @@ iRangei allocRange_VisBuf       (const iVisBuf *);
 iRangei bufferRange_VisBuf      (const iVisBuf *, size_t index);
 void    invalidRanges_VisBuf    (const iVisBuf *, const iRangei full, iRangei *out_invalidRanges);
 void    draw_VisBuf             (const iVisBuf *, iInt2 topLeft, iRangei yClipBounds);
+
+/* All VisBuf textures are recycled via a shared pool with a memory budget. */
+void            purgePool_VisBuf    (SDL_Renderer *render); /* renderer is going away or was reset */
+const iString * debugInfoPool_VisBuf(void);
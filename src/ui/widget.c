@@ -154,6 +154,7 @@ void init_Widget(iWidget *d) {
     d->flags          = 0;
     d->flags2         = 0;
     d->rect           = zero_Rect();
+    d->drawnBounds    = zero_Rect();
     d->oldSize        = zero_I2();
     d->minSize        = zero_I2();
     d->overflowTopMargin = 0;
@@ -1975,15 +1976,40 @@ iLocalDef void incrementDrawCount_(const iWidget *d) {
     }
 }
 
+static const int64_t fullDamage_WidgetFlags_ = visualOffset_WidgetFlag | keepOnTop_WidgetFlag |
+                                              mouseModal_WidgetFlag |
+                                              drawBackgroundToBottom_WidgetFlag;
+
+static iRect damageBounds_Widget_(const iWidget *d) {
+    /* Some decorations, like focus frames, may extend a bit outside the bounds. */
+    return expanded_Rect(bounds_Widget(d), init1_I2(gap_UI));
+}
+
+static iBool isOutsideDamage_Widget_(const iWidget *d) {
+    const iWindow *win = get_Window();
+    if (!win->damageTarget || d->flags & fullDamage_WidgetFlags_ ||
+        SDL_GetRenderTarget(win->render) != win->damageTarget) {
+        return iFalse; /* the whole window, or a widget buffer, is being drawn */
+    }
+    return isEmpty_Rect(intersect_Rect(damageBounds_Widget_(d), win->damageClip));
+}
+
+static void draw_Widget_(const iWidget *d) {
+    incrementDrawCount_(d);
+    /* Remembered so the old area gets damaged if the widget is moved or hidden. */
+    iConstCast(iWidget *, d)->drawnBounds = damageBounds_Widget_(d);
+    class_Widget(d)->draw(d);
+}
+
 void drawChildren_Widget(const iWidget *d) {
     if (!isDrawn_Widget_(d)) {
         return;
     }
     iConstForEach(ObjectList, i, d->children) {
         const iWidget *child = constAs_Widget(i.object);
-        if (~child->flags & keepOnTop_WidgetFlag && isDrawn_Widget_(child)) {
-            incrementDrawCount_(child);
-            class_Widget(child)->draw(child);
+        if (~child->flags & keepOnTop_WidgetFlag && isDrawn_Widget_(child) &&
+            !isOutsideDamage_Widget_(child)) {
+            draw_Widget_(child);
         }
     }
 }
@@ -1995,8 +2021,10 @@ void drawRoot_Widget(const iWidget *d) {
     init_PtrArray(&pvs);
     findPotentiallyVisible_Widget_(d, &pvs);
     iReverseConstForEach(PtrArray, i, &pvs) {
-        incrementDrawCount_(i.ptr);
-        class_Widget(i.ptr)->draw(i.ptr);
+        if (isOutsideDamage_Widget_(i.ptr)) {
+            continue;
+        }
+        draw_Widget_(i.ptr);
     }
     deinit_PtrArray(&pvs);
 }
@@ -2039,7 +2067,7 @@ static void beginBufferDraw_Widget_(const iWidget *d) {
 static void endBufferDraw_Widget_(const iWidget *d) {
     if (d->drawBuf) {
         d->drawBuf->isValid = iTrue;
-        SDL_SetRenderTarget(renderer_Window(get_Window()), d->drawBuf->oldTarget);
+        restoreTarget_Paint(renderer_Window(get_Window()), d->drawBuf->oldTarget);
         origin_Paint = d->drawBuf->oldOrigin;
 //        printf("endBufferDraw: origin %d,%d\n", origin_Paint.x, origin_Paint.y);
 //        fflush(stdout);
@@ -2635,7 +2663,19 @@ void refresh_Widget(const iAnyObject *d) {
             w->drawBuf->isValid = iFalse;
         }
     }
-    postRefresh_Window(window_Widget(d));
+    /* Redraw only the widget's area, unless it may be moving or covering other widgets. */
+    for (const iWidget *w = d; w; w = w->parent) {
+        if (w->flags & fullDamage_WidgetFlags_) {
+            postRefresh_Window(window_Widget(d));
+            return;
+        }
+    }
+    const iWidget *w      = d;
+    iRect          damage = damageBounds_Widget_(w);
+    if (!isEmpty_Rect(w->drawnBounds)) {
+        damage = union_Rect(damage, w->drawnBounds); /* may have moved or been hidden */
+    }
+    postDamage_Window(window_Widget(d), damage);
 }
 
 void raise_Widget(iWidget *d) {
@@ -161,6 +161,7 @@ struct Impl_Widget {
     int64_t      flags;
     int          flags2;
     iRect        rect;
+    iRect        drawnBounds; /* damage bounds when last drawn; may no longer be current */
     iInt2        oldSize; /* in previous arrangement; for notification */
     iInt2        minSize;
     iWidget *    sizeRef;
@@ -32,10 +32,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "documentwidget.h"
 #include "sidebarwidget.h"
 #include "paint.h"
+#include "profiler.h"
 #include "snippets.h"
 #include "root.h"
 #include "touch.h"
 #include "util.h"
+#include "visbuf.h"
 
 #if defined (iPlatformMsys)
 #   include "../win32.h"
@@ -621,6 +623,10 @@ void init_Window(iWindow *d, enum iWindowType type, iRect rect, uint32_t flags)
     d->isInvalidated = iFalse; /* set when posting event, to avoid repeated events */
     d->isMouseInside = iTrue;
     set_Atomic(&d->isRefreshPending, iTrue);
+    set_Atomic(&d->isFullyDamaged, iTrue);
+    d->damage        = zero_Rect();
+    d->damageTarget  = NULL;
+    d->damageClip    = zero_Rect();
     d->ignoreClick   = iFalse;
     d->focusGainedAt = SDL_GetTicks();
     d->frameTime     = SDL_GetTicks();
@@ -680,6 +686,7 @@ void deinit_Window(iWindow *d) {
     }
     deinitRoots_Window_(d);
     delete_Text(d->text);
+    purgePool_VisBuf(d->render);
     SDL_DestroyRenderer(d->render);
     SDL_DestroyWindow(d->win);
     iForIndices(i, d->cursors) {
@@ -709,6 +716,7 @@ void init_MainWindow(iMainWindow *d, iRect rect) {
     theWindow_ = &d->base;
     theMainWindow_ = d;
     d->enableBackBuf = iFalse;
+    d->enableDamage = !isMobile_Platform() && !isTerminal_Platform();
     uint32_t flags = 0;
 #if defined (iPlatformAppleDesktop)
     SDL_SetHint(SDL_HINT_RENDER_DRIVER, shouldDefaultToMetalRenderer_MacOS() ? "metal" : "opengl");
@@ -901,11 +909,12 @@ static void invalidate_Window_(iAnyWindow *d, iBool forced) {
         w->isInvalidated = iTrue;
         if (w->type == main_WindowType) {
             iMainWindow *mw = as_MainWindow(w);
-            if (mw->enableBackBuf && mw->backBuf) {
+            if (mw->backBuf) {
                 SDL_DestroyTexture(mw->backBuf);
                 mw->backBuf = NULL;
             }
         }
+        purgePool_VisBuf(w->render); /* hidden views' contents are no longer valid */
         resetFontCache_Text(text_Window(w));
         postCommand_App("theme.changed auto:1"); /* forces UI invalidation */
     }
@@ -1568,6 +1577,8 @@ void draw_Window(iWindow *d) {
         return;
     }
     isDrawing_ = iTrue;
+    set_Atomic(&d->isFullyDamaged, iFalse); /* always redrawn fully */
+    d->damage = zero_Rect();
     iPaint p;
     init_Paint(&p);
     iRoot *root = d->roots[0];
@@ -1635,6 +1646,7 @@ void draw_MainWindow(iMainWindow *d) {
         return;
     }
     isDrawing_ = iTrue;
+    beginZone_Profiler("draw_MainWindow");
     if (deviceType_App() == desktop_AppDeviceType) {
         checkPixelRatioChange_Window_(&d->base);
     }
@@ -1665,7 +1677,7 @@ void draw_MainWindow(iMainWindow *d) {
         /* TODO: On macOS, a detached popup window will mess up the main window's rendering
            completely. Looks like a render target mixup. macOS builds normally use native menus,
            though, so leaving it in. */
-        if (d->enableBackBuf) {
+        if (d->enableBackBuf || d->enableDamage) {
             /* Possible resize the backing buffer. */
             if (!d->backBuf || !isEqual_I2(size_SDLTexture(d->backBuf), w->size)) {
                 if (d->backBuf) {
@@ -1676,6 +1688,7 @@ void draw_MainWindow(iMainWindow *d) {
                                                SDL_TEXTUREACCESS_TARGET,
                                                w->size.x,
                                                w->size.y);
+                set_Atomic(&w->isFullyDamaged, iTrue); /* contents are undefined */
 //                printf("NEW BACKING: %dx%d %p\n", renderSize.x, renderSize.y, d->backBuf); fflush(stdout);
             }
         }
@@ -1683,10 +1696,24 @@ void draw_MainWindow(iMainWindow *d) {
     setCurrent_Window(d);
     const int   winFlags = SDL_GetWindowFlags(d->base.win);
     const iBool gotFocus = (winFlags & SDL_WINDOW_INPUT_FOCUS) != 0;
+    /* The back buffer keeps the previous frame, so only the damaged areas need to be redrawn.
+       Widgets may have moved around if the arrangement has changed. */
+    iBool isPartial = d->enableDamage && d->backBuf && !exchange_Atomic(&w->isFullyDamaged, iFalse);
+    iForIndices(i, w->roots) {
+        if (w->roots[i] && w->roots[i]->didChangeArrangement) {
+            isPartial = iFalse;
+        }
+    }
+    const iRect damage = intersect_Rect(w->damage, (iRect){ zero_I2(), w->size });
+    w->damage = zero_Rect();
     iPaint p;
     init_Paint(&p);
     if (d->backBuf) {
         SDL_SetRenderTarget(d->base.render, d->backBuf);
+        if (isPartial) {
+            w->damageTarget = d->backBuf;
+            w->damageClip   = damage;
+        }
     }
     /* Clear the window. The clear color is visible as a border around the window
        when the custom frame is being used. */ {
@@ -1711,7 +1738,12 @@ void draw_MainWindow(iMainWindow *d) {
         }
         unsetClip_Paint(&p); /* update clip to full window */
         SDL_SetRenderDrawColor(w->render, back.r, back.g, back.b, 255);
-        SDL_RenderClear(w->render);
+        if (isPartial) {
+            SDL_RenderFillRect(w->render, (const SDL_Rect *) &damage); /* clear ignores clip */
+        }
+        else {
+            SDL_RenderClear(w->render);
+        }
     }
     /* Draw widgets. */
     w->frameTime = SDL_GetTicks();
@@ -1730,7 +1762,7 @@ void draw_MainWindow(iMainWindow *d) {
             root->didChangeArrangement = iFalse;
         }
     }
-    if (isExposed_Window(w)) {
+    if (isExposed_Window(w) && !(isPartial && isEmpty_Rect(damage))) {
         w->isInvalidated = iFalse;
         extern int drawCount_;
         iForIndices(i, w->roots) {
@@ -1787,8 +1819,10 @@ void draw_MainWindow(iMainWindow *d) {
         drawCount_ = 0;
 #endif
     }
+    w->damageTarget = NULL;
     if (d->backBuf) {
         SDL_SetRenderTarget(d->base.render, NULL);
+        SDL_RenderSetClipRect(d->base.render, NULL);
         SDL_RenderCopy(d->base.render, d->backBuf, NULL, NULL);
     }
 #if 0
@@ -1799,6 +1833,7 @@ void draw_MainWindow(iMainWindow *d) {
         SDL_RenderCopy(d->render, glyphCache_Text(), NULL, &rect);
     }
 #endif
+    endZone_Profiler(); /* presenting may wait for vsync */
     SDL_RenderPresent(w->render);
     isDrawing_ = iFalse;
 }
@@ -93,6 +93,10 @@ struct Impl_Window {
     iBool         isMouseInside;
     iBool         isInvalidated;
     iAtomicInt    isRefreshPending;
+    iAtomicInt    isFullyDamaged; /* everything must be redrawn on the next frame */
+    iRect         damage;       /* areas to redraw on the next frame; main thread only */
+    SDL_Texture * damageTarget; /* set while redrawing only the `damageClip` area */
+    iRect         damageClip;
     iBool         ignoreClick; /* used on the Windows platform only */
     uint32_t      focusGainedAt;
     SDL_Renderer *render;
@@ -129,6 +133,7 @@ struct Impl_MainWindow {
     int           keyboardHeight; /* mobile software keyboards */
     int           maxDrawableHeight;
     iBool         enableBackBuf; /* only used on macOS with Metal (helps with refresh glitches for some reason??) */
+    iBool         enableDamage; /* redraw only the damaged areas of the back buffer */
     SDL_Texture * backBuf; /* enables refreshing the window without redrawing anything */
 };
 
@@ -169,6 +174,7 @@ iBool       isOpenGLRenderer_Window (void);
 
 void        setCurrent_Window       (iAnyWindow *);
 void        postRefresh_Window      (iAnyWindow *);
+void        postDamage_Window       (iAnyWindow *, iRect rect); /* redraw only `rect` (main thread) */
 
 iLocalDef iBool isExposed_Window(const iWindow *d) {
     iAssert(d);
@@ -23,14 +23,28 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "visited.h"
 #include "app.h"
 
+#include <the_Foundation/block.h>
 #include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
+#include <the_Foundation/hash.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/ptrarray.h>
-#include <the_Foundation/sortedarray.h>
 
 const int maxAge_Visited = 6 * 3600 * 24 * 30; /* six months */
 
+static const char *fileName_Visited_     = "visited.lgr";
+static const char *tempFileName_Visited_ = "visited.lgr.tmp";
+static const char *textFileName_Visited_ = "visited.2.txt"; /* older format, only loaded */
+static const char *magic_Visited_        = "lgVi";
+
+enum iVisitedFileVersion {
+    initial_VisitedFileVersion = 1,
+    journal_VisitedFileVersion = 2,
+    /* meta */
+    latest_VisitedFileVersion = journal_VisitedFileVersion,
+};
+
 void init_VisitedUrl(iVisitedUrl *d) {
     initCurrent_Time(&d->when);
     init_String(&d->url);
@@ -41,62 +55,338 @@ void deinit_VisitedUrl(iVisitedUrl *d) {
     deinit_String(&d->url);
 }
 
-static int cmpUrl_VisitedUrl_(const void *a, const void *b) {
-    return cmpString_String(&((const iVisitedUrl *) a)->url, &((const iVisitedUrl *) b)->url);
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(VisitedNode)
+
+/* Visited URLs are stored in a hash keyed by a checksum of the canonical URL. The rare URLs
+   with colliding checksums are chained behind the one that is in the hash. */
+struct Impl_VisitedNode {
+    iHashNode     node; /* key is the CRC-32 of the URL */
+    iVisitedNode *next; /* another URL with the same key */
+    iVisitedUrl   visit;
+};
+
+static uint32_t urlKey_VisitedNode_(const char *url, size_t len) {
+    return iCrc32(url, len);
+}
+
+static iVisitedNode *new_VisitedNode_(iRangecc url, iTime when, uint16_t flags) {
+    iVisitedNode *d = iMalloc(VisitedNode);
+    d->node.key = urlKey_VisitedNode_(url.start, size_Range(&url));
+    d->next     = NULL;
+    initRange_String(&d->visit.url, url);
+    d->visit.when  = when;
+    d->visit.flags = flags;
+    return d;
 }
 
-static int cmpNewer_VisitedUrl_(const void *insert, const void *existing) {
-    return seconds_Time(&((const iVisitedUrl *) insert  )->when) >=
-           seconds_Time(&((const iVisitedUrl *) existing)->when);
+static void delete_VisitedNode_(iVisitedNode *d) {
+    deinit_VisitedUrl(&d->visit);
+    free(d);
 }
 
 /*----------------------------------------------------------------------------------------------*/
 
 struct Impl_Visited {
     iMutex *mtx;
-    iSortedArray visited;
+    iHash   visited; /* VisitedNodes */
+    size_t  count;
+    iBlock  journal; /* changes not yet appended to the file */
+    size_t  numJournaled; /* records appended after the saved snapshot */
+    iBool   needSnapshot;
 };
 
 iDefineTypeConstruction(Visited)
 
 void init_Visited(iVisited *d) {
     d->mtx = new_Mutex();
-    init_SortedArray(&d->visited, sizeof(iVisitedUrl), cmpUrl_VisitedUrl_);
+    init_Hash(&d->visited);
+    d->count = 0;
+    init_Block(&d->journal, 0);
+    d->numJournaled = 0;
+    d->needSnapshot = iFalse;
 }
 
 void deinit_Visited(iVisited *d) {
     iGuardMutex(d->mtx, {
         clear_Visited(d);
-        deinit_SortedArray(&d->visited);
+        deinit_Hash(&d->visited);
     });
+    deinit_Block(&d->journal);
     delete_Mutex(d->mtx);
 }
 
+static iVisitedNode *find_Visited_(const iVisited *d, const iString *url) {
+    /* `url` must be canonical. The mutex must be locked. */
+    const uint32_t key  = urlKey_VisitedNode_(cstr_String(url), size_String(url));
+    iVisitedNode  *node = (iVisitedNode *) value_Hash(&d->visited, key);
+    while (node && !equal_String(&node->visit.url, url)) {
+        node = node->next;
+    }
+    return node;
+}
+
+static void insert_Visited_(iVisited *d, iVisitedNode *node) {
+    /* `node` must not already be in the hash. */
+    iVisitedNode *head = (iVisitedNode *) value_Hash(&d->visited, node->node.key);
+    if (head) {
+        node->next = head->next;
+        head->next = node;
+    }
+    else {
+        insert_Hash(&d->visited, &node->node);
+    }
+    d->count++;
+}
+
+static void remove_Visited_(iVisited *d, iVisitedNode *node) {
+    iVisitedNode *head = (iVisitedNode *) value_Hash(&d->visited, node->node.key);
+    if (head == node) {
+        remove_Hash(&d->visited, node->node.key);
+        if (node->next) {
+            insert_Hash(&d->visited, &node->next->node);
+        }
+    }
+    else {
+        while (head->next != node) {
+            head = head->next;
+        }
+        head->next = node->next;
+    }
+    delete_VisitedNode_(node);
+    d->count--;
+}
+
 void serialize_Visited(const iVisited *d, iStream *out) {
     iString *line = new_String();
     lock_Mutex(d->mtx);
-    iConstForEach(Array, i, &d->visited.values) {
-        const iVisitedUrl *item = i.value;
-        if (startsWithCase_String(&item->url, "data:")) {
-            continue;
+    iConstForEach(Hash, i, &d->visited) {
+        for (const iVisitedNode *node = (const iVisitedNode *) i.value; node; node = node->next) {
+            const iVisitedUrl *item = &node->visit;
+            if (startsWithCase_String(&item->url, "data:")) {
+                continue;
+            }
+            format_String(line,
+                          "%llu %04x %s\n",
+                          (unsigned long long) integralSeconds_Time(&item->when),
+                          item->flags,
+                          cstr_String(&item->url));
+            writeData_Stream(out, cstr_String(line), size_String(line));
         }
-        format_String(line,
-                      "%llu %04x %s\n",
-                      (unsigned long long) integralSeconds_Time(&item->when),
-                      item->flags,
-                      cstr_String(&item->url));
-        writeData_Stream(out, cstr_String(line), size_String(line));
     }
     unlock_Mutex(d->mtx);
     delete_String(line);
 }
 
+/* The binary format is a header followed by a fixed-size record for each URL. Each record is
+   followed by the URL's bytes, padded to a multiple of eight bytes. All integers are little
+   endian. The file is read in one go and parsed in place.
+
+   header: "lgVi"  u32 version  u32 count  u32 reserved
+   record: u64 seconds  u32 urlSize  u16 flags  u16 op
+
+   The `count` records are a snapshot of the visited URLs. Changes made after that are appended
+   as further records whose `op` says whether the URL was visited or removed. */
+
+enum iVisitedRecordOp {
+    set_VisitedRecordOp    = 0,
+    remove_VisitedRecordOp = 1,
+};
+
+enum {
+    headerSize_VisitedFile_ = 16,
+    recordSize_VisitedFile_ = 16,
+};
+
+iLocalDef size_t paddedSize_VisitedFile_(size_t size) {
+    return (size + 7) & ~(size_t) 7;
+}
+
+static void appendU16_(iBlock *d, uint16_t value) {
+    const uint8_t bytes[2] = { value & 0xff, value >> 8 };
+    appendData_Block(d, bytes, 2);
+}
+
+static void appendU32_(iBlock *d, uint32_t value) {
+    appendU16_(d, value & 0xffff);
+    appendU16_(d, value >> 16);
+}
+
+static void appendU64_(iBlock *d, uint64_t value) {
+    appendU32_(d, value & 0xffffffff);
+    appendU32_(d, value >> 32);
+}
+
+static uint16_t decodeU16_(const uint8_t *bytes) {
+    return (uint16_t) (bytes[0] | (bytes[1] << 8));
+}
+
+static uint32_t decodeU32_(const uint8_t *bytes) {
+    return decodeU16_(bytes) | ((uint32_t) decodeU16_(bytes + 2) << 16);
+}
+
+static uint64_t decodeU64_(const uint8_t *bytes) {
+    return decodeU32_(bytes) | ((uint64_t) decodeU32_(bytes + 4) << 32);
+}
+
+static void appendRecord_Visited_(iBlock *data, const iVisitedUrl *item, enum iVisitedRecordOp op) {
+    static const uint8_t padding[8];
+    const size_t urlSize = size_String(&item->url);
+    appendU64_(data, integralSeconds_Time(&item->when));
+    appendU32_(data, (uint32_t) urlSize);
+    appendU16_(data, item->flags);
+    appendU16_(data, op);
+    appendData_Block(data, cstr_String(&item->url), urlSize);
+    appendData_Block(data, padding, paddedSize_VisitedFile_(urlSize) - urlSize);
+}
+
+static void journal_Visited_(iVisited *d, const iVisitedUrl *item, enum iVisitedRecordOp op) {
+    /* The mutex must be locked. */
+    if (!startsWithCase_String(&item->url, "data:")) {
+        appendRecord_Visited_(&d->journal, item, op);
+        d->numJournaled++;
+    }
+}
+
 void save_Visited(const iVisited *d, const char *dirPath) {
-    iFile *f = newCStr_File(concatPath_CStr(dirPath, "visited.2.txt"));
-    if (open_File(f, writeOnly_FileMode | text_FileMode)) {
-        serialize_Visited(d, stream_File(f));
+    iBlock *data = new_Block(0);
+    uint32_t count = 0;
+    appendData_Block(data, magic_Visited_, 4);
+    appendU32_(data, latest_VisitedFileVersion);
+    appendU32_(data, 0); /* count is updated below */
+    appendU32_(data, 0);
+    lock_Mutex(d->mtx);
+    iConstForEach(Hash, i, &d->visited) {
+        for (const iVisitedNode *node = (const iVisitedNode *) i.value; node; node = node->next) {
+            const iVisitedUrl *item = &node->visit;
+            if (startsWithCase_String(&item->url, "data:")) {
+                continue;
+            }
+            appendRecord_Visited_(data, item, set_VisitedRecordOp);
+            count++;
+        }
+    }
+    /* Everything is in the snapshot now. */ {
+        iVisited *mut = iConstCast(iVisited *, d);
+        clear_Block(&mut->journal);
+        mut->numJournaled = 0;
+        mut->needSnapshot = iFalse;
+    }
+    unlock_Mutex(d->mtx);
+    uint8_t *countBytes = (uint8_t *) data_Block(data) + 8;
+    for (int i = 0; i < 4; i++) {
+        countBytes[i] = (count >> (8 * i)) & 0xff;
+    }
+    /* The previous snapshot is replaced only after the new one has been fully written. */
+    const char *tempPath = concatPath_CStr(dirPath, tempFileName_Visited_);
+    iFile *f = newCStr_File(tempPath);
+    const iBool ok = open_File(f, writeOnly_FileMode);
+    if (ok) {
+        write_File(f, data);
+        close_File(f);
     }
     iRelease(f);
+    delete_Block(data);
+    if (ok) {
+        commitFile_App(concatPath_CStr(dirPath, fileName_Visited_), tempPath);
+    }
+    else {
+        iGuardMutex(d->mtx, iConstCast(iVisited *, d)->needSnapshot = iTrue);
+    }
+}
+
+void saveChanges_Visited(iVisited *d, const char *dirPath) {
+    const char *path = concatPath_CStr(dirPath, fileName_Visited_);
+    lock_Mutex(d->mtx);
+    if (d->needSnapshot || d->numJournaled > d->count || !fileExistsCStr_FileInfo(path)) {
+        unlock_Mutex(d->mtx);
+        save_Visited(d, dirPath);
+        return;
+    }
+    if (!isEmpty_Block(&d->journal)) {
+        iFile *f = newCStr_File(path);
+        if (open_File(f, append_FileMode)) {
+            write_File(f, &d->journal);
+            clear_Block(&d->journal);
+        }
+        iRelease(f);
+    }
+    unlock_Mutex(d->mtx);
+}
+
+static iBool isTooOld_Visited_(const iTime *now, iTime when, uint32_t flags) {
+    return ~flags & kept_VisitedUrlFlag && secondsSince_Time(now, &when) > maxAge_Visited;
+}
+
+static void add_Visited_(iVisited *d, iRangecc url, iTime when, uint16_t flags,
+                         iBool mergeKeepingLatest) {
+    if (mergeKeepingLatest) {
+        /* Check if we already have this. */
+        iString urlStr;
+        initRange_String(&urlStr, url);
+        iVisitedNode *existing = find_Visited_(d, &urlStr);
+        deinit_String(&urlStr);
+        if (existing) {
+            max_Time(&existing->visit.when, &when);
+            existing->visit.flags = flags;
+            return;
+        }
+    }
+    insert_Visited_(d, new_VisitedNode_(url, when, flags));
+}
+
+static iBool deserializeBinary_Visited_(iVisited *d, const iBlock *data) {
+    const uint8_t *pos = constData_Block(data);
+    const uint8_t *end = pos + size_Block(data);
+    if (size_Block(data) < headerSize_VisitedFile_ || memcmp(pos, magic_Visited_, 4) ||
+        decodeU32_(pos + 4) > latest_VisitedFileVersion) {
+        return iFalse;
+    }
+    const uint32_t count = decodeU32_(pos + 8);
+    pos += headerSize_VisitedFile_;
+    iTime now;
+    initCurrent_Time(&now);
+    lock_Mutex(d->mtx);
+    for (uint32_t i = 0; end - pos >= recordSize_VisitedFile_; i++) {
+        const uint64_t ts      = decodeU64_(pos);
+        const uint32_t urlSize = decodeU32_(pos + 8);
+        const uint16_t flags   = decodeU16_(pos + 12);
+        const uint16_t op      = decodeU16_(pos + 14);
+        pos += recordSize_VisitedFile_;
+        if ((size_t) (end - pos) < urlSize) {
+            break; /* truncated */
+        }
+        const iRangecc url  = { (const char *) pos, (const char *) pos + urlSize };
+        const iTime    when = { .ts = { .tv_sec = ts } };
+        pos += iMin(paddedSize_VisitedFile_(urlSize), (size_t) (end - pos));
+        if (i < count) {
+            if (!isTooOld_Visited_(&now, when, flags)) {
+                add_Visited_(d, url, when, flags, iFalse);
+            }
+            continue;
+        }
+        /* Changes made after the snapshot. */
+        iString urlStr;
+        initRange_String(&urlStr, url);
+        iVisitedNode *node = find_Visited_(d, &urlStr);
+        deinit_String(&urlStr);
+        if (op == remove_VisitedRecordOp || isTooOld_Visited_(&now, when, flags)) {
+            if (node) {
+                remove_Visited_(d, node);
+            }
+        }
+        else if (node) {
+            node->visit.when  = when;
+            node->visit.flags = flags;
+        }
+        else {
+            insert_Visited_(d, new_VisitedNode_(url, when, flags));
+        }
+        d->numJournaled++;
+    }
+    unlock_Mutex(d->mtx);
+    return iTrue;
 }
 
 void deserialize_Visited(iVisited *d, iStream *ins, iBool mergeKeepingLatest) {
@@ -112,32 +402,32 @@ void deserialize_Visited(iVisited *d, iStream *ins, iBool mergeKeepingLatest) {
         if (ts == 0) break;
         const uint32_t flags = (uint32_t) strtoul(skipSpace_CStr(endp), &endp, 16);
         const char *urlStart = skipSpace_CStr(endp);
-        iVisitedUrl item;
-        item.when.ts = (struct timespec){ .tv_sec = ts };
-        if (~flags & kept_VisitedUrlFlag &&
-            secondsSince_Time(&now, &item.when) > maxAge_Visited) {
+        const iTime when = { .ts = { .tv_sec = ts } };
+        if (isTooOld_Visited_(&now, when, flags)) {
             continue; /* Too old. */
         }
-        item.flags = flags;
-        initRange_String(&item.url, (iRangecc){ urlStart, line.end });
-        set_String(&item.url, &item.url);
-        if (mergeKeepingLatest) {
-            /* Check if we already have this. */
-            size_t existingPos;
-            if (locate_SortedArray(&d->visited, &item, &existingPos)) {
-                iVisitedUrl *existing = at_SortedArray(&d->visited, existingPos);
-                max_Time(&existing->when, &item.when);
-                existing->flags = item.flags;
-                continue;
-            }
-        }
-        insert_SortedArray(&d->visited, &item);
+        add_Visited_(d, (iRangecc){ urlStart, line.end }, when, flags, mergeKeepingLatest);
     }
+    d->needSnapshot = iTrue;
     unlock_Mutex(d->mtx);
 }
 
 void load_Visited(iVisited *d, const char *dirPath) {
-    iFile *f = newCStr_File(concatPath_CStr(dirPath, "visited.2.txt"));
+    const char *path = concatPath_CStr(dirPath, fileName_Visited_);
+    if (fileExistsCStr_FileInfo(path)) {
+        iFile *f = newCStr_File(path);
+        if (open_File(f, readOnly_FileMode)) {
+            iBlock *data = readAll_File(f);
+            if (!deserializeBinary_Visited_(d, data)) {
+                fprintf(stderr, "[Visited] %s has an unknown format\n", path);
+            }
+            delete_Block(data);
+        }
+        iRelease(f);
+        return;
+    }
+    /* Fall back to the older text format. */
+    iFile *f = newCStr_File(concatPath_CStr(dirPath, textFileName_Visited_));
     if (open_File(f, readOnly_FileMode | text_FileMode)) {
         deserialize_Visited(d, stream_File(f), iFalse /* no merge */);
     }
@@ -146,25 +436,21 @@ void load_Visited(iVisited *d, const char *dirPath) {
 
 void clear_Visited(iVisited *d) {
     lock_Mutex(d->mtx);
-    iForEach(Array, v, &d->visited.values) {
-        deinit_VisitedUrl(v.value);
+    iForEach(Hash, i, &d->visited) {
+        iVisitedNode *node = (iVisitedNode *) i.value;
+        while (node) {
+            iVisitedNode *next = node->next;
+            delete_VisitedNode_(node);
+            node = next;
+        }
     }
-    clear_SortedArray(&d->visited);
+    clear_Hash(&d->visited);
+    d->count = 0;
+    clear_Block(&d->journal);
+    d->needSnapshot = iTrue;
     unlock_Mutex(d->mtx);
 }
 
-static size_t find_Visited_(const iVisited *d, const iString *url) {
-    iVisitedUrl visit;
-    init_VisitedUrl(&visit);
-    set_String(&visit.url, url);
-    size_t pos = iInvalidPos;
-    iGuardMutex(d->mtx, {
-        locate_SortedArray(&d->visited, &visit, &pos);
-        deinit_VisitedUrl(&visit);
-    });
-    return pos;
-}
-
 void visitUrl_Visited(iVisited *d, const iString *url, uint16_t visitFlags) {
     iTime when;
     initCurrent_Time(&when);
@@ -174,71 +460,58 @@ void visitUrl_Visited(iVisited *d, const iString *url, uint16_t visitFlags) {
 void visitUrlTime_Visited(iVisited *d, const iString *url, uint16_t visitFlags, iTime when) {
     if (isEmpty_String(url)) return;
     url = canonicalUrl_String(url);
-    iVisitedUrl visit;
-    init_VisitedUrl(&visit);
-    visit.when = when;
-    visit.flags = visitFlags;
-    set_String(&visit.url, url);
-    size_t pos;
     lock_Mutex(d->mtx);
-    if (locate_SortedArray(&d->visited, &visit, &pos)) {
-        iVisitedUrl *old = at_SortedArray(&d->visited, pos);
-        if (old->flags & kept_VisitedUrlFlag) {
+    iVisitedNode *old = find_Visited_(d, url);
+    if (old) {
+        if (old->visit.flags & kept_VisitedUrlFlag) {
             visitFlags |= kept_VisitedUrlFlag; /* must continue to be kept */
         }
-        if (cmpNewer_VisitedUrl_(&visit, old)) {
-            old->when = visit.when;
-            old->flags = visitFlags;
-            unlock_Mutex(d->mtx);
-            deinit_VisitedUrl(&visit);
-            return;
-        }
+        max_Time(&old->visit.when, &when); /* an older visit doesn't replace a newer one */
+        old->visit.flags = visitFlags;
+        journal_Visited_(d, &old->visit, set_VisitedRecordOp);
+    }
+    else {
+        iVisitedNode *node = new_VisitedNode_(range_String(url), when, visitFlags);
+        insert_Visited_(d, node);
+        journal_Visited_(d, &node->visit, set_VisitedRecordOp);
     }
-    insert_SortedArray(&d->visited, &visit);
     unlock_Mutex(d->mtx);
 }
 
 void setUrlKept_Visited(iVisited *d, const iString *url, iBool isKept) {
     if (isEmpty_String(url)) return;
-    iVisitedUrl visit;
-    init_VisitedUrl(&visit);
-    set_String(&visit.url, canonicalUrl_String(url));
-    size_t pos;
+    url = canonicalUrl_String(url);
     lock_Mutex(d->mtx);
-    if (locate_SortedArray(&d->visited, &visit, &pos)) {
-        iVisitedUrl *vis = at_SortedArray(&d->visited, pos);
-        iChangeFlags(vis->flags, kept_VisitedUrlFlag, isKept);
+    iVisitedNode *node = find_Visited_(d, url);
+    if (node && ((node->visit.flags & kept_VisitedUrlFlag) != 0) != isKept) {
+        iChangeFlags(node->visit.flags, kept_VisitedUrlFlag, isKept);
+        journal_Visited_(d, &node->visit, set_VisitedRecordOp);
     }
     unlock_Mutex(d->mtx);
-    deinit_VisitedUrl(&visit);
 }
 
 void removeUrl_Visited(iVisited *d, const iString *url) {
     url = canonicalUrl_String(url);
     iGuardMutex(d->mtx, {
-        size_t pos = find_Visited_(d, url);
-        if (pos < size_SortedArray(&d->visited)) {
-            iVisitedUrl *visUrl = at_SortedArray(&d->visited, pos);
-            if (equal_String(&visUrl->url, url)) {
-                deinit_VisitedUrl(visUrl);
-                remove_Array(&d->visited.values, pos);
-            }
+        iVisitedNode *node = find_Visited_(d, url);
+        if (node) {
+            journal_Visited_(d, &node->visit, remove_VisitedRecordOp);
+            remove_Visited_(d, node);
         }
     });
 }
 
 iTime urlVisitTime_Visited(const iVisited *d, const iString *url) {
-    iVisitedUrl item;
-    size_t pos;
-    iZap(item);
-    initCopy_String(&item.url, canonicalUrl_String(url));
+    iTime when;
+    iZap(when);
+    url = canonicalUrl_String(url);
     lock_Mutex(d->mtx);
-    if (locate_SortedArray(&d->visited, &item, &pos)) {
-        item.when = ((const iVisitedUrl *) constAt_SortedArray(&d->visited, pos))->when;
+    const iVisitedNode *node = find_Visited_(d, url);
+    if (node) {
+        when = node->visit.when;
     }
     unlock_Mutex(d->mtx);
-    deinit_String(&item.url);
-    return item.when;
+    return when;
 }
 
 iBool containsUrl_Visited(const iVisited *d, const iString *url) {
@@ -254,10 +527,12 @@ static int cmpWhenDescending_VisitedUrlPtr_(const void *a, const void *b) {
 const iPtrArray *list_Visited(const iVisited *d, size_t count) {
     iPtrArray *urls = collectNew_PtrArray();
     iGuardMutex(d->mtx, {
-        iConstForEach(Array, i, &d->visited.values) {
-            const iVisitedUrl *vis = i.value;
-            if (~vis->flags & transient_VisitedUrlFlag) {
-                pushBack_PtrArray(urls, vis);
+        iConstForEach(Hash, i, &d->visited) {
+            for (const iVisitedNode *node = (const iVisitedNode *) i.value; node;
+                 node = node->next) {
+                if (~node->visit.flags & transient_VisitedUrlFlag) {
+                    pushBack_PtrArray(urls, &node->visit);
+                }
             }
         }
     });
@@ -271,10 +546,12 @@ const iPtrArray *list_Visited(const iVisited *d, size_t count) {
 const iPtrArray *listKept_Visited(const iVisited *d) {
     iPtrArray *urls = collectNew_PtrArray();
     iGuardMutex(d->mtx, {
-        iConstForEach(Array, i, &d->visited.values) {
-            const iVisitedUrl *vis = i.value;
-            if (vis->flags & kept_VisitedUrlFlag) {
-                pushBack_PtrArray(urls, vis);
+        iConstForEach(Hash, i, &d->visited) {
+            for (const iVisitedNode *node = (const iVisitedNode *) i.value; node;
+                 node = node->next) {
+                if (node->visit.flags & kept_VisitedUrlFlag) {
+                    pushBack_PtrArray(urls, &node->visit);
+                }
             }
         }
     });
@@ -50,6 +50,7 @@ iDeclareTypeConstruction(Visited)
 void    clear_Visited           (iVisited *);
 void    load_Visited            (iVisited *, const char *dirPath);
 void    save_Visited            (const iVisited *, const char *dirPath);
+void    saveChanges_Visited     (iVisited *, const char *dirPath); /* appends to the saved file */
 void    serialize_Visited       (const iVisited *, iStream *out);
 void    deserialize_Visited     (iVisited *, iStream *ins, iBool mergeKeepingLatest);
 